@@ -0,0 +1,171 @@
+#!/usr/bin/env bash
+# Stand-in for ffmpeg and ffprobe, for stress-testing bac's job engine and log
+# path without real encodes (see scripts/stress-batch.sh). Link it as `ffmpeg`
+# and `ffprobe` in a directory put first in PATH. Invoked as ffprobe it prints
+# a fixed probe result; as ffmpeg it answers the discovery queries bac makes
+# and fakes conversions: progress lines on stderr, then the output file.
+#
+# Conversions are controlled with environment variables:
+#   FAKE_FFMPEG_DURATION      media length reported by ffprobe, whole seconds (60)
+#   FAKE_FFMPEG_AUDIO_ONLY    1: probe as an audio-only file
+#   FAKE_FFMPEG_LINES         progress lines per conversion (100)
+#   FAKE_FFMPEG_NOISE         extra log lines after every progress line (0)
+#   FAKE_FFMPEG_STDOUT        lines written to stdout per conversion (0)
+#   FAKE_FFMPEG_SLEEP         pause between progress lines, seconds (0)
+#   FAKE_FFMPEG_BYTES         bytes written to the output file (4096)
+#   FAKE_FFMPEG_EXIT          exit code of every conversion (0)
+#   FAKE_FFMPEG_SIGNAL        signal every conversion kills itself with, e.g. SEGV
+#   FAKE_FFMPEG_HANG          1: never finish; 2: also ignore SIGTERM
+#   FAKE_FFMPEG_FAIL_EVERY    N: fail one in N outputs (picked by output name)
+#   FAKE_FFMPEG_FAIL_MESSAGE  last stderr line of those failures ("Conversion failed!")
+# Fault injection applies only to conversions of real inputs, not to bac's
+# checks on generated lavfi input.
+
+set -u
+
+name=$(basename "$0")
+
+if [ "$name" = "ffprobe" ]; then
+  duration=${FAKE_FFMPEG_DURATION:-60}
+  audio='{"index": 1, "codec_type": "audio", "codec_name": "aac", "channels": 2}'
+  if [ "${FAKE_FFMPEG_AUDIO_ONLY:-0}" = "1" ]; then
+    audio='{"index": 0, "codec_type": "audio", "codec_name": "mp3", "channels": 2}'
+    streams="$audio"
+  else
+    streams='{"index": 0, "codec_type": "video", "codec_name": "h264", "width": 1920, "height": 1080, "avg_frame_rate": "30/1"}, '"$audio"
+  fi
+  printf '{"streams": [%s], "packets": [], "format": {"format_name": "mov,mp4,m4a,3gp,3g2,mj2", "start_time": "0.000000", "duration": "%s.000000", "bit_rate": "5000000"}}\n' \
+    "$streams" "$duration"
+  exit 0
+fi
+
+# Discovery: `-encoders`, `-muxers` and `-h <topic>`
+case " $* " in
+  *" -encoders "*)
+    cat <<'EOF'
+Encoders:
+ V..... = Video
+ A..... = Audio
+ ------
+ V....D libx264              libx264 H.264 / AVC / MPEG-4 AVC / MPEG-4 part 10 (codec h264)
+ V....D libx265              libx265 H.265 / HEVC (codec hevc)
+ V....D libvpx-vp9           libvpx VP9 (codec vp9)
+ V....D mpeg4                MPEG-4 part 2
+ A....D aac                  AAC (Advanced Audio Coding)
+ A....D libmp3lame           libmp3lame MP3 (MPEG audio layer 3) (codec mp3)
+ A....D libopus              libopus Opus (codec opus)
+ A....D flac                 FLAC (Free Lossless Audio Codec)
+ A....D pcm_s16le            PCM signed 16-bit little-endian
+EOF
+    exit 0 ;;
+  *" -muxers "*)
+    cat <<'EOF'
+File formats:
+ D. = Demuxing supported
+ .E = Muxing supported
+ --
+  E avi             AVI (Audio Video Interleaved)
+  E flac            raw FLAC
+  E matroska        Matroska
+  E mov             QuickTime / MOV
+  E mp3             MP3 (MPEG audio layer 3)
+  E mp4             MP4 (MPEG-4 Part 14)
+  E ogg             Ogg
+  E wav             WAV / WAVE (Waveform Audio)
+  E webm            WebM
+EOF
+    exit 0 ;;
+  *" -h encoder="*)
+    topic=${!#}
+    topic=${topic#encoder=}
+    printf 'Encoder %s [%s]:\n    General capabilities: delay threads\n    Threading capabilities: frame and slice\n' "$topic" "$topic"
+    case "$topic" in
+      lib*x26*|libvpx*|mpeg4) printf '    Supported pixel formats: yuv420p\n' ;;
+      *) printf '    Supported sample formats: s16 fltp\n' ;;
+    esac
+    exit 0 ;;
+  *" -h muxer="*)
+    topic=${!#}
+    topic=${topic#muxer=}
+    case "$topic" in
+      matroska) ext=mkv; video=h264; audio=vorbis ;;
+      webm) ext=webm; video=vp9; audio=opus ;;
+      mp3) ext=mp3; video=; audio=mp3 ;;
+      flac) ext=flac; video=; audio=flac ;;
+      wav) ext=wav; video=; audio=pcm_s16le ;;
+      ogg) ext=ogg; video=; audio=vorbis ;;
+      *) ext=$topic; video=h264; audio=aac ;;
+    esac
+    printf 'Muxer %s [%s]:\n    Common extensions: %s.\n' "$topic" "$topic" "$ext"
+    [ -n "$video" ] && printf '    Default video codec: %s.\n' "$video"
+    printf '    Default audio codec: %s.\n' "$audio"
+    exit 0 ;;
+  *" -h "*|*" -version "*)
+    echo "ffmpeg version fake (scripts/fake-ffmpeg.sh)"
+    exit 0 ;;
+esac
+
+out=${!#}
+synthetic=0
+case " $* " in
+  *" -f lavfi "*) synthetic=1 ;;
+esac
+
+# Print "time=HH:MM:SS.cc" progress the way ffmpeg's stats line does
+duration=${FAKE_FFMPEG_DURATION:-60}
+lines=${FAKE_FFMPEG_LINES:-100}
+noise=${FAKE_FFMPEG_NOISE:-0}
+stdout_lines=${FAKE_FFMPEG_STDOUT:-0}
+[ "$synthetic" = "1" ] && lines=1 && noise=0 && stdout_lines=0
+echo "Input #0, mov,mp4,m4a,3gp,3g2,mj2, from 'fake':" >&2
+for ((i = 1; i <= lines; i++)); do
+  cs=$((duration * 100 * i / lines))
+  printf 'frame=%5d fps=250 q=28.0 size=%8dKiB time=%02d:%02d:%02d.%02d bitrate=1000.0kbits/s speed=10.0x\r' \
+    $((i * 25)) $((i * 16)) $((cs / 360000)) $((cs / 6000 % 60)) $((cs / 100 % 60)) $((cs % 100)) >&2
+  for ((j = 0; j < noise; j++)); do
+    printf '[libx264 @ 0x5555] frame=%d slice:P QP:23.00 size:%d bytes\n' "$i" $((i * 97 + j)) >&2
+  done
+  if [ "${FAKE_FFMPEG_SLEEP:-0}" != "0" ]; then
+    sleep "$FAKE_FFMPEG_SLEEP"
+  fi
+done
+for ((i = 0; i < stdout_lines; i++)); do
+  printf 'out_time_us=%d\nprogress=continue\n' $((i * 1000))
+done
+
+if [ "$synthetic" = "0" ]; then
+  case "${FAKE_FFMPEG_HANG:-0}" in
+    2) trap '' TERM ;&
+    1) while :; do sleep 1; done ;;
+  esac
+  if [ -n "${FAKE_FFMPEG_SIGNAL:-}" ]; then
+    kill -s "$FAKE_FFMPEG_SIGNAL" $$
+  fi
+  every=${FAKE_FFMPEG_FAIL_EVERY:-0}
+  if [ "$every" -gt 0 ]; then
+    sum=$(printf '%s' "$out" | cksum | cut -d' ' -f1)
+    if [ $((sum % every)) -eq 0 ]; then
+      printf '\n%s\n' "${FAKE_FFMPEG_FAIL_MESSAGE:-Conversion failed!}" >&2
+      exit 1
+    fi
+  fi
+fi
+
+# Quality checks (-lavfi psnr/ssim) and benchmarks (-benchmark) read their
+# results from the end of stderr
+case " $* " in
+  *" -lavfi "*)
+    echo "[Parsed_psnr_6 @ 0x5555] PSNR y:41.20 u:43.01 v:43.35 average:41.83 min:39.90 max:44.02" >&2
+    echo "[Parsed_ssim_7 @ 0x5555] SSIM Y:0.981 (17.2) U:0.985 (18.2) V:0.986 (18.5) All:0.983 (17.6)" >&2 ;;
+esac
+case " $* " in
+  *" -benchmark "*) echo "bench: utime=0.200s stime=0.020s rtime=0.100s" >&2 ;;
+esac
+printf '\nvideo:%dKiB audio:%dKiB subtitle:0KiB other streams:0KiB global headers:0KiB muxing overhead: 0.5%%\n' \
+  $((lines * 16)) 12 >&2
+
+if [ "$out" != "-" ]; then
+  head -c "${FAKE_FFMPEG_BYTES:-4096}" /dev/zero > "$out"
+fi
+[ "$synthetic" = "1" ] && exit 0
+exit "${FAKE_FFMPEG_EXIT:-0}"
@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+# Run a large batch through bac against scripts/fake-ffmpeg.sh and report how
+# long it took, bac's peak memory, main loop latency and whether every job was
+# accounted for. Needs a display (run under xvfb-run on a headless machine).
+# Usage: ./scripts/stress-batch.sh [-n JOBS] [-b path/to/bac] [-k]
+#   -n  number of jobs (default 1000)
+#   -b  bac binary (default build/src/bac)
+#   -k  keep the work directory with inputs, outputs, logs and caches
+# The FAKE_FFMPEG_* variables described in fake-ffmpeg.sh are passed through,
+# e.g. FAKE_FFMPEG_NOISE=50 FAKE_FFMPEG_FAIL_EVERY=10 ./scripts/stress-batch.sh
+
+set -euo pipefail
+
+here=$(cd "$(dirname "$0")" && pwd)
+jobs=1000
+bac="$here/../build/src/bac"
+keep=0
+while getopts "n:b:k" opt; do
+  case "$opt" in
+    n) jobs=$OPTARG ;;
+    b) bac=$OPTARG ;;
+    k) keep=1 ;;
+    *) sed -n '5,8p' "$0" >&2; exit 2 ;;
+  esac
+done
+if [ ! -x "$bac" ]; then
+  echo "bac not found at $bac (build it first or pass -b)" >&2
+  exit 2
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/bac-stress-XXXXXX")
+if [ "$keep" -eq 0 ]; then
+  trap 'rm -rf "$work"' EXIT
+fi
+mkdir -p "$work/bin" "$work/in" "$work/out"
+ln -s "$here/fake-ffmpeg.sh" "$work/bin/ffmpeg"
+ln -s "$here/fake-ffmpeg.sh" "$work/bin/ffprobe"
+
+# One job per input, converted to mp4 with explicit encoders
+echo "input,output,audio,video" > "$work/jobs.csv"
+for i in $(seq -w 1 "$jobs"); do
+  head -c 1024 /dev/zero > "$work/in/clip$i.mp4"
+  echo "$work/in/clip$i.mp4,$work/out/clip$i.mp4,aac,libx264" >> "$work/jobs.csv"
+done
+
+echo "Running $jobs jobs in $work"
+start=$(date +%s.%N)
+# Own cache and state directories keep the fake encoder lists and the logs
+# away from the real ones
+PATH="$work/bin:$PATH" XDG_CACHE_HOME="$work/cache" XDG_STATE_HOME="$work/state" \
+  BAC_AUTORUN="$work/jobs.csv" BAC_PROGRESS=1 BAC_LATENCY=1 \
+  "$bac" > "$work/stdout.txt" 2> "$work/stderr.txt" &
+pid=$!
+peak=0
+while kill -0 "$pid" 2> /dev/null; do
+  rss=$(awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status" 2> /dev/null || echo 0)
+  if [ "${rss:-0}" -gt "$peak" ]; then
+    peak=$rss
+  fi
+  sleep 0.5
+done
+status=0
+wait "$pid" || status=$?
+end=$(date +%s.%N)
+
+summary=$(grep '^Batch finished:' "$work/stdout.txt" || true)
+latency=$(grep '^bac latency:' "$work/stderr.txt" | tail -n 1 || true)
+outputs=$(find "$work/out" -type f | wc -l)
+echo "Elapsed:   $(awk "BEGIN { printf \"%.1f\", $end - $start }") s"
+echo "Peak RSS:  $((peak / 1024)) MiB"
+echo "Latency:   ${latency#bac latency: }"
+echo "Result:    ${summary:-no summary (bac exited with $status)}"
+echo "Outputs:   $outputs"
+
+# Every job is either converted (and has its output) or reported as failed
+converted=$(echo "$summary" | sed -n 's/^Batch finished: \([0-9]*\) converted, \([0-9]*\) failed\.$/\1/p')
+failed=$(echo "$summary" | sed -n 's/^Batch finished: \([0-9]*\) converted, \([0-9]*\) failed\.$/\2/p')
+if [ -z "$converted" ] || [ "$converted" -ne "$outputs" ] || [ $((converted + failed)) -ne "$jobs" ]; then
+  echo "FAIL: jobs are missing or were counted twice" >&2
+  exit 1
+fi
+echo "OK"
@@ -4,6 +4,20 @@
 #include <json-glib/json-glib.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <sys/statvfs.h>
+#include <sys/resource.h>
+#include <errno.h>
+#ifdef HAVE_LIBAV
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+#endif
 
 static gchar *input_file = NULL;
 static gchar *output_file = NULL;
@@ -19,18 +33,114 @@ static GtkStringList *video_model = NULL;
 static GtkStringList *format_model = NULL;
 static GtkWidget *start_button;
 static GtkWidget *stop_button;
+static GtkWidget *preview_button;
+static GtkWidget *preview_at_spin;
+static gchar *preview_file = NULL; /* last preview output, removed on the next one */
+/* Trim: keep only from..to of the input, see start_trim */
+static GtkWidget *trim_check;
+static GtkWidget *trim_from_spin;
+static GtkWidget *trim_to_spin;
+static GtkWidget *trim_smart_check;
+/* Additional targets written from the same decode as the main output */
+typedef struct {
+    gchar *format;
+    gchar *audio;
+    gchar *video;
+} OutputTarget;
+static GPtrArray *extra_outputs = NULL; /* OutputTarget* */
+static GtkWidget *extra_outputs_label;
+static GtkWidget *extra_outputs_clear;
 static GtkWidget *reset_audio;
 static GtkWidget *reset_video;
 static GtkWidget *log_text_view;
 static GtkTextBuffer *log_buffer;
-static GPid ffmpeg_pid = 0;
-static GIOChannel *ffmpeg_stdout_chan = NULL;
-static GIOChannel *ffmpeg_stderr_chan = NULL;
-static guint ffmpeg_stdout_watch = 0;
-static guint ffmpeg_stderr_watch = 0;
+/* Speed row (options of the selected video encoder) */
+static GtkWidget *speed_preset_combo;
+static GtkStringList *speed_preset_model = NULL;
+static gchar *speed_preset_encoder = NULL; /* encoder the preset list belongs to */
+static GtkWidget *speed_threads_spin;
+static GtkWidget *speed_tiles_combo;
+static GtkWidget *speed_row_mt_check;
+/* One running conversion, normally an ffmpeg process. Single conversions use
+ * one worker; batches may run several in parallel. Workers are freed when
+ * their child is reaped (or, for in-process jobs, when the thread is done). */
+typedef struct {
+    GPid pid;
+    gchar *input;
+    gchar *output;
+    GIOChannel *stdout_chan;
+    GIOChannel *stderr_chan;
+    guint stdout_watch;
+    guint stderr_watch;
+    gboolean batch;       /* started by the batch engine */
+    gchar *mem_key;       /* memory model key (encoder) */
+    gint64 pixels;        /* width * height of the source, 0 for audio */
+    gint64 mem_estimate;  /* bytes, admission estimate */
+    gint64 rss;           /* bytes, last sampled resident set */
+    gint64 peak_rss;      /* bytes, sampled VmHWM */
+    gpointer inproc;      /* InprocJob* when converted in-process (pid is 0) */
+    gchar *audio;         /* settings the job runs with, for retries */
+    gchar *video;
+    gchar *vfilter;
+    gchar *afilter;
+    GString *tail;        /* last WORKER_TAIL_BYTES of output, for failure analysis */
+    gboolean preview;     /* short test encode, see on_preview_clicked */
+    gint64 started;       /* monotonic time of start, microseconds */
+    gdouble source_duration; /* full input length, for the projection */
+    GPtrArray *group_inputs;  /* grouped batch run: all inputs and outputs */
+    GPtrArray *group_outputs;
+    GPtrArray *fanout_outputs; /* one input, several outputs: all output paths */
+    guint fanout_ticks;
+    gint64 out_estimate;  /* expected bytes written, reserved on out_dev */
+    dev_t out_dev;
+    gpointer trim;        /* TrimJob* while one of its steps runs */
+    gchar *command;       /* argv as one line, first line of the log file */
+    FILE *log;            /* per-job log, see worker_log_write */
+    gchar *log_path;
+    gint64 log_bytes;     /* written to the current part of the log */
+    gboolean log_failed;  /* the log could not be opened; output is only shown */
+    gdouble encoded;      /* media seconds done, from ffmpeg's time= stats */
+    gdouble cpu_seconds;  /* user + system time at the last sample */
+    gint64 cpu_sampled;   /* monotonic time of that sample, 0 if none */
+    guint parallel_sum;   /* batch jobs running at each sample, for the history */
+    guint parallel_samples;
+} FfmpegWorker;
+#define WORKER_TAIL_BYTES 4096
+
+static GPtrArray *workers = NULL; /* FfmpegWorker* */
+static guint worker_sample_source = 0;
+
+/* Registry of live children spawned asynchronously. Each child leads its own
+ * process group, so stop/quit/timeouts signal exactly our process trees and
+ * never unrelated ffmpeg processes on the machine. */
+static GHashTable *child_registry = NULL; /* GPid -> gchar* label */
+#define CHILD_KILL_GRACE_SECONDS 3
 
 static void update_output_label(void);
 
+static char *ffmpeg_path = NULL;
+static char *ffprobe_path = NULL;
+
+/* Startup: the window is shown first and ffmpeg paths, encoders, their
+ * capabilities and muxers are discovered on a background thread. Until
+ * discovery_ready the thread owns those globals, so everything that reads
+ * them (choosing a file, batch, drops) stays disabled. */
+static gboolean discovery_ready = FALSE;
+static GThread *discovery_thread = NULL;
+static GtkWidget *choose_file_button = NULL;
+static GtkWidget *batch_open_button = NULL;
+/* BAC_STARTUP_TIMING=1 prints how long each startup phase took */
+static gboolean startup_timing = FALSE;
+/* BAC_PROGRESS=1 prints batch-wide progress lines to standard output */
+static gboolean progress_stdout = FALSE;
+/* BAC_LATENCY=1 reports main loop delays; BAC_AUTORUN=<list> imports a job
+ * list, runs it as a batch and quits. Both serve scripts/stress-batch.sh. */
+static gboolean latency_probe = FALSE;
+static const char *autorun_manifest = NULL;
+static gboolean plan_only = FALSE;       /* BAC_PLAN=1: print the plan of autorun_manifest, convert nothing */
+static void latency_report(void);
+static gint64 startup_t0 = 0; /* monotonic time when main() was entered */
+
 static GPtrArray *audio_codecs = NULL;
 static GPtrArray *video_codecs = NULL;
 static GPtrArray *container_formats = NULL;
@@ -44,15 +154,19 @@ static char *default_video_codec = NULL;
 /* Batch processing state */
 static GPtrArray *batch_files = NULL; /* array of gchar* paths */
 static gboolean batch_running = FALSE;
+static gboolean batch_user_stopped = FALSE; /* Stop pressed; arrivals wait for Start */
 static guint batch_index = 0;
 /* Batch dialog widgets (created on demand) */
 static GtkWidget *batch_dialog = NULL;
-static GtkWidget *batch_listbox = NULL;
+static GtkWidget *batch_list_view = NULL;
+static GtkStringList *batch_model = NULL;            /* batch_files as shown in batch_list_view */
+static GtkSingleSelection *batch_selection = NULL;
 static GtkWidget *batch_start_button = NULL;
 static GtkWidget *batch_add_folder_button = NULL;
 static GtkWidget *batch_add_files_button = NULL;
 static GtkWidget *batch_remove_button = NULL;
 static GtkWidget *batch_stop_button = NULL;
+static GtkWidget *batch_progress_bar = NULL;
 
 /* Forward declarations for batch functions */
 static void open_batch_dialog(GtkWindow *parent);
@@ -63,14 +177,181 @@ static void batch_start_clicked_cb(GtkButton *button, gpointer user_data);
 static void batch_stop_clicked_cb(GtkButton *button, gpointer user_data);
 static void process_next_in_batch(void);
 static gboolean continue_batch_idle(gpointer user_data);
-static void batch_row_selected_cb(GtkListBox *box, GtkListBoxRow *row, gpointer user_data);
+static void batch_row_selected_cb(GObject *selection, GParamSpec *pspec, gpointer user_data);
 static void batch_add_folder_native_response(GtkNativeDialog *native, gint response, gpointer user_data);
 static void batch_add_files_native_response(GtkNativeDialog *native, gint response, gpointer user_data);
 static void add_single_file_to_batch(GFile *file);
+static void batch_import_clicked(GtkButton *button, gpointer user_data);
 static void batch_clear_clicked(GtkButton *button, gpointer user_data);
 static gboolean batch_dialog_close_request_cb(GtkWindow *window, gpointer user_data);
 static gboolean batch_has_path(const char *path);
 static gboolean on_drop_received(GtkDropTarget *target, const GValue *value, double x, double y, gpointer user_data);
+static void batch_begin(gboolean from_start);
+static void batch_prefetch_cancel(void);
+static void batch_progress_update(gboolean finished);
+
+/* Hot-folder watch state. Every directory below the watched root gets its own
+ * GFileMonitor; new files are held as candidates until they are stable (no
+ * size/mtime change for watch_stable_seconds and no process has them open for
+ * writing) and only then appended to batch_files. */
+typedef struct {
+    goffset size;
+    gint64 mtime;
+    gint64 stable_since; /* monotonic time (usec) of the last observed change */
+} WatchCandidate;
+
+/* Version of a file the watcher already queued; a rewrite under the same
+ * name changes mtime or size and is queued again. */
+typedef struct {
+    goffset size;
+    gint64 mtime;
+} WatchSeen;
+
+static GFile *watch_root = NULL;
+static GHashTable *watch_monitors = NULL;   /* dir path -> GFileMonitor* */
+static GHashTable *watch_candidates = NULL; /* file path -> WatchCandidate* */
+static GHashTable *watch_seen = NULL;       /* file path -> WatchSeen* */
+static guint watch_tick_source = 0;
+static guint watch_stable_seconds = 5;
+static GtkWidget *batch_watch_button = NULL;
+static GtkWidget *batch_watch_spin = NULL;
+
+/* Probe results for a queued file (filled in the background, see
+ * probe_media_info). All fields are zero/NULL until the probe completes. */
+typedef struct {
+    gboolean probed;
+    gdouble duration;     /* seconds */
+    goffset size;         /* bytes on disk */
+    gint64 bit_rate;      /* container bit rate, bits/s */
+    gint width;
+    gint height;
+    gdouble fps;          /* average frame rate of the first video stream, 0 if unknown */
+    gchar *format_name;
+    gchar *audio_codec;   /* first audio stream codec */
+    gchar *video_codec;   /* first video stream codec */
+    gchar *video_profile; /* its profile as ffprobe names it ("High"), or NULL */
+    gint video_level;     /* codec specific level, 0 if unknown */
+    gchar *pix_fmt;
+    GPtrArray *streams;   /* StreamInfo*, in file order; NULL if not probed */
+} MediaInfo;
+
+/* One probed stream, as far as stream selection needs it */
+typedef struct {
+    gint index;
+    gchar *type;          /* "video", "audio", "subtitle", "data", "attachment" */
+    gchar *codec;
+    gchar *language;      /* ISO 639-2 tag, NULL if untagged */
+    gint channels;
+    gint width;
+    gint height;
+    gboolean attached_pic; /* cover art */
+} StreamInfo;
+
+/* Stream selection rules of the main window. Batch jobs take a copy with
+ * their JobSettings. When disabled ffmpeg's default selection applies (one
+ * stream of each kind). */
+static gboolean stream_rules_enabled = FALSE;
+static gboolean stream_all_audio = FALSE;
+static gchar **stream_languages = NULL; /* preferred audio/subtitle languages */
+static gboolean stream_keep_subtitles = FALSE;
+static gboolean stream_keep_cover = TRUE;
+
+/* Everything a batch job is converted with. Taken from the main window when
+ * the job is queued for a run (see job_settings_from_ui) or read from a
+ * manifest row, and never changed afterwards, so editing the window while a
+ * batch runs does not touch queued jobs. Reference counted (GAtomicRcBox);
+ * all jobs queued from the window share one. */
+typedef struct {
+    gchar *format;        /* container for build_output_path; NULL keeps the input's */
+    gchar *output;        /* explicit output path (manifest), or NULL */
+    gchar *audio;         /* encoder, "copy" or "No audio" */
+    gchar *video;
+    gchar *vfilter;       /* -vf/-af from a manifest, or NULL */
+    gchar *afilter;
+    gchar *preset;        /* speed options, as in the Speed row */
+    gint threads;
+    gint tile_columns;
+    gboolean row_mt;
+    gboolean stream_rules; /* stream selection, as in the stream_* globals */
+    gboolean all_audio;
+    gchar **languages;
+    gboolean keep_subtitles;
+    gboolean keep_cover;
+} JobSettings;
+
+/* Per-path scheduling data kept alongside batch_files. */
+typedef struct {
+    MediaInfo info;
+    gboolean probing;     /* a probe of the file is queued or running */
+    JobSettings *settings; /* NULL until queued for a run */
+    gboolean from_manifest; /* settings came with the file, keep them on restarts */
+    gint priority;        /* manual bumps; higher runs earlier */
+    /* Retry state: overrides of the UI settings picked after a failure */
+    guint attempts;
+    gchar *retry_audio;
+    gchar *retry_video;
+    gchar *retry_vf;
+    gchar *retry_af;
+    GPtrArray *tried;     /* encoders that already failed on this file */
+    gboolean no_group;    /* failed in a grouped run, runs on its own now */
+    gchar *log_path;      /* per-job log of the latest run, or NULL */
+} BatchJob;
+
+#define BATCH_MAX_RETRIES 3
+static guint batch_converted = 0;
+static GPtrArray *batch_failed = NULL; /* paths that failed after all retries */
+/* Batch-wide progress of the current run, see batch_progress_update */
+static guint batch_first = 0;           /* batch_index the run started at */
+static gint64 batch_started_us = 0;     /* monotonic */
+static gdouble batch_encoded_seconds = 0; /* media seconds of jobs converted this run */
+static gint64 batch_progress_printed = 0;
+#define BATCH_ETA_MIN_SECONDS 10   /* no ETA before the rate means something */
+#define BATCH_PROGRESS_PRINT_SECONDS 10
+
+/* Order in which pending batch entries are dispatched */
+typedef enum {
+    BATCH_POLICY_FIFO,    /* insertion order */
+    BATCH_POLICY_SJF,     /* shortest estimated job first */
+    BATCH_POLICY_LPT      /* longest estimated job first (minimum makespan) */
+} BatchPolicy;
+
+static GHashTable *batch_jobs = NULL;      /* path -> BatchJob* */
+static JobSettings *batch_ui_settings = NULL; /* window settings the running batch was started with */
+static void batch_plan_forecast(guint first, const JobSettings *ui);
+static GThreadPool *probe_pool = NULL;
+static BatchPolicy batch_policy = BATCH_POLICY_FIFO;
+static guint batch_reorder_source = 0;
+static GtkWidget *batch_policy_combo = NULL;
+static GtkWidget *batch_bump_button = NULL;
+static guint batch_max_workers = 1;
+static GtkWidget *batch_workers_spin = NULL;
+/* Small audio-only jobs with the same settings share one ffmpeg process,
+ * up to batch_group_limit inputs (1 disables grouping). */
+#define BATCH_GROUP_MAX_BYTES (64 * 1024 * 1024)
+static guint batch_group_limit = 16;
+static GtkWidget *batch_group_spin = NULL;
+
+/* Load-adaptive concurrency: when enabled the worker limit floats between
+ * batch_min_workers and batch_max_workers based on /proc/loadavg and PSI. */
+static gboolean batch_adaptive = FALSE;
+static guint batch_min_workers = 1;
+static guint batch_target_workers = 1;
+static gboolean batch_admission_paused = FALSE;
+static guint adaptive_source = 0;
+static guint adaptive_calm_samples = 0;  /* consecutive samples below grow thresholds */
+static guint adaptive_cooldown = 0;      /* samples to wait after a change */
+static GtkWidget *batch_adaptive_check = NULL;
+static GtkWidget *batch_min_workers_spin = NULL;
+
+static void batch_job_register(const char *path);
+static gboolean batch_job_rewritten(const char *path);
+static void batch_list_rebuild(void);
+static void batch_job_forget(const char *path);
+static void batch_schedule_reorder(void);
+static void batch_list_append(const char *path);
+
+static void watch_start(GFile *dir);
+static void watch_stop(void);
 
 static gboolean is_batch_dialog_open(void)
 {
@@ -79,9 +360,11 @@ static gboolean is_batch_dialog_open(void)
 
 static gboolean can_enable_start_button(void)
 {
+    if (!discovery_ready)
+        return FALSE;
     if (!input_file)
         return FALSE;
-    if (ffmpeg_pid > 0)
+    if (workers && workers->len > 0)
         return FALSE;
     if (is_batch_dialog_open())
         return FALSE;
@@ -93,6 +376,8 @@ static void update_start_button_state(void)
     if (!start_button)
         return;
     gtk_widget_set_sensitive(start_button, can_enable_start_button());
+    if (preview_button)
+        gtk_widget_set_sensitive(preview_button, can_enable_start_button());
 }
 
 /* Helper: add codec to array if not already present */
@@ -212,780 +497,6122 @@ static void gather_ffmpeg_encoders(const char *ffmpeg_exe)
     g_free(stderr_str);
 }
 
-/* Mapping from ffprobe codec names to common ffmpeg encoder names for best-match */
+/* What `ffmpeg -h encoder=<name>` reports about one encoder. Lists are NULL
+ * when the encoder does not restrict them. */
 typedef struct {
-    const char *codec;
-    const char *encoder;
-} CodecMap;
+    gboolean video;
+    gboolean experimental;  /* needs -strict experimental */
+    gboolean hardware;
+    gboolean threads;       /* frame, slice or other threading */
+    gchar **pix_fmts;
+    gchar **sample_fmts;
+    gchar **sample_rates;
+    gchar *preset_option;   /* speed knob: "preset", "cpu-used" or "speed" */
+    GPtrArray *presets;     /* values offered for preset_option */
+    gchar *preset_default;
+    gboolean tiles;         /* has -tile-columns */
+    gboolean row_mt;        /* has -row-mt */
+} EncoderCaps;
 
-static const CodecMap video_encoder_map[] = {
-    {"h264", "libx264"},
-    {"hevc", "libx265"},
-    {"h265", "libx265"},
-    {"vp9", "libvpx-vp9"},
-    {"av1", "libaom-av1"},
-    {"mpeg4", "mpeg4"},
-    {"theora", "libtheora"},
-    {NULL, NULL}
-};
+static GHashTable *encoder_caps = NULL; /* encoder name -> EncoderCaps* */
+#define ENCODER_CACHE_VERSION 1
 
-static const CodecMap audio_encoder_map[] = {
-    {"aac", "aac"},
-    {"mp3", "libmp3lame"},
-    {"opus", "libopus"},
-    {"vorbis", "libvorbis"},
-    {"flac", "flac"},
-    {"ac3", "ac3"},
-    {NULL, NULL}
-};
+/* Speed settings applied to the video encoder when it supports them */
+static gchar *speed_preset = NULL;     /* NULL: encoder default */
+static gint speed_threads = 0;         /* 0: let ffmpeg decide */
+static gint speed_tile_columns = -1;   /* log2 of the column count, -1: default */
+static gboolean speed_row_mt = FALSE;
 
-/* Mapping from container/format name to preferred audio/video encoders */
-typedef struct {
-    const char *format;
-    const char *audio;
-    const char *video;
-} FormatDefault;
+static const char *preset_options[] = {"preset", "cpu-used", "speed", NULL};
+/* libx264/libx265 take -preset as a free string; these are the valid names */
+static const char *x264_presets[] = {"ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo", NULL};
+/* pixel formats that are GPU surfaces; software frames cannot be fed to an
+ * encoder that only accepts these without an explicit hwupload */
+static const char *hw_pix_fmts[] = {"vaapi", "vaapi_vld", "qsv", "cuda", "d3d11", "d3d11va_vld", "d3d12", "dxva2_vld", "videotoolbox_vld", "drm_prime", "vulkan", "mediacodec", "opencl", "vdpau", "mmal", NULL};
 
-static const FormatDefault format_defaults[] = {
-    {"auto", NULL, NULL},
-    {"avi", "mp3", "mpeg4"},
-    {"mp4", "aac", "libx264"},
-    {"mkv", "aac", "libx264"},
-    {"webm", "libvorbis", "libvpx-vp9"},
-    {"mov", "aac", "libx264"},
-    {"mpeg", "mp2", "mpeg2video"},
-    {"ogg", "libvorbis", NULL},
-    {"mp3", "mp3", NULL},
-    {"flac", "flac", NULL},
-    {"wav", "pcm_s16le", NULL},
-    {NULL, NULL, NULL}
-};
+static void encoder_caps_free(gpointer data)
+{
+    EncoderCaps *c = data;
+    g_strfreev(c->pix_fmts);
+    g_strfreev(c->sample_fmts);
+    g_strfreev(c->sample_rates);
+    g_free(c->preset_option);
+    g_ptr_array_unref(c->presets);
+    g_free(c->preset_default);
+    g_free(c);
+}
 
-/* forward declare function used below */
-static gint find_best_encoder_in_array(GPtrArray *arr, const char *codec, const CodecMap *map);
+static EncoderCaps *encoder_caps_lookup(const char *encoder)
+{
+    return encoder_caps && encoder ? g_hash_table_lookup(encoder_caps, encoder) : NULL;
+}
 
-static int find_format_index(const char *fmt)
+/* "Supported pixel formats: yuv420p yuv444p" -> {"yuv420p", "yuv444p"} */
+static gchar **caps_split_list(const char *line)
 {
-    if (!container_formats || !fmt) return 0;
-    for (guint i = 0; i < container_formats->len; i++) {
-        const char *s = g_ptr_array_index(container_formats, i);
-        if (g_strcmp0(s, fmt) == 0) return (int)i;
-    }
-    return 0;
+    const char *colon = strchr(line, ':');
+    gchar **parts = g_strsplit_set(colon ? colon + 1 : line, " \t", -1);
+    GPtrArray *out = g_ptr_array_new();
+    for (gint i = 0; parts[i]; i++)
+        if (parts[i][0]) g_ptr_array_add(out, g_strdup(parts[i]));
+    g_strfreev(parts);
+    g_ptr_array_add(out, NULL);
+    return (gchar **)g_ptr_array_free(out, FALSE);
 }
 
-/* Map common ffprobe 'format_name' tokens to our canonical container names */
-static const char *map_probe_format_to_container(const char *probe)
+static gint preset_option_rank(const char *name)
 {
-    if (!probe) return NULL;
-    if (g_strstr_len(probe, -1, "matroska") || g_strstr_len(probe, -1, "webm")) return "mkv";
-    if (g_strstr_len(probe, -1, "mov") || g_strstr_len(probe, -1, "mp4") || g_strstr_len(probe, -1, "isom")) return "mp4";
-    if (g_strstr_len(probe, -1, "avi")) return "avi";
-    if (g_strstr_len(probe, -1, "mpeg") || g_strstr_len(probe, -1, "mpg") || g_strstr_len(probe, -1, "mpegts")) return "mpeg";
-    if (g_strstr_len(probe, -1, "wav")) return "wav";
-    if (g_strstr_len(probe, -1, "mp3")) return "mp3";
-    if (g_strstr_len(probe, -1, "flac")) return "flac";
-    if (g_strstr_len(probe, -1, "ogg")) return "ogg";
-    if (g_strstr_len(probe, -1, "webm")) return "webm";
-    return NULL;
+    for (gint i = 0; preset_options[i]; i++)
+        if (g_strcmp0(name, preset_options[i]) == 0) return i;
+    return -1;
 }
 
-/* Set audio/video codec combos to defaults for given format name (if available) */
-static void set_codecs_for_format(const char *fmt)
+/* Parse the help text of one encoder. Option lines look like
+ *   "  -preset            <int>        E..V....... Set the preset (from 0 to 13) (default 10)"
+ * and named constants of the option above are indented further. */
+static EncoderCaps *encoder_caps_parse(const char *help, gboolean video)
 {
-    if (!fmt) return;
-    /* If the user explicitly selected 'auto', behave like the Reset buttons
-     * for both audio and video: apply detected/default selections so the UI
-     * reflects what was detected from the input file. This makes selecting
-     * Auto equivalent to resetting codecs to detected defaults. */
-    if (g_strcmp0(fmt, "auto") == 0) {
-        /* Audio reset logic */
-        if (audio_codecs) {
-            if (!input_has_audio) {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 0);
-                gtk_widget_set_sensitive(audio_combo, TRUE);
-                gtk_widget_set_sensitive(reset_audio, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)));
-            } else if (!default_audio_codec || g_strcmp0(default_audio_codec, "copy") == 0) {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
-                gtk_widget_set_sensitive(audio_combo, FALSE);
-                /* 'copy' is at index 1 (leading 'No audio' at 0) */
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 1);
-                gtk_widget_set_sensitive(reset_audio, FALSE);
-            } else {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-                gtk_widget_set_sensitive(audio_combo, TRUE);
-                int aidx = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), aidx + 1);
-                gtk_widget_set_sensitive(reset_audio, TRUE);
+    EncoderCaps *c = g_new0(EncoderCaps, 1);
+    c->video = video;
+    c->presets = g_ptr_array_new_with_free_func(g_free);
+    gchar **lines = g_strsplit(help, "\n", -1);
+    gboolean collecting = FALSE;
+    gboolean string_preset = FALSE;
+    gint rank = G_MAXINT;
+    gint range_min = 0, range_max = -1;
+    for (gint i = 0; lines[i]; i++) {
+        const char *raw = lines[i];
+        gchar *line = g_strstrip(g_strdup(raw));
+        if (g_str_has_prefix(line, "General capabilities:")) {
+            c->experimental = strstr(line, "experimental") != NULL;
+            c->hardware = strstr(line, "hardware") != NULL;
+        } else if (g_str_has_prefix(line, "Threading capabilities:")) {
+            c->threads = strstr(line, "none") == NULL;
+        } else if (g_str_has_prefix(line, "Supported pixel formats:")) {
+            c->pix_fmts = caps_split_list(line);
+        } else if (g_str_has_prefix(line, "Supported sample formats:")) {
+            c->sample_fmts = caps_split_list(line);
+        } else if (g_str_has_prefix(line, "Supported sample rates:")) {
+            c->sample_rates = caps_split_list(line);
+        } else if (line[0] == '-') {
+            char name[64] = "", type[32] = "";
+            collecting = FALSE;
+            if (sscanf(line, "-%63s %31s", name, type) < 1) {
+                g_free(line);
+                continue;
             }
-        }
-
-        /* Video reset logic */
-        if (video_codecs) {
-            if (!input_has_video) {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
-                gtk_widget_set_sensitive(video_combo, TRUE);
-                gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
-            } else if (!default_video_codec || g_strcmp0(default_video_codec, "copy") == 0) {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
-                gtk_widget_set_sensitive(video_combo, FALSE);
-                /* 'copy' is at index 1 (leading 'No video' at 0) */
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 1);
-                gtk_widget_set_sensitive(reset_video, FALSE);
-            } else {
-                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-                gtk_widget_set_sensitive(video_combo, TRUE);
-                int vidx = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
-                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), vidx + 1);
-                gtk_widget_set_sensitive(reset_video, TRUE);
+            if (g_strcmp0(name, "tile-columns") == 0)
+                c->tiles = TRUE;
+            else if (g_strcmp0(name, "row-mt") == 0)
+                c->row_mt = TRUE;
+            gint r = preset_option_rank(name);
+            if (r >= 0 && r < rank) {
+                rank = r;
+                g_free(c->preset_option);
+                c->preset_option = g_strdup(name);
+                g_ptr_array_set_size(c->presets, 0);
+                g_clear_pointer(&c->preset_default, g_free);
+                string_preset = g_strcmp0(type, "<string>") == 0;
+                range_max = range_min - 1;
+                const char *from = strstr(line, "(from ");
+                double lo, hi;
+                if (from && sscanf(from, "(from %lf to %lf)", &lo, &hi) == 2) {
+                    range_min = (gint)lo;
+                    range_max = (gint)hi;
+                }
+                const char *def = strstr(line, "(default ");
+                if (def) {
+                    gchar *v = g_strndup(def + 9, strcspn(def + 9, ")"));
+                    g_strdelimit(v, "\"", ' ');
+                    c->preset_default = g_strdup(g_strstrip(v));
+                    g_free(v);
+                }
+                collecting = TRUE;
             }
+        } else if (collecting && g_str_has_prefix(raw, "     ") && line[0]) {
+            /* named constant of the preset option */
+            gchar *end = line + strcspn(line, " \t");
+            g_ptr_array_add(c->presets, g_strndup(line, end - line));
+        } else if (!g_str_has_prefix(raw, " ")) {
+            collecting = FALSE; /* next AVOptions section */
         }
-        return;
+        g_free(line);
     }
-    const char *want_audio = NULL;
-    const char *want_video = NULL;
-    for (int i = 0; format_defaults[i].format != NULL; i++) {
-        if (g_strcmp0(format_defaults[i].format, fmt) == 0) {
-            want_audio = format_defaults[i].audio;
-            want_video = format_defaults[i].video;
-            break;
+    g_strfreev(lines);
+    if (c->preset_option && c->presets->len == 0) {
+        if (string_preset) {
+            for (gint i = 0; x264_presets[i]; i++)
+                g_ptr_array_add(c->presets, g_strdup(x264_presets[i]));
+        } else if (range_max >= range_min && range_max - range_min <= 40) {
+            for (gint v = range_min; v <= range_max; v++)
+                g_ptr_array_add(c->presets, g_strdup_printf("%d", v));
         }
     }
+    return c;
+}
 
-    if (want_audio && audio_codecs) {
-        int idx = find_best_encoder_in_array(audio_codecs, want_audio, audio_encoder_map);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), idx + 1);
-    }
-    if (want_video && video_codecs) {
-        int idx = find_best_encoder_in_array(video_codecs, want_video, video_encoder_map);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), idx + 1);
-        if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
-            gtk_widget_set_sensitive(video_combo, TRUE);
-        gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
-    } else {
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
-        gtk_widget_set_sensitive(video_combo, TRUE);
-        gtk_widget_set_sensitive(reset_video, TRUE);
-    }
+typedef struct {
+    const char *ffmpeg_exe;
+    gchar *topic;   /* "encoder=libx264", "muxer=mp4", ... */
+    gchar *output;  /* result, NULL if ffmpeg failed */
+} HelpTask;
+
+static void help_task_free(gpointer data)
+{
+    HelpTask *task = data;
+    g_free(task->topic);
+    g_free(task->output);
+    g_free(task);
 }
 
-/* Map simple format name to preferred extension (including dot). Return NULL to keep original. */
-static const char *format_to_extension(const char *fmt)
+/* GThreadPool worker: run `ffmpeg -h <topic>` */
+static void help_task_run(gpointer data, gpointer user_data)
 {
-    if (!fmt) return NULL;
-    if (g_strcmp0(fmt, "auto") == 0) return NULL;
-    if (g_strcmp0(fmt, "mp4") == 0) return ".mp4";
-    if (g_strcmp0(fmt, "mkv") == 0) return ".mkv";
-    if (g_strcmp0(fmt, "webm") == 0) return ".webm";
-    if (g_strcmp0(fmt, "avi") == 0) return ".avi";
-    if (g_strcmp0(fmt, "mov") == 0) return ".mov";
-    if (g_strcmp0(fmt, "mpeg") == 0) return ".mpg";
-    if (g_strcmp0(fmt, "mp3") == 0) return ".mp3";
-    if (g_strcmp0(fmt, "flac") == 0) return ".flac";
-    if (g_strcmp0(fmt, "wav") == 0) return ".wav";
-    if (g_strcmp0(fmt, "ogg") == 0) return ".ogg";
-    return NULL;
+    HelpTask *task = data;
+    gchar *argv[] = {(gchar *)task->ffmpeg_exe, "-hide_banner", "-h", task->topic, NULL};
+    gchar *out = NULL;
+    gint status = 0;
+    if (g_spawn_sync(NULL, argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, &status, NULL) &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        task->output = g_steal_pointer(&out);
+    g_free(out);
 }
 
-/* Helper: get active text from a GtkDropDown using the stored model */
-static gchar *drop_down_get_active_text(GtkWidget *dropdown, GtkStringList *model)
+/* Run `ffmpeg -h <topic>` for every HelpTask in `tasks`, one ffmpeg per CPU
+ * at a time, and wait for all of them. */
+static void ffmpeg_help_parallel(GPtrArray *tasks)
 {
-    if (!dropdown || !model) return NULL;
-    gint sel = gtk_drop_down_get_selected(GTK_DROP_DOWN(dropdown));
-    if (sel < 0) return NULL;
-    const char *s = gtk_string_list_get_string(model, sel);
-    return s ? g_strdup(s) : NULL;
+    GThreadPool *pool = g_thread_pool_new(help_task_run, NULL, (gint)g_get_num_processors(), FALSE, NULL);
+    for (guint i = 0; i < tasks->len; i++)
+        g_thread_pool_push(pool, g_ptr_array_index(tasks, i), NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
 }
 
-static void drop_down_set_items_from_ptrarray(GtkWidget *dropdown, GtkStringList **model_store, GPtrArray *arr, const char *leading)
+/* Introspect every listed encoder */
+static void encoder_caps_introspect(const char *ffmpeg_exe)
 {
-    if (!dropdown) return;
-    /* free old model if present */
-    if (*model_store) {
-        g_object_unref(*model_store);
-        *model_store = NULL;
+    if (!encoder_caps)
+        encoder_caps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, encoder_caps_free);
+    GPtrArray *tasks = g_ptr_array_new_with_free_func(help_task_free);
+    GPtrArray *lists[] = {audio_codecs, video_codecs};
+    for (gint l = 0; l < 2; l++) {
+        for (guint i = 0; lists[l] && i < lists[l]->len; i++) {
+            const char *name = g_ptr_array_index(lists[l], i);
+            if (g_strcmp0(name, "copy") == 0) continue;
+            HelpTask *task = g_new0(HelpTask, 1);
+            task->ffmpeg_exe = ffmpeg_exe;
+            task->topic = g_strdup_printf("encoder=%s", name);
+            g_ptr_array_add(tasks, task);
+        }
     }
-    GtkStringList *m = gtk_string_list_new(NULL);
-    if (leading)
-        gtk_string_list_append(m, leading);
-    if (arr) {
-        for (guint i = 0; i < arr->len; i++) {
-            const char *c = g_ptr_array_index(arr, i);
-            gtk_string_list_append(m, c);
+    ffmpeg_help_parallel(tasks);
+    guint t = 0;
+    for (gint l = 0; l < 2; l++) {
+        for (guint i = 0; lists[l] && i < lists[l]->len; i++) {
+            const char *name = g_ptr_array_index(lists[l], i);
+            if (g_strcmp0(name, "copy") == 0) continue;
+            HelpTask *task = g_ptr_array_index(tasks, t++);
+            if (task->output)
+                g_hash_table_replace(encoder_caps, g_strdup(name), encoder_caps_parse(task->output, l == 1));
         }
     }
-    /* set model on dropdown (takes a reference) */
-    gtk_drop_down_set_model(GTK_DROP_DOWN(dropdown), (GListModel*)m);
-    *model_store = m; /* keep reference so we can read values */
-    /* default select first item */
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(dropdown), 0);
+    g_ptr_array_free(tasks, TRUE);
 }
 
-/* Helper: check extension (lowercase, without dot) against whitelist and blacklist
- * Returns TRUE for known media extensions, FALSE otherwise. Explicitly blacklist
- * ambiguous extensions like 'mod' to avoid false-positives. */
-static gboolean is_media_extension(const char *ext_l)
+/* The cache is valid for one ffmpeg binary, identified by path, size and mtime */
+static gchar *ffmpeg_cache_path(const char *name)
 {
-    if (!ext_l) return FALSE;
-    /* blacklist first (explicit rejects) */
-    const char *blacklist[] = {"mod", NULL};
-    for (int i = 0; blacklist[i] != NULL; i++) {
-        if (g_strcmp0(ext_l, blacklist[i]) == 0) return FALSE;
-    }
-    const char *good_exts[] = {"mp4","mkv","webm","avi","mov","mpeg","mpg","mp3","flac","wav","ogg","aac","m4a","opus","m4v","m2ts", NULL};
-    for (int i = 0; good_exts[i] != NULL; i++) {
-        if (g_strcmp0(ext_l, good_exts[i]) == 0) return TRUE;
-    }
-    return FALSE;
+    return g_build_filename(g_get_user_cache_dir(), "baconverter", name, NULL);
 }
 
-static void on_format_combo_changed_generic(GtkDropDown *combo, gpointer user_data)
+/* Start a cache document with the identity of `ffmpeg_exe`; FALSE if the
+ * binary cannot be stat'ed. */
+static gboolean ffmpeg_cache_begin(JsonBuilder *b, const char *ffmpeg_exe, gint version)
 {
-    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), format_model);
-    if (!sel) return;
-    /* If the user selects 'auto', leave copy checkboxes alone (auto-exempt).
-     * For any other explicit format selection, clear both Copy checkboxes so
-     * the user must explicitly choose codecs. */
-    if (g_strcmp0(sel, "auto") != 0 && copy_audio_check && copy_video_check) {
-        if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-        if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-        /* Ensure codec combos are enabled so user can pick encoders */
-        gtk_widget_set_sensitive(audio_combo, TRUE);
-        gtk_widget_set_sensitive(video_combo, TRUE);
-        gtk_widget_set_sensitive(reset_audio, TRUE);
-        gtk_widget_set_sensitive(reset_video, TRUE);
-    }
-    g_free(current_format);
-    current_format = g_strdup(sel);
-    set_codecs_for_format(sel);
-    update_output_label();
-    g_free(sel);
+    GStatBuf st;
+    if (!ffmpeg_exe || g_stat(ffmpeg_exe, &st) != 0) return FALSE;
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "version");
+    json_builder_add_int_value(b, version);
+    json_builder_set_member_name(b, "ffmpeg");
+    json_builder_add_string_value(b, ffmpeg_exe);
+    json_builder_set_member_name(b, "size");
+    json_builder_add_int_value(b, st.st_size);
+    json_builder_set_member_name(b, "mtime");
+    json_builder_add_int_value(b, st.st_mtime);
+    return TRUE;
 }
 
+/* Close the document started by ffmpeg_cache_begin and write it */
+static void ffmpeg_cache_write(JsonBuilder *b, const char *name)
+{
+    json_builder_end_object(b);
+    gchar *path = ffmpeg_cache_path(name);
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    JsonGenerator *gen = json_generator_new();
+    JsonNode *root = json_builder_get_root(b);
+    json_generator_set_root(gen, root);
+    GError *error = NULL;
+    if (!json_generator_to_file(gen, path, &error)) {
+        g_warning("Cannot write cache %s: %s", path, error->message);
+        g_error_free(error);
+    }
+    json_node_unref(root);
+    g_object_unref(gen);
+    g_free(dir);
+    g_free(path);
+}
+
+/* Load cache `name` if it was written for this very ffmpeg binary. The
+ * returned object belongs to *parser_out (unref it when done). */
+static JsonObject *ffmpeg_cache_load(const char *name, const char *ffmpeg_exe, gint version, JsonParser **parser_out)
+{
+    GStatBuf st;
+    *parser_out = NULL;
+    if (!ffmpeg_exe || g_stat(ffmpeg_exe, &st) != 0) return NULL;
+    gchar *path = ffmpeg_cache_path(name);
+    JsonParser *parser = json_parser_new();
+    gboolean ok = json_parser_load_from_file(parser, path, NULL);
+    g_free(path);
+    JsonNode *root = ok ? json_parser_get_root(parser) : NULL;
+    JsonObject *o = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+    if (!o || json_object_get_int_member_with_default(o, "version", 0) != version ||
+        g_strcmp0(json_object_get_string_member_with_default(o, "ffmpeg", NULL), ffmpeg_exe) != 0 ||
+        json_object_get_int_member_with_default(o, "size", -1) != (gint64)st.st_size ||
+        json_object_get_int_member_with_default(o, "mtime", -1) != (gint64)st.st_mtime) {
+        g_object_unref(parser);
+        return NULL;
+    }
+    *parser_out = parser;
+    return o;
+}
+
+static void json_add_strv(JsonBuilder *b, const char *member, gchar **strv)
+{
+    if (!strv) return;
+    json_builder_set_member_name(b, member);
+    json_builder_begin_array(b);
+    for (gint i = 0; strv[i]; i++)
+        json_builder_add_string_value(b, strv[i]);
+    json_builder_end_array(b);
+}
+
+static gchar **json_get_strv(JsonObject *o, const char *member)
+{
+    JsonArray *a = json_object_has_member(o, member) ? json_object_get_array_member(o, member) : NULL;
+    if (!a) return NULL;
+    guint n = json_array_get_length(a);
+    gchar **strv = g_new0(gchar *, n + 1);
+    for (guint i = 0; i < n; i++)
+        strv[i] = g_strdup(json_array_get_string_element(a, i));
+    return strv;
+}
+
+static void encoder_cache_save(const char *ffmpeg_exe)
+{
+    JsonBuilder *b = json_builder_new();
+    if (!ffmpeg_cache_begin(b, ffmpeg_exe, ENCODER_CACHE_VERSION)) {
+        g_object_unref(b);
+        return;
+    }
+    const char *list_names[] = {"audio", "video"};
+    GPtrArray *lists[] = {audio_codecs, video_codecs};
+    for (gint l = 0; l < 2; l++) {
+        json_builder_set_member_name(b, list_names[l]);
+        json_builder_begin_array(b);
+        for (guint i = 0; lists[l] && i < lists[l]->len; i++)
+            json_builder_add_string_value(b, g_ptr_array_index(lists[l], i));
+        json_builder_end_array(b);
+    }
+    json_builder_set_member_name(b, "caps");
+    json_builder_begin_object(b);
+    GHashTableIter it;
+    gpointer key, value;
+    if (encoder_caps) {
+        g_hash_table_iter_init(&it, encoder_caps);
+        while (g_hash_table_iter_next(&it, &key, &value)) {
+            EncoderCaps *c = value;
+            json_builder_set_member_name(b, key);
+            json_builder_begin_object(b);
+            json_builder_set_member_name(b, "video");
+            json_builder_add_boolean_value(b, c->video);
+            json_builder_set_member_name(b, "experimental");
+            json_builder_add_boolean_value(b, c->experimental);
+            json_builder_set_member_name(b, "hardware");
+            json_builder_add_boolean_value(b, c->hardware);
+            json_builder_set_member_name(b, "threads");
+            json_builder_add_boolean_value(b, c->threads);
+            json_builder_set_member_name(b, "tiles");
+            json_builder_add_boolean_value(b, c->tiles);
+            json_builder_set_member_name(b, "row_mt");
+            json_builder_add_boolean_value(b, c->row_mt);
+            json_add_strv(b, "pix_fmts", c->pix_fmts);
+            json_add_strv(b, "sample_fmts", c->sample_fmts);
+            json_add_strv(b, "sample_rates", c->sample_rates);
+            if (c->preset_option) {
+                json_builder_set_member_name(b, "preset_option");
+                json_builder_add_string_value(b, c->preset_option);
+                g_ptr_array_add(c->presets, NULL);
+                json_add_strv(b, "presets", (gchar **)c->presets->pdata);
+                g_ptr_array_set_size(c->presets, c->presets->len - 1);
+            }
+            if (c->preset_default) {
+                json_builder_set_member_name(b, "preset_default");
+                json_builder_add_string_value(b, c->preset_default);
+            }
+            json_builder_end_object(b);
+        }
+    }
+    json_builder_end_object(b);
+    ffmpeg_cache_write(b, "encoders.json");
+    g_object_unref(b);
+}
+
+/* Load encoder lists and capabilities from the cache if it was written for
+ * this very ffmpeg binary. Returns FALSE when it must be rebuilt. */
+static gboolean encoder_cache_load(const char *ffmpeg_exe)
+{
+    JsonParser *parser = NULL;
+    JsonObject *o = ffmpeg_cache_load("encoders.json", ffmpeg_exe, ENCODER_CACHE_VERSION, &parser);
+    if (!o) return FALSE;
+    if (!json_object_has_member(o, "caps")) {
+        g_object_unref(parser);
+        return FALSE;
+    }
+    if (!audio_codecs)
+        audio_codecs = g_ptr_array_new_with_free_func(g_free);
+    if (!video_codecs)
+        video_codecs = g_ptr_array_new_with_free_func(g_free);
+    const char *list_names[] = {"audio", "video"};
+    GPtrArray *lists[] = {audio_codecs, video_codecs};
+    for (gint l = 0; l < 2; l++) {
+        gchar **names = json_get_strv(o, list_names[l]);
+        for (gint i = 0; names && names[i]; i++)
+            add_codec_if_missing(lists[l], names[i]);
+        g_strfreev(names);
+    }
+    if (!encoder_caps)
+        encoder_caps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, encoder_caps_free);
+    JsonObject *caps = json_object_get_object_member(o, "caps");
+    GList *members = json_object_get_members(caps);
+    for (GList *m = members; m; m = m->next) {
+        JsonObject *co = json_object_get_object_member(caps, m->data);
+        EncoderCaps *c = g_new0(EncoderCaps, 1);
+        c->video = json_object_get_boolean_member_with_default(co, "video", FALSE);
+        c->experimental = json_object_get_boolean_member_with_default(co, "experimental", FALSE);
+        c->hardware = json_object_get_boolean_member_with_default(co, "hardware", FALSE);
+        c->threads = json_object_get_boolean_member_with_default(co, "threads", FALSE);
+        c->tiles = json_object_get_boolean_member_with_default(co, "tiles", FALSE);
+        c->row_mt = json_object_get_boolean_member_with_default(co, "row_mt", FALSE);
+        c->pix_fmts = json_get_strv(co, "pix_fmts");
+        c->sample_fmts = json_get_strv(co, "sample_fmts");
+        c->sample_rates = json_get_strv(co, "sample_rates");
+        c->preset_option = g_strdup(json_object_get_string_member_with_default(co, "preset_option", NULL));
+        c->preset_default = g_strdup(json_object_get_string_member_with_default(co, "preset_default", NULL));
+        c->presets = g_ptr_array_new_with_free_func(g_free);
+        gchar **presets = json_get_strv(co, "presets");
+        for (gint i = 0; presets && presets[i]; i++)
+            g_ptr_array_add(c->presets, g_strdup(presets[i]));
+        g_strfreev(presets);
+        g_hash_table_replace(encoder_caps, g_strdup(m->data), c);
+    }
+    g_list_free(members);
+    g_object_unref(parser);
+    return TRUE;
+}
+
+/* FALSE, with a reason, if `encoder` cannot work in a plain software
+ * pipeline (it only accepts GPU surfaces). ffmpeg converts pixel/sample
+ * formats and rates by itself, so those are not checked. */
+static gboolean encoder_usable(const char *encoder, gchar **reason)
+{
+    EncoderCaps *c = encoder_caps_lookup(encoder);
+    if (!c || !c->pix_fmts || !c->pix_fmts[0]) return TRUE;
+    for (gint i = 0; c->pix_fmts[i]; i++)
+        if (!g_strv_contains(hw_pix_fmts, c->pix_fmts[i])) return TRUE;
+    gchar *fmts = g_strjoinv(" ", c->pix_fmts);
+    *reason = g_strdup_printf("%s only accepts hardware frames (%s) and cannot encode decoded software frames", encoder, fmts);
+    g_free(fmts);
+    return FALSE;
+}
+
+/* Check the selected encoders before any job is started */
+static gboolean selected_encoders_usable(const char *audio, const char *video, gchar **reason)
+{
+    return encoder_usable(audio, reason) && encoder_usable(video, reason);
+}
+
+/* Encoder benchmark: every encoder converts a generated clip (lavfi
+ * testsrc2 at two sizes for video, a sine tone for audio) with its default
+ * preset and the first one it lists. Speed and CPU use come from ffmpeg's
+ * -benchmark line, the bitrate from its final size report. Results are
+ * cached per host and ffmpeg binary; the dropdowns show each encoder's speed
+ * relative to libx264 (video) or aac (audio), the scale of encoder_costs. */
+#define BENCH_CACHE_VERSION 1
+#define BENCH_VIDEO_SECONDS 2
+#define BENCH_VIDEO_RATE 30
+#define BENCH_AUDIO_SECONDS 30
+
+static const gint bench_sizes[][2] = {{640, 360}, {1920, 1080}};
+
+typedef struct {
+    gchar *encoder;
+    gboolean video;
+    gint width;           /* 0 for audio */
+    gint height;
+    gchar *preset_option; /* as in EncoderCaps; NULL runs the default */
+    gchar *preset;
+    gboolean experimental;
+    gdouble speed;        /* media seconds per wall second, 0 if the run failed */
+    gdouble fps;          /* frames per wall second, 0 for audio */
+    gdouble cpu;          /* (user + system) / wall time, in cores */
+    gdouble bitrate;      /* bits/s of the encoded stream */
+} BenchResult;
+
+static GPtrArray *bench_results = NULL;   /* BenchResult*, last benchmark */
+static GHashTable *bench_relative = NULL; /* encoder -> gdouble*, speed relative to the reference */
+static GThread *bench_thread = NULL;
+static GtkWidget *bench_button = NULL;
+static gint bench_cancel = 0; /* atomic: Stop or quit, start no further runs */
+static GPid bench_pid = 0;    /* running encode, under bench_lock */
+G_LOCK_DEFINE_STATIC(bench_lock);
+
+static void bench_result_free(gpointer data)
+{
+    BenchResult *r = data;
+    g_free(r->encoder);
+    g_free(r->preset_option);
+    g_free(r->preset);
+    g_free(r);
+}
+
+/* Number after `key` in `text`, or -1 */
+static gdouble bench_value(const char *text, const char *key)
+{
+    const char *p = text ? strstr(text, key) : NULL;
+    if (!p) return -1;
+    gchar *end;
+    gdouble v = g_ascii_strtod(p + strlen(key), &end);
+    return end == p + strlen(key) ? -1 : v;
+}
+
+static void child_setup_new_pgroup(gpointer user_data);
+
+/* g_spawn_sync for the benchmark thread, but in a process group of its own
+ * that bench_stop can signal. The child is reaped only after bench_pid is
+ * cleared, so its pid cannot be reused while bench_stop may still use it. */
+static gboolean bench_spawn(gchar **argv, gchar **err, gint *status)
+{
+    GPid pid;
+    gint err_fd;
+    G_LOCK(bench_lock);
+    gboolean ok = !g_atomic_int_get(&bench_cancel) &&
+                  g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL,
+                                           child_setup_new_pgroup, NULL, &pid, NULL, NULL, &err_fd, NULL);
+    if (ok) bench_pid = pid;
+    G_UNLOCK(bench_lock);
+    if (!ok) return FALSE;
+    GString *text = g_string_new(NULL);
+    gchar buf[4096];
+    gssize n;
+    while ((n = read(err_fd, buf, sizeof buf)) > 0 || (n < 0 && errno == EINTR))
+        if (n > 0) g_string_append_len(text, buf, n);
+    close(err_fd);
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR)
+        ;
+    G_LOCK(bench_lock);
+    bench_pid = 0;
+    G_UNLOCK(bench_lock);
+    while (waitpid(pid, status, 0) < 0 && errno == EINTR)
+        ;
+    *err = g_string_free(text, FALSE);
+    return TRUE;
+}
+
+/* Stop and quit: end the running encode and skip the remaining runs */
+static void bench_stop(int sig)
+{
+    g_atomic_int_set(&bench_cancel, 1);
+    G_LOCK(bench_lock);
+    if (bench_pid > 0) killpg(bench_pid, sig);
+    G_UNLOCK(bench_lock);
+}
+
+/* One encode of the reference clip; runs on the benchmark thread */
+static void bench_run(const char *ffmpeg_exe, BenchResult *r)
+{
+    gdouble seconds = r->video ? BENCH_VIDEO_SECONDS : BENCH_AUDIO_SECONDS;
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup(ffmpeg_exe));
+    g_ptr_array_add(argv, g_strdup("-hide_banner"));
+    g_ptr_array_add(argv, g_strdup("-nostdin"));
+    g_ptr_array_add(argv, g_strdup("-benchmark"));
+    g_ptr_array_add(argv, g_strdup("-f"));
+    g_ptr_array_add(argv, g_strdup("lavfi"));
+    g_ptr_array_add(argv, g_strdup("-i"));
+    if (r->video) {
+        g_ptr_array_add(argv, g_strdup_printf("testsrc2=size=%dx%d:rate=%d:duration=%d", r->width, r->height,
+                                              BENCH_VIDEO_RATE, BENCH_VIDEO_SECONDS));
+        g_ptr_array_add(argv, g_strdup("-c:v"));
+    } else {
+        g_ptr_array_add(argv, g_strdup_printf("sine=frequency=440:sample_rate=48000:duration=%d", BENCH_AUDIO_SECONDS));
+        g_ptr_array_add(argv, g_strdup("-ac"));
+        g_ptr_array_add(argv, g_strdup("2"));
+        g_ptr_array_add(argv, g_strdup("-c:a"));
+    }
+    g_ptr_array_add(argv, g_strdup(r->encoder));
+    if (r->preset_option && r->preset) {
+        g_ptr_array_add(argv, g_strdup_printf("-%s", r->preset_option));
+        g_ptr_array_add(argv, g_strdup(r->preset));
+    }
+    if (r->experimental) {
+        g_ptr_array_add(argv, g_strdup("-strict"));
+        g_ptr_array_add(argv, g_strdup("experimental"));
+    }
+    g_ptr_array_add(argv, g_strdup("-f"));
+    g_ptr_array_add(argv, g_strdup("null"));
+    g_ptr_array_add(argv, g_strdup("-"));
+    g_ptr_array_add(argv, NULL);
+    gchar *err = NULL;
+    gint status = 0;
+    if (bench_spawn((gchar **)argv->pdata, &err, &status) && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        /* "bench: utime=1.2s stime=0.1s rtime=0.8s" and "video:123KiB audio:0KiB ..." */
+        const char *bench = err ? strstr(err, "bench: utime=") : NULL;
+        gdouble rtime = bench_value(bench, "rtime=");
+        gdouble kib = bench_value(err, r->video ? "video:" : "audio:");
+        if (rtime > 0) {
+            r->speed = seconds / rtime;
+            r->fps = r->video ? seconds * BENCH_VIDEO_RATE / rtime : 0;
+            r->cpu = (MAX(bench_value(bench, "utime="), 0) + MAX(bench_value(bench, "stime="), 0)) / rtime;
+            r->bitrate = kib > 0 ? kib * 1024 * 8 / seconds : 0;
+        }
+    }
+    g_free(err);
+    g_ptr_array_free(argv, TRUE);
+}
+
+/* Default-preset run at the largest size: what the relative speed uses */
+static BenchResult *bench_reference_run(const char *encoder)
+{
+    BenchResult *best = NULL;
+    for (guint i = 0; bench_results && i < bench_results->len; i++) {
+        BenchResult *r = g_ptr_array_index(bench_results, i);
+        if (r->preset || r->speed <= 0 || g_strcmp0(r->encoder, encoder) != 0) continue;
+        if (!best || r->width > best->width) best = r;
+    }
+    return best;
+}
+
+static void bench_update_relative(void)
+{
+    if (!bench_relative)
+        bench_relative = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_remove_all(bench_relative);
+    if (!bench_results) return;
+    /* libx264 and aac are the references; without them, the fastest */
+    gdouble ref[2] = {0, 0};
+    const char *ref_names[2] = {"aac", "libx264"};
+    for (gint v = 0; v < 2; v++) {
+        BenchResult *r = bench_reference_run(ref_names[v]);
+        if (r) {
+            ref[v] = r->speed;
+            continue;
+        }
+        for (guint i = 0; i < bench_results->len; i++) {
+            BenchResult *o = g_ptr_array_index(bench_results, i);
+            if (!o->video == !v && o == bench_reference_run(o->encoder) && o->speed > ref[v]) ref[v] = o->speed;
+        }
+    }
+    for (guint i = 0; i < bench_results->len; i++) {
+        BenchResult *r = g_ptr_array_index(bench_results, i);
+        gdouble base = ref[r->video ? 1 : 0];
+        if (base <= 0 || r != bench_reference_run(r->encoder)) continue;
+        gdouble *rel = g_new(gdouble, 1);
+        *rel = r->speed / base;
+        g_hash_table_replace(bench_relative, g_strdup(r->encoder), rel);
+    }
+}
+
+/* "1.0×", "0.35×", "12×", or NULL if `encoder` was not benchmarked */
+static gchar *bench_relative_text(const char *encoder)
+{
+    gdouble *rel = bench_relative && encoder ? g_hash_table_lookup(bench_relative, encoder) : NULL;
+    if (!rel) return NULL;
+    return g_strdup_printf(*rel >= 10 ? "%.0f×" : *rel >= 1 ? "%.1f×" : "%.2f×", *rel);
+}
+
+/* Every run of `encoder`, one per line, for the dropdown tooltip */
+static gchar *bench_describe(const char *encoder)
+{
+    GString *s = g_string_new(NULL);
+    for (guint i = 0; bench_results && i < bench_results->len; i++) {
+        BenchResult *r = g_ptr_array_index(bench_results, i);
+        if (r->speed <= 0 || g_strcmp0(r->encoder, encoder) != 0) continue;
+        if (s->len) g_string_append_c(s, '\n');
+        if (r->video)
+            g_string_append_printf(s, "%dx%d %s: %.0f fps", r->width, r->height, r->preset ? r->preset : "default", r->fps);
+        else
+            g_string_append_printf(s, "%s: %.0fx realtime", r->preset ? r->preset : "default", r->speed);
+        g_string_append_printf(s, ", %.1f cores, %.0f kbit/s", r->cpu, r->bitrate / 1000);
+    }
+    if (s->len == 0) {
+        g_string_free(s, TRUE);
+        return NULL;
+    }
+    return g_string_free(s, FALSE);
+}
+
+static void bench_cache_save(const char *ffmpeg_exe)
+{
+    JsonBuilder *b = json_builder_new();
+    if (!ffmpeg_cache_begin(b, ffmpeg_exe, BENCH_CACHE_VERSION)) {
+        g_object_unref(b);
+        return;
+    }
+    json_builder_set_member_name(b, "host");
+    json_builder_add_string_value(b, g_get_host_name());
+    json_builder_set_member_name(b, "results");
+    json_builder_begin_array(b);
+    for (guint i = 0; bench_results && i < bench_results->len; i++) {
+        BenchResult *r = g_ptr_array_index(bench_results, i);
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "encoder");
+        json_builder_add_string_value(b, r->encoder);
+        json_builder_set_member_name(b, "video");
+        json_builder_add_boolean_value(b, r->video);
+        json_builder_set_member_name(b, "width");
+        json_builder_add_int_value(b, r->width);
+        json_builder_set_member_name(b, "height");
+        json_builder_add_int_value(b, r->height);
+        if (r->preset) {
+            json_builder_set_member_name(b, "preset");
+            json_builder_add_string_value(b, r->preset);
+        }
+        json_builder_set_member_name(b, "speed");
+        json_builder_add_double_value(b, r->speed);
+        json_builder_set_member_name(b, "fps");
+        json_builder_add_double_value(b, r->fps);
+        json_builder_set_member_name(b, "cpu");
+        json_builder_add_double_value(b, r->cpu);
+        json_builder_set_member_name(b, "bitrate");
+        json_builder_add_double_value(b, r->bitrate);
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+    ffmpeg_cache_write(b, "benchmark.json");
+    g_object_unref(b);
+}
+
+/* Load the results measured on this host with this ffmpeg binary */
+static void bench_cache_load(const char *ffmpeg_exe)
+{
+    JsonParser *parser = NULL;
+    JsonObject *o = ffmpeg_cache_load("benchmark.json", ffmpeg_exe, BENCH_CACHE_VERSION, &parser);
+    if (!o) return;
+    JsonArray *a = json_object_has_member(o, "results") ? json_object_get_array_member(o, "results") : NULL;
+    if (a && g_strcmp0(json_object_get_string_member_with_default(o, "host", NULL), g_get_host_name()) == 0) {
+        bench_results = g_ptr_array_new_with_free_func(bench_result_free);
+        for (guint i = 0; i < json_array_get_length(a); i++) {
+            JsonObject *ro = json_array_get_object_element(a, i);
+            BenchResult *r = g_new0(BenchResult, 1);
+            r->encoder = g_strdup(json_object_get_string_member_with_default(ro, "encoder", ""));
+            r->video = json_object_get_boolean_member_with_default(ro, "video", FALSE);
+            r->width = json_object_get_int_member_with_default(ro, "width", 0);
+            r->height = json_object_get_int_member_with_default(ro, "height", 0);
+            r->preset = g_strdup(json_object_get_string_member_with_default(ro, "preset", NULL));
+            r->speed = json_object_get_double_member_with_default(ro, "speed", 0);
+            r->fps = json_object_get_double_member_with_default(ro, "fps", 0);
+            r->cpu = json_object_get_double_member_with_default(ro, "cpu", 0);
+            r->bitrate = json_object_get_double_member_with_default(ro, "bitrate", 0);
+            g_ptr_array_add(bench_results, r);
+        }
+    }
+    g_object_unref(parser);
+}
+
+static gboolean bench_log_idle(gpointer data)
+{
+    gtk_text_buffer_insert_at_cursor(log_buffer, data, -1);
+    g_free(data);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean bench_done_idle(gpointer data)
+{
+    GPtrArray *runs = g_thread_join(bench_thread);
+    bench_thread = NULL;
+    if (bench_button) gtk_widget_set_sensitive(bench_button, TRUE);
+    if (!workers || workers->len == 0) gtk_widget_set_sensitive(stop_button, FALSE);
+    if (g_atomic_int_get(&bench_cancel)) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, "Benchmark stopped; the previous results are kept\n", -1);
+        g_ptr_array_free(runs, TRUE);
+        return G_SOURCE_REMOVE;
+    }
+    if (bench_results) g_ptr_array_free(bench_results, TRUE);
+    bench_results = runs;
+    bench_cache_save(ffmpeg_path);
+    bench_update_relative();
+    guint measured = 0;
+    for (guint i = 0; i < runs->len; i++)
+        if (((BenchResult *)g_ptr_array_index(runs, i))->speed > 0) measured++;
+    gchar *msg = g_strdup_printf("Benchmark finished: %u of %u runs measured; relative speeds are shown in the encoder lists\n",
+                                 measured, runs->len);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+    /* rows already bound keep their old text until rebound */
+    GtkStringList *models[] = {audio_model, video_model};
+    for (gint m = 0; m < 2; m++) {
+        if (!models[m]) continue;
+        guint n = g_list_model_get_n_items(G_LIST_MODEL(models[m]));
+        g_list_model_items_changed(G_LIST_MODEL(models[m]), 0, n, n);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Benchmark thread: runs the planned encodes one after the other so they
+ * do not compete for the CPU. Returns the runs, filled in. */
+static gpointer bench_thread_func(gpointer data)
+{
+    GPtrArray *runs = data;
+    const char *last = NULL;
+    for (guint i = 0; i < runs->len && !g_atomic_int_get(&bench_cancel); i++) {
+        BenchResult *r = g_ptr_array_index(runs, i);
+        if (g_strcmp0(last, r->encoder) != 0)
+            g_idle_add(bench_log_idle, g_strdup_printf("Benchmark %u/%u: %s\n", i + 1, runs->len, r->encoder));
+        last = r->encoder;
+        bench_run(ffmpeg_path, r);
+    }
+    g_idle_add(bench_done_idle, NULL);
+    return runs;
+}
+
+static void bench_clicked(GtkButton *button, gpointer user_data)
+{
+    if (bench_thread || !ffmpeg_path) return;
+    GPtrArray *runs = g_ptr_array_new_with_free_func(bench_result_free);
+    GPtrArray *lists[] = {audio_codecs, video_codecs};
+    for (gint l = 0; l < 2; l++) {
+        for (guint i = 0; lists[l] && i < lists[l]->len; i++) {
+            const char *name = g_ptr_array_index(lists[l], i);
+            gchar *reason = NULL;
+            if (g_strcmp0(name, "copy") == 0) continue;
+            if (!encoder_usable(name, &reason)) {
+                g_free(reason);
+                continue;
+            }
+            EncoderCaps *c = encoder_caps_lookup(name);
+            const char *first = c && c->preset_option && c->presets->len > 0 ? g_ptr_array_index(c->presets, 0) : NULL;
+            for (guint s = 0; s < (l == 1 ? G_N_ELEMENTS(bench_sizes) : 1); s++) {
+                for (gint p = 0; p < (first ? 2 : 1); p++) {
+                    BenchResult *r = g_new0(BenchResult, 1);
+                    r->encoder = g_strdup(name);
+                    r->video = l == 1;
+                    r->width = l == 1 ? bench_sizes[s][0] : 0;
+                    r->height = l == 1 ? bench_sizes[s][1] : 0;
+                    r->preset_option = p ? g_strdup(c->preset_option) : NULL;
+                    r->preset = p ? g_strdup(first) : NULL;
+                    r->experimental = c && c->experimental;
+                    g_ptr_array_add(runs, r);
+                }
+            }
+        }
+    }
+    gchar *msg = g_strdup_printf("Benchmarking encoders: %u runs, one at a time; this takes a while (Stop cancels)\n", runs->len);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+    gtk_widget_set_sensitive(bench_button, FALSE);
+    gtk_widget_set_sensitive(stop_button, TRUE);
+    g_atomic_int_set(&bench_cancel, 0);
+    bench_thread = g_thread_new("benchmark", bench_thread_func, runs);
+}
+
+/* Encoder dropdown rows: the name, and the benchmarked relative speed */
+static void encoder_item_setup(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data)
+{
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 12);
+    GtkWidget *name = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(name), 0.0);
+    gtk_widget_set_hexpand(name, TRUE);
+    gtk_box_append(GTK_BOX(box), name);
+    GtkWidget *speed = gtk_label_new(NULL);
+    gtk_widget_add_css_class(speed, "dim-label");
+    gtk_box_append(GTK_BOX(box), speed);
+    gtk_list_item_set_child(item, box);
+}
+
+static void encoder_item_bind(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data)
+{
+    GtkWidget *box = gtk_list_item_get_child(item);
+    GtkWidget *name = gtk_widget_get_first_child(box);
+    GtkWidget *speed = gtk_widget_get_next_sibling(name);
+    const char *encoder = gtk_string_object_get_string(GTK_STRING_OBJECT(gtk_list_item_get_item(item)));
+    gtk_label_set_text(GTK_LABEL(name), encoder);
+    gchar *rel = bench_relative_text(encoder);
+    gchar *details = bench_describe(encoder);
+    gtk_label_set_text(GTK_LABEL(speed), rel ? rel : "");
+    gtk_widget_set_tooltip_text(box, details);
+    g_free(details);
+    g_free(rel);
+}
+
+static GtkListItemFactory *encoder_list_factory_new(void)
+{
+    GtkListItemFactory *factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(factory, "setup", G_CALLBACK(encoder_item_setup), NULL);
+    g_signal_connect(factory, "bind", G_CALLBACK(encoder_item_bind), NULL);
+    return factory;
+}
+
+/* Output container facts from `ffmpeg -muxers` and `ffmpeg -h muxer=<name>` */
+typedef struct {
+    gchar *name;
+    gchar **extensions;     /* without dots, may be empty */
+    gchar *ext_dot;         /* "." + first extension, NULL if none */
+    gchar *default_audio;   /* codec names as printed by ffmpeg, may be NULL */
+    gchar *default_video;
+} MuxerInfo;
+
+static GPtrArray *muxers = NULL;        /* MuxerInfo*, in `ffmpeg -muxers` order */
+static GHashTable *mux_compat = NULL;   /* "muxer|encoder" -> "" if it works, else ffmpeg's error */
+static gint quality_vmaf = -1;          /* libvmaf filter available; -1 until discovery checked */
+#define MUXER_CACHE_VERSION 1
+
+static void muxer_info_free(gpointer data)
+{
+    MuxerInfo *m = data;
+    g_free(m->name);
+    g_strfreev(m->extensions);
+    g_free(m->ext_dot);
+    g_free(m->default_audio);
+    g_free(m->default_video);
+    g_free(m);
+}
+
+static MuxerInfo *muxer_info_new(const char *name, gchar **extensions, const char *audio, const char *video)
+{
+    MuxerInfo *m = g_new0(MuxerInfo, 1);
+    m->name = g_strdup(name);
+    m->extensions = extensions ? extensions : g_new0(gchar *, 1);
+    if (m->extensions[0])
+        m->ext_dot = g_strconcat(".", m->extensions[0], NULL);
+    m->default_audio = g_strdup(audio);
+    m->default_video = g_strdup(video);
+    return m;
+}
+
+static const MuxerInfo *muxer_lookup(const char *name)
+{
+    for (guint i = 0; muxers && name && i < muxers->len; i++) {
+        MuxerInfo *m = g_ptr_array_index(muxers, i);
+        if (g_strcmp0(m->name, name) == 0) return m;
+    }
+    return NULL;
+}
+
+/* The muxer ffmpeg picks for `path` from its extension */
+static const MuxerInfo *muxer_for_path(const char *path)
+{
+    const char *dot = path ? strrchr(path, '.') : NULL;
+    if (!dot || strchr(dot, G_DIR_SEPARATOR)) return NULL;
+    gchar *ext = g_ascii_strdown(dot + 1, -1);
+    const MuxerInfo *found = NULL;
+    for (guint i = 0; muxers && i < muxers->len && !found; i++) {
+        MuxerInfo *m = g_ptr_array_index(muxers, i);
+        if (g_strv_contains((const gchar * const *)m->extensions, ext)) found = m;
+    }
+    g_free(ext);
+    return found;
+}
+
+/* Value of a "    Key: value." line of `ffmpeg -h muxer=...`, without the dot */
+static gchar *muxer_help_value(const char *help, const char *key)
+{
+    const char *p = strstr(help, key);
+    if (!p) return NULL;
+    p += strlen(key);
+    gchar *v = g_strstrip(g_strndup(p, strcspn(p, "\n")));
+    gsize n = strlen(v);
+    if (n > 0 && v[n - 1] == '.') v[n - 1] = '\0';
+    return v;
+}
+
+static MuxerInfo *muxer_info_parse(const char *name, const char *help)
+{
+    gchar *exts = muxer_help_value(help, "Common extensions:");
+    gchar *audio = muxer_help_value(help, "Default audio codec:");
+    gchar *video = muxer_help_value(help, "Default video codec:");
+    MuxerInfo *m = muxer_info_new(name, exts && *exts ? g_strsplit(exts, ",", -1) : NULL, audio, video);
+    g_free(exts);
+    g_free(audio);
+    g_free(video);
+    return m;
+}
+
+/* Does this ffmpeg have the libvmaf filter? Runs in the discovery thread;
+ * the answer is cached with the muxers. */
+static void detect_vmaf(const char *ffmpeg_exe)
+{
+    gchar *argv[] = {(gchar *)ffmpeg_exe, "-hide_banner", "-h", "filter=libvmaf", NULL};
+    gchar *out = NULL;
+    quality_vmaf = g_spawn_sync(NULL, argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, NULL, NULL) &&
+                   out && strstr(out, "Filter libvmaf");
+    g_free(out);
+}
+
+/* List muxers with `ffmpeg -muxers` and read each one's help in parallel.
+ * Device outputs (flag 'd') are skipped. */
+static void gather_ffmpeg_muxers(const char *ffmpeg_exe)
+{
+    gchar *argv[] = {(gchar *)ffmpeg_exe, "-hide_banner", "-muxers", NULL};
+    gchar *out = NULL;
+    gint status = 0;
+    if (!g_spawn_sync(NULL, argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, &status, NULL) ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !out) {
+        g_warning("ffmpeg -muxers failed; container checks disabled");
+        g_free(out);
+        return;
+    }
+    GPtrArray *tasks = g_ptr_array_new_with_free_func(help_task_free);
+    gchar **lines = g_strsplit(out, "\n", -1);
+    gboolean body = FALSE;
+    for (gint i = 0; lines[i]; i++) {
+        gchar *line = g_strstrip(lines[i]);
+        if (!body) {
+            body = g_str_has_prefix(line, "--");
+            continue;
+        }
+        char flags[8] = "", name[64] = "";
+        if (sscanf(line, "%7s %63s", flags, name) != 2 || !strchr(flags, 'E') || strchr(flags, 'd'))
+            continue;
+        HelpTask *task = g_new0(HelpTask, 1);
+        task->ffmpeg_exe = ffmpeg_exe;
+        task->topic = g_strdup_printf("muxer=%s", name);
+        g_ptr_array_add(tasks, task);
+    }
+    g_strfreev(lines);
+    g_free(out);
+    ffmpeg_help_parallel(tasks);
+    if (!muxers)
+        muxers = g_ptr_array_new_with_free_func(muxer_info_free);
+    for (guint i = 0; i < tasks->len; i++) {
+        HelpTask *task = g_ptr_array_index(tasks, i);
+        if (task->output)
+            g_ptr_array_add(muxers, muxer_info_parse(task->topic + strlen("muxer="), task->output));
+    }
+    g_ptr_array_free(tasks, TRUE);
+}
+
+static void muxer_cache_save(const char *ffmpeg_exe)
+{
+    JsonBuilder *b = json_builder_new();
+    if (!ffmpeg_cache_begin(b, ffmpeg_exe, MUXER_CACHE_VERSION)) {
+        g_object_unref(b);
+        return;
+    }
+    json_builder_set_member_name(b, "muxers");
+    json_builder_begin_array(b);
+    for (guint i = 0; muxers && i < muxers->len; i++) {
+        MuxerInfo *m = g_ptr_array_index(muxers, i);
+        json_builder_begin_object(b);
+        json_builder_set_member_name(b, "name");
+        json_builder_add_string_value(b, m->name);
+        json_add_strv(b, "extensions", m->extensions);
+        if (m->default_audio) {
+            json_builder_set_member_name(b, "audio");
+            json_builder_add_string_value(b, m->default_audio);
+        }
+        if (m->default_video) {
+            json_builder_set_member_name(b, "video");
+            json_builder_add_string_value(b, m->default_video);
+        }
+        json_builder_end_object(b);
+    }
+    json_builder_end_array(b);
+    json_builder_set_member_name(b, "compat");
+    json_builder_begin_object(b);
+    if (mux_compat) {
+        GHashTableIter it;
+        gpointer key, value;
+        g_hash_table_iter_init(&it, mux_compat);
+        while (g_hash_table_iter_next(&it, &key, &value)) {
+            json_builder_set_member_name(b, key);
+            json_builder_add_string_value(b, value);
+        }
+    }
+    json_builder_end_object(b);
+    if (quality_vmaf >= 0) {
+        json_builder_set_member_name(b, "vmaf");
+        json_builder_add_boolean_value(b, quality_vmaf > 0);
+    }
+    ffmpeg_cache_write(b, "muxers.json");
+    g_object_unref(b);
+}
+
+static gboolean muxer_cache_load(const char *ffmpeg_exe)
+{
+    JsonParser *parser = NULL;
+    JsonObject *o = ffmpeg_cache_load("muxers.json", ffmpeg_exe, MUXER_CACHE_VERSION, &parser);
+    if (!o) return FALSE;
+    JsonArray *list = json_object_has_member(o, "muxers") ? json_object_get_array_member(o, "muxers") : NULL;
+    if (!list) {
+        g_object_unref(parser);
+        return FALSE;
+    }
+    if (!muxers)
+        muxers = g_ptr_array_new_with_free_func(muxer_info_free);
+    for (guint i = 0; i < json_array_get_length(list); i++) {
+        JsonObject *mo = json_array_get_object_element(list, i);
+        g_ptr_array_add(muxers, muxer_info_new(json_object_get_string_member_with_default(mo, "name", ""),
+                                               json_get_strv(mo, "extensions"),
+                                               json_object_get_string_member_with_default(mo, "audio", NULL),
+                                               json_object_get_string_member_with_default(mo, "video", NULL)));
+    }
+    if (!mux_compat)
+        mux_compat = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    JsonObject *compat = json_object_has_member(o, "compat") ? json_object_get_object_member(o, "compat") : NULL;
+    GList *members = compat ? json_object_get_members(compat) : NULL;
+    for (GList *m = members; m; m = m->next)
+        g_hash_table_replace(mux_compat, g_strdup(m->data), g_strdup(json_object_get_string_member(compat, m->data)));
+    g_list_free(members);
+    if (json_object_has_member(o, "vmaf"))
+        quality_vmaf = json_object_get_boolean_member(o, "vmaf");
+    g_object_unref(parser);
+    return TRUE;
+}
+
+/* Can `muxer` store what `encoder` produces? Each pair is tried for real:
+ * one synthetic frame (or 0.1 s of silence) is encoded and muxed into a
+ * temporary file. The pairs of the curated formats are tried during
+ * discovery; any other pair is tried in the background the first time it
+ * is asked for, and is unknown until then. Verdicts are cached with the
+ * muxer list. */
+typedef struct {
+    gchar *ffmpeg_exe;
+    gchar *key;           /* "muxer|encoder" */
+    gchar *muxer;
+    gchar *encoder;
+    gboolean video;
+    gboolean experimental;
+    gchar *verdict;       /* "" if the pair works, else ffmpeg's error; NULL if ffmpeg did not run */
+} MuxTest;
+
+static GThreadPool *mux_test_pool = NULL;
+static GHashTable *mux_test_pending = NULL; /* keys of the pairs being tried */
+#define MUX_TEST_THREADS 2
+
+static MuxTest *mux_test_new(const char *muxer, const char *encoder, gboolean video)
+{
+    MuxTest *t = g_new0(MuxTest, 1);
+    t->ffmpeg_exe = g_strdup(ffmpeg_path);
+    t->key = g_strdup_printf("%s|%s", muxer, encoder);
+    t->muxer = g_strdup(muxer);
+    t->encoder = g_strdup(encoder);
+    t->video = video;
+    EncoderCaps *caps = encoder_caps_lookup(encoder);
+    t->experimental = caps && caps->experimental;
+    return t;
+}
+
+static void mux_test_free(gpointer data)
+{
+    MuxTest *t = data;
+    g_free(t->ffmpeg_exe);
+    g_free(t->key);
+    g_free(t->muxer);
+    g_free(t->encoder);
+    g_free(t->verdict);
+    g_free(t);
+}
+
+/* GThreadPool worker: try the pair and set t->verdict */
+static void mux_test_run(gpointer data, gpointer user_data)
+{
+    MuxTest *t = data;
+    gchar *tmp = NULL;
+    gint fd = g_file_open_tmp("bac-muxtest-XXXXXX", &tmp, NULL);
+    if (fd < 0) return;
+    close(fd);
+    GPtrArray *argv = g_ptr_array_new();
+    g_ptr_array_add(argv, t->ffmpeg_exe);
+    g_ptr_array_add(argv, "-hide_banner");
+    g_ptr_array_add(argv, "-nostdin");
+    g_ptr_array_add(argv, "-v");
+    g_ptr_array_add(argv, "error");
+    g_ptr_array_add(argv, "-f");
+    g_ptr_array_add(argv, "lavfi");
+    g_ptr_array_add(argv, "-i");
+    if (t->video) {
+        g_ptr_array_add(argv, "color=c=black:s=320x240:r=25");
+        g_ptr_array_add(argv, "-frames:v");
+        g_ptr_array_add(argv, "1");
+        g_ptr_array_add(argv, "-c:v");
+    } else {
+        g_ptr_array_add(argv, "anullsrc=r=48000:cl=stereo");
+        g_ptr_array_add(argv, "-t");
+        g_ptr_array_add(argv, "0.1");
+        g_ptr_array_add(argv, "-c:a");
+    }
+    g_ptr_array_add(argv, t->encoder);
+    if (t->experimental) {
+        g_ptr_array_add(argv, "-strict");
+        g_ptr_array_add(argv, "experimental");
+    }
+    g_ptr_array_add(argv, "-f");
+    g_ptr_array_add(argv, t->muxer);
+    g_ptr_array_add(argv, "-y");
+    g_ptr_array_add(argv, tmp);
+    g_ptr_array_add(argv, NULL);
+    gchar *err = NULL;
+    gint status = 0;
+    gboolean ran = g_spawn_sync(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, NULL, &err, &status, NULL);
+    g_ptr_array_free(argv, TRUE);
+    g_unlink(tmp);
+    g_free(tmp);
+    if (ran && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        t->verdict = g_strdup("");
+    } else if (ran) {
+        /* the last error line is the most specific one */
+        gchar **lines = g_strsplit(err ? err : "", "\n", -1);
+        const char *last = NULL;
+        for (gint i = 0; lines[i]; i++)
+            if (*g_strstrip(lines[i])) last = lines[i];
+        t->verdict = g_strdup(last ? last : "ffmpeg failed");
+        g_strfreev(lines);
+    }
+    g_free(err);
+}
+
+/* A background verdict arrived; the cache is written once all are in */
+static gboolean mux_test_done_idle(gpointer data)
+{
+    MuxTest *t = data;
+    if (t->verdict)
+        g_hash_table_replace(mux_compat, g_strdup(t->key), g_steal_pointer(&t->verdict));
+    g_hash_table_remove(mux_test_pending, t->key);
+    if (g_hash_table_size(mux_test_pending) == 0)
+        muxer_cache_save(ffmpeg_path);
+    mux_test_free(t);
+    return G_SOURCE_REMOVE;
+}
+
+static void mux_test_async(gpointer data, gpointer user_data)
+{
+    mux_test_run(data, user_data);
+    g_idle_add(mux_test_done_idle, data);
+}
+
+/* Returns "" when the pair works, ffmpeg's error otherwise, NULL while it
+ * is unknown (the check is then started and the caller goes ahead). */
+static const char *mux_compat_check(const char *muxer, const char *encoder, gboolean video)
+{
+    if (!ffmpeg_path || !muxer || !encoder || !discovery_ready) return NULL;
+    if (!mux_compat)
+        mux_compat = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar *key = g_strdup_printf("%s|%s", muxer, encoder);
+    const char *known = g_hash_table_lookup(mux_compat, key);
+    if (known || (mux_test_pending && g_hash_table_contains(mux_test_pending, key))) {
+        g_free(key);
+        return known;
+    }
+    if (!mux_test_pool) {
+        mux_test_pool = g_thread_pool_new(mux_test_async, NULL, MUX_TEST_THREADS, FALSE, NULL);
+        mux_test_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+    g_hash_table_add(mux_test_pending, key);
+    g_thread_pool_push(mux_test_pool, mux_test_new(muxer, encoder, video), NULL);
+    return NULL;
+}
+
+/* NULL if writing `output` with these encoder selections can work, else a
+ * description of why not. `info` (may be NULL) lets streams the input does
+ * not have be skipped. Stream copy depends on the input and is not checked. */
+static gchar *job_settings_problem(const char *output, const char *audio, const char *video, const MediaInfo *info)
+{
+    if (!muxers || muxers->len == 0) return NULL;
+    const MuxerInfo *m = muxer_for_path(output);
+    if (!m) return g_strdup_printf("no container format is known for %s", output);
+    gboolean probed = info && info->probed;
+    if (audio && g_strcmp0(audio, "copy") != 0 && g_strcmp0(audio, "No audio") != 0 && (!probed || info->audio_codec)) {
+        const char *r = mux_compat_check(m->name, audio, FALSE);
+        if (r && *r) return g_strdup_printf("%s audio cannot be written as %s: %s", audio, m->name, r);
+    }
+    if (video && g_strcmp0(video, "copy") != 0 && g_strcmp0(video, "No video") != 0 && (!probed || info->video_codec)) {
+        const char *r = mux_compat_check(m->name, video, TRUE);
+        if (r && *r) return g_strdup_printf("%s video cannot be written as %s: %s", video, m->name, r);
+    }
+    return NULL;
+}
+
+/* Mapping from ffprobe codec names to common ffmpeg encoder names for best-match */
+typedef struct {
+    const char *codec;
+    const char *encoder;
+} CodecMap;
+
+static const CodecMap video_encoder_map[] = {
+    {"h264", "libx264"},
+    {"hevc", "libx265"},
+    {"h265", "libx265"},
+    {"vp9", "libvpx-vp9"},
+    {"av1", "libaom-av1"},
+    {"mpeg4", "mpeg4"},
+    {"theora", "libtheora"},
+    {NULL, NULL}
+};
+
+static const CodecMap audio_encoder_map[] = {
+    {"aac", "aac"},
+    {"mp3", "libmp3lame"},
+    {"opus", "libopus"},
+    {"vorbis", "libvorbis"},
+    {"flac", "flac"},
+    {"ac3", "ac3"},
+    {NULL, NULL}
+};
+
+/* Preferred audio/video encoders for the curated formats. Formats not listed
+ * here fall back to the default codecs of their muxer. */
+typedef struct {
+    const char *format;
+    const char *audio;
+    const char *video;
+} FormatDefault;
+
+static const FormatDefault format_defaults[] = {
+    {"auto", NULL, NULL},
+    {"avi", "mp3", "mpeg4"},
+    {"mp4", "aac", "libx264"},
+    {"mkv", "aac", "libx264"},
+    {"webm", "libvorbis", "libvpx-vp9"},
+    {"mov", "aac", "libx264"},
+    {"mpeg", "mp2", "mpeg2video"},
+    {"ogg", "libvorbis", NULL},
+    {"mp3", "mp3", NULL},
+    {"flac", "flac", NULL},
+    {"wav", "pcm_s16le", NULL},
+    {NULL, NULL, NULL}
+};
+
+/* forward declare function used below */
+static gint find_best_encoder_in_array(GPtrArray *arr, const char *codec, const CodecMap *map);
+
+static int find_format_index(const char *fmt)
+{
+    if (!container_formats || !fmt) return 0;
+    for (guint i = 0; i < container_formats->len; i++) {
+        const char *s = g_ptr_array_index(container_formats, i);
+        if (g_strcmp0(s, fmt) == 0) return (int)i;
+    }
+    return 0;
+}
+
+/* Map common ffprobe 'format_name' tokens to our canonical container names */
+static const char *map_probe_format_to_container(const char *probe)
+{
+    if (!probe) return NULL;
+    if (g_strstr_len(probe, -1, "matroska") || g_strstr_len(probe, -1, "webm")) return "mkv";
+    if (g_strstr_len(probe, -1, "mov") || g_strstr_len(probe, -1, "mp4") || g_strstr_len(probe, -1, "isom")) return "mp4";
+    if (g_strstr_len(probe, -1, "avi")) return "avi";
+    if (g_strstr_len(probe, -1, "mpeg") || g_strstr_len(probe, -1, "mpg") || g_strstr_len(probe, -1, "mpegts")) return "mpeg";
+    if (g_strstr_len(probe, -1, "wav")) return "wav";
+    if (g_strstr_len(probe, -1, "mp3")) return "mp3";
+    if (g_strstr_len(probe, -1, "flac")) return "flac";
+    if (g_strstr_len(probe, -1, "ogg")) return "ogg";
+    if (g_strstr_len(probe, -1, "webm")) return "webm";
+    return NULL;
+}
+
+/* Set audio/video codec combos to defaults for given format name (if available) */
+static void set_codecs_for_format(const char *fmt)
+{
+    if (!fmt) return;
+    /* If the user explicitly selected 'auto', behave like the Reset buttons
+     * for both audio and video: apply detected/default selections so the UI
+     * reflects what was detected from the input file. This makes selecting
+     * Auto equivalent to resetting codecs to detected defaults. */
+    if (g_strcmp0(fmt, "auto") == 0) {
+        /* Audio reset logic */
+        if (audio_codecs) {
+            if (!input_has_audio) {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 0);
+                gtk_widget_set_sensitive(audio_combo, TRUE);
+                gtk_widget_set_sensitive(reset_audio, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)));
+            } else if (!default_audio_codec || g_strcmp0(default_audio_codec, "copy") == 0) {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
+                gtk_widget_set_sensitive(audio_combo, FALSE);
+                /* 'copy' is at index 1 (leading 'No audio' at 0) */
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 1);
+                gtk_widget_set_sensitive(reset_audio, FALSE);
+            } else {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+                gtk_widget_set_sensitive(audio_combo, TRUE);
+                int aidx = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), aidx + 1);
+                gtk_widget_set_sensitive(reset_audio, TRUE);
+            }
+        }
+
+        /* Video reset logic */
+        if (video_codecs) {
+            if (!input_has_video) {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
+                gtk_widget_set_sensitive(video_combo, TRUE);
+                gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
+            } else if (!default_video_codec || g_strcmp0(default_video_codec, "copy") == 0) {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
+                gtk_widget_set_sensitive(video_combo, FALSE);
+                /* 'copy' is at index 1 (leading 'No video' at 0) */
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 1);
+                gtk_widget_set_sensitive(reset_video, FALSE);
+            } else {
+                gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+                gtk_widget_set_sensitive(video_combo, TRUE);
+                int vidx = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
+                gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), vidx + 1);
+                gtk_widget_set_sensitive(reset_video, TRUE);
+            }
+        }
+        return;
+    }
+    const char *want_audio = NULL;
+    const char *want_video = NULL;
+    gboolean curated = FALSE;
+    for (int i = 0; format_defaults[i].format != NULL; i++) {
+        if (g_strcmp0(format_defaults[i].format, fmt) == 0) {
+            want_audio = format_defaults[i].audio;
+            want_video = format_defaults[i].video;
+            curated = TRUE;
+            break;
+        }
+    }
+    const MuxerInfo *mux = curated ? NULL : muxer_lookup(fmt);
+    if (mux) {
+        want_audio = mux->default_audio;
+        want_video = mux->default_video;
+    }
+
+    if (want_audio && audio_codecs) {
+        int idx = find_best_encoder_in_array(audio_codecs, want_audio, audio_encoder_map);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), idx + 1);
+    }
+    if (want_video && video_codecs) {
+        int idx = find_best_encoder_in_array(video_codecs, want_video, video_encoder_map);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), idx + 1);
+        if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+            gtk_widget_set_sensitive(video_combo, TRUE);
+        gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
+    } else {
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
+        gtk_widget_set_sensitive(video_combo, TRUE);
+        gtk_widget_set_sensitive(reset_video, TRUE);
+    }
+}
+
+/* Map simple format name to preferred extension (including dot). Return NULL to keep original. */
+static const char *format_to_extension(const char *fmt)
+{
+    if (!fmt) return NULL;
+    if (g_strcmp0(fmt, "auto") == 0) return NULL;
+    if (g_strcmp0(fmt, "mp4") == 0) return ".mp4";
+    if (g_strcmp0(fmt, "mkv") == 0) return ".mkv";
+    if (g_strcmp0(fmt, "webm") == 0) return ".webm";
+    if (g_strcmp0(fmt, "avi") == 0) return ".avi";
+    if (g_strcmp0(fmt, "mov") == 0) return ".mov";
+    if (g_strcmp0(fmt, "mpeg") == 0) return ".mpg";
+    if (g_strcmp0(fmt, "mp3") == 0) return ".mp3";
+    if (g_strcmp0(fmt, "flac") == 0) return ".flac";
+    if (g_strcmp0(fmt, "wav") == 0) return ".wav";
+    if (g_strcmp0(fmt, "ogg") == 0) return ".ogg";
+    const MuxerInfo *m = muxer_lookup(fmt);
+    return m ? m->ext_dot : NULL;
+}
+
+/* Try the curated formats with their preferred encoders, in parallel. Runs
+ * in the discovery thread, which owns mux_compat until discovery_ready.
+ * TRUE if new verdicts were added. */
+static gboolean mux_compat_discover(void)
+{
+    if (!mux_compat)
+        mux_compat = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    GPtrArray *tests = g_ptr_array_new_with_free_func(mux_test_free);
+    for (int i = 0; format_defaults[i].format; i++) {
+        gchar *probe = g_strconcat("out", format_to_extension(format_defaults[i].format), NULL);
+        const MuxerInfo *m = muxer_for_path(probe);
+        g_free(probe);
+        if (!m) continue;
+        const char *encoders[] = {format_defaults[i].audio, format_defaults[i].video};
+        for (int v = 0; v < 2; v++) {
+            if (!encoders[v] || !encoder_caps_lookup(encoders[v])) continue;
+            gchar *key = g_strdup_printf("%s|%s", m->name, encoders[v]);
+            if (!g_hash_table_contains(mux_compat, key))
+                g_ptr_array_add(tests, mux_test_new(m->name, encoders[v], v == 1));
+            g_free(key);
+        }
+    }
+    GThreadPool *pool = g_thread_pool_new(mux_test_run, NULL, (gint)g_get_num_processors(), FALSE, NULL);
+    for (guint i = 0; i < tests->len; i++)
+        g_thread_pool_push(pool, g_ptr_array_index(tests, i), NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+    gboolean added = FALSE;
+    for (guint i = 0; i < tests->len; i++) {
+        MuxTest *t = g_ptr_array_index(tests, i);
+        if (!t->verdict) continue;
+        g_hash_table_replace(mux_compat, g_strdup(t->key), g_steal_pointer(&t->verdict));
+        added = TRUE;
+    }
+    g_ptr_array_free(tests, TRUE);
+    return added;
+}
+
+/* Helper: get active text from a GtkDropDown using the stored model */
+static gchar *drop_down_get_active_text(GtkWidget *dropdown, GtkStringList *model)
+{
+    if (!dropdown || !model) return NULL;
+    gint sel = gtk_drop_down_get_selected(GTK_DROP_DOWN(dropdown));
+    if (sel < 0) return NULL;
+    const char *s = gtk_string_list_get_string(model, sel);
+    return s ? g_strdup(s) : NULL;
+}
+
+static void drop_down_set_items_from_ptrarray(GtkWidget *dropdown, GtkStringList **model_store, GPtrArray *arr, const char *leading)
+{
+    if (!dropdown) return;
+    /* free old model if present */
+    if (*model_store) {
+        g_object_unref(*model_store);
+        *model_store = NULL;
+    }
+    GtkStringList *m = gtk_string_list_new(NULL);
+    if (leading)
+        gtk_string_list_append(m, leading);
+    if (arr) {
+        for (guint i = 0; i < arr->len; i++) {
+            const char *c = g_ptr_array_index(arr, i);
+            gtk_string_list_append(m, c);
+        }
+    }
+    /* set model on dropdown (takes a reference) */
+    gtk_drop_down_set_model(GTK_DROP_DOWN(dropdown), (GListModel*)m);
+    *model_store = m; /* keep reference so we can read values */
+    /* default select first item */
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(dropdown), 0);
+}
+
+/* Helper: check extension (lowercase, without dot) against whitelist and blacklist
+ * Returns TRUE for known media extensions, FALSE otherwise. Explicitly blacklist
+ * ambiguous extensions like 'mod' to avoid false-positives. */
+static gboolean is_media_extension(const char *ext_l)
+{
+    if (!ext_l) return FALSE;
+    /* blacklist first (explicit rejects) */
+    const char *blacklist[] = {"mod", NULL};
+    for (int i = 0; blacklist[i] != NULL; i++) {
+        if (g_strcmp0(ext_l, blacklist[i]) == 0) return FALSE;
+    }
+    const char *good_exts[] = {"mp4","mkv","webm","avi","mov","mpeg","mpg","mp3","flac","wav","ogg","aac","m4a","opus","m4v","m2ts", NULL};
+    for (int i = 0; good_exts[i] != NULL; i++) {
+        if (g_strcmp0(ext_l, good_exts[i]) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+/* Helper: decide whether a file is media from its content-type (if known),
+ * falling back to extension matching. */
+static gboolean file_looks_like_media(const char *path, const char *ctype)
+{
+    if (ctype && (g_str_has_prefix(ctype, "audio/") || g_str_has_prefix(ctype, "video/")))
+        return TRUE;
+    if (!path) return FALSE;
+    const char *ext = strrchr(path, '.');
+    if (!ext) return FALSE;
+    gchar *ext_l = g_utf8_strdown(ext + 1, -1);
+    gboolean ok = is_media_extension(ext_l);
+    g_free(ext_l);
+    return ok;
+}
+
+static void on_format_combo_changed_generic(GtkDropDown *combo, gpointer user_data)
+{
+    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), format_model);
+    if (!sel) return;
+    /* If the user selects 'auto', leave copy checkboxes alone (auto-exempt).
+     * For any other explicit format selection, clear both Copy checkboxes so
+     * the user must explicitly choose codecs. */
+    if (g_strcmp0(sel, "auto") != 0 && copy_audio_check && copy_video_check) {
+        if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+        if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+        /* Ensure codec combos are enabled so user can pick encoders */
+        gtk_widget_set_sensitive(audio_combo, TRUE);
+        gtk_widget_set_sensitive(video_combo, TRUE);
+        gtk_widget_set_sensitive(reset_audio, TRUE);
+        gtk_widget_set_sensitive(reset_video, TRUE);
+    }
+    g_free(current_format);
+    current_format = g_strdup(sel);
+    set_codecs_for_format(sel);
+    update_output_label();
+    g_free(sel);
+}
+
+
+static gint find_best_encoder_in_array(GPtrArray *arr, const char *codec, const CodecMap *map)
+{
+    if (!arr || arr->len == 0) return 0;
+    if (!codec) return 0;
+    gchar *codec_l = g_utf8_strdown(codec, -1);
+    for (guint i = 0; i < arr->len; i++) {
+        const char *name = g_ptr_array_index(arr, i);
+        if (g_strcmp0(name, codec) == 0) {
+            g_free(codec_l);
+            return i;
+        }
+    }
+    if (map) {
+        for (int m = 0; map[m].codec != NULL; m++) {
+            if (g_strcmp0(map[m].codec, codec) == 0) {
+                const char *want = map[m].encoder;
+                for (guint i = 0; i < arr->len; i++) {
+                    const char *name = g_ptr_array_index(arr, i);
+                    if (g_strcmp0(name, want) == 0) {
+                        g_free(codec_l);
+                        return i;
+                    }
+                    gchar *name_l = g_utf8_strdown(name, -1);
+                    if (g_strstr_len(name_l, -1, want)) {
+                        g_free(name_l);
+                        g_free(codec_l);
+                        return i;
+                    }
+                    g_free(name_l);
+                }
+            }
+        }
+    }
+    for (guint i = 0; i < arr->len; i++) {
+        const char *name = g_ptr_array_index(arr, i);
+        gchar *name_l = g_utf8_strdown(name, -1);
+        if (g_strstr_len(name_l, -1, codec_l)) {
+            g_free(name_l);
+            g_free(codec_l);
+            return i;
+        }
+        g_free(name_l);
+    }
+    g_free(codec_l);
+    return 0;
+}
+
+/* Helper: show an alert dialog (non-blocking) */
+static void show_alert (GtkWindow *parent, const char *title, const char *body)
+{
+    AdwDialog *d = adw_alert_dialog_new (title, body);
+    adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (d), "ok", "_OK", NULL);
+    adw_dialog_present (d, GTK_WIDGET (parent));
+}
+
+/* Forward declarations for IO/child callbacks */
+static gboolean ffmpeg_output_cb(GIOChannel *source, GIOCondition condition, gpointer user_data);
+static void ffmpeg_child_watch_cb(GPid pid, gint status, gpointer user_data);
+static gboolean enable_ui_after_child(gpointer user_data);
+static void on_stop_clicked(GtkButton *button, gpointer user_data);
+/* (prototype already declared above) */
+
+static void stream_info_free(gpointer data)
+{
+    StreamInfo *s = data;
+    g_free(s->type);
+    g_free(s->codec);
+    g_free(s->language);
+    g_free(s);
+}
+
+static void media_info_clear(MediaInfo *mi)
+{
+    g_free(mi->format_name);
+    g_free(mi->audio_codec);
+    g_free(mi->video_codec);
+    g_free(mi->video_profile);
+    g_free(mi->pix_fmt);
+    if (mi->streams) g_ptr_array_free(mi->streams, TRUE);
+    memset(mi, 0, sizeof(*mi));
+}
+
+static StreamInfo *media_info_add_stream(MediaInfo *mi, gint index, const char *type, const char *codec)
+{
+    if (!mi->streams) mi->streams = g_ptr_array_new_with_free_func(stream_info_free);
+    StreamInfo *s = g_new0(StreamInfo, 1);
+    s->index = index;
+    s->type = g_strdup(type ? type : "data");
+    s->codec = g_strdup(codec);
+    g_ptr_array_add(mi->streams, s);
+    return s;
+}
+
+/* Probe for the main window's input file, kept for stream selection */
+static MediaInfo input_info = {0};
+static gchar *input_info_path = NULL;
+static GtkWidget *streams_label;
+static GtkWidget *stream_rules_check;
+static GtkWidget *stream_audio_combo;
+static GtkWidget *stream_lang_entry;
+static GtkWidget *stream_subs_check;
+static GtkWidget *stream_cover_check;
+static void streams_label_update(void);
+
+#ifdef HAVE_LIBAV
+/* Header-only probe through libavformat: no process, no JSON. The probe
+ * window is kept small; stream info is only analyzed when the header alone
+ * leaves a codec, the video size or the duration unknown (e.g. MPEG-TS, or
+ * mp3/flac/wav/ogg/avi, whose length libavformat estimates only there). */
+#define LIBAV_PROBESIZE "1048576"       /* bytes */
+#define LIBAV_ANALYZEDURATION "500000"  /* microseconds */
+
+/* Length in seconds from the container, or else the longest stream; 0 if
+ * neither is known. */
+static gdouble libav_duration(const AVFormatContext *fmt)
+{
+    if (fmt->duration != AV_NOPTS_VALUE && fmt->duration > 0)
+        return fmt->duration / (gdouble)AV_TIME_BASE;
+    gdouble longest = 0;
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        const AVStream *st = fmt->streams[i];
+        if (st->duration != AV_NOPTS_VALUE && st->duration > 0)
+            longest = MAX(longest, st->duration * av_q2d(st->time_base));
+    }
+    return longest;
+}
+
+static gboolean probe_media_info_libav(const char *file, MediaInfo *mi)
+{
+    AVFormatContext *fmt = NULL;
+    AVDictionary *opts = NULL;
+    av_dict_set(&opts, "probesize", LIBAV_PROBESIZE, 0);
+    av_dict_set(&opts, "analyzeduration", LIBAV_ANALYZEDURATION, 0);
+    int ret = avformat_open_input(&fmt, file, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) return FALSE;
+
+    gboolean need_info = fmt->nb_streams == 0 || libav_duration(fmt) <= 0;
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        AVCodecParameters *par = fmt->streams[i]->codecpar;
+        if (par->codec_id == AV_CODEC_ID_NONE || (par->codec_type == AVMEDIA_TYPE_VIDEO && par->width == 0))
+            need_info = TRUE;
+    }
+    if (need_info && avformat_find_stream_info(fmt, NULL) < 0) {
+        avformat_close_input(&fmt);
+        return FALSE;
+    }
+
+    mi->duration = libav_duration(fmt);
+    mi->bit_rate = fmt->bit_rate;
+    if (mi->bit_rate <= 0 && mi->duration > 0 && mi->size > 0)
+        mi->bit_rate = (gint64)(mi->size * 8 / mi->duration);
+    mi->format_name = g_strdup(fmt->iformat->name);
+    for (unsigned i = 0; i < fmt->nb_streams; i++) {
+        AVStream *st = fmt->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        const char *type = av_get_media_type_string(par->codec_type);
+        StreamInfo *s = media_info_add_stream(mi, (gint)i, type, avcodec_get_name(par->codec_id));
+        AVDictionaryEntry *lang = av_dict_get(st->metadata, "language", NULL, 0);
+        if (lang) s->language = g_strdup(lang->value);
+        s->channels = par->ch_layout.nb_channels;
+        s->width = par->width;
+        s->height = par->height;
+        s->attached_pic = (st->disposition & AV_DISPOSITION_ATTACHED_PIC) != 0;
+        /* avcodec_get_name() yields the same names ffprobe prints as codec_name */
+        if (par->codec_type == AVMEDIA_TYPE_AUDIO && !mi->audio_codec) {
+            mi->audio_codec = g_strdup(avcodec_get_name(par->codec_id));
+        } else if (par->codec_type == AVMEDIA_TYPE_VIDEO && !mi->video_codec) {
+            mi->video_codec = g_strdup(avcodec_get_name(par->codec_id));
+            mi->width = par->width;
+            mi->height = par->height;
+            if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0)
+                mi->fps = av_q2d(st->avg_frame_rate);
+            mi->video_profile = g_strdup(avcodec_profile_name(par->codec_id, par->profile));
+            mi->video_level = MAX(par->level, 0);
+            mi->pix_fmt = g_strdup(av_get_pix_fmt_name(par->format));
+        }
+    }
+    mi->probed = TRUE;
+    avformat_close_input(&fmt);
+    return TRUE;
+}
+#endif
+
+/* Probe duration, size and first audio/video codecs of `file`. Only touches
+ * `mi`, so it is safe to call from worker threads. Uses libavformat when
+ * built with it and falls back to spawning ffprobe. */
+static gboolean probe_media_info(const char *file, MediaInfo *mi)
+{
+    GStatBuf st;
+    if (g_stat(file, &st) == 0)
+        mi->size = st.st_size;
+#ifdef HAVE_LIBAV
+    if (probe_media_info_libav(file, mi))
+        return TRUE;
+    media_info_clear(mi);
+    if (g_stat(file, &st) == 0)
+        mi->size = st.st_size;
+#endif
+    const char *probe = ffprobe_path ? ffprobe_path : "ffprobe";
+    const char *argv[] = {probe, "-v", "quiet", "-print_format", "json",
+                          "-show_entries", "format=format_name,duration,bit_rate:stream=index,codec_type,codec_name,width,height,channels,avg_frame_rate"
+                          ",profile,level,pix_fmt:stream_tags=language:stream_disposition=attached_pic",
+                          file, NULL};
+    gchar *stdout_str = NULL;
+    gint exit_status = 0;
+    if (!g_spawn_sync(NULL, (gchar **)argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL,
+                      NULL, NULL, &stdout_str, NULL, &exit_status, NULL) || exit_status != 0) {
+        g_free(stdout_str);
+        return FALSE;
+    }
+    JsonParser *parser = json_parser_new();
+    gboolean ok = json_parser_load_from_data(parser, stdout_str, -1, NULL);
+    JsonNode *root = ok ? json_parser_get_root(parser) : NULL;
+    if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+        JsonObject *obj = json_node_get_object(root);
+        JsonObject *format_obj = json_object_has_member(obj, "format") ? json_object_get_object_member(obj, "format") : NULL;
+        if (format_obj) {
+            /* ffprobe prints numbers as strings in its JSON writer */
+            if (json_object_has_member(format_obj, "duration"))
+                mi->duration = g_ascii_strtod(json_object_get_string_member(format_obj, "duration"), NULL);
+            if (json_object_has_member(format_obj, "bit_rate"))
+                mi->bit_rate = g_ascii_strtoll(json_object_get_string_member(format_obj, "bit_rate"), NULL, 10);
+            if (json_object_has_member(format_obj, "format_name"))
+                mi->format_name = g_strdup(json_object_get_string_member(format_obj, "format_name"));
+        }
+        JsonArray *streams = json_object_has_member(obj, "streams") ? json_object_get_array_member(obj, "streams") : NULL;
+        for (guint i = 0; streams && i < json_array_get_length(streams); i++) {
+            JsonObject *stream = json_array_get_object_element(streams, i);
+            const char *codec_type = json_object_get_string_member_with_default(stream, "codec_type", NULL);
+            const char *codec_name = json_object_get_string_member_with_default(stream, "codec_name", NULL);
+            StreamInfo *s = media_info_add_stream(mi, (gint)json_object_get_int_member_with_default(stream, "index", i),
+                                                  codec_type, codec_name);
+            JsonObject *tags = json_object_has_member(stream, "tags") ? json_object_get_object_member(stream, "tags") : NULL;
+            if (tags)
+                s->language = g_strdup(json_object_get_string_member_with_default(tags, "language", NULL));
+            JsonObject *disp = json_object_has_member(stream, "disposition") ? json_object_get_object_member(stream, "disposition") : NULL;
+            if (disp)
+                s->attached_pic = json_object_get_int_member_with_default(disp, "attached_pic", 0) != 0;
+            s->channels = (gint)json_object_get_int_member_with_default(stream, "channels", 0);
+            s->width = (gint)json_object_get_int_member_with_default(stream, "width", 0);
+            s->height = (gint)json_object_get_int_member_with_default(stream, "height", 0);
+            if (g_strcmp0(codec_type, "audio") == 0 && !mi->audio_codec) {
+                mi->audio_codec = g_strdup(codec_name);
+            } else if (g_strcmp0(codec_type, "video") == 0 && !mi->video_codec) {
+                mi->video_codec = g_strdup(codec_name);
+                mi->width = (gint)json_object_get_int_member_with_default(stream, "width", 0);
+                mi->height = (gint)json_object_get_int_member_with_default(stream, "height", 0);
+                /* "30000/1001"; "0/0" when unknown */
+                const char *rate = json_object_get_string_member_with_default(stream, "avg_frame_rate", NULL);
+                gchar *end = NULL;
+                gdouble num = rate ? g_ascii_strtod(rate, &end) : 0;
+                gdouble den = end && *end == '/' ? g_ascii_strtod(end + 1, NULL) : 1;
+                if (num > 0 && den > 0) mi->fps = num / den;
+                mi->video_profile = g_strdup(json_object_get_string_member_with_default(stream, "profile", NULL));
+                /* -99 when unknown */
+                mi->video_level = MAX((gint)json_object_get_int_member_with_default(stream, "level", 0), 0);
+                mi->pix_fmt = g_strdup(json_object_get_string_member_with_default(stream, "pix_fmt", NULL));
+            }
+        }
+        mi->probed = TRUE;
+    }
+    g_object_unref(parser);
+    g_free(stdout_str);
+    return mi->probed;
+}
+
+/* A probe run on probe_pool. `done` is called on the main loop and may take
+ * over `info` (leaving it zeroed); the rest is freed after it returns. */
+typedef struct ProbeResult ProbeResult;
+struct ProbeResult {
+    gchar *path;
+    MediaInfo info;
+    gboolean ok;
+    void (*done)(ProbeResult *res);
+    gpointer data;
+};
+
+static gboolean probe_done_idle(gpointer user_data)
+{
+    ProbeResult *res = user_data;
+    res->done(res);
+    media_info_clear(&res->info);
+    g_free(res->path);
+    g_free(res);
+    return G_SOURCE_REMOVE;
+}
+
+/* Thread pool worker: probe one path and hand the result to the main loop */
+static void probe_worker(gpointer data, gpointer user_data)
+{
+    ProbeResult *res = data;
+    res->ok = probe_media_info(res->path, &res->info);
+    g_idle_add(probe_done_idle, res);
+}
+
+/* Probe `path` without blocking the main loop; ffprobe may take seconds */
+static void probe_in_background(const char *path, void (*done)(ProbeResult *res), gpointer data)
+{
+    ProbeResult *res = g_new0(ProbeResult, 1);
+    res->path = g_strdup(path);
+    res->done = done;
+    res->data = data;
+    if (!probe_pool)
+        probe_pool = g_thread_pool_new(probe_worker, NULL, (gint)g_get_num_processors(), FALSE, NULL);
+    g_thread_pool_push(probe_pool, res, NULL);
+}
+
+/* Keyframes are looked up this far around a cut point; longer GOPs than
+ * this are rare outside of still-image video. */
+#define KEYFRAME_WINDOW 30.0 /* seconds */
+
+static gint trim_time_compare(gconstpointer a, gconstpointer b)
+{
+    gdouble ta = *(const gdouble *)a, tb = *(const gdouble *)b;
+    return ta < tb ? -1 : ta > tb;
+}
+
+#ifdef HAVE_LIBAV
+/* Packet-level scan: the demuxer seeks to `from` and only packet flags of
+ * the first (non cover art) video stream are read, nothing is decoded. */
+static gboolean probe_keyframes_libav(const char *file, gdouble from, gdouble to, GArray *keys)
+{
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, file, NULL, NULL) < 0) return FALSE;
+    int idx = -1;
+    for (unsigned i = 0; i < fmt->nb_streams && idx < 0; i++) {
+        AVStream *st = fmt->streams[i];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && !(st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+            idx = (int)i;
+    }
+    if (idx < 0) {
+        avformat_close_input(&fmt);
+        return FALSE;
+    }
+    AVStream *st = fmt->streams[idx];
+    /* times are relative to the start of the file, as ffmpeg's -ss is */
+    gdouble start = fmt->start_time != AV_NOPTS_VALUE ? fmt->start_time / (gdouble)AV_TIME_BASE : 0.0;
+    av_seek_frame(fmt, -1, (int64_t)((from + start) * AV_TIME_BASE), AVSEEK_FLAG_BACKWARD);
+    AVPacket *pkt = av_packet_alloc();
+    while (av_read_frame(fmt, pkt) >= 0) {
+        gint64 ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+        gboolean key = pkt->stream_index == idx && (pkt->flags & AV_PKT_FLAG_KEY);
+        gboolean mine = pkt->stream_index == idx && ts != AV_NOPTS_VALUE;
+        gdouble t = mine ? ts * av_q2d(st->time_base) - start : 0.0;
+        av_packet_unref(pkt);
+        if (!mine) continue;
+        if (t > to) break;
+        if (key && t >= from) g_array_append_val(keys, t);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+    return TRUE;
+}
+#endif
+
+/* Keyframe times (seconds from the start of the file, ascending) of the
+ * first video stream between `from` and `to`. NULL if the file could not be
+ * read. */
+static GArray *probe_keyframes(const char *file, gdouble from, gdouble to)
+{
+    GArray *keys = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    from = MAX(0.0, from);
+#ifdef HAVE_LIBAV
+    if (probe_keyframes_libav(file, from, to, keys)) {
+        g_array_sort(keys, trim_time_compare);
+        return keys;
+    }
+    g_array_set_size(keys, 0);
+#endif
+    /* "+a%+b": start a after the file's start time and read b seconds */
+    gchar *interval = g_strdup_printf("+%d%%+%d", (gint)from, (gint)(to - (gint)from) + 1);
+    const char *probe = ffprobe_path ? ffprobe_path : "ffprobe";
+    const char *argv[] = {probe, "-v", "quiet", "-print_format", "json", "-select_streams", "v:0",
+                          "-read_intervals", interval, "-show_entries", "packet=pts_time,dts_time,flags:format=start_time",
+                          file, NULL};
+    gchar *stdout_str = NULL;
+    gint exit_status = 0;
+    gboolean ok = g_spawn_sync(NULL, (gchar **)argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL,
+                               NULL, NULL, &stdout_str, NULL, &exit_status, NULL) && exit_status == 0;
+    g_free(interval);
+    JsonParser *parser = json_parser_new();
+    ok = ok && json_parser_load_from_data(parser, stdout_str, -1, NULL);
+    JsonNode *root = ok ? json_parser_get_root(parser) : NULL;
+    JsonArray *packets = NULL;
+    gdouble start = 0.0;
+    if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+        JsonObject *obj = json_node_get_object(root);
+        if (json_object_has_member(obj, "packets"))
+            packets = json_object_get_array_member(obj, "packets");
+        JsonObject *format_obj = json_object_has_member(obj, "format") ? json_object_get_object_member(obj, "format") : NULL;
+        if (format_obj && json_object_has_member(format_obj, "start_time"))
+            start = g_ascii_strtod(json_object_get_string_member(format_obj, "start_time"), NULL);
+    }
+    for (guint i = 0; packets && i < json_array_get_length(packets); i++) {
+        JsonObject *p = json_array_get_object_element(packets, i);
+        const char *flags = json_object_get_string_member_with_default(p, "flags", "");
+        const char *time = json_object_get_string_member_with_default(p, "pts_time",
+                           json_object_get_string_member_with_default(p, "dts_time", NULL));
+        if (!time || flags[0] != 'K') continue;
+        gdouble t = g_ascii_strtod(time, NULL) - start;
+        if (t >= from && t <= to) g_array_append_val(keys, t);
+    }
+    g_object_unref(parser);
+    g_free(stdout_str);
+    if (!packets) {
+        g_array_free(keys, TRUE);
+        return NULL;
+    }
+    /* packets are listed in decode order */
+    g_array_sort(keys, trim_time_compare);
+    return keys;
+}
+
+/* Detect default codecs from input file */
+static void detect_defaults(const char *file) {
+    MediaInfo mi = {0};
+    if (!probe_media_info(file, &mi)) {
+        g_warning("Cannot probe %s; codecs not detected", file);
+        media_info_clear(&mi);
+        media_info_clear(&input_info);
+        streams_label_update();
+        return;
+    }
+    if (mi.format_name) {
+        gchar **parts = g_strsplit(mi.format_name, ",", 2);
+        gchar *first = g_strstrip(parts[0]);
+        gchar *low = g_utf8_strdown(first, -1);
+        const char *mapped = map_probe_format_to_container(low);
+        g_free(current_format);
+        if (mapped)
+            current_format = g_strdup(mapped);
+        else
+            current_format = g_strdup(low);
+        g_free(low);
+        g_strfreev(parts);
+    }
+    input_has_audio = mi.audio_codec != NULL;
+    input_has_video = mi.video_codec != NULL;
+    if (mi.audio_codec && !default_audio_codec)
+        default_audio_codec = g_strdup(mi.audio_codec);
+    if (mi.video_codec && !default_video_codec)
+        default_video_codec = g_strdup(mi.video_codec);
+    media_info_clear(&input_info);
+    input_info = mi; /* keeps the stream list */
+    g_free(input_info_path);
+    input_info_path = g_strdup(file);
+    streams_label_update();
+}
+
+/* Build "<dir>/<name>_out<ext>" for `input`, switching the extension to the
+ * one of `fmt` when a container is selected. */
+static gchar *build_output_path(const char *input, const char *fmt)
+{
+    char *dir = g_path_get_dirname(input);
+    char *basename = g_path_get_basename(input);
+    char *dot = strrchr(basename, '.');
+    const char *new_ext = format_to_extension(fmt);
+    gchar *name;
+    if (dot) {
+        const char *orig_ext = dot;
+        gchar *stem = g_strndup(basename, dot - basename);
+        name = g_strdup_printf("%s_out%s", stem, new_ext ? new_ext : orig_ext);
+        g_free(stem);
+    } else {
+        name = g_strdup_printf("%s_out%s", basename, new_ext ? new_ext : "");
+    }
+    gchar *out = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+    g_free(basename);
+    return out;
+}
+
+/* Helper to update output filename */
+static void update_output_label() {
+    if (!input_file) return;
+    g_free(output_file);
+    output_file = build_output_path(input_file, current_format);
+    gtk_label_set_text(GTK_LABEL(output_label), output_file);
+}
+
+/* Use the modern GtkFileDialog API (GTK >= 4.8) and open it asynchronously.
+ * The finish callback will handle the selected file and update UI state. */
+static void on_file_dialog_open_finish(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GtkFileDialog *dialog = GTK_FILE_DIALOG(source_object);
+    GError *error = NULL;
+    GFile *file = gtk_file_dialog_open_finish(dialog, res, &error);
+    if (!file) {
+        if (error) {
+            g_warning("File dialog error: %s", error->message);
+            g_error_free(error);
+        }
+        g_object_unref(dialog);
+        return;
+    }
+
+    input_file = g_file_get_path(file);
+    gtk_label_set_text(GTK_LABEL(input_label), input_file);
+    g_free(default_audio_codec);
+    g_free(default_video_codec);
+    default_audio_codec = NULL;
+    default_video_codec = NULL;
+    detect_defaults(input_file);
+    if (!default_audio_codec) default_audio_codec = g_strdup("copy");
+    if (!default_video_codec) default_video_codec = g_strdup("copy");
+
+    int active_idx = 0;
+    drop_down_set_items_from_ptrarray(audio_combo, &audio_model, audio_codecs, "No audio");
+    if (!input_has_audio) active_idx = 0;
+    else if (default_audio_codec) {
+        int best = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
+        active_idx = best + 1;
+    }
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), active_idx);
+
+    active_idx = 0;
+    drop_down_set_items_from_ptrarray(video_combo, &video_model, video_codecs, "No video");
+    if (!input_has_video) active_idx = 0;
+    else if (default_video_codec) {
+        int best = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
+        active_idx = best + 1;
+    }
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), active_idx);
+
+    if (current_format) {
+        int fidx = find_format_index(current_format);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), fidx);
+        set_codecs_for_format(current_format);
+    } else {
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), 0);
+    }
+    update_output_label();
+    /* Enable UI controls now that an input was selected. */
+    update_start_button_state();
+    /* Enable copy checkboxes so user can toggle copy behavior */
+    gtk_widget_set_sensitive(copy_audio_check, TRUE);
+    gtk_widget_set_sensitive(copy_video_check, TRUE);
+    /* Format dropdown should be enabled */
+    gtk_widget_set_sensitive(format_combo_audio, TRUE);
+    /* Enable or disable audio controls based on detection and copy checkbox */
+    if (input_has_audio) {
+        /* If default is 'copy', set the checkbox active and disable combo */
+        if (default_audio_codec && g_strcmp0(default_audio_codec, "copy") == 0) {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
+            gtk_widget_set_sensitive(audio_combo, FALSE);
+            gtk_widget_set_sensitive(reset_audio, FALSE);
+        } else {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+            gtk_widget_set_sensitive(audio_combo, TRUE);
+            gtk_widget_set_sensitive(reset_audio, TRUE);
+        }
+    } else {
+        /* No audio: leave Copy unchecked and allow selection of 'No audio' */
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+        gtk_widget_set_sensitive(audio_combo, TRUE);
+        gtk_widget_set_sensitive(reset_audio, TRUE);
+    }
+    /* Enable or disable video controls based on detection and copy checkbox */
+    if (input_has_video) {
+        if (default_video_codec && g_strcmp0(default_video_codec, "copy") == 0) {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
+            gtk_widget_set_sensitive(video_combo, FALSE);
+            gtk_widget_set_sensitive(reset_video, FALSE);
+        } else {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+            gtk_widget_set_sensitive(video_combo, TRUE);
+            gtk_widget_set_sensitive(reset_video, TRUE);
+        }
+    } else {
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+        gtk_widget_set_sensitive(video_combo, TRUE);
+        gtk_widget_set_sensitive(reset_video, TRUE);
+    }
+    /* Ensure Start/Stop reflect running state */
+    gtk_widget_set_sensitive(stop_button, FALSE);
+    g_object_unref(file);
+    g_object_unref(dialog);
+}
+
+static void on_choose_file_clicked(GtkButton *button, gpointer user_data) {
+    GtkWindow *window = GTK_WINDOW(user_data);
+    GtkFileDialog *dialog = gtk_file_dialog_new();
+    gtk_file_dialog_set_title(dialog, "Choose input file");
+    /* Open asynchronously; the finish callback will handle the chosen file */
+    gtk_file_dialog_open(dialog, window, NULL, on_file_dialog_open_finish, NULL);
+}
+
+static void on_copy_audio_toggled(GtkCheckButton *check, gpointer user_data) {
+    gboolean copy = gtk_check_button_get_active(check);
+    /* If conversion is running, keep combos disabled regardless */
+    if (workers && workers->len > 0) {
+        gtk_widget_set_sensitive(audio_combo, FALSE);
+    } else {
+        gtk_widget_set_sensitive(audio_combo, !copy);
+    }
+    /* Reset button should be disabled when copy is active */
+    gtk_widget_set_sensitive(reset_audio, !copy);
+    update_output_label();
+}
+
+static void on_copy_video_toggled(GtkCheckButton *check, gpointer user_data) {
+    gboolean copy = gtk_check_button_get_active(check);
+    if (workers && workers->len > 0) {
+        gtk_widget_set_sensitive(video_combo, FALSE);
+    } else {
+        gtk_widget_set_sensitive(video_combo, !copy);
+    }
+    /* Reset button should be disabled when copy is active */
+    gtk_widget_set_sensitive(reset_video, !copy);
+    update_output_label();
+}
+
+/* Combo changes */
+static void on_audio_combo_changed(GtkComboBox *combo, gpointer user_data) {
+    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), audio_model);
+    if (sel) {
+        if (g_strcmp0(sel, "copy") == 0 || g_strcmp0(sel, "Copy") == 0) {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
+        } else {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+        }
+        g_free(sel);
+    }
+    update_output_label();
+}
+
+static void on_video_combo_changed(GtkComboBox *combo, gpointer user_data) {
+    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), video_model);
+    if (sel) {
+        if (g_strcmp0(sel, "copy") == 0 || g_strcmp0(sel, "Copy") == 0) {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
+        } else {
+            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+        }
+        g_free(sel);
+    }
+    update_output_label();
+}
+
+/* Reset buttons */
+static void on_reset_audio_clicked(GtkButton *button, gpointer user_data) {
+    if (!audio_codecs) return;
+    /* If the input has no audio, reset to 'No audio' (index 0). */
+    if (!input_has_audio) {
+        /* No audio stream: ensure Copy is off and combobox shows 'No audio' */
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 0);
+        gtk_widget_set_sensitive(audio_combo, TRUE);
+        gtk_widget_set_sensitive(reset_audio, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)));
+        return;
+    }
+    /* default_audio_codec should normally be set after file selection; if missing, default to 'copy' */
+    if (!default_audio_codec || g_strcmp0(default_audio_codec, "copy") == 0) {
+        /* Default is 'copy' -> enable the Copy checkbox and disable codec combobox */
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
+        gtk_widget_set_sensitive(audio_combo, FALSE);
+        /* combobox layout: [No audio, copy, ...] -> 'copy' is index 1 */
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 1);
+        /* When Copy is active, reset button should be disabled */
+        gtk_widget_set_sensitive(reset_audio, FALSE);
+        return;
+    }
+    /* Non-copy default: ensure Copy is off and combo enabled */
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
+    gtk_widget_set_sensitive(audio_combo, TRUE);
+    int idx = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
+    /* offset by 1 because combobox has a leading 'No audio' entry */
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), idx + 1);
+    gtk_widget_set_sensitive(reset_audio, TRUE);
+}
+
+static void on_reset_video_clicked(GtkButton *button, gpointer user_data) {
+    if (!video_codecs) return;
+    /* If the input has no video, reset to 'No video' (index 0). */
+    if (!input_has_video) {
+        /* No video stream: ensure Copy is off and combobox shows 'No video' */
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
+        gtk_widget_set_sensitive(video_combo, TRUE);
+        gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
+        return;
+    }
+    if (!default_video_codec || g_strcmp0(default_video_codec, "copy") == 0) {
+        /* Default is 'copy' -> enable the Copy checkbox and disable codec combobox */
+        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
+        gtk_widget_set_sensitive(video_combo, FALSE);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 1);
+        gtk_widget_set_sensitive(reset_video, FALSE);
+        return;
+    }
+    /* Non-copy default: ensure Copy is off and combo enabled */
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+    gtk_widget_set_sensitive(video_combo, TRUE);
+    int idx = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), idx + 1);
+    gtk_widget_set_sensitive(reset_video, TRUE);
+}
+
+/* Read the codec selections the way a conversion uses them: "copy" when the
+ * Copy checkbox is active, else the dropdown text ("No audio", encoder, ...). */
+static void get_selected_codecs(gchar **audio, gchar **video)
+{
+    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
+        *audio = g_strdup("copy");
+    else
+        *audio = drop_down_get_active_text(audio_combo, audio_model);
+    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+        *video = g_strdup("copy");
+    else
+        *video = drop_down_get_active_text(video_combo, video_model);
+}
+
+static void job_settings_clear(gpointer data)
+{
+    JobSettings *js = data;
+    g_free(js->format);
+    g_free(js->output);
+    g_free(js->audio);
+    g_free(js->video);
+    g_free(js->vfilter);
+    g_free(js->afilter);
+    g_free(js->preset);
+    g_strfreev(js->languages);
+}
+
+static void job_settings_unref(JobSettings *js)
+{
+    g_atomic_rc_box_release_full(js, job_settings_clear);
+}
+
+/* Snapshot of the main window's format, codec and speed settings */
+static JobSettings *job_settings_from_ui(void)
+{
+    JobSettings *js = g_atomic_rc_box_new0(JobSettings);
+    js->format = g_strdup(current_format);
+    get_selected_codecs(&js->audio, &js->video);
+    js->preset = g_strdup(speed_preset);
+    js->threads = speed_threads;
+    js->tile_columns = speed_tile_columns;
+    js->row_mt = speed_row_mt;
+    js->stream_rules = stream_rules_enabled;
+    js->all_audio = stream_all_audio;
+    js->languages = g_strdupv(stream_languages);
+    js->keep_subtitles = stream_keep_subtitles;
+    js->keep_cover = stream_keep_cover;
+    return js;
+}
+
+static gchar *job_output_path(const char *input, const JobSettings *js)
+{
+    return js->output ? g_strdup(js->output) : build_output_path(input, js->format);
+}
+
+/* Refresh the speed row for the selected video encoder: rebuild the preset
+ * list when the encoder changed and enable only knobs the encoder has. */
+static void speed_controls_update(void)
+{
+    if (!speed_preset_combo) return;
+    gchar *enc = NULL;
+    if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+        enc = drop_down_get_active_text(video_combo, video_model);
+    EncoderCaps *c = encoder_caps_lookup(enc);
+    if (g_strcmp0(enc, speed_preset_encoder) != 0) {
+        GtkStringList *m = gtk_string_list_new(NULL);
+        gchar *first = c && c->preset_default ? g_strdup_printf("Default (%s)", c->preset_default) : g_strdup("Default");
+        gtk_string_list_append(m, first);
+        g_free(first);
+        for (guint i = 0; c && i < c->presets->len; i++)
+            gtk_string_list_append(m, g_ptr_array_index(c->presets, i));
+        if (speed_preset_model) g_object_unref(speed_preset_model);
+        speed_preset_model = m;
+        gtk_drop_down_set_model(GTK_DROP_DOWN(speed_preset_combo), G_LIST_MODEL(m));
+        gtk_drop_down_set_selected(GTK_DROP_DOWN(speed_preset_combo), 0);
+        g_clear_pointer(&speed_preset, g_free);
+        g_free(speed_preset_encoder);
+        speed_preset_encoder = g_strdup(enc);
+    }
+    gboolean on = c && gtk_widget_get_sensitive(video_combo);
+    gtk_widget_set_sensitive(speed_preset_combo, on && c->preset_option && c->presets->len > 0);
+    gtk_widget_set_tooltip_text(speed_preset_combo, on && c->preset_option ? c->preset_option : NULL);
+    gtk_widget_set_sensitive(speed_threads_spin, on && c->threads);
+    gtk_widget_set_sensitive(speed_tiles_combo, on && c->tiles);
+    gtk_widget_set_sensitive(speed_row_mt_check, on && c->row_mt);
+    g_free(enc);
+}
+
+static void speed_controls_notify(GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    speed_controls_update();
+}
+
+static void speed_preset_changed(GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    guint sel = gtk_drop_down_get_selected(GTK_DROP_DOWN(speed_preset_combo));
+    g_clear_pointer(&speed_preset, g_free);
+    if (sel != GTK_INVALID_LIST_POSITION && sel > 0 && speed_preset_model)
+        speed_preset = g_strdup(gtk_string_list_get_string(speed_preset_model, sel));
+}
+
+static void speed_threads_changed(GtkSpinButton *spin, gpointer user_data)
+{
+    speed_threads = gtk_spin_button_get_value_as_int(spin);
+}
+
+static void speed_tiles_changed(GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    guint sel = gtk_drop_down_get_selected(GTK_DROP_DOWN(speed_tiles_combo));
+    /* entries: Default, 1, 2, 4, ... -> log2 of the column count */
+    speed_tile_columns = (sel == GTK_INVALID_LIST_POSITION || sel == 0) ? -1 : (gint)sel - 1;
+}
+
+static void speed_row_mt_toggled(GtkCheckButton *check, gpointer user_data)
+{
+    speed_row_mt = gtk_check_button_get_active(check);
+}
+
+/* Probe results for `path`: the batch job's, or the main window's input */
+static const MediaInfo *media_info_for(const char *path)
+{
+    BatchJob *job = batch_jobs && path ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    if (job && job->info.probed) return &job->info;
+    if (path && input_info.probed && g_strcmp0(path, input_info_path) == 0) return &input_info;
+    return NULL;
+}
+
+static gboolean stream_language_wanted(const StreamInfo *s, gchar **languages)
+{
+    if (!languages || !languages[0]) return TRUE;
+    return s->language && g_strv_contains((const gchar * const *)languages, s->language);
+}
+
+/* "eng, slv" -> {"eng", "slv"}; NULL for an empty list */
+static gchar **stream_languages_parse(const char *text)
+{
+    if (!text || !*text) return NULL;
+    gchar **parts = g_strsplit_set(text, ", ", -1);
+    GPtrArray *list = g_ptr_array_new();
+    for (gint i = 0; parts[i]; i++)
+        if (*parts[i]) g_ptr_array_add(list, g_ascii_strdown(parts[i], -1));
+    g_strfreev(parts);
+    if (list->len == 0) {
+        g_ptr_array_free(list, TRUE);
+        return NULL;
+    }
+    g_ptr_array_add(list, NULL);
+    return (gchar **)g_ptr_array_free(list, FALSE);
+}
+
+static gint stream_index_compare(gconstpointer a, gconstpointer b)
+{
+    const StreamInfo *sa = *(StreamInfo * const *)a;
+    const StreamInfo *sb = *(StreamInfo * const *)b;
+    return sa->index - sb->index;
+}
+
+/* Streams the rules keep for a job converted with `audio`/`video`, in file
+ * order (not owned). The rules come from `js`, or from the main window when
+ * it is NULL. NULL when the rules are off or the input's streams are
+ * unknown, which leaves the choice to ffmpeg. Audio in a preferred language
+ * wins; if no track has one, all audio tracks are candidates. Data streams
+ * and attachments are never kept. */
+static GPtrArray *stream_selection(const MediaInfo *mi, const char *audio, const char *video, const JobSettings *js)
+{
+    gboolean enabled = js ? js->stream_rules : stream_rules_enabled;
+    gboolean all_audio = js ? js->all_audio : stream_all_audio;
+    gchar **languages = js ? js->languages : stream_languages;
+    gboolean keep_subtitles = js ? js->keep_subtitles : stream_keep_subtitles;
+    gboolean keep_cover = js ? js->keep_cover : stream_keep_cover;
+    if (!enabled || !mi || !mi->streams) return NULL;
+    gboolean want_audio = audio && g_strcmp0(audio, "No audio") != 0;
+    gboolean want_video = video && g_strcmp0(video, "No video") != 0;
+    GPtrArray *sel = g_ptr_array_new();
+    const StreamInfo *video_stream = NULL, *cover = NULL;
+    GPtrArray *audio_pref = g_ptr_array_new(), *audio_any = g_ptr_array_new();
+    for (guint i = 0; i < mi->streams->len; i++) {
+        StreamInfo *s = g_ptr_array_index(mi->streams, i);
+        if (g_strcmp0(s->type, "video") == 0) {
+            if (s->attached_pic && !cover) cover = s;
+            else if (!s->attached_pic && !video_stream) video_stream = s;
+        } else if (g_strcmp0(s->type, "audio") == 0) {
+            g_ptr_array_add(audio_any, s);
+            if (stream_language_wanted(s, languages)) g_ptr_array_add(audio_pref, s);
+        } else if (g_strcmp0(s->type, "subtitle") == 0) {
+            if (keep_subtitles && stream_language_wanted(s, languages)) g_ptr_array_add(sel, s);
+        }
+    }
+    if (want_video && video_stream) g_ptr_array_add(sel, (gpointer)video_stream);
+    /* cover art is a video stream too, so it needs video output */
+    if (want_video && keep_cover && cover) g_ptr_array_add(sel, (gpointer)cover);
+    GPtrArray *audio_from = audio_pref->len > 0 ? audio_pref : audio_any;
+    for (guint i = 0; want_audio && i < audio_from->len && (all_audio || i == 0); i++)
+        g_ptr_array_add(sel, g_ptr_array_index(audio_from, i));
+    g_ptr_array_free(audio_pref, TRUE);
+    g_ptr_array_free(audio_any, TRUE);
+    if (sel->len == 0) {
+        g_ptr_array_free(sel, TRUE);
+        return NULL;
+    }
+    g_ptr_array_sort(sel, stream_index_compare);
+    return sel;
+}
+
+/* -map options for the selected streams of input 0, by the rules of `js`
+ * (the main window's when NULL). Options that must come after the codec
+ * options (cover art is copied, not encoded; subtitles are copied into
+ * Matroska, which takes any codec) are added to `late`. */
+static void append_stream_maps(GPtrArray *argv, GPtrArray *late, const MediaInfo *mi,
+                               const char *output, const char *audio, const char *video, const JobSettings *js)
+{
+    GPtrArray *sel = stream_selection(mi, audio, video, js);
+    if (!sel) return;
+    gint out_video = 0;
+    gboolean subtitles = FALSE;
+    for (guint i = 0; i < sel->len; i++) {
+        StreamInfo *s = g_ptr_array_index(sel, i);
+        g_ptr_array_add(argv, g_strdup("-map"));
+        g_ptr_array_add(argv, g_strdup_printf("0:%d", s->index));
+        if (g_strcmp0(s->type, "subtitle") == 0) subtitles = TRUE;
+        if (g_strcmp0(s->type, "video") != 0) continue;
+        if (s->attached_pic) {
+            g_ptr_array_add(late, g_strdup_printf("-c:v:%d", out_video));
+            g_ptr_array_add(late, g_strdup("copy"));
+            g_ptr_array_add(late, g_strdup_printf("-disposition:v:%d", out_video));
+            g_ptr_array_add(late, g_strdup("attached_pic"));
+        }
+        out_video++;
+    }
+    const MuxerInfo *m = muxer_for_path(output);
+    if (subtitles && m && (g_str_has_prefix(m->name, "matroska") || g_strcmp0(m->name, "webm") == 0)) {
+        g_ptr_array_add(late, g_strdup("-c:s"));
+        g_ptr_array_add(late, g_strdup("copy"));
+    }
+    g_ptr_array_free(sel, TRUE);
+}
+
+/* Append the per-output codec options of one conversion: stream selection,
+ * encoders, filters and encoder specific speed options. `vfilter`/`afilter`
+ * (may be NULL) are added as -vf/-af. The speed options come from `js`, or
+ * from the Speed row when it is NULL. */
+static void append_encode_options(GPtrArray *argv, const char *audio, const char *video,
+                                  const char *vfilter, const char *afilter, const JobSettings *js)
+{
+    const char *preset = js ? js->preset : speed_preset;
+    gint threads = js ? js->threads : speed_threads;
+    gint tile_columns = js ? js->tile_columns : speed_tile_columns;
+    gboolean row_mt = js ? js->row_mt : speed_row_mt;
+    /* Handle "No audio" / "No video" selections: pass -an / -vn instead of codec flags */
+    if (g_strcmp0(audio, "No audio") == 0) {
+        g_ptr_array_add(argv, g_strdup("-an"));
+    } else if (audio) {
+        g_ptr_array_add(argv, g_strdup("-c:a"));
+        g_ptr_array_add(argv, g_strdup(audio));
+    }
+    if (g_strcmp0(video, "No video") == 0) {
+        g_ptr_array_add(argv, g_strdup("-vn"));
+    } else if (video) {
+        g_ptr_array_add(argv, g_strdup("-c:v"));
+        g_ptr_array_add(argv, g_strdup(video));
+    }
+    if (vfilter && g_strcmp0(video, "No video") != 0) {
+        g_ptr_array_add(argv, g_strdup("-vf"));
+        g_ptr_array_add(argv, g_strdup(vfilter));
+    }
+    if (afilter && g_strcmp0(audio, "No audio") != 0) {
+        g_ptr_array_add(argv, g_strdup("-af"));
+        g_ptr_array_add(argv, g_strdup(afilter));
+    }
+    /* Encoder specific options, only where the encoder has them */
+    EncoderCaps *ac = encoder_caps_lookup(audio);
+    EncoderCaps *vc = encoder_caps_lookup(video);
+    if ((ac && ac->experimental) || (vc && vc->experimental)) {
+        g_ptr_array_add(argv, g_strdup("-strict"));
+        g_ptr_array_add(argv, g_strdup("experimental"));
+    }
+    if (vc) {
+        if (preset && vc->preset_option) {
+            g_ptr_array_add(argv, g_strdup_printf("-%s", vc->preset_option));
+            g_ptr_array_add(argv, g_strdup(preset));
+        }
+        if (threads > 0 && vc->threads) {
+            g_ptr_array_add(argv, g_strdup("-threads"));
+            g_ptr_array_add(argv, g_strdup_printf("%d", threads));
+        }
+        if (tile_columns >= 0 && vc->tiles) {
+            g_ptr_array_add(argv, g_strdup("-tile-columns"));
+            g_ptr_array_add(argv, g_strdup_printf("%d", tile_columns));
+        }
+        if (row_mt && vc->row_mt) {
+            g_ptr_array_add(argv, g_strdup("-row-mt"));
+            g_ptr_array_add(argv, g_strdup("1"));
+        }
+    }
+}
+
+/* Build the ffmpeg argv (NULL-terminated, owned strings) for one conversion */
+static GPtrArray *build_ffmpeg_argv(const char *input, const char *output, const char *audio, const char *video,
+                                    const char *vfilter, const char *afilter, const JobSettings *js)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup("ffmpeg"));
+    g_ptr_array_add(argv, g_strdup("-y")); /* overwrite output */
+    g_ptr_array_add(argv, g_strdup("-i"));
+    g_ptr_array_add(argv, g_strdup(input));
+    GPtrArray *late = g_ptr_array_new_with_free_func(g_free);
+    append_stream_maps(argv, late, media_info_for(input), output, audio, video, js);
+    append_encode_options(argv, audio, video, vfilter, afilter, js);
+    g_ptr_array_extend_and_steal(argv, late);
+    g_ptr_array_add(argv, g_strdup(output));
+    g_ptr_array_add(argv, NULL);
+    return argv;
+}
+
+/* GSpawnChildSetupFunc: runs in the child between fork and exec */
+static void child_setup_new_pgroup(gpointer user_data)
+{
+    setpgid(0, 0);
+}
+
+static void child_registry_add(GPid pid, const char *label)
+{
+    if (!child_registry)
+        child_registry = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    /* also set it from the parent so the group exists before we could signal it */
+    setpgid(pid, pid);
+    g_hash_table_insert(child_registry, GINT_TO_POINTER(pid), g_strdup(label));
+}
+
+/* Called once the child has been reaped. Its group is not signalled any
+ * more: with the leader gone the id may already belong to someone else. */
+static void child_registry_remove(GPid pid)
+{
+    if (child_registry)
+        g_hash_table_remove(child_registry, GINT_TO_POINTER(pid));
+}
+
+static void child_signal_group(GPid pid, int sig)
+{
+    if (killpg(pid, sig) != 0)
+        kill(pid, sig); /* setpgid may have lost the race with exec */
+}
+
+static gboolean child_kill_escalate_cb(gpointer user_data)
+{
+    GPid pid = GPOINTER_TO_INT(user_data);
+    if (child_registry && g_hash_table_contains(child_registry, user_data)) {
+        g_warning("pid %d ignored SIGTERM, sending SIGKILL", pid);
+        child_signal_group(pid, SIGKILL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Ask a child tree to exit (ffmpeg finalizes its output on SIGTERM) and
+ * force it after CHILD_KILL_GRACE_SECONDS if it is still registered. */
+static void child_terminate(GPid pid)
+{
+    child_signal_group(pid, SIGTERM);
+    g_timeout_add_seconds(CHILD_KILL_GRACE_SECONDS, child_kill_escalate_cb, GINT_TO_POINTER(pid));
+}
+
+static void child_registry_foreach_signal(int sig)
+{
+    if (!child_registry) return;
+    GHashTableIter it;
+    gpointer key;
+    g_hash_table_iter_init(&it, child_registry);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        if (sig == SIGTERM)
+            child_terminate(GPOINTER_TO_INT(key));
+        else
+            child_signal_group(GPOINTER_TO_INT(key), sig);
+    }
+}
+
+/* Memory admission: each batch job gets an estimate from its resolution and
+ * encoder; a new worker only starts when MemAvailable minus a safety reserve
+ * minus the not-yet-used part of running estimates covers it. Observed peak
+ * RSS of finished jobs refines the per-encoder model. */
+typedef struct {
+    const char *encoder;
+    gdouble bytes_per_pixel; /* resident bytes per source pixel */
+} EncoderMemory;
+
+static const EncoderMemory encoder_memory[] = {
+    {"libx264", 150.0},
+    {"libx265", 300.0},
+    {"libvpx-vp9", 120.0},
+    {"libaom-av1", 500.0},
+    {"libsvtav1", 600.0},
+    {"librav1e", 350.0},
+    {NULL, 0.0}
+};
+
+#define MEM_BASE_BYTES (80 * 1024 * 1024)       /* demux/decode/mux baseline */
+#define MEM_RESERVE_BYTES (512 * 1024 * 1024)   /* never plan into the last 512 MiB */
+
+typedef struct {
+    gdouble value;   /* bytes per pixel (video) or bytes (audio/copy) */
+    guint samples;
+} MemModel;
+
+static GHashTable *mem_model = NULL; /* key -> MemModel* */
+
+/* Read a "<Key>: <n> kB" line from a /proc status-style file; -1 if missing */
+static gint64 read_proc_kb(const char *file, const char *key)
+{
+    gchar *contents = NULL;
+    if (!g_file_get_contents(file, &contents, NULL, NULL)) return -1;
+    gint64 val = -1;
+    const char *p = strstr(contents, key);
+    if (p) val = g_ascii_strtoll(p + strlen(key), NULL, 10) * 1024;
+    g_free(contents);
+    return val;
+}
+
+static gint64 mem_available_bytes(void)
+{
+    return read_proc_kb("/proc/meminfo", "MemAvailable:");
+}
+
+/* User + system time of a process in seconds, -1 if it is gone */
+static gdouble read_proc_cpu_seconds(GPid pid)
+{
+    gchar *file = g_strdup_printf("/proc/%d/stat", pid);
+    gchar *contents = NULL;
+    gdouble seconds = -1;
+    if (g_file_get_contents(file, &contents, NULL, NULL)) {
+        /* the command name may contain spaces; fields restart after ')' */
+        const char *p = strrchr(contents, ')');
+        gchar **fields = g_strsplit(p ? p + 2 : "", " ", -1);
+        /* utime and stime are fields 14 and 15 */
+        if (g_strv_length(fields) > 12)
+            seconds = (g_ascii_strtod(fields[11], NULL) + g_ascii_strtod(fields[12], NULL)) / sysconf(_SC_CLK_TCK);
+        g_strfreev(fields);
+    }
+    g_free(contents);
+    g_free(file);
+    return seconds;
+}
+
+/* Key used by the memory model: the video encoder for video work, or the
+ * audio encoder when only audio is encoded (or video is copied). */
+static gchar *mem_model_key(const char *audio, const char *video, gint64 pixels)
+{
+    if (pixels > 0 && video && g_strcmp0(video, "No video") != 0 && g_strcmp0(video, "copy") != 0)
+        return g_strdup(video);
+    return g_strdup_printf("audio:%s", audio ? audio : "none");
+}
+
+static gint64 estimate_job_memory(const char *key, gint64 pixels)
+{
+    MemModel *m = mem_model ? g_hash_table_lookup(mem_model, key) : NULL;
+    if (!g_str_has_prefix(key, "audio:")) {
+        gdouble bpp = 100.0;
+        for (int i = 0; encoder_memory[i].encoder != NULL; i++) {
+            if (g_strcmp0(encoder_memory[i].encoder, key) == 0) {
+                bpp = encoder_memory[i].bytes_per_pixel;
+                break;
+            }
+        }
+        /* learned values replace the table, with 15% margin for variance */
+        if (m && m->samples > 0) bpp = m->value * 1.15;
+        return MEM_BASE_BYTES + (gint64)(bpp * pixels);
+    }
+    if (m && m->samples > 0) return (gint64)(m->value * 1.15);
+    return MEM_BASE_BYTES;
+}
+
+static void mem_model_learn(const FfmpegWorker *w)
+{
+    if (!w->mem_key || w->peak_rss <= 0) return; /* too short to be sampled */
+    if (!mem_model)
+        mem_model = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    MemModel *m = g_hash_table_lookup(mem_model, w->mem_key);
+    if (!m) {
+        m = g_new0(MemModel, 1);
+        g_hash_table_insert(mem_model, g_strdup(w->mem_key), m);
+    }
+    gdouble observed;
+    if (g_str_has_prefix(w->mem_key, "audio:") || w->pixels <= 0)
+        observed = (gdouble)w->peak_rss;
+    else
+        observed = (gdouble)MAX(w->peak_rss - MEM_BASE_BYTES, 0) / (gdouble)w->pixels;
+    /* exponential moving average, but never forget a larger peak entirely */
+    m->value = m->samples == 0 ? observed : MAX(0.7 * m->value + 0.3 * observed, observed * 0.9);
+    m->samples++;
+}
+
+/* TRUE if a job needing `estimate` bytes fits next to the running workers.
+ * With nothing running we always admit, so a single huge job cannot stall. */
+static gboolean mem_admit(gint64 estimate)
+{
+    if (!workers || workers->len == 0) return TRUE;
+    gint64 avail = mem_available_bytes();
+    if (avail < 0) return TRUE; /* no /proc/meminfo: behave as before */
+    gint64 committed = 0;
+    for (guint i = 0; i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        committed += MAX(w->mem_estimate - w->rss, 0);
+    }
+    return estimate <= avail - MEM_RESERVE_BYTES - committed;
+}
+
+/* Output size estimation and free-space admission. A job's output size is
+ * predicted from its probed duration: stream copies keep the source bit
+ * rate, encoders use the rate observed on earlier jobs with the same
+ * settings (per pixel for video) or a typical default rate. Before a job
+ * starts, its estimate plus what running jobs on the same file system are
+ * still expected to write must fit into the free space minus a margin. */
+typedef struct {
+    const char *encoder;
+    gdouble kbps;        /* typical default-quality rate; video at 1080p */
+} EncoderBitrate;
+
+static const EncoderBitrate encoder_bitrates[] = {
+    {"libx264", 5000}, {"libx265", 2500}, {"libvpx-vp9", 2500}, {"libaom-av1", 2000},
+    {"libsvtav1", 2000}, {"mpeg4", 6000}, {"libtheora", 6000},
+    {"aac", 128}, {"libmp3lame", 128}, {"mp3", 128}, {"libopus", 96}, {"opus", 96},
+    {"libvorbis", 112}, {"flac", 900}, {"ac3", 192}, {"pcm_s16le", 1411},
+    {NULL, 0}
+};
+
+#define SIZE_DEFAULT_VIDEO_KBPS 5000
+#define SIZE_DEFAULT_AUDIO_KBPS 192
+#define SIZE_CONTAINER_OVERHEAD 1.02
+#define FREE_SPACE_MARGIN ((gint64)256 * 1024 * 1024)
+
+typedef struct {
+    gdouble value;   /* bytes per second, per pixel when video is encoded */
+    guint samples;
+} SizeModel;
+
+static GHashTable *size_model = NULL; /* "video|audio" -> SizeModel* */
+static gchar *space_held_path = NULL;  /* job last held for space, logged once */
+
+static gdouble encoder_kbps(const char *encoder, gdouble fallback)
+{
+    for (int i = 0; encoder_bitrates[i].encoder; i++)
+        if (g_strcmp0(encoder_bitrates[i].encoder, encoder) == 0) return encoder_bitrates[i].kbps;
+    return fallback;
+}
+
+/* Which streams a job writes and whether any of them is copied */
+static void job_streams(const MediaInfo *mi, const char *audio, const char *video,
+                        gboolean *has_audio, gboolean *has_video, gboolean *copies)
+{
+    *has_audio = (!mi->probed || mi->audio_codec) && audio && g_strcmp0(audio, "No audio") != 0;
+    *has_video = (!mi->probed || mi->video_codec) && video && g_strcmp0(video, "No video") != 0;
+    *copies = (*has_audio && g_strcmp0(audio, "copy") == 0) || (*has_video && g_strcmp0(video, "copy") == 0);
+}
+
+static gint64 estimate_output_bytes(const MediaInfo *mi, const char *audio, const char *video)
+{
+    if (!mi->probed || mi->duration <= 0) return mi->size; /* nothing better than the input size */
+    gboolean has_audio, has_video, copies;
+    job_streams(mi, audio, video, &has_audio, &has_video, &copies);
+    gint64 pixels = has_video && mi->width > 0 ? (gint64)mi->width * mi->height : 0;
+    if (!copies && size_model) {
+        gchar *key = g_strdup_printf("%s|%s", has_video ? video : "", has_audio ? audio : "");
+        SizeModel *m = g_hash_table_lookup(size_model, key);
+        g_free(key);
+        if (m) return (gint64)(m->value * mi->duration * (pixels > 0 ? pixels : 1));
+    }
+    gdouble bytes_per_sec = 0;
+    gdouble source = mi->bit_rate > 0 ? mi->bit_rate / 8.0 : mi->size / mi->duration;
+    if (has_video) {
+        if (g_strcmp0(video, "copy") == 0)
+            return (gint64)(source * mi->duration * SIZE_CONTAINER_OVERHEAD); /* audio is small next to it */
+        gdouble scale = pixels > 0 ? pixels / (1920.0 * 1080.0) : 1.0;
+        bytes_per_sec += encoder_kbps(video, SIZE_DEFAULT_VIDEO_KBPS) * 125.0 * scale;
+    }
+    if (has_audio) {
+        if (g_strcmp0(audio, "copy") == 0)
+            bytes_per_sec += has_video ? SIZE_DEFAULT_AUDIO_KBPS * 125.0 : source;
+        else
+            bytes_per_sec += encoder_kbps(audio, SIZE_DEFAULT_AUDIO_KBPS) * 125.0;
+    }
+    return (gint64)(bytes_per_sec * mi->duration * SIZE_CONTAINER_OVERHEAD);
+}
+
+/* Refine the rate for these settings from a finished job's real output */
+static void size_model_learn(const MediaInfo *mi, const char *audio, const char *video, const char *output)
+{
+    GStatBuf st;
+    if (!mi->probed || mi->duration <= 0 || g_stat(output, &st) != 0 || st.st_size <= 0) return;
+    gboolean has_audio, has_video, copies;
+    job_streams(mi, audio, video, &has_audio, &has_video, &copies);
+    if (copies) return; /* copies follow the source, nothing to learn */
+    gint64 pixels = has_video && mi->width > 0 ? (gint64)mi->width * mi->height : 0;
+    gdouble observed = st.st_size / mi->duration / (pixels > 0 ? pixels : 1);
+    if (!size_model)
+        size_model = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar *key = g_strdup_printf("%s|%s", has_video ? video : "", has_audio ? audio : "");
+    SizeModel *m = g_hash_table_lookup(size_model, key);
+    if (!m) {
+        m = g_new0(SizeModel, 1);
+        g_hash_table_insert(size_model, key, m);
+    } else {
+        g_free(key);
+    }
+    /* running mean over the first jobs, then an exponential average */
+    m->samples++;
+    gdouble weight = m->samples < 8 ? 1.0 / m->samples : 0.125;
+    m->value += (observed - m->value) * weight;
+}
+
+/* Throughput history: wall and CPU time of converted batch jobs, kept across
+ * runs as JSON lines in history.jsonl so durations can be predicted before a
+ * job starts. A job's work is its media duration, scaled by pixel rate
+ * relative to 1080p30 when video is encoded. Per encoder (and preset, once
+ * it has samples of its own) CPU seconds are fitted as a linear function of
+ * work; CPU per wall second of a job running alone turns that into wall
+ * time for a given number of jobs side by side. */
+#define HISTORY_MAX_RECORDS 5000  /* the oldest are dropped beyond a quarter more */
+#define HISTORY_MIN_SAMPLES 3
+#define HISTORY_REFERENCE_PIXEL_RATE (1920.0 * 1080.0 * 30.0)
+
+typedef struct {
+    gchar *key;       /* mem_model_key: video encoder, or "audio:<encoder>" */
+    gchar *preset;    /* NULL for the encoder's default */
+    gint width;
+    gint height;
+    gdouble fps;
+    gdouble duration; /* media seconds */
+    gdouble wall;
+    gdouble cpu;
+    gdouble parallel; /* batch jobs running on average, this one included */
+    gint64 time;      /* when it finished, seconds since the epoch */
+} HistoryRecord;
+
+typedef struct {
+    gdouble base;     /* CPU seconds of any job (start-up, probing) */
+    gdouble rate;     /* CPU seconds per unit of work */
+    gdouble util;     /* CPU seconds per wall second of a job running alone */
+} ThroughputFit;
+
+static GPtrArray *history = NULL;          /* HistoryRecord*, oldest first */
+static GHashTable *throughput_fits = NULL; /* "key|preset" or "key" -> ThroughputFit*, NULL if too few samples */
+
+static gchar *history_path(void)
+{
+#if GLIB_CHECK_VERSION(2, 72, 0)
+    return g_build_filename(g_get_user_state_dir(), "baconverter", "history.jsonl", NULL);
+#else
+    return g_build_filename(g_get_user_cache_dir(), "baconverter", "history.jsonl", NULL);
+#endif
+}
+
+static void history_record_free(gpointer data)
+{
+    HistoryRecord *r = data;
+    g_free(r->key);
+    g_free(r->preset);
+    g_free(r);
+}
+
+static gdouble history_work(const char *key, gint width, gint height, gdouble fps, gdouble duration)
+{
+    if (g_str_has_prefix(key, "audio:") || width <= 0 || height <= 0) return duration;
+    return duration * width * height * (fps > 0 ? fps : 30.0) / HISTORY_REFERENCE_PIXEL_RATE;
+}
+
+static gchar *history_record_to_line(const HistoryRecord *r)
+{
+    JsonBuilder *b = json_builder_new();
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "key");
+    json_builder_add_string_value(b, r->key);
+    if (r->preset) {
+        json_builder_set_member_name(b, "preset");
+        json_builder_add_string_value(b, r->preset);
+    }
+    json_builder_set_member_name(b, "width");
+    json_builder_add_int_value(b, r->width);
+    json_builder_set_member_name(b, "height");
+    json_builder_add_int_value(b, r->height);
+    json_builder_set_member_name(b, "fps");
+    json_builder_add_double_value(b, r->fps);
+    json_builder_set_member_name(b, "duration");
+    json_builder_add_double_value(b, r->duration);
+    json_builder_set_member_name(b, "wall");
+    json_builder_add_double_value(b, r->wall);
+    json_builder_set_member_name(b, "cpu");
+    json_builder_add_double_value(b, r->cpu);
+    json_builder_set_member_name(b, "parallel");
+    json_builder_add_double_value(b, r->parallel);
+    json_builder_set_member_name(b, "time");
+    json_builder_add_int_value(b, r->time);
+    json_builder_end_object(b);
+    JsonGenerator *gen = json_generator_new();
+    JsonNode *root = json_builder_get_root(b);
+    json_generator_set_root(gen, root);
+    gchar *line = json_generator_to_data(gen, NULL);
+    json_node_unref(root);
+    g_object_unref(gen);
+    g_object_unref(b);
+    return line;
+}
+
+static HistoryRecord *history_record_from_line(JsonParser *parser, const char *line)
+{
+    if (!json_parser_load_from_data(parser, line, -1, NULL)) return NULL;
+    JsonNode *root = json_parser_get_root(parser);
+    JsonObject *o = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+    const char *key = o ? json_object_get_string_member_with_default(o, "key", NULL) : NULL;
+    if (!key) return NULL;
+    HistoryRecord *r = g_new0(HistoryRecord, 1);
+    r->key = g_strdup(key);
+    r->preset = g_strdup(json_object_get_string_member_with_default(o, "preset", NULL));
+    r->width = (gint)json_object_get_int_member_with_default(o, "width", 0);
+    r->height = (gint)json_object_get_int_member_with_default(o, "height", 0);
+    r->fps = json_object_get_double_member_with_default(o, "fps", 0);
+    r->duration = json_object_get_double_member_with_default(o, "duration", 0);
+    r->wall = json_object_get_double_member_with_default(o, "wall", 0);
+    r->cpu = json_object_get_double_member_with_default(o, "cpu", 0);
+    r->parallel = json_object_get_double_member_with_default(o, "parallel", 1);
+    r->time = json_object_get_int_member_with_default(o, "time", 0);
+    if (r->duration <= 0 || r->wall <= 0 || r->cpu <= 0) {
+        history_record_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* Rewrite the file with the records in memory, after trimming */
+static void history_save(void)
+{
+    gchar *path = history_path();
+    GString *data = g_string_new(NULL);
+    for (guint i = 0; i < history->len; i++) {
+        gchar *line = history_record_to_line(g_ptr_array_index(history, i));
+        g_string_append(data, line);
+        g_string_append_c(data, '\n');
+        g_free(line);
+    }
+    GError *error = NULL;
+    if (!g_file_set_contents(path, data->str, data->len, &error)) {
+        g_warning("Cannot write %s: %s", path, error->message);
+        g_error_free(error);
+    }
+    g_string_free(data, TRUE);
+    g_free(path);
+}
+
+/* Runs in the discovery thread */
+static void history_load(void)
+{
+    history = g_ptr_array_new_with_free_func(history_record_free);
+    gchar *path = history_path();
+    gchar *contents = NULL;
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        JsonParser *parser = json_parser_new();
+        for (gint i = 0; lines[i]; i++) {
+            HistoryRecord *r = *lines[i] ? history_record_from_line(parser, lines[i]) : NULL;
+            if (r) g_ptr_array_add(history, r);
+        }
+        g_object_unref(parser);
+        g_strfreev(lines);
+    }
+    g_free(contents);
+    g_free(path);
+}
+
+static void history_append(HistoryRecord *r)
+{
+    g_ptr_array_add(history, r);
+    if (throughput_fits) g_hash_table_remove_all(throughput_fits);
+    if (history->len > HISTORY_MAX_RECORDS + HISTORY_MAX_RECORDS / 4) {
+        g_ptr_array_remove_range(history, 0, history->len - HISTORY_MAX_RECORDS);
+        history_save();
+        return;
+    }
+    gchar *path = history_path();
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    FILE *f = g_fopen(path, "a");
+    if (f) {
+        gchar *line = history_record_to_line(r);
+        fprintf(f, "%s\n", line);
+        fclose(f);
+        g_free(line);
+    } else {
+        g_warning("cannot write %s: %s", path, g_strerror(errno));
+    }
+    g_free(dir);
+    g_free(path);
+}
+
+/* Remember how long a converted batch job took. CPU time is sampled from
+ * /proc while the job runs and extrapolated over its last second or so;
+ * jobs converted in-process (or too short to sample) count their wall time. */
+static void history_record_job(const FfmpegWorker *w, const BatchJob *job)
+{
+    if (!history || !w->mem_key || !job || !job->info.probed || job->info.duration <= 0 || w->started <= 0) return;
+    gdouble wall = (g_get_monotonic_time() - w->started) / (gdouble)G_USEC_PER_SEC;
+    gdouble sampled = (w->cpu_sampled - w->started) / (gdouble)G_USEC_PER_SEC;
+    if (wall <= 0) return;
+    HistoryRecord *r = g_new0(HistoryRecord, 1);
+    r->key = g_strdup(w->mem_key);
+    r->preset = g_strdup(job->settings ? job->settings->preset : NULL);
+    r->width = job->info.width;
+    r->height = job->info.height;
+    r->fps = job->info.fps;
+    r->duration = job->info.duration;
+    r->wall = wall;
+    r->cpu = w->cpu_sampled > 0 && sampled >= 1.0 && w->cpu_seconds > 0 ? w->cpu_seconds * wall / sampled : wall;
+    r->parallel = w->parallel_samples > 0 ? (gdouble)w->parallel_sum / w->parallel_samples : 1.0;
+    r->time = g_get_real_time() / G_USEC_PER_SEC;
+    history_append(r);
+}
+
+/* Least-squares fit of CPU seconds against work over the records of `key`,
+ * only those with `preset` unless `any_preset`. NULL with too few samples. */
+static ThroughputFit *throughput_fit_new(const char *key, const char *preset, gboolean any_preset)
+{
+    gdouble n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    gdouble alone = 0, alone_n = 0, busiest = 0;
+    for (guint i = 0; i < history->len; i++) {
+        const HistoryRecord *r = g_ptr_array_index(history, i);
+        if (g_strcmp0(r->key, key) != 0 || (!any_preset && g_strcmp0(r->preset, preset) != 0)) continue;
+        gdouble x = history_work(r->key, r->width, r->height, r->fps, r->duration);
+        n++;
+        sx += x;
+        sy += r->cpu;
+        sxx += x * x;
+        sxy += x * r->cpu;
+        if (r->parallel < 1.5) {
+            alone += r->cpu / r->wall;
+            alone_n++;
+        }
+        busiest = MAX(busiest, r->cpu / r->wall);
+    }
+    if (n < HISTORY_MIN_SAMPLES) return NULL;
+    ThroughputFit *f = g_new0(ThroughputFit, 1);
+    gdouble denom = n * sxx - sx * sx;
+    if (denom > 1e-9 * n * sxx) {
+        f->rate = (n * sxy - sx * sy) / denom;
+        f->base = (sy - f->rate * sx) / n;
+    }
+    /* all of about the same length, or a negative start-up cost: through the origin */
+    if (denom <= 1e-9 * n * sxx || f->base < 0 || f->rate < 0) {
+        f->base = 0;
+        f->rate = sxx > 0 ? sxy / sxx : 0;
+    }
+    /* jobs that shared the machine used less than one alone could */
+    f->util = alone_n > 0 ? alone / alone_n : busiest;
+    f->util = CLAMP(f->util, 0.05, (gdouble)g_get_num_processors());
+    return f;
+}
+
+static const ThroughputFit *throughput_fit(const char *key, const char *preset, gboolean any_preset)
+{
+    if (!throughput_fits)
+        throughput_fits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar *name = any_preset ? g_strdup(key) : g_strdup_printf("%s|%s", key, preset ? preset : "");
+    gpointer fit;
+    if (g_hash_table_lookup_extended(throughput_fits, name, NULL, &fit)) {
+        g_free(name);
+        return fit;
+    }
+    fit = throughput_fit_new(key, preset, any_preset);
+    g_hash_table_insert(throughput_fits, name, fit);
+    return fit;
+}
+
+/* Expected CPU seconds of a job and its CPU use when running alone; FALSE
+ * when its encoder has no history yet. */
+static gboolean history_predict(const char *key, const char *preset, const MediaInfo *mi, gdouble *cpu, gdouble *util)
+{
+    if (!history || !mi->probed || mi->duration <= 0) return FALSE;
+    const ThroughputFit *f = throughput_fit(key, preset, FALSE);
+    if (!f) f = throughput_fit(key, NULL, TRUE);
+    if (!f) return FALSE;
+    *cpu = f->base + f->rate * history_work(key, mi->width, mi->height, mi->fps, mi->duration);
+    *util = f->util;
+    return TRUE;
+}
+
+/* Wall seconds of a job with `concurrency` jobs sharing the processors */
+static gdouble history_wall(gdouble cpu, gdouble util, guint concurrency)
+{
+    gdouble share = (gdouble)g_get_num_processors() / MAX(concurrency, 1);
+    return cpu / MIN(util, share);
+}
+
+/* File system of the directory `output` is written to; free bytes in *avail */
+static gboolean output_fs(const char *output, dev_t *dev, gint64 *avail)
+{
+    gchar *dir = g_path_get_dirname(output);
+    GStatBuf st;
+    struct statvfs vfs;
+    gboolean ok = g_stat(dir, &st) == 0 && statvfs(dir, &vfs) == 0;
+    g_free(dir);
+    if (!ok) return FALSE;
+    *dev = st.st_dev;
+    *avail = (gint64)vfs.f_bavail * (gint64)vfs.f_frsize;
+    return TRUE;
+}
+
+/* Bytes a running worker has written so far */
+static gint64 worker_written_bytes(const FfmpegWorker *w)
+{
+    GPtrArray *outs = w->group_outputs ? w->group_outputs : w->fanout_outputs;
+    gint64 total = 0;
+    GStatBuf st;
+    if (!outs)
+        return g_stat(w->output, &st) == 0 ? st.st_size : 0;
+    for (guint i = 0; i < outs->len; i++)
+        if (g_stat(g_ptr_array_index(outs, i), &st) == 0) total += st.st_size;
+    return total;
+}
+
+/* Can a job writing about `needed` bytes to `output` start now? Running jobs
+ * on the same file system keep the unwritten part of their estimate
+ * reserved. *others tells whether any of them could still free space by
+ * finishing (a held job waits for them). The device is returned in *dev. */
+static gboolean space_admit(const char *output, gint64 needed, dev_t *dev, gboolean *others, gint64 *avail)
+{
+    *others = FALSE;
+    if (!output_fs(output, dev, avail)) return TRUE; /* cannot tell: do not hold */
+    gint64 reserved = 0;
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (!w->batch || w->out_dev != *dev) continue;
+        reserved += MAX(w->out_estimate - worker_written_bytes(w), 0);
+        *others = TRUE;
+    }
+    return needed <= *avail - reserved - FREE_SPACE_MARGIN;
+}
+
+typedef struct {
+    gchar *dir;
+    gint64 needed;
+    gint64 avail;
+    guint jobs;
+} DestSpace;
+
+static void dest_space_free(gpointer data)
+{
+    DestSpace *d = data;
+    g_free(d->dir);
+    g_free(d);
+}
+
+/* Sum the estimates of the pending jobs per destination file system and warn
+ * about those that will run out of space */
+static void batch_space_preflight(guint from)
+{
+    GHashTable *dests = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, dest_space_free);
+    for (guint i = from; i < batch_files->len; i++) {
+        const char *path = g_ptr_array_index(batch_files, i);
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+        if (!job || !job->settings) continue;
+        gchar *out = job_output_path(path, job->settings);
+        dev_t dev;
+        gint64 avail;
+        if (output_fs(out, &dev, &avail)) {
+            gint64 key = (gint64)dev;
+            DestSpace *d = g_hash_table_lookup(dests, &key);
+            if (!d) {
+                d = g_new0(DestSpace, 1);
+                d->dir = g_path_get_dirname(out);
+                d->avail = avail;
+                g_hash_table_insert(dests, g_memdup2(&key, sizeof(key)), d);
+            }
+            d->needed += estimate_output_bytes(&job->info, job->settings->audio, job->settings->video);
+            d->jobs++;
+        }
+        g_free(out);
+    }
+    GHashTableIter it;
+    DestSpace *d;
+    g_hash_table_iter_init(&it, dests);
+    while (g_hash_table_iter_next(&it, NULL, (gpointer *)&d)) {
+        if (d->needed <= d->avail - FREE_SPACE_MARGIN) continue;
+        gchar *need = g_format_size(d->needed);
+        gchar *free_str = g_format_size(MAX(d->avail, 0));
+        gchar *msg = g_strdup_printf("Warning: the %u jobs writing to the file system of %s need about %s, "
+                                     "but only %s is free. Jobs that do not fit will wait for running jobs "
+                                     "and are skipped when nothing else is running.\n",
+                                     d->jobs, d->dir, need, free_str);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+        g_free(need);
+        g_free(free_str);
+    }
+    g_hash_table_destroy(dests);
+}
+
+/* System pressure snapshot. PSI values are the "some avg10" percentages
+ * and stay at -1 on kernels without /proc/pressure. */
+typedef struct {
+    gdouble load1;       /* 1-minute load average per CPU */
+    gdouble cpu_some;
+    gdouble io_some;
+    gdouble mem_some;
+} SystemPressure;
+
+static gdouble read_psi_some_avg10(const char *resource)
+{
+    gchar *file = g_strdup_printf("/proc/pressure/%s", resource);
+    gchar *contents = NULL;
+    gdouble val = -1.0;
+    if (g_file_get_contents(file, &contents, NULL, NULL)) {
+        const char *p = strstr(contents, "some avg10=");
+        if (p) val = g_ascii_strtod(p + strlen("some avg10="), NULL);
+    }
+    g_free(contents);
+    g_free(file);
+    return val;
+}
+
+static void read_system_pressure(SystemPressure *sp)
+{
+    gchar *contents = NULL;
+    sp->load1 = 0.0;
+    if (g_file_get_contents("/proc/loadavg", &contents, NULL, NULL))
+        sp->load1 = g_ascii_strtod(contents, NULL) / MAX(g_get_num_processors(), 1);
+    g_free(contents);
+    sp->cpu_some = read_psi_some_avg10("cpu");
+    sp->io_some = read_psi_some_avg10("io");
+    sp->mem_some = read_psi_some_avg10("memory");
+}
+
+/* Thresholds (percent of time stalled / load per CPU). The gaps between
+ * grow, shrink and spike levels provide the hysteresis. */
+#define ADAPT_SPIKE_MEM 20.0
+#define ADAPT_SPIKE_IO 40.0
+#define ADAPT_SPIKE_CPU 80.0
+#define ADAPT_SHRINK_LOAD 1.2
+#define ADAPT_SHRINK_CPU 40.0
+#define ADAPT_GROW_LOAD 0.7
+#define ADAPT_GROW_PSI 10.0
+#define ADAPT_GROW_SAMPLES 3
+
+static guint batch_worker_limit(void)
+{
+    return batch_adaptive ? batch_target_workers : batch_max_workers;
+}
+
+static gboolean adaptive_sample_cb(gpointer user_data)
+{
+    if (!batch_running || !batch_adaptive) {
+        adaptive_source = 0;
+        batch_admission_paused = FALSE;
+        return G_SOURCE_REMOVE;
+    }
+    SystemPressure sp;
+    read_system_pressure(&sp);
+    guint old_target = batch_target_workers;
+    gboolean was_paused = batch_admission_paused;
+
+    gboolean spike = sp.mem_some > ADAPT_SPIKE_MEM || sp.io_some > ADAPT_SPIKE_IO || sp.cpu_some > ADAPT_SPIKE_CPU;
+    gboolean calm_spike = sp.mem_some < ADAPT_SPIKE_MEM / 2 && sp.io_some < ADAPT_SPIKE_IO / 2 && sp.cpu_some < ADAPT_SPIKE_CPU / 2;
+    gboolean busy = sp.load1 > ADAPT_SHRINK_LOAD || sp.cpu_some > ADAPT_SHRINK_CPU;
+    gboolean idle = sp.load1 < ADAPT_GROW_LOAD && sp.cpu_some < ADAPT_GROW_PSI && sp.io_some < ADAPT_GROW_PSI && sp.mem_some < ADAPT_GROW_PSI / 2;
+
+    if (spike)
+        batch_admission_paused = TRUE;
+    else if (batch_admission_paused && calm_spike)
+        batch_admission_paused = FALSE;
+
+    if (adaptive_cooldown > 0)
+        adaptive_cooldown--;
+    adaptive_calm_samples = idle ? adaptive_calm_samples + 1 : 0;
+    if ((spike || busy) && adaptive_cooldown == 0 && batch_target_workers > batch_min_workers) {
+        batch_target_workers--;
+        adaptive_cooldown = 2;
+    } else if (adaptive_calm_samples >= ADAPT_GROW_SAMPLES && adaptive_cooldown == 0 && batch_target_workers < batch_max_workers) {
+        batch_target_workers++;
+        adaptive_calm_samples = 0;
+        adaptive_cooldown = 2;
+    }
+
+    if (old_target != batch_target_workers || was_paused != batch_admission_paused) {
+        gchar *msg = g_strdup_printf("Adaptive: %u worker(s)%s (load/cpu %.2f, psi cpu %.1f io %.1f mem %.1f)\n",
+                                     batch_target_workers, batch_admission_paused ? ", admission paused" : "",
+                                     sp.load1, sp.cpu_some, sp.io_some, sp.mem_some);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+    }
+    if (!batch_admission_paused)
+        process_next_in_batch();
+    return G_SOURCE_CONTINUE;
+}
+
+static void adaptive_start(void)
+{
+    if (!batch_adaptive || adaptive_source) return;
+    batch_target_workers = CLAMP(batch_target_workers, batch_min_workers, batch_max_workers);
+    adaptive_calm_samples = 0;
+    adaptive_cooldown = 0;
+    adaptive_source = g_timeout_add_seconds(5, adaptive_sample_cb, NULL);
+}
+
+static void worker_free(FfmpegWorker *w);
+static void worker_finished(FfmpegWorker *w);
+static void batch_job_exited(FfmpegWorker *w, gboolean ok, gboolean killed);
+
+/* Per-job logs. Each worker's output goes to its own file under
+ * $XDG_STATE_HOME/baconverter/logs through a stdio buffer, so nothing is
+ * lost on exit and parallel jobs do not interleave. Batch runs get a
+ * directory each. The log view shows single conversions live; of a batch it
+ * only shows the job selected in the batch list, read from its file when it
+ * is selected and followed from then on. When a new batch starts, the logs
+ * of earlier batches are gzipped in the background and the oldest logs are
+ * deleted above LOG_KEEP_BYTES. */
+#define LOG_BUFFER_BYTES (64 * 1024)
+#define LOG_ROTATE_BYTES ((gint64)8 * 1024 * 1024)  /* per job; the previous part is kept as .1 */
+#define LOG_KEEP_BYTES ((gint64)256 * 1024 * 1024)
+#define LOG_VIEW_BYTES (256 * 1024)                 /* tail of a log loaded into the view */
+
+static gchar *batch_log_dir = NULL;  /* directory of the current batch run */
+static gchar *log_followed = NULL;   /* batch input whose output the view shows */
+
+static gchar *logs_root(void)
+{
+#if GLIB_CHECK_VERSION(2, 72, 0)
+    return g_build_filename(g_get_user_state_dir(), "baconverter", "logs", NULL);
+#else
+    return g_build_filename(g_get_user_cache_dir(), "baconverter", "logs", NULL);
+#endif
+}
+
+static gchar *log_timestamp(void)
+{
+    GDateTime *now = g_date_time_new_now_local();
+    gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    g_date_time_unref(now);
+    return stamp;
+}
+
+static void worker_log_open(FfmpegWorker *w)
+{
+    gchar *dir = w->batch && batch_log_dir ? g_strdup(batch_log_dir) : logs_root();
+    gchar *base = g_path_get_basename(w->input ? w->input : "conversion");
+    gchar *name;
+    BatchJob *job = w->batch && batch_jobs ? g_hash_table_lookup(batch_jobs, w->input) : NULL;
+    gchar *job_dir = job && job->log_path ? g_path_get_dirname(job->log_path) : NULL;
+    if (job_dir && g_strcmp0(job_dir, batch_log_dir) == 0) {
+        /* a retry appends to the log of the earlier attempt */
+        name = g_path_get_basename(job->log_path);
+    } else if (w->batch && batch_log_dir) {
+        /* inputs of the same name from different folders get their own logs */
+        gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, w->input ? w->input : "", -1);
+        name = g_strdup_printf("%s-%.8s.log", base, hash);
+        g_free(hash);
+    } else {
+        gchar *stamp = log_timestamp();
+        name = g_strdup_printf("%s-%s.log", stamp, base);
+        g_free(stamp);
+    }
+    w->log_path = g_build_filename(dir, name, NULL);
+    if (g_mkdir_with_parents(dir, 0700) == 0)
+        w->log = g_fopen(w->log_path, "a");
+    g_free(job_dir);
+    g_free(name);
+    g_free(base);
+    g_free(dir);
+    if (!w->log) {
+        g_warning("Cannot write log %s: %s", w->log_path, g_strerror(errno));
+        w->log_failed = TRUE;
+        return;
+    }
+    setvbuf(w->log, NULL, _IOFBF, LOG_BUFFER_BYTES);
+    GStatBuf st;
+    w->log_bytes = g_stat(w->log_path, &st) == 0 ? st.st_size : 0;
+    if (w->command)
+        w->log_bytes += fprintf(w->log, "$ %s\n", w->command);
+    /* grouped runs share one log */
+    GPtrArray *inputs = w->group_inputs;
+    for (guint i = 0; w->batch && batch_jobs && i < (inputs ? inputs->len : 1); i++) {
+        BatchJob *job = g_hash_table_lookup(batch_jobs, inputs ? g_ptr_array_index(inputs, i) : w->input);
+        if (!job) continue;
+        g_free(job->log_path);
+        job->log_path = g_strdup(w->log_path);
+    }
+}
+
+/* Buffered append to the worker's log file. A log that grows past
+ * LOG_ROTATE_BYTES is moved to "<log>.1" and started over. */
+static void worker_log_write(FfmpegWorker *w, const char *text)
+{
+    if (!w->log && !w->log_failed) worker_log_open(w);
+    if (!w->log) return;
+    gsize len = strlen(text);
+    if (w->log_bytes + (gint64)len > LOG_ROTATE_BYTES) {
+        fclose(w->log);
+        gchar *old = g_strconcat(w->log_path, ".1", NULL);
+        g_rename(w->log_path, old);
+        g_free(old);
+        w->log = g_fopen(w->log_path, "w");
+        w->log_bytes = 0;
+        if (!w->log) {
+            w->log_failed = TRUE;
+            return;
+        }
+        setvbuf(w->log, NULL, _IOFBF, LOG_BUFFER_BYTES);
+    }
+    fwrite(text, 1, len, w->log);
+    w->log_bytes += len;
+}
+
+static gboolean worker_log_shown(const FfmpegWorker *w)
+{
+    if (!w->batch) return TRUE;
+    if (!log_followed) return FALSE;
+    if (w->group_inputs)
+        return g_ptr_array_find_with_equal_func(w->group_inputs, log_followed, g_str_equal, NULL);
+    return g_strcmp0(w->input, log_followed) == 0;
+}
+
+/* Show the log of batch input `path` and follow its output from now on.
+ * Only the last LOG_VIEW_BYTES of the file are loaded. */
+static void batch_log_show(const char *path)
+{
+    g_free(log_followed);
+    log_followed = g_strdup(path);
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    if (!job || !job->log_path) {
+        gchar *msg = g_strdup_printf("No log yet for %s\n", path);
+        gtk_text_buffer_set_text(log_buffer, msg, -1);
+        g_free(msg);
+        return;
+    }
+    /* a running job may still hold output in its stdio buffer */
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (w->log && g_strcmp0(w->log_path, job->log_path) == 0)
+            fflush(w->log);
+    }
+    GString *text = g_string_new(NULL);
+    FILE *f = g_fopen(job->log_path, "r");
+    if (f) {
+        g_string_append_printf(text, "Log of %s (%s)\n", path, job->log_path);
+        if (fseeko(f, 0, SEEK_END) == 0 && ftello(f) > LOG_VIEW_BYTES) {
+            fseeko(f, -LOG_VIEW_BYTES, SEEK_END);
+            g_string_append(text, "[...]\n");
+        } else {
+            rewind(f);
+        }
+        gchar buf[8192];
+        gsize n;
+        while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+            g_string_append_len(text, buf, n);
+        fclose(f);
+    } else {
+        gchar *gz = g_strconcat(job->log_path, ".gz", NULL);
+        g_string_append_printf(text, "The log of %s has been compressed to %s\n", path, gz);
+        g_free(gz);
+    }
+    gchar *valid = g_utf8_make_valid(text->str, text->len);
+    gtk_text_buffer_set_text(log_buffer, valid, -1);
+    g_free(valid);
+    g_string_free(text, TRUE);
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(log_buffer, &end);
+    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(log_text_view), &end, 0.0, FALSE, 0.0, 1.0);
+}
+
+static gboolean log_gzip(const char *path)
+{
+    gchar *gz = g_strconcat(path, ".gz", NULL);
+    GFile *src = g_file_new_for_path(path);
+    GFile *dst = g_file_new_for_path(gz);
+    GFileInputStream *in = g_file_read(src, NULL, NULL);
+    GFileOutputStream *out = in ? g_file_replace(dst, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, NULL) : NULL;
+    gboolean ok = FALSE;
+    if (out) {
+        GZlibCompressor *z = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+        GOutputStream *zout = g_converter_output_stream_new(G_OUTPUT_STREAM(out), G_CONVERTER(z));
+        ok = g_output_stream_splice(zout, G_INPUT_STREAM(in),
+                                    G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                    NULL, NULL) >= 0;
+        g_object_unref(zout);
+        g_object_unref(z);
+        g_object_unref(out);
+    }
+    if (in) g_object_unref(in);
+    if (ok) g_unlink(path);
+    else g_unlink(gz);
+    g_object_unref(src);
+    g_object_unref(dst);
+    g_free(gz);
+    return ok;
+}
+
+typedef struct {
+    gchar *path;
+    const char *stamp;  /* start time in the name, orders entries by age */
+    gint64 bytes;
+} LogEntry;
+
+static void log_entry_free(gpointer data)
+{
+    LogEntry *e = data;
+    g_free(e->path);
+    g_free(e);
+}
+
+static gint log_entry_older(gconstpointer a, gconstpointer b)
+{
+    const LogEntry *ea = *(LogEntry * const *)a;
+    const LogEntry *eb = *(LogEntry * const *)b;
+    return g_strcmp0(ea->stamp, eb->stamp);
+}
+
+/* Background housekeeping when batch `keep` starts: gzip the logs of
+ * earlier batch runs, then delete the oldest runs and single logs until the
+ * total is below LOG_KEEP_BYTES. */
+static gpointer logs_housekeeping_thread(gpointer data)
+{
+    gchar *keep = data;
+    gchar *root = logs_root();
+    GPtrArray *entries = g_ptr_array_new_with_free_func(log_entry_free);
+    gint64 total = 0;
+    GDir *dir = g_dir_open(root, 0, NULL);
+    const char *name;
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        gchar *path = g_build_filename(root, name, NULL);
+        GStatBuf st;
+        if (g_strcmp0(path, keep) == 0 || g_stat(path, &st) != 0) {
+            g_free(path);
+            continue;
+        }
+        LogEntry *e = g_new0(LogEntry, 1);
+        e->path = path;
+        e->stamp = g_str_has_prefix(path + strlen(root) + 1, "batch-") ? path + strlen(root) + 7 : path + strlen(root) + 1;
+        if (S_ISDIR(st.st_mode)) {
+            GDir *run = g_dir_open(path, 0, NULL);
+            const char *file;
+            while (run && (file = g_dir_read_name(run)) != NULL) {
+                gchar *log = g_build_filename(path, file, NULL);
+                if (g_str_has_prefix(name, "batch-") && !g_str_has_suffix(file, ".gz"))
+                    log_gzip(log);
+                gchar *gz = g_str_has_suffix(log, ".gz") ? g_strdup(log) : g_strconcat(log, ".gz", NULL);
+                GStatBuf fst;
+                if (g_stat(gz, &fst) == 0 || g_stat(log, &fst) == 0)
+                    e->bytes += fst.st_size;
+                g_free(gz);
+                g_free(log);
+            }
+            if (run) g_dir_close(run);
+        } else {
+            e->bytes = st.st_size;
+        }
+        total += e->bytes;
+        g_ptr_array_add(entries, e);
+    }
+    if (dir) g_dir_close(dir);
+    g_ptr_array_sort(entries, log_entry_older);
+    for (guint i = 0; i < entries->len && total > LOG_KEEP_BYTES; i++) {
+        LogEntry *e = g_ptr_array_index(entries, i);
+        if (g_file_test(e->path, G_FILE_TEST_IS_DIR)) {
+            GDir *run = g_dir_open(e->path, 0, NULL);
+            const char *file;
+            while (run && (file = g_dir_read_name(run)) != NULL) {
+                gchar *log = g_build_filename(e->path, file, NULL);
+                g_unlink(log);
+                g_free(log);
+            }
+            if (run) g_dir_close(run);
+            g_rmdir(e->path);
+        } else {
+            g_unlink(e->path);
+        }
+        total -= e->bytes;
+    }
+    g_ptr_array_free(entries, TRUE);
+    g_free(root);
+    g_free(keep);
+    return NULL;
+}
+
+/* A new batch run logs into a directory of its own */
+static void batch_logs_begin(void)
+{
+    gchar *root = logs_root();
+    gchar *stamp = log_timestamp();
+    gchar *name = g_strconcat("batch-", stamp, NULL);
+    g_free(batch_log_dir);
+    batch_log_dir = g_build_filename(root, name, NULL);
+    g_free(name);
+    g_free(stamp);
+    g_free(root);
+    g_thread_unref(g_thread_new("log-housekeeping", logs_housekeeping_thread, g_strdup(batch_log_dir)));
+}
+
+/* Media position of the last complete "time=HH:MM:SS.ss" in ffmpeg's stats
+ * output, or -1 if there is none (or it is "N/A") */
+static gdouble ffmpeg_stats_time(const char *text)
+{
+    gdouble t = -1;
+    for (const char *p = strstr(text, "time="); p; p = strstr(p + 5, "time=")) {
+        const char *q = p + 5;
+        if (!g_ascii_isdigit(*q)) continue;
+        gchar *end;
+        guint64 h = g_ascii_strtoull(q, &end, 10);
+        if (*end != ':') continue;
+        guint64 m = g_ascii_strtoull(end + 1, &end, 10);
+        if (*end != ':') continue;
+        gdouble s = g_ascii_strtod(end + 1, &end);
+        if (*end == '\0') continue; /* cut off at the end of the chunk */
+        t = h * 3600.0 + m * 60.0 + s;
+    }
+    return t;
+}
+
+/* Record process output: in the job's log file, in the failure tail, and in
+ * the view when the job is shown there */
+static void worker_log_output(FfmpegWorker *w, const char *text)
+{
+    if (!w->tail) w->tail = g_string_new(NULL);
+    g_string_append(w->tail, text);
+    if (w->tail->len > WORKER_TAIL_BYTES)
+        g_string_erase(w->tail, 0, w->tail->len - WORKER_TAIL_BYTES);
+    gdouble t = ffmpeg_stats_time(text);
+    if (t >= 0) w->encoded = t;
+    worker_log_write(w, text);
+    if (!worker_log_shown(w)) return;
+    gtk_text_buffer_insert_at_cursor(log_buffer, text, -1);
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(log_buffer, &end);
+    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(log_text_view), &end, 0.0, FALSE, 0.0, 1.0);
+}
+
+#ifdef HAVE_LIBAV
+/* In-process engine. For short audio-only inputs the fork/exec and codec
+ * start-up of an ffmpeg process cost more than the encode itself, so those
+ * are decoded, resampled, encoded and muxed on bac's own worker threads.
+ * Anything the engine does not handle (video, stream copy, unknown encoder
+ * or muxer, large files) still goes through spawn_ffmpeg_worker. */
+#define INPROC_MAX_INPUT_BYTES (64 * 1024 * 1024)
+#define INPROC_CHUNK_SAMPLES 4096 /* frame size for variable-size encoders */
+
+typedef enum {
+    INPROC_OK,
+    INPROC_FAILED,
+    INPROC_CANCELLED,
+    INPROC_UNSUPPORTED /* nothing written yet; run ffmpeg instead */
+} InprocResult;
+
+typedef struct {
+    FfmpegWorker *worker; /* main thread only */
+    gchar *input;
+    gchar *output;
+    gchar *encoder;
+    gchar *video;         /* video selection, kept for the ffmpeg fallback */
+    gchar *vfilter;       /* likewise the filters and job settings, may be NULL */
+    gchar *afilter;
+    JobSettings *settings;
+    gint64 duration_us;   /* from the batch probe, 0 if unknown */
+    gint cancel;          /* atomic, set by Stop */
+    gint permille;        /* atomic, written by the progress callback */
+    gint reported;        /* main thread: last permille written to the log */
+    InprocResult result;
+    gchar *message;
+} InprocJob;
+
+/* Per-thread state kept between jobs: packets, frames and the resampler are
+ * always reused; decoder and encoder contexts are flushed and reused when the
+ * next job has identical parameters. */
+typedef struct {
+    AVPacket *pkt;
+    AVFrame *frame;       /* decoder output */
+    AVFrame *conv;        /* resampler output, grown on demand */
+    AVFrame *enc_frame;   /* encoder input, refilled in place */
+    int conv_cap;
+    int enc_frame_cap;
+    SwrContext *swr;
+    gboolean swr_ready;
+    enum AVSampleFormat swr_in_fmt;
+    int swr_in_rate;
+    AVChannelLayout swr_in_layout;
+    AVAudioFifo *fifo;
+    enum AVSampleFormat fifo_fmt;
+    int fifo_channels;
+    AVCodecContext *dec;
+    AVCodecContext *enc;
+} InprocThreadCtx;
+
+static GThreadPool *inproc_pool = NULL;
+static gboolean inproc_enabled = TRUE;
+static GtkWidget *batch_inproc_check = NULL;
+
+static void inproc_log_progress(FfmpegWorker *w)
+{
+    InprocJob *job = w->inproc;
+    gint permille = g_atomic_int_get(&job->permille);
+    if (permille == job->reported) return;
+    job->reported = permille;
+    gchar *base = g_path_get_basename(job->input);
+    gchar *msg = g_strdup_printf("in-process: %s %d%%\n", base, permille / 10);
+    worker_log_output(w, msg);
+    g_free(msg);
+    g_free(base);
+}
+#endif
+
+#define FANOUT_REPORT_SECONDS 5
+
+/* Bytes written so far to each output of a fan-out run */
+static void fanout_log_progress(FfmpegWorker *w)
+{
+    GString *line = g_string_new("outputs:");
+    for (guint i = 0; i < w->fanout_outputs->len; i++) {
+        const char *out = g_ptr_array_index(w->fanout_outputs, i);
+        GStatBuf st;
+        gchar *base = g_path_get_basename(out);
+        gchar *size = g_format_size(g_stat(out, &st) == 0 ? (guint64)st.st_size : 0);
+        g_string_append_printf(line, " %s %s%s", base, size, i + 1 < w->fanout_outputs->len ? "," : "\n");
+        g_free(size);
+        g_free(base);
+    }
+    worker_log_output(w, line->str);
+    g_string_free(line, TRUE);
+}
+
+/* Sample resident/peak memory of running workers; also retries admission
+ * for a waiting batch since memory may have been freed by other processes. */
+static gboolean worker_sample_cb(gpointer user_data)
+{
+    if (!workers || workers->len == 0) {
+        worker_sample_source = 0;
+        return G_SOURCE_REMOVE;
+    }
+    guint running = 0;
+    for (guint i = 0; i < workers->len; i++)
+        if (((FfmpegWorker *)g_ptr_array_index(workers, i))->batch) running++;
+    for (guint i = 0; i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+#ifdef HAVE_LIBAV
+        if (w->inproc) {
+            inproc_log_progress(w);
+            continue;
+        }
+#endif
+        gdouble cpu = read_proc_cpu_seconds(w->pid);
+        if (cpu >= 0) {
+            w->cpu_seconds = cpu;
+            w->cpu_sampled = g_get_monotonic_time();
+        }
+        if (w->batch) {
+            w->parallel_sum += running;
+            w->parallel_samples++;
+        }
+        gchar *status = g_strdup_printf("/proc/%d/status", w->pid);
+        gint64 rss = read_proc_kb(status, "VmRSS:");
+        gint64 hwm = read_proc_kb(status, "VmHWM:");
+        g_free(status);
+        if (rss >= 0) w->rss = rss;
+        if (hwm > w->peak_rss) w->peak_rss = hwm;
+        if (w->fanout_outputs && ++w->fanout_ticks % FANOUT_REPORT_SECONDS == 0)
+            fanout_log_progress(w);
+    }
+    if (batch_running) {
+        batch_progress_update(FALSE);
+        process_next_in_batch();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static FfmpegWorker *spawn_ffmpeg_worker(GPtrArray *argv, const char *input, const char *output, GError **error)
+{
+    gint stdin_fd = -1, stdout_fd = -1, stderr_fd = -1;
+    GPid pid = 0;
+    GError *err = NULL;
+    /* Spawn ffmpeg using bare program name so PATH is used. If that fails with ENOENT,
+     * retry with the resolved ffmpeg_path (if available). */
+    gboolean spawned = g_spawn_async_with_pipes(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH, child_setup_new_pgroup, NULL, &pid, &stdin_fd, &stdout_fd, &stderr_fd, &err);
+    if (!spawned && err && err->domain == G_SPAWN_ERROR && err->code == G_SPAWN_ERROR_NOENT && ffmpeg_path) {
+        g_clear_error(&err);
+        g_free(argv->pdata[0]);
+        argv->pdata[0] = g_strdup(ffmpeg_path); /* use full path */
+        spawned = g_spawn_async_with_pipes(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD, child_setup_new_pgroup, NULL, &pid, &stdin_fd, &stdout_fd, &stderr_fd, &err);
+    }
+    if (!spawned) {
+        g_propagate_error(error, err);
+        return NULL;
+    }
+
+    child_registry_add(pid, input);
+    FfmpegWorker *w = g_new0(FfmpegWorker, 1);
+    w->pid = pid;
+    w->started = g_get_monotonic_time();
+    w->command = g_strjoinv(" ", (gchar **)argv->pdata);
+    w->input = g_strdup(input);
+    w->output = g_strdup(output);
+    /* Set up GIO channels to read ffmpeg stdout/stderr and watch the child process */
+    if (stdin_fd != -1) close(stdin_fd); /* we don't write to ffmpeg stdin */
+    if (stdout_fd != -1) {
+        w->stdout_chan = g_io_channel_unix_new(stdout_fd);
+        g_io_channel_set_encoding(w->stdout_chan, NULL, NULL);
+        g_io_channel_set_buffered(w->stdout_chan, FALSE);
+        g_io_channel_set_flags(w->stdout_chan, G_IO_FLAG_NONBLOCK, NULL);
+        w->stdout_watch = g_io_add_watch(w->stdout_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, ffmpeg_output_cb, w);
+    }
+    if (stderr_fd != -1) {
+        w->stderr_chan = g_io_channel_unix_new(stderr_fd);
+        g_io_channel_set_encoding(w->stderr_chan, NULL, NULL);
+        g_io_channel_set_buffered(w->stderr_chan, FALSE);
+        g_io_channel_set_flags(w->stderr_chan, G_IO_FLAG_NONBLOCK, NULL);
+        w->stderr_watch = g_io_add_watch(w->stderr_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, ffmpeg_output_cb, w);
+    }
+    if (!workers) workers = g_ptr_array_new();
+    g_ptr_array_add(workers, w);
+    /* Watch the child so we can cleanup when it exits */
+    g_child_watch_add(pid, ffmpeg_child_watch_cb, w);
+    if (!worker_sample_source)
+        worker_sample_source = g_timeout_add_seconds(1, worker_sample_cb, NULL);
+    return w;
+}
+
+#ifdef HAVE_LIBAV
+/* Resolve an encoder the way ffmpeg's -c:a does: by encoder name first, then
+ * by codec name ("mp3" -> the default mp3 encoder). */
+static const AVCodec *inproc_find_encoder(const char *name)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(name);
+    if (!codec) {
+        const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(name);
+        if (desc) codec = avcodec_find_encoder(desc->id);
+    }
+    /* experimental encoders need -strict in ffmpeg too; let it report that */
+    if (!codec || codec->type != AVMEDIA_TYPE_AUDIO || (codec->capabilities & AV_CODEC_CAP_EXPERIMENTAL))
+        return NULL;
+    return codec;
+}
+
+static void inproc_thread_ctx_free(gpointer data)
+{
+    InprocThreadCtx *t = data;
+    av_packet_free(&t->pkt);
+    av_frame_free(&t->frame);
+    av_frame_free(&t->conv);
+    av_frame_free(&t->enc_frame);
+    swr_free(&t->swr);
+    av_channel_layout_uninit(&t->swr_in_layout);
+    if (t->fifo) av_audio_fifo_free(t->fifo);
+    avcodec_free_context(&t->dec);
+    avcodec_free_context(&t->enc);
+    g_free(t);
+}
+
+static GPrivate inproc_thread_key = G_PRIVATE_INIT(inproc_thread_ctx_free);
+
+static InprocThreadCtx *inproc_thread_ctx(void)
+{
+    InprocThreadCtx *t = g_private_get(&inproc_thread_key);
+    if (!t) {
+        t = g_new0(InprocThreadCtx, 1);
+        t->pkt = av_packet_alloc();
+        t->frame = av_frame_alloc();
+        t->conv = av_frame_alloc();
+        t->enc_frame = av_frame_alloc();
+        g_private_set(&inproc_thread_key, t);
+    }
+    return t;
+}
+
+static InprocResult inproc_fail(InprocJob *job, InprocResult result, const char *what, int err)
+{
+    char buf[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(err, buf, sizeof(buf));
+    g_free(job->message);
+    job->message = g_strdup_printf("%s: %s", what, buf);
+    return result;
+}
+
+/* Progress callback of the engine: called from the worker thread for every
+ * decoded frame, picked up by worker_sample_cb on the main thread. */
+static void inproc_progress(InprocJob *job, gint64 done_us)
+{
+    if (job->duration_us <= 0) return;
+    g_atomic_int_set(&job->permille, (gint)CLAMP(done_us * 1000 / job->duration_us, 0, 1000));
+}
+
+/* Encoder parameters follow ffmpeg's defaults: keep the input rate, sample
+ * format and layout when supported, else take the closest supported value. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+static int inproc_pick_rate(const AVCodec *codec, int want)
+{
+    if (!codec->supported_samplerates) return want;
+    int best = 0;
+    for (const int *r = codec->supported_samplerates; *r; r++) {
+        if (*r == want) return want;
+        if (!best || abs(*r - want) < abs(best - want)) best = *r;
+    }
+    return best;
+}
+
+static enum AVSampleFormat inproc_pick_format(const AVCodec *codec, enum AVSampleFormat want)
+{
+    if (!codec->sample_fmts) return want;
+    for (const enum AVSampleFormat *f = codec->sample_fmts; *f != AV_SAMPLE_FMT_NONE; f++)
+        if (*f == want) return want;
+    return codec->sample_fmts[0];
+}
+
+static int inproc_pick_layout(const AVCodec *codec, const AVChannelLayout *want, AVChannelLayout *out)
+{
+    if (!codec->ch_layouts)
+        return av_channel_layout_copy(out, want);
+    const AVChannelLayout *same_count = NULL;
+    for (const AVChannelLayout *l = codec->ch_layouts; l->nb_channels; l++) {
+        if (av_channel_layout_compare(l, want) == 0)
+            return av_channel_layout_copy(out, l);
+        if (!same_count && l->nb_channels == want->nb_channels)
+            same_count = l;
+    }
+    return av_channel_layout_copy(out, same_count ? same_count : &codec->ch_layouts[0]);
+}
+#pragma GCC diagnostic pop
+
+/* Open (or flush and reuse) the decoder for `par` */
+static int inproc_open_decoder(InprocThreadCtx *t, const AVStream *ist)
+{
+    const AVCodecParameters *par = ist->codecpar;
+    AVCodecContext *dec = t->dec;
+    if (dec && dec->codec_id == par->codec_id && dec->sample_rate == par->sample_rate &&
+        av_channel_layout_compare(&dec->ch_layout, &par->ch_layout) == 0 &&
+        dec->extradata_size == par->extradata_size &&
+        (par->extradata_size == 0 || memcmp(dec->extradata, par->extradata, par->extradata_size) == 0)) {
+        avcodec_flush_buffers(dec);
+        dec->pkt_timebase = ist->time_base;
+        return 0;
+    }
+    avcodec_free_context(&t->dec);
+    const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+    if (!codec) return AVERROR_DECODER_NOT_FOUND;
+    dec = avcodec_alloc_context3(codec);
+    if (!dec) return AVERROR(ENOMEM);
+    int ret = avcodec_parameters_to_context(dec, par);
+    dec->pkt_timebase = ist->time_base;
+    if (ret >= 0) ret = avcodec_open2(dec, codec, NULL);
+    if (ret < 0) {
+        avcodec_free_context(&dec);
+        return ret;
+    }
+    t->dec = dec;
+    return 0;
+}
+
+/* Open (or flush and reuse) the encoder. Reuse needs identical parameters
+ * and an encoder that supports being flushed. */
+static int inproc_open_encoder(InprocThreadCtx *t, const AVCodec *codec, int rate, enum AVSampleFormat fmt, const AVChannelLayout *layout, int flags)
+{
+    AVCodecContext *enc = t->enc;
+    if (enc && enc->codec == codec && (codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) &&
+        enc->sample_rate == rate && enc->sample_fmt == fmt && enc->flags == flags &&
+        av_channel_layout_compare(&enc->ch_layout, layout) == 0) {
+        avcodec_flush_buffers(enc);
+        return 0;
+    }
+    avcodec_free_context(&t->enc);
+    enc = avcodec_alloc_context3(codec);
+    if (!enc) return AVERROR(ENOMEM);
+    enc->sample_rate = rate;
+    enc->sample_fmt = fmt;
+    enc->time_base = (AVRational){1, rate};
+    enc->flags = flags;
+    int ret = av_channel_layout_copy(&enc->ch_layout, layout);
+    if (ret >= 0) ret = avcodec_open2(enc, codec, NULL);
+    if (ret < 0) {
+        avcodec_free_context(&enc);
+        return ret;
+    }
+    t->enc = enc;
+    return 0;
+}
+
+/* (Re)size a reusable audio frame; buffers are only reallocated when the
+ * format changes or a larger capacity is needed. */
+static int inproc_frame_reserve(AVFrame *frame, int *cap, enum AVSampleFormat fmt, const AVChannelLayout *layout, int rate, int samples)
+{
+    if (frame->format == fmt && av_channel_layout_compare(&frame->ch_layout, layout) == 0 && *cap >= samples) {
+        frame->sample_rate = rate;
+        return 0;
+    }
+    av_frame_unref(frame);
+    frame->format = fmt;
+    frame->sample_rate = rate;
+    frame->nb_samples = samples;
+    int ret = av_channel_layout_copy(&frame->ch_layout, layout);
+    if (ret >= 0) ret = av_frame_get_buffer(frame, 0);
+    *cap = ret >= 0 ? samples : 0;
+    return ret;
+}
+
+static int inproc_encode(InprocThreadCtx *t, AVFrame *frame, AVFormatContext *oc, AVStream *st)
+{
+    int ret = avcodec_send_frame(t->enc, frame);
+    if (ret < 0) return ret;
+    while ((ret = avcodec_receive_packet(t->enc, t->pkt)) >= 0) {
+        av_packet_rescale_ts(t->pkt, t->enc->time_base, st->time_base);
+        t->pkt->stream_index = st->index;
+        ret = av_interleaved_write_frame(oc, t->pkt);
+        if (ret < 0) return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* Feed whole encoder frames from the FIFO; with `flush` also the remainder,
+ * padded with silence for encoders that need full frames. */
+static int inproc_drain_fifo(InprocThreadCtx *t, AVFormatContext *oc, AVStream *st, gint64 *next_pts, gboolean flush)
+{
+    gboolean fixed = t->enc->frame_size > 0 && !(t->enc->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE);
+    int chunk = t->enc_frame_cap;
+    while (av_audio_fifo_size(t->fifo) >= chunk || (flush && av_audio_fifo_size(t->fifo) > 0)) {
+        int n = MIN(av_audio_fifo_size(t->fifo), chunk);
+        /* copies only if the encoder still holds a reference to the buffer */
+        t->enc_frame->nb_samples = chunk;
+        int ret = av_frame_make_writable(t->enc_frame);
+        if (ret < 0) return ret;
+        if (av_audio_fifo_read(t->fifo, (void **)t->enc_frame->extended_data, n) < n)
+            return AVERROR_BUG;
+        if (n < chunk && fixed && !(t->enc->codec->capabilities & AV_CODEC_CAP_SMALL_LAST_FRAME)) {
+            av_samples_set_silence(t->enc_frame->extended_data, n, chunk - n, t->enc->ch_layout.nb_channels, t->enc->sample_fmt);
+            n = chunk;
+        }
+        t->enc_frame->nb_samples = n;
+        t->enc_frame->pts = *next_pts;
+        *next_pts += n;
+        ret = inproc_encode(t, t->enc_frame, oc, st);
+        if (ret < 0) return ret;
+    }
+    return 0;
+}
+
+/* Resample `in` (NULL flushes the resampler) into the FIFO */
+static int inproc_resample(InprocThreadCtx *t, const AVFrame *in)
+{
+    if (in && (!t->swr_ready || in->format != t->swr_in_fmt || in->sample_rate != t->swr_in_rate ||
+               av_channel_layout_compare(&in->ch_layout, &t->swr_in_layout) != 0)) {
+        /* first frame, or the input changed mid-stream */
+        int ret = swr_alloc_set_opts2(&t->swr, &t->enc->ch_layout, t->enc->sample_fmt, t->enc->sample_rate,
+                                      &in->ch_layout, in->format, in->sample_rate, 0, NULL);
+        if (ret >= 0) ret = swr_init(t->swr);
+        if (ret < 0) return ret;
+        t->swr_in_fmt = in->format;
+        t->swr_in_rate = in->sample_rate;
+        av_channel_layout_uninit(&t->swr_in_layout);
+        av_channel_layout_copy(&t->swr_in_layout, &in->ch_layout);
+        t->swr_ready = TRUE;
+    }
+    if (!t->swr_ready) return 0;
+    int need = swr_get_out_samples(t->swr, in ? in->nb_samples : 0);
+    if (need <= 0) return need;
+    int ret = inproc_frame_reserve(t->conv, &t->conv_cap, t->enc->sample_fmt, &t->enc->ch_layout, t->enc->sample_rate, MAX(need, INPROC_CHUNK_SAMPLES));
+    if (ret < 0) return ret;
+    int n = swr_convert(t->swr, t->conv->extended_data, t->conv_cap,
+                        in ? (const uint8_t **)in->extended_data : NULL, in ? in->nb_samples : 0);
+    if (n < 0) return n;
+    if (n > 0 && av_audio_fifo_write(t->fifo, (void **)t->conv->extended_data, n) < n)
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static int inproc_decode_frames(InprocThreadCtx *t, InprocJob *job, const AVStream *ist, AVFormatContext *oc, AVStream *st, gint64 *next_pts)
+{
+    int ret;
+    while ((ret = avcodec_receive_frame(t->dec, t->frame)) >= 0) {
+        if (t->frame->pts != AV_NOPTS_VALUE) {
+            gint64 start = ist->start_time != AV_NOPTS_VALUE ? ist->start_time : 0;
+            inproc_progress(job, av_rescale_q(t->frame->pts - start, ist->time_base, AV_TIME_BASE_Q));
+        }
+        ret = inproc_resample(t, t->frame);
+        av_frame_unref(t->frame);
+        if (ret >= 0) ret = inproc_drain_fifo(t, oc, st, next_pts, FALSE);
+        if (ret < 0) return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* decode -> resample -> encode -> mux. Returns INPROC_UNSUPPORTED for any
+ * problem found before the output file is created. */
+static InprocResult inproc_transcode(InprocThreadCtx *t, InprocJob *job)
+{
+    AVFormatContext *ic = NULL;
+    AVFormatContext *oc = NULL;
+    AVChannelLayout layout = {0};
+    InprocResult result = INPROC_UNSUPPORTED;
+    gboolean opened = FALSE;
+    int ret;
+
+    if (g_atomic_int_get(&job->cancel))
+        return INPROC_CANCELLED;
+    if ((ret = avformat_open_input(&ic, job->input, NULL, NULL)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "open input", ret);
+        goto out;
+    }
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "read stream info", ret);
+        goto out;
+    }
+    for (unsigned i = 0; i < ic->nb_streams; i++) {
+        /* cover art and other video would be mapped by ffmpeg; leave it to ffmpeg */
+        if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            job->message = g_strdup("input has a video stream");
+            goto out;
+        }
+    }
+    int idx = av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (idx < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "find audio stream", idx);
+        goto out;
+    }
+    AVStream *ist = ic->streams[idx];
+    const AVCodec *codec = inproc_find_encoder(job->encoder);
+    if (!codec) {
+        job->message = g_strdup_printf("encoder %s not available", job->encoder);
+        goto out;
+    }
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, NULL, job->output)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "guess output format", ret);
+        goto out;
+    }
+    if (avformat_query_codec(oc->oformat, codec->id, FF_COMPLIANCE_NORMAL) == 0) {
+        job->message = g_strdup_printf("%s cannot be stored in %s", codec->name, oc->oformat->name);
+        goto out;
+    }
+    if ((ret = inproc_open_decoder(t, ist)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "open decoder", ret);
+        goto out;
+    }
+
+    AVChannelLayout in_layout = {0};
+    if (t->dec->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+        av_channel_layout_default(&in_layout, t->dec->ch_layout.nb_channels);
+    else
+        av_channel_layout_copy(&in_layout, &t->dec->ch_layout);
+    ret = inproc_pick_layout(codec, &in_layout, &layout);
+    av_channel_layout_uninit(&in_layout);
+    if (ret >= 0) {
+        int flags = (oc->oformat->flags & AVFMT_GLOBALHEADER) ? AV_CODEC_FLAG_GLOBAL_HEADER : 0;
+        ret = inproc_open_encoder(t, codec, inproc_pick_rate(codec, t->dec->sample_rate),
+                                  inproc_pick_format(codec, t->dec->sample_fmt), &layout, flags);
+    }
+    if (ret < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "open encoder", ret);
+        goto out;
+    }
+
+    gboolean fixed = t->enc->frame_size > 0 && !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE);
+    int chunk = fixed ? t->enc->frame_size : INPROC_CHUNK_SAMPLES;
+    if (!t->fifo || t->fifo_fmt != t->enc->sample_fmt || t->fifo_channels != t->enc->ch_layout.nb_channels) {
+        if (t->fifo) av_audio_fifo_free(t->fifo);
+        t->fifo = av_audio_fifo_alloc(t->enc->sample_fmt, t->enc->ch_layout.nb_channels, chunk);
+        t->fifo_fmt = t->enc->sample_fmt;
+        t->fifo_channels = t->enc->ch_layout.nb_channels;
+    } else {
+        av_audio_fifo_reset(t->fifo);
+    }
+    if (!t->fifo) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "allocate FIFO", AVERROR(ENOMEM));
+        goto out;
+    }
+    if (t->enc_frame_cap != chunk)
+        t->enc_frame_cap = 0; /* the capacity doubles as the chunk size */
+    if ((ret = inproc_frame_reserve(t->enc_frame, &t->enc_frame_cap, t->enc->sample_fmt, &t->enc->ch_layout, t->enc->sample_rate, chunk)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "allocate frame", ret);
+        goto out;
+    }
+    t->swr_ready = FALSE;
+
+    AVStream *st = avformat_new_stream(oc, NULL);
+    if (!st || (ret = avcodec_parameters_from_context(st->codecpar, t->enc)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "create output stream", st ? ret : AVERROR(ENOMEM));
+        goto out;
+    }
+    st->time_base = t->enc->time_base;
+    /* ffmpeg copies global and stream metadata by default */
+    av_dict_copy(&oc->metadata, ic->metadata, 0);
+    av_dict_copy(&st->metadata, ist->metadata, 0);
+
+    /* From here on the output exists: errors are real failures */
+    result = INPROC_FAILED;
+    if (!(oc->oformat->flags & AVFMT_NOFILE) && (ret = avio_open(&oc->pb, job->output, AVIO_FLAG_WRITE)) < 0) {
+        result = inproc_fail(job, INPROC_UNSUPPORTED, "open output", ret);
+        goto out;
+    }
+    opened = TRUE;
+    if ((ret = avformat_write_header(oc, NULL)) < 0) {
+        result = inproc_fail(job, INPROC_FAILED, "write header", ret);
+        goto out;
+    }
+
+    gint64 next_pts = 0;
+    while (!g_atomic_int_get(&job->cancel)) {
+        ret = av_read_frame(ic, t->pkt);
+        if (ret == AVERROR_EOF) break;
+        if (ret < 0) {
+            result = inproc_fail(job, INPROC_FAILED, "read", ret);
+            goto out;
+        }
+        if (t->pkt->stream_index != idx) {
+            av_packet_unref(t->pkt);
+            continue;
+        }
+        ret = avcodec_send_packet(t->dec, t->pkt);
+        av_packet_unref(t->pkt);
+        /* like ffmpeg, skip over corrupt packets */
+        if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+            result = inproc_fail(job, INPROC_FAILED, "decode", ret);
+            goto out;
+        }
+        if ((ret = inproc_decode_frames(t, job, ist, oc, st, &next_pts)) < 0) {
+            result = inproc_fail(job, INPROC_FAILED, "encode", ret);
+            goto out;
+        }
+    }
+    if (g_atomic_int_get(&job->cancel)) {
+        result = INPROC_CANCELLED;
+        goto out;
+    }
+    /* drain decoder, resampler, FIFO and encoder */
+    avcodec_send_packet(t->dec, NULL);
+    ret = inproc_decode_frames(t, job, ist, oc, st, &next_pts);
+    if (ret >= 0) ret = inproc_resample(t, NULL);
+    if (ret >= 0) ret = inproc_drain_fifo(t, oc, st, &next_pts, TRUE);
+    if (ret >= 0) ret = inproc_encode(t, NULL, oc, st);
+    if (ret >= 0) ret = av_write_trailer(oc);
+    if (ret < 0) {
+        result = inproc_fail(job, INPROC_FAILED, "finish output", ret);
+        goto out;
+    }
+    inproc_progress(job, job->duration_us);
+    result = INPROC_OK;
+
+out:
+    if (result != INPROC_OK) {
+        /* a half-used codec context is not worth flushing */
+        avcodec_free_context(&t->dec);
+        avcodec_free_context(&t->enc);
+    }
+    av_channel_layout_uninit(&layout);
+    if (oc) {
+        if (opened && !(oc->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&oc->pb);
+        avformat_free_context(oc);
+    }
+    avformat_close_input(&ic);
+    if (opened && result != INPROC_OK)
+        g_unlink(job->output);
+    return result;
+}
+
+static gboolean inproc_done_idle(gpointer user_data);
+
+/* GThreadPool worker */
+static void inproc_thread_func(gpointer data, gpointer user_data)
+{
+    InprocJob *job = data;
+    job->result = inproc_transcode(inproc_thread_ctx(), job);
+    g_idle_add(inproc_done_idle, job);
+}
+
+static void inproc_job_free(InprocJob *job)
+{
+    g_free(job->input);
+    g_free(job->output);
+    g_free(job->encoder);
+    g_free(job->video);
+    g_free(job->vfilter);
+    g_free(job->afilter);
+    if (job->settings) job_settings_unref(job->settings);
+    g_free(job->message);
+    g_free(job);
+}
+
+/* TRUE if the in-process engine can take this conversion. Only batch jobs
+ * qualify since their probe result tells us the input is small and audio-only;
+ * `job` is NULL for anything else. */
+static gboolean inproc_accepts(const BatchJob *job, const char *output, const char *audio, const JobSettings *js)
+{
+    if (!inproc_enabled || !audio || g_strcmp0(audio, "copy") == 0 || g_strcmp0(audio, "No audio") == 0)
+        return FALSE;
+    if (js ? js->stream_rules : stream_rules_enabled) /* the in-process path converts the best audio track only */
+        return FALSE;
+    if (!job || !job->info.probed || !job->info.audio_codec || job->info.video_codec)
+        return FALSE;
+    if (job->info.size <= 0 || job->info.size > INPROC_MAX_INPUT_BYTES)
+        return FALSE;
+    return inproc_find_encoder(audio) && av_guess_format(NULL, output, NULL);
+}
+
+static FfmpegWorker *inproc_start(const BatchJob *bj, const char *input, const char *output, const char *audio,
+                                  const char *video, const char *vfilter, const char *afilter, const JobSettings *js)
+{
+    if (!inproc_pool)
+        inproc_pool = g_thread_pool_new(inproc_thread_func, NULL, (gint)g_get_num_processors(), FALSE, NULL);
+    InprocJob *job = g_new0(InprocJob, 1);
+    job->input = g_strdup(input);
+    job->output = g_strdup(output);
+    job->encoder = g_strdup(audio);
+    job->video = g_strdup(video);
+    job->vfilter = g_strdup(vfilter);
+    job->afilter = g_strdup(afilter);
+    job->settings = js ? g_atomic_rc_box_acquire((JobSettings *)js) : NULL;
+    job->reported = -1;
+    job->duration_us = (gint64)(bj->info.duration * G_USEC_PER_SEC);
+
+    FfmpegWorker *w = g_new0(FfmpegWorker, 1);
+    w->input = g_strdup(input);
+    w->output = g_strdup(output);
+    w->started = g_get_monotonic_time();
+    w->inproc = job;
+    job->worker = w;
+    if (!workers) workers = g_ptr_array_new();
+    g_ptr_array_add(workers, w);
+    if (!worker_sample_source)
+        worker_sample_source = g_timeout_add_seconds(1, worker_sample_cb, NULL);
+    g_thread_pool_push(inproc_pool, job, NULL);
+    return w;
+}
+
+static gboolean inproc_done_idle(gpointer user_data)
+{
+    InprocJob *job = user_data;
+    FfmpegWorker *w = job->worker;
+    gchar *msg;
+    switch (job->result) {
+    case INPROC_OK:
+        msg = g_strdup_printf("in-process: %s finished\n", job->output);
+        break;
+    case INPROC_CANCELLED:
+        msg = g_strdup_printf("in-process: %s stopped\n", job->input);
+        break;
+    case INPROC_UNSUPPORTED:
+        msg = g_strdup_printf("in-process: %s: %s, using ffmpeg\n", job->input, job->message ? job->message : "not supported");
+        break;
+    default:
+        msg = g_strdup_printf("in-process: %s failed: %s\n", job->input, job->message ? job->message : "unknown error");
+        break;
+    }
+    worker_log_output(w, msg);
+    g_free(msg);
+
+    /* Failures are retried once through ffmpeg, which may cope better */
+    if ((job->result == INPROC_UNSUPPORTED || job->result == INPROC_FAILED) && !g_atomic_int_get(&job->cancel)) {
+        GPtrArray *argv = build_ffmpeg_argv(w->input, w->output, job->encoder, job->video,
+                                            job->vfilter, job->afilter, job->settings);
+        GError *error = NULL;
+        FfmpegWorker *fw = spawn_ffmpeg_worker(argv, w->input, w->output, &error);
+        g_ptr_array_free(argv, TRUE);
+        if (fw) {
+            /* hand the admission bookkeeping over to the process worker */
+            fw->batch = w->batch;
+            fw->mem_key = g_steal_pointer(&w->mem_key);
+            fw->pixels = w->pixels;
+            fw->mem_estimate = w->mem_estimate;
+            fw->out_estimate = w->out_estimate;
+            fw->out_dev = w->out_dev;
+            fw->audio = g_strdup(job->encoder);
+            fw->video = g_strdup(job->video);
+            fw->vfilter = g_strdup(job->vfilter);
+            fw->afilter = g_strdup(job->afilter);
+            g_ptr_array_remove(workers, w);
+            worker_free(w);
+            inproc_job_free(job);
+            return G_SOURCE_REMOVE;
+        }
+        worker_log_output(w, error->message);
+        worker_log_output(w, "\n");
+        g_error_free(error);
+    }
+    if (w->batch)
+        batch_job_exited(w, job->result == INPROC_OK, job->result == INPROC_CANCELLED);
+    w->inproc = NULL;
+    inproc_job_free(job);
+    worker_finished(w);
+    return G_SOURCE_REMOVE;
+}
+
+static void inproc_cancel_all(void)
+{
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (w->inproc)
+            g_atomic_int_set(&((InprocJob *)w->inproc)->cancel, 1);
+    }
+}
+
+static void batch_inproc_toggled(GtkCheckButton *check, gpointer user_data)
+{
+    inproc_enabled = gtk_check_button_get_active(check);
+}
+#endif
+
+/* Start one conversion with explicit settings; logs and reports spawn errors.
+ * `job` is the batch entry being converted, NULL outside the batch.
+ * Returns the new worker or NULL. */
+static FfmpegWorker *start_conversion(const char *input, const char *output, const char *audio, const char *video,
+                                      const char *vfilter, const char *afilter, const JobSettings *js,
+                                      const BatchJob *job)
+{
+    /* Build a human-readable preview command for log; a batch job's goes to
+     * its own log, the view shows only the selected job */
+    gchar *command = g_strdup_printf("ffmpeg -i \"%s\" ... \"%s\"\n", input, output);
+
+#ifdef HAVE_LIBAV
+    if (!vfilter && !afilter && inproc_accepts(job, output, audio, js)) {
+        FfmpegWorker *iw = inproc_start(job, input, output, audio, video, vfilter, afilter, js);
+        iw->batch = job != NULL;
+        worker_log_output(iw, command);
+        g_free(command);
+        iw->audio = g_strdup(audio);
+        iw->video = g_strdup(video);
+        gtk_widget_set_sensitive(start_button, FALSE);
+        gtk_widget_set_sensitive(preview_button, FALSE);
+        gtk_widget_set_sensitive(stop_button, TRUE);
+        gtk_widget_set_sensitive(audio_combo, FALSE);
+        gtk_widget_set_sensitive(video_combo, FALSE);
+        return iw;
+    }
+#endif
+    GPtrArray *argv = build_ffmpeg_argv(input, output, audio, video, vfilter, afilter, js);
+    GError *error = NULL;
+    FfmpegWorker *w = spawn_ffmpeg_worker(argv, input, output, &error);
+    if (w) {
+        w->batch = job != NULL;
+        w->audio = g_strdup(audio);
+        w->video = g_strdup(video);
+        w->vfilter = g_strdup(vfilter);
+        w->afilter = g_strdup(afilter);
+    }
+    /* Log which executable was used (argv[0]) */
+    gchar *which_msg = g_strdup_printf("Spawning: %s\n", (const char *)g_ptr_array_index(argv, 0));
+    if (w) {
+        worker_log_output(w, command);
+        worker_log_output(w, which_msg);
+    } else {
+        gtk_text_buffer_insert_at_cursor(log_buffer, command, -1);
+        gtk_text_buffer_insert_at_cursor(log_buffer, which_msg, -1);
+    }
+    g_free(command);
+    g_free(which_msg);
+    g_ptr_array_free(argv, TRUE);
+
+    if (!w) {
+        const char *msg = error ? error->message : "Failed to spawn ffmpeg";
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+        /* show alert to user (no parent available here) */
+        show_alert(NULL, "ffmpeg error", msg);
+        if (error) g_error_free(error);
+        return NULL;
+    }
+    /* Disable codec selection while conversion is running */
+    gtk_widget_set_sensitive(start_button, FALSE);
+    gtk_widget_set_sensitive(preview_button, FALSE);
+    gtk_widget_set_sensitive(stop_button, TRUE);
+    gtk_widget_set_sensitive(audio_combo, FALSE);
+    gtk_widget_set_sensitive(video_combo, FALSE);
+    return w;
+}
+
+/* Show the probed streams of the current input; with rules enabled each is
+ * marked kept (+) or dropped (-) for the selected codecs */
+static void streams_label_update(void)
+{
+    if (!streams_label) return;
+    if (!input_info.streams || !audio_combo || !video_combo) {
+        gtk_label_set_text(GTK_LABEL(streams_label), "");
+        return;
+    }
+    gchar *audio = NULL, *video = NULL;
+    get_selected_codecs(&audio, &video);
+    GPtrArray *sel = stream_selection(&input_info, audio, video, NULL);
+    GString *text = g_string_new("Streams:");
+    for (guint i = 0; i < input_info.streams->len; i++) {
+        StreamInfo *s = g_ptr_array_index(input_info.streams, i);
+        g_string_append_printf(text, "%s %s#%d %s %s", i ? "," : "",
+                               !stream_rules_enabled ? "" : sel && g_ptr_array_find(sel, s, NULL) ? "+" : "-",
+                               s->index, s->type, s->codec ? s->codec : "?");
+        if (s->language) g_string_append_printf(text, " %s", s->language);
+        if (s->channels > 0) g_string_append_printf(text, " %dch", s->channels);
+        if (s->attached_pic) g_string_append(text, " cover");
+        else if (s->width > 0) g_string_append_printf(text, " %dx%d", s->width, s->height);
+    }
+    gtk_label_set_text(GTK_LABEL(streams_label), text->str);
+    g_string_free(text, TRUE);
+    if (sel) g_ptr_array_free(sel, TRUE);
+    g_free(audio);
+    g_free(video);
+}
+
+static void streams_label_notify(GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    streams_label_update();
+}
+
+/* Read the stream rule widgets into the globals */
+static void stream_rules_changed(gpointer user_data)
+{
+    stream_rules_enabled = gtk_check_button_get_active(GTK_CHECK_BUTTON(stream_rules_check));
+    stream_all_audio = gtk_drop_down_get_selected(GTK_DROP_DOWN(stream_audio_combo)) == 1;
+    stream_keep_subtitles = gtk_check_button_get_active(GTK_CHECK_BUTTON(stream_subs_check));
+    stream_keep_cover = gtk_check_button_get_active(GTK_CHECK_BUTTON(stream_cover_check));
+    g_strfreev(stream_languages);
+    stream_languages = stream_languages_parse(gtk_editable_get_text(GTK_EDITABLE(stream_lang_entry)));
+    gtk_widget_set_sensitive(stream_audio_combo, stream_rules_enabled);
+    gtk_widget_set_sensitive(stream_lang_entry, stream_rules_enabled);
+    gtk_widget_set_sensitive(stream_subs_check, stream_rules_enabled);
+    gtk_widget_set_sensitive(stream_cover_check, stream_rules_enabled);
+    streams_label_update();
+}
+
+/* "1:02:03" / "2:03" */
+static gchar *format_duration(gdouble seconds)
+{
+    gint s = (gint)(seconds + 0.5);
+    if (s >= 3600)
+        return g_strdup_printf("%d:%02d:%02d", s / 3600, (s / 60) % 60, s % 60);
+    return g_strdup_printf("%d:%02d", s / 60, s % 60);
+}
+
+static void output_target_free(gpointer data)
+{
+    OutputTarget *t = data;
+    g_free(t->format);
+    g_free(t->audio);
+    g_free(t->video);
+    g_free(t);
+}
+
+static void extra_outputs_update_label(void)
+{
+    if (!extra_outputs || extra_outputs->len == 0) {
+        gtk_label_set_text(GTK_LABEL(extra_outputs_label), "No additional outputs");
+        gtk_widget_set_sensitive(extra_outputs_clear, FALSE);
+        return;
+    }
+    GString *text = g_string_new("Also: ");
+    for (guint i = 0; i < extra_outputs->len; i++) {
+        OutputTarget *t = g_ptr_array_index(extra_outputs, i);
+        g_string_append_printf(text, "%s%s (%s, %s)", i ? "; " : "", t->format, t->audio, t->video);
+    }
+    gtk_label_set_text(GTK_LABEL(extra_outputs_label), text->str);
+    gtk_widget_set_sensitive(extra_outputs_clear, TRUE);
+    g_string_free(text, TRUE);
+}
+
+/* Remember the current format and codec selection as an additional output */
+static void on_add_output_clicked(GtkButton *button, gpointer user_data)
+{
+    if (!current_format) return;
+    if (!extra_outputs) extra_outputs = g_ptr_array_new_with_free_func(output_target_free);
+    OutputTarget *t = g_new0(OutputTarget, 1);
+    t->format = g_strdup(current_format);
+    get_selected_codecs(&t->audio, &t->video);
+    g_ptr_array_add(extra_outputs, t);
+    extra_outputs_update_label();
+}
+
+static void on_clear_outputs_clicked(GtkButton *button, gpointer user_data)
+{
+    if (extra_outputs) g_ptr_array_set_size(extra_outputs, 0);
+    extra_outputs_update_label();
+}
+
+/* Convert `input_file` to the main output and every additional target with
+ * a single ffmpeg: the input is demuxed and decoded once and each output
+ * file gets its own encoders (ffmpeg selects streams per output). */
+static FfmpegWorker *start_fanout(const char *audio, const char *video, gchar **problem)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *outputs = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup("ffmpeg"));
+    g_ptr_array_add(argv, g_strdup("-y"));
+    g_ptr_array_add(argv, g_strdup("-i"));
+    g_ptr_array_add(argv, g_strdup(input_file));
+    const MediaInfo *streams = media_info_for(input_file);
+    GPtrArray *late = g_ptr_array_new_with_free_func(g_free);
+    append_stream_maps(argv, late, streams, output_file, audio, video, NULL);
+    append_encode_options(argv, audio, video, NULL, NULL, NULL);
+    g_ptr_array_extend_and_steal(argv, late);
+    g_ptr_array_add(argv, g_strdup(output_file));
+    g_ptr_array_add(outputs, g_strdup(output_file));
+    for (guint i = 0; i < extra_outputs->len && !*problem; i++) {
+        OutputTarget *t = g_ptr_array_index(extra_outputs, i);
+        gchar *out = build_output_path(input_file, t->format);
+        if (g_ptr_array_find_with_equal_func(outputs, out, g_str_equal, NULL)) {
+            *problem = g_strdup_printf("two outputs would be written to %s; pick different formats", out);
+            g_free(out);
+            break;
+        }
+        if (!selected_encoders_usable(t->audio, t->video, problem) ||
+            (*problem = job_settings_problem(out, t->audio, t->video, NULL)) != NULL) {
+            g_free(out);
+            break;
+        }
+        late = g_ptr_array_new_with_free_func(g_free);
+        append_stream_maps(argv, late, streams, out, t->audio, t->video, NULL);
+        append_encode_options(argv, t->audio, t->video, NULL, NULL, NULL);
+        g_ptr_array_extend_and_steal(argv, late);
+        g_ptr_array_add(argv, g_strdup(out));
+        g_ptr_array_add(outputs, out);
+    }
+    g_ptr_array_add(argv, NULL);
+    if (*problem) {
+        g_ptr_array_free(argv, TRUE);
+        g_ptr_array_free(outputs, TRUE);
+        return NULL;
+    }
+
+    for (guint i = 0; i < outputs->len; i++) {
+        gchar *msg = g_strdup_printf("output %u: %s\n", i + 1, (const char *)g_ptr_array_index(outputs, i));
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+    }
+    GError *error = NULL;
+    FfmpegWorker *w = spawn_ffmpeg_worker(argv, input_file, output_file, &error);
+    g_ptr_array_free(argv, TRUE);
+    if (!w) {
+        *problem = g_strdup(error ? error->message : "Failed to spawn ffmpeg");
+        if (error) g_error_free(error);
+        g_ptr_array_free(outputs, TRUE);
+        return NULL;
+    }
+    /* probed when the input was chosen */
+    const MediaInfo *src = media_info_for(input_file);
+    w->source_duration = src ? src->duration : 0;
+    w->fanout_outputs = outputs;
+    w->audio = g_strdup(audio);
+    w->video = g_strdup(video);
+    gtk_widget_set_sensitive(audio_combo, FALSE);
+    gtk_widget_set_sensitive(video_combo, FALSE);
+    return w;
+}
+
+/* Outputs of a finished fan-out run being probed on probe_pool */
+typedef struct {
+    GPtrArray *outputs;
+    gchar **lines;      /* report line per output, as the probes come back */
+    guint pending;
+    gboolean ok;
+    gdouble source_duration;
+} FanoutCheck;
+
+static void fanout_probed(ProbeResult *res)
+{
+    FanoutCheck *fc = res->data;
+    guint i = 0;
+    g_ptr_array_find_with_equal_func(fc->outputs, res->path, g_str_equal, &i);
+    if (res->ok && res->info.duration > 0) {
+        gchar *size = g_format_size(res->info.size);
+        gchar *length = format_duration(res->info.duration);
+        /* a stream copy may end a little early or late at a keyframe */
+        gboolean complete = fc->ok && (fc->source_duration <= 0 || res->info.duration >= fc->source_duration - 1.0);
+        fc->lines[i] = g_strdup_printf("%s: %s, %s, %s\n", complete ? "done" : "incomplete", res->path, size, length);
+        g_free(size);
+        g_free(length);
+    } else {
+        fc->lines[i] = g_strdup_printf("failed: %s\n", res->path);
+    }
+    if (--fc->pending > 0) return;
+    for (guint j = 0; j < fc->outputs->len; j++)
+        gtk_text_buffer_insert_at_cursor(log_buffer, fc->lines[j], -1);
+    g_strfreev(fc->lines);
+    g_ptr_array_unref(fc->outputs);
+    g_free(fc);
+}
+
+/* Result per output of a fan-out run: written size and length, checked
+ * against the input length */
+static void fanout_report(FfmpegWorker *w, gboolean ok)
+{
+    FanoutCheck *fc = g_new0(FanoutCheck, 1);
+    fc->outputs = g_ptr_array_ref(w->fanout_outputs);
+    fc->lines = g_new0(gchar *, fc->outputs->len + 1);
+    fc->pending = fc->outputs->len;
+    fc->ok = ok;
+    fc->source_duration = w->source_duration;
+    for (guint i = 0; i < fc->outputs->len; i++)
+        probe_in_background(g_ptr_array_index(fc->outputs, i), fanout_probed, fc);
+}
+
+/* Trim: keep from..to of the input with stream copy. The input is opened
+ * with -ss at a keyframe, so the demuxer seeks there and nothing is decoded;
+ * cutting a long file takes about as long as copying the kept part. Smart
+ * mode re-encodes only the partial GOP at the start and joins it with the
+ * copied rest through the concat demuxer. The input is probed and the steps
+ * planned on trim_thread; the steps then run one after another as ordinary
+ * workers. */
+typedef struct {
+    GPtrArray *steps;   /* argv (GPtrArray*) of each ffmpeg run, in order */
+    guint next;
+    gchar *input;
+    gchar *output;
+    gchar *tmpdir;      /* smart mode segments and concat list, or NULL */
+    gdouble from;       /* requested range, seconds */
+    gdouble to;
+    gboolean smart;
+    gdouble length;     /* expected output length, seconds */
+    MediaInfo info;     /* the input, probed by trim_plan_thread */
+    JobSettings *settings; /* stream selection and speed options at Start */
+    GString *notes;     /* planning messages, logged once planning is done */
+    gchar *problem;     /* why the trim cannot run, or NULL */
+    gboolean cancelled; /* Stop was clicked while planning */
+} TrimJob;
+
+static GThread *trim_thread = NULL;
+static TrimJob *trim_planning = NULL; /* owned by trim_thread until its idle runs */
 
-static gint find_best_encoder_in_array(GPtrArray *arr, const char *codec, const CodecMap *map)
+/* seek targets are nudged past the keyframe so rounding can never land the
+ * demuxer on the one before it */
+#define TRIM_SEEK_SLACK 0.0005
+
+static gchar *seconds_arg(gdouble seconds)
 {
-    if (!arr || arr->len == 0) return 0;
-    if (!codec) return 0;
-    gchar *codec_l = g_utf8_strdown(codec, -1);
-    for (guint i = 0; i < arr->len; i++) {
-        const char *name = g_ptr_array_index(arr, i);
-        if (g_strcmp0(name, codec) == 0) {
-            g_free(codec_l);
-            return i;
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    return g_strdup(g_ascii_formatd(buf, sizeof buf, "%.6f", seconds));
+}
+
+static void trim_job_free(TrimJob *tj)
+{
+    if (tj->tmpdir) {
+        GDir *dir = g_dir_open(tj->tmpdir, 0, NULL);
+        const char *name;
+        while (dir && (name = g_dir_read_name(dir)) != NULL) {
+            gchar *path = g_build_filename(tj->tmpdir, name, NULL);
+            g_unlink(path);
+            g_free(path);
         }
+        if (dir) g_dir_close(dir);
+        g_rmdir(tj->tmpdir);
+        g_free(tj->tmpdir);
     }
-    if (map) {
-        for (int m = 0; map[m].codec != NULL; m++) {
-            if (g_strcmp0(map[m].codec, codec) == 0) {
-                const char *want = map[m].encoder;
-                for (guint i = 0; i < arr->len; i++) {
-                    const char *name = g_ptr_array_index(arr, i);
-                    if (g_strcmp0(name, want) == 0) {
-                        g_free(codec_l);
-                        return i;
-                    }
-                    gchar *name_l = g_utf8_strdown(name, -1);
-                    if (g_strstr_len(name_l, -1, want)) {
-                        g_free(name_l);
-                        g_free(codec_l);
-                        return i;
-                    }
-                    g_free(name_l);
-                }
-            }
-        }
+    g_ptr_array_free(tj->steps, TRUE);
+    g_free(tj->input);
+    g_free(tj->output);
+    media_info_clear(&tj->info);
+    if (tj->settings) job_settings_unref(tj->settings);
+    g_string_free(tj->notes, TRUE);
+    g_free(tj->problem);
+    g_free(tj);
+}
+
+/* -profile:v values of the source profiles the edge encoders can produce */
+static const struct {
+    const char *codec;
+    const char *profile; /* as ffprobe and libavcodec name it */
+    const char *option;
+} trim_profiles[] = {
+    {"h264", "Constrained Baseline", "baseline"},
+    {"h264", "Baseline", "baseline"},
+    {"h264", "Main", "main"},
+    {"h264", "High", "high"},
+    {"h264", "High 10", "high10"},
+    {"h264", "High 4:2:2", "high422"},
+    {"h264", "High 4:4:4 Predictive", "high444"},
+    {"hevc", "Main", "main"},
+    {"hevc", "Main 10", "main10"},
+    {"vp9", "Profile 0", "0"},
+    {"vp9", "Profile 1", "1"},
+    {"vp9", "Profile 2", "2"},
+    {"vp9", "Profile 3", "3"},
+    {"av1", "Main", "0"},
+    {"av1", "High", "1"},
+    {"av1", "Professional", "2"},
+    {NULL, NULL, NULL}
+};
+
+/* The re-encoded piece has to decode with the copied one: same pixel
+ * format, profile and (H.264) level as the source */
+static void trim_append_source_options(GPtrArray *argv, const MediaInfo *mi)
+{
+    if (mi->pix_fmt) {
+        g_ptr_array_add(argv, g_strdup("-pix_fmt"));
+        g_ptr_array_add(argv, g_strdup(mi->pix_fmt));
     }
-    for (guint i = 0; i < arr->len; i++) {
-        const char *name = g_ptr_array_index(arr, i);
-        gchar *name_l = g_utf8_strdown(name, -1);
-        if (g_strstr_len(name_l, -1, codec_l)) {
-            g_free(name_l);
-            g_free(codec_l);
-            return i;
+    for (gint i = 0; trim_profiles[i].codec; i++) {
+        if (g_strcmp0(trim_profiles[i].codec, mi->video_codec) == 0 &&
+            g_strcmp0(trim_profiles[i].profile, mi->video_profile) == 0) {
+            g_ptr_array_add(argv, g_strdup("-profile:v"));
+            g_ptr_array_add(argv, g_strdup(trim_profiles[i].option));
+            break;
         }
-        g_free(name_l);
     }
-    g_free(codec_l);
-    return 0;
+    /* stored times ten: 41 is level 4.1 */
+    if (g_strcmp0(mi->video_codec, "h264") == 0 && mi->video_level >= 10) {
+        g_ptr_array_add(argv, g_strdup("-level"));
+        g_ptr_array_add(argv, g_strdup_printf("%d.%d", mi->video_level / 10, mi->video_level % 10));
+    }
 }
 
-/* Helper: show an alert dialog (non-blocking) */
-static char *ffmpeg_path = NULL;
-static char *ffprobe_path = NULL;
+/* H.264 and HEVC keep their parameter sets in the container header of most
+ * formats, and concat keeps only the first piece's. MPEG-TS carries them in
+ * band before every keyframe, so pieces from different encoders join
+ * cleanly when cut to it first. */
+static const char *const trim_ts_audio[] = {"aac", "mp3", "mp2", "ac3", "eac3", "opus", NULL};
 
-static void show_alert (GtkWindow *parent, const char *title, const char *body)
+static gboolean trim_needs_ts(const MediaInfo *mi)
 {
-    AdwDialog *d = adw_alert_dialog_new (title, body);
-    adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (d), "ok", "_OK", NULL);
-    adw_dialog_present (d, GTK_WIDGET (parent));
+    return g_strcmp0(mi->video_codec, "h264") == 0 || g_strcmp0(mi->video_codec, "hevc") == 0;
 }
 
-/* Forward declarations for IO/child callbacks */
-static gboolean ffmpeg_stdout_cb(GIOChannel *source, GIOCondition condition, gpointer user_data);
-static gboolean ffmpeg_stderr_cb(GIOChannel *source, GIOCondition condition, gpointer user_data);
-static void ffmpeg_child_watch_cb(GPid pid, gint status, gpointer user_data);
-static gboolean enable_ui_after_child(gpointer user_data);
-static void on_stop_clicked(GtkButton *button, gpointer user_data);
-/* (prototype already declared above) */
+/* Whether every stream the trim keeps can go into MPEG-TS */
+static gboolean trim_ts_usable(const MediaInfo *mi, const JobSettings *js)
+{
+    /* without stream rules ffmpeg picks one video, one audio and, where the
+     * muxer takes them, one subtitle stream */
+    GPtrArray *sel = stream_selection(mi, "copy", "copy", js);
+    GPtrArray *streams = sel ? sel : mi->streams;
+    gboolean ok = streams != NULL;
+    for (guint i = 0; ok && i < streams->len; i++) {
+        StreamInfo *s = g_ptr_array_index(streams, i);
+        if (g_strcmp0(s->type, "audio") == 0)
+            ok = s->codec && g_strv_contains(trim_ts_audio, s->codec);
+        else if (g_strcmp0(s->type, "video") == 0)
+            ok = !(sel && s->attached_pic);
+        else
+            ok = !sel && g_strcmp0(s->type, "subtitle") != 0;
+    }
+    if (sel) g_ptr_array_free(sel, TRUE);
+    return ok;
+}
 
-/* Detect default codecs from input file */
-static void detect_defaults(const char *file) {
-    gchar *ffprobe_path = g_find_program_in_path("ffprobe");
-    if (!ffprobe_path) {
-        g_warning("ffprobe not found in PATH; cannot detect codecs");
-        return;
+/* One ffmpeg run of a trim: `length` seconds from `from` into `output`, with
+ * all streams copied, or the video re-encoded with `video` (NULL copies) */
+static void trim_add_step(TrimJob *tj, gdouble from, gdouble length, const char *video, const char *output)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup("ffmpeg"));
+    g_ptr_array_add(argv, g_strdup("-y"));
+    g_ptr_array_add(argv, g_strdup("-ss"));
+    g_ptr_array_add(argv, seconds_arg(video ? from : from + TRIM_SEEK_SLACK));
+    g_ptr_array_add(argv, g_strdup("-i"));
+    g_ptr_array_add(argv, g_strdup(tj->input));
+    g_ptr_array_add(argv, g_strdup("-t"));
+    g_ptr_array_add(argv, seconds_arg(length));
+    GPtrArray *late = g_ptr_array_new_with_free_func(g_free);
+    append_stream_maps(argv, late, &tj->info, output, "copy", video ? video : "copy", tj->settings);
+    if (video) {
+        append_encode_options(argv, "copy", video, NULL, NULL, tj->settings);
+        trim_append_source_options(argv, &tj->info);
+    } else {
+        g_ptr_array_add(argv, g_strdup("-c"));
+        g_ptr_array_add(argv, g_strdup("copy"));
     }
-    gchar *command = g_strdup_printf("%s -v quiet -print_format json -show_streams -show_format \"%s\"", ffprobe_path, file);
-    gchar *stdout_str = NULL;
-    gchar *stderr_str = NULL;
-    gint exit_status;
+    g_ptr_array_extend_and_steal(argv, late);
+    /* every piece starts at 0 so the pieces line up when concatenated */
+    g_ptr_array_add(argv, g_strdup("-avoid_negative_ts"));
+    g_ptr_array_add(argv, g_strdup("make_zero"));
+    g_ptr_array_add(argv, g_strdup(output));
+    g_ptr_array_add(argv, NULL);
+    g_ptr_array_add(tj->steps, argv);
+}
+
+/* Encoder for the re-encoded start in smart mode: the copied rest is not
+ * touched, so the start must be in the same codec as the source */
+static const char *trim_edge_encoder(const MediaInfo *mi)
+{
+    for (gint m = 0; video_encoder_map[m].codec; m++) {
+        if (g_strcmp0(video_encoder_map[m].codec, mi->video_codec) == 0 && video_codecs &&
+            g_ptr_array_find_with_equal_func(video_codecs, video_encoder_map[m].encoder, g_str_equal, NULL) &&
+            encoder_caps_lookup(video_encoder_map[m].encoder))
+            return video_encoder_map[m].encoder;
+    }
+    return NULL;
+}
+
+static void trim_log(const char *fmt, ...) G_GNUC_PRINTF(1, 2);
+static void trim_log(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    gchar *msg = g_strdup_vprintf(fmt, args);
+    va_end(args);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+}
+
+/* trim_log for trim_thread: kept until the plan is handed over */
+static void trim_note(TrimJob *tj, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+static void trim_note(TrimJob *tj, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    g_string_append_vprintf(tj->notes, fmt, args);
+    va_end(args);
+}
+
+static FfmpegWorker *trim_run_next(TrimJob *tj, GError **error)
+{
+    GPtrArray *argv = g_ptr_array_index(tj->steps, tj->next);
+    tj->next++;
+    trim_log("Trim step %u of %u\n", tj->next, tj->steps->len);
+    FfmpegWorker *w = spawn_ffmpeg_worker(argv, tj->input, g_ptr_array_index(argv, argv->len - 2), error);
+    if (w) w->trim = tj;
+    return w;
+}
+
+/* Stream copy has to start at a keyframe: move the start back to one */
+static void trim_plan_keyframe(TrimJob *tj)
+{
+    GArray *keys = probe_keyframes(tj->input, tj->from - KEYFRAME_WINDOW, tj->from);
+    gboolean snapped = keys && keys->len > 0;
+    gdouble start = snapped ? g_array_index(keys, gdouble, keys->len - 1) : tj->from;
+    if (keys) g_array_free(keys, TRUE);
+    if (snapped && start < tj->from - 0.001)
+        trim_note(tj, "Start moved back to the keyframe at %.3f s (%.3f s earlier)\n", start, tj->from - start);
+    else if (!snapped && tj->from > 0)
+        trim_note(tj, "No keyframe found near the start; ffmpeg starts at the keyframe before %.3f s\n", tj->from);
+    tj->length = tj->to - start;
+    trim_add_step(tj, start, tj->to - start, NULL, tj->output);
+}
+
+/* Smart mode: re-encode from..k1, up to the first keyframe, and copy k1..to
+ * (a copy may end anywhere, only its start has to be a keyframe). Returns
+ * FALSE when there is no keyframe inside the range to copy from. */
+static gboolean trim_plan_smart(TrimJob *tj, const char *encoder, GError **error)
+{
+    gdouble from = tj->from, to = tj->to;
+    GArray *head = probe_keyframes(tj->input, from, MIN(to, from + KEYFRAME_WINDOW));
+    gboolean found = head && head->len > 0;
+    gdouble k1 = found ? g_array_index(head, gdouble, 0) : 0.0;
+    if (head) g_array_free(head, TRUE);
+    if (!found || to - k1 <= 0.001) return FALSE;
+
+    if (k1 - from <= 0.001) {
+        trim_add_step(tj, k1, to - k1, NULL, tj->output);
+        trim_note(tj, "The start is a keyframe; copying %.3f s\n", to - k1);
+        return TRUE;
+    }
+    gboolean ts = trim_needs_ts(&tj->info);
+    if (ts && !trim_ts_usable(&tj->info, tj->settings)) {
+        trim_note(tj, "Some kept streams cannot be joined through MPEG-TS; cutting at keyframes\n");
+        trim_plan_keyframe(tj);
+        return TRUE;
+    }
+    tj->tmpdir = g_dir_make_tmp("bac-trim-XXXXXX", error);
+    if (!tj->tmpdir) return FALSE;
+    const char *dot = strrchr(tj->output, '.');
+    if (dot && strchr(dot, G_DIR_SEPARATOR)) dot = NULL;
+    const char *ext = ts ? ".ts" : dot ? dot : ".mkv";
+    GString *list = g_string_new(NULL);
+    for (gint i = 0; i < 2; i++) {
+        gchar *name = g_strdup_printf("part%d%s", i, ext);
+        gchar *path = g_build_filename(tj->tmpdir, name, NULL);
+        if (i == 0)
+            trim_add_step(tj, from, k1 - from, encoder, path);
+        else
+            trim_add_step(tj, k1, to - k1, NULL, path);
+        g_string_append_printf(list, "file '%s'\n", name);
+        g_free(path);
+        g_free(name);
+    }
+    gchar *list_path = g_build_filename(tj->tmpdir, "parts.txt", NULL);
+    gboolean ok = g_file_set_contents(list_path, list->str, -1, error);
+    g_string_free(list, TRUE);
+    if (ok) {
+        GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+        const char *concat[] = {"ffmpeg", "-y", "-f", "concat", "-safe", "0", "-i", list_path,
+                                "-map", "0", "-c", "copy", tj->output, NULL};
+        for (gint i = 0; concat[i]; i++)
+            g_ptr_array_add(argv, g_strdup(concat[i]));
+        g_ptr_array_add(argv, NULL);
+        g_ptr_array_add(tj->steps, argv);
+        trim_note(tj, "Re-encoding %.3f s at the start with %s, copying %.3f s\n", k1 - from, encoder, to - k1);
+    }
+    g_free(list_path);
+    return ok;
+}
+
+/* Fill tj->steps. Returns why the trim cannot run, or NULL. */
+static gchar *trim_plan(TrimJob *tj)
+{
+    const MediaInfo *info = &tj->info;
+    if (info->duration > 0 && tj->to > info->duration) tj->to = info->duration;
+    if (tj->to <= tj->from)
+        return g_strdup("the end of the trim range must be after its start");
+    tj->length = tj->to - tj->from;
+
+    GError *error = NULL;
+    gchar *problem = NULL;
+    const char *encoder = info->video_codec && tj->smart ? trim_edge_encoder(info) : NULL;
+    if (tj->smart && info->video_codec && !encoder)
+        trim_note(tj, "No encoder for %s is available to re-encode the start; cutting at keyframes\n", info->video_codec);
+    if (!info->video_codec) {
+        /* every audio packet can start a stream: cut exactly */
+        trim_add_step(tj, tj->from, tj->to - tj->from, NULL, tj->output);
+    } else if (encoder && trim_plan_smart(tj, encoder, &error)) {
+        /* planned */
+    } else if (error) {
+        problem = g_strdup(error->message);
+        g_clear_error(&error);
+    } else if (encoder && tj->to - tj->from <= KEYFRAME_WINDOW) {
+        /* the whole range lies within one GOP */
+        trim_add_step(tj, tj->from, tj->to - tj->from, encoder, tj->output);
+        trim_note(tj, "No keyframe inside the range; re-encoding all of it with %s\n", encoder);
+    } else {
+        if (encoder)
+            trim_note(tj, "No keyframe found near the start; cutting at keyframes\n");
+        trim_plan_keyframe(tj);
+    }
+    return problem;
+}
+
+static gboolean trim_planned_idle(gpointer data)
+{
+    TrimJob *tj = data;
+    g_thread_join(trim_thread);
+    trim_thread = NULL;
+    trim_planning = NULL;
+    if (tj->cancelled) {
+        trim_job_free(tj);
+        return G_SOURCE_REMOVE;
+    }
+    gtk_text_buffer_insert_at_cursor(log_buffer, tj->notes->str, -1);
     GError *error = NULL;
+    if (!tj->problem && trim_run_next(tj, &error)) {
+        gtk_widget_set_sensitive(audio_combo, FALSE);
+        gtk_widget_set_sensitive(video_combo, FALSE);
+        return G_SOURCE_REMOVE;
+    }
+    const char *reason = tj->problem ? tj->problem : error ? error->message : "Failed to spawn ffmpeg";
+    trim_log("%s\n", reason);
+    show_alert(NULL, "Cannot trim", reason);
+    g_clear_error(&error);
+    trim_job_free(tj);
+    update_start_button_state();
+    gtk_widget_set_sensitive(stop_button, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/* Both probes read the file, which takes a while on large ones */
+static gpointer trim_plan_thread(gpointer data)
+{
+    TrimJob *tj = data;
+    if (probe_media_info(tj->input, &tj->info))
+        tj->problem = trim_plan(tj);
+    else
+        tj->problem = g_strdup_printf("cannot read %s", tj->input);
+    g_idle_add(trim_planned_idle, tj);
+    return NULL;
+}
+
+/* Cut the input to the Trim range into `output_file`. The input is probed
+ * and the steps planned on trim_thread; trim_planned_idle starts them. */
+static gboolean start_trim(gchar **problem)
+{
+    gdouble from = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trim_from_spin));
+    gdouble to = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trim_to_spin));
+    if (to <= from) {
+        *problem = g_strdup("the end of the trim range must be after its start");
+        return FALSE;
+    }
+    if (trim_thread) {
+        *problem = g_strdup("another trim is still being prepared");
+        return FALSE;
+    }
+    TrimJob *tj = g_new0(TrimJob, 1);
+    tj->steps = g_ptr_array_new_with_free_func((GDestroyNotify)g_ptr_array_unref);
+    tj->input = g_strdup(input_file);
+    tj->output = g_strdup(output_file);
+    tj->from = from;
+    tj->to = to;
+    tj->smart = gtk_check_button_get_active(GTK_CHECK_BUTTON(trim_smart_check));
+    tj->settings = job_settings_from_ui();
+    tj->notes = g_string_new(NULL);
+    trim_log("Looking up keyframes in %s\n", tj->input);
+    trim_planning = tj;
+    trim_thread = g_thread_new("trim", trim_plan_thread, tj);
+    return TRUE;
+}
+
+/* The trimmed output, probed on probe_pool */
+static void trim_output_probed(ProbeResult *res)
+{
+    TrimJob *tj = res->data;
+    if (res->ok && res->info.duration > 0) {
+        gchar *size = g_format_size(res->info.size);
+        gchar *length = format_duration(res->info.duration);
+        gchar *expected = format_duration(tj->length);
+        trim_log("Trimmed: %s, %s, %s (expected %s)\n", tj->output, size, length, expected);
+        g_free(size);
+        g_free(length);
+        g_free(expected);
+    } else {
+        trim_log("Trim failed, see the output above.\n");
+    }
+    trim_job_free(tj);
+}
+
+/* A trim step ended: start the next one, or report and clean up */
+static void trim_step_finished(FfmpegWorker *w, gboolean ok)
+{
+    TrimJob *tj = w->trim;
+    w->trim = NULL;
+    if (ok && tj->next < tj->steps->len) {
+        GError *error = NULL;
+        if (trim_run_next(tj, &error)) return;
+        trim_log("%s\n", error ? error->message : "Failed to spawn ffmpeg");
+        g_clear_error(&error);
+        ok = FALSE;
+    }
+    if (!ok) {
+        trim_log("Trim failed, see the output above.\n");
+        trim_job_free(tj);
+        return;
+    }
+    probe_in_background(tj->output, trim_output_probed, tj);
+}
+
+static void trim_controls_update(gpointer user_data)
+{
+    gboolean on = gtk_check_button_get_active(GTK_CHECK_BUTTON(trim_check));
+    gtk_widget_set_sensitive(trim_from_spin, on);
+    gtk_widget_set_sensitive(trim_to_spin, on);
+    gtk_widget_set_sensitive(trim_smart_check, on);
+}
+
+/* Start conversion */
+static void on_start_clicked(GtkButton *button, gpointer user_data) {
+    // Disable all except stop
+    gtk_widget_set_sensitive(start_button, FALSE);
+    gtk_widget_set_sensitive(preview_button, FALSE);
+    gtk_widget_set_sensitive(stop_button, TRUE);
+    gtk_text_buffer_set_text(log_buffer, "Starting conversion...\n", -1);
+
+    gchar *audio_dup = NULL;
+    gchar *video_dup = NULL;
+    gchar *reason = NULL;
+    get_selected_codecs(&audio_dup, &video_dup);
+    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(trim_check))) {
+        /* streams are copied; the codec selection does not apply */
+        if (!start_trim(&reason)) {
+            gtk_text_buffer_insert_at_cursor(log_buffer, reason, -1);
+            gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+            show_alert(NULL, "Cannot trim", reason);
+            g_free(reason);
+            update_start_button_state();
+            gtk_widget_set_sensitive(stop_button, FALSE);
+        }
+    } else if (!selected_encoders_usable(audio_dup, video_dup, &reason) ||
+        (reason = job_settings_problem(output_file, audio_dup, video_dup, NULL)) != NULL) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, reason, -1);
+        gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+        show_alert(NULL, "Cannot convert with these settings", reason);
+        g_free(reason);
+        update_start_button_state();
+        gtk_widget_set_sensitive(stop_button, FALSE);
+    } else if (extra_outputs && extra_outputs->len > 0) {
+        if (!start_fanout(audio_dup, video_dup, &reason)) {
+            gtk_text_buffer_insert_at_cursor(log_buffer, reason, -1);
+            gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+            show_alert(NULL, "Cannot convert with these settings", reason);
+            g_free(reason);
+            update_start_button_state();
+            gtk_widget_set_sensitive(stop_button, FALSE);
+        }
+    } else if (!start_conversion(input_file, output_file, audio_dup, video_dup, NULL, NULL, NULL, NULL)) {
+        /* Restore UI since spawn failed */
+        update_start_button_state();
+        gtk_widget_set_sensitive(stop_button, FALSE);
+    }
+    g_free(audio_dup);
+    g_free(video_dup);
+}
+
+#define PREVIEW_SECONDS 10
+
+/* Encode PREVIEW_SECONDS from the chosen timestamp into a temporary file with
+ * exactly the argv Start would use, plus an input-side -ss (demuxer seek, so
+ * nothing before the window is decoded) and -t. */
+static void on_preview_clicked(GtkButton *button, gpointer user_data)
+{
+    gchar *audio = NULL;
+    gchar *video = NULL;
+    gchar *reason = NULL;
+    get_selected_codecs(&audio, &video);
+    if (!selected_encoders_usable(audio, video, &reason) ||
+        (reason = job_settings_problem(output_file, audio, video, NULL)) != NULL) {
+        show_alert(NULL, "Cannot convert with these settings", reason);
+        g_free(reason);
+        g_free(audio);
+        g_free(video);
+        return;
+    }
+
+    /* probed when the input was chosen */
+    const MediaInfo *src = media_info_for(input_file);
+    gdouble duration = src ? src->duration : 0;
+    gdouble at = gtk_spin_button_get_value(GTK_SPIN_BUTTON(preview_at_spin));
+    if (duration > 0 && at + PREVIEW_SECONDS > duration)
+        at = MAX(0.0, duration - PREVIEW_SECONDS);
 
-    if (!g_spawn_command_line_sync(command, &stdout_str, &stderr_str, &exit_status, &error)) {
-        g_warning("Failed to run ffprobe: %s", error->message);
+    /* same extension as the real output so the same muxer is picked */
+    const char *dot = output_file ? strrchr(output_file, '.') : NULL;
+    if (dot && strchr(dot, G_DIR_SEPARATOR)) dot = NULL;
+    gchar *tmpl = g_strdup_printf("bac-preview-XXXXXX%s", dot ? dot : ".mkv");
+    gchar *tmp = NULL;
+    GError *error = NULL;
+    gint fd = g_file_open_tmp(tmpl, &tmp, &error);
+    g_free(tmpl);
+    if (fd < 0) {
+        show_alert(NULL, "Preview failed", error->message);
         g_error_free(error);
-        g_free(command);
+        g_free(audio);
+        g_free(video);
         return;
     }
-    g_free(command);
-    g_free(ffprobe_path);
+    close(fd);
+    if (preview_file) {
+        g_unlink(preview_file);
+        g_free(preview_file);
+    }
+    preview_file = g_strdup(tmp);
 
-    if (exit_status != 0) {
-        g_warning("ffprobe failed: %s", stderr_str);
-        g_free(stdout_str);
-        g_free(stderr_str);
+    GPtrArray *argv = build_ffmpeg_argv(input_file, output_file, audio, video, NULL, NULL, NULL);
+    /* argv is "ffmpeg -y -i <in> ... <out> NULL" */
+    g_ptr_array_insert(argv, 2, g_strdup("-ss"));
+    g_ptr_array_insert(argv, 3, seconds_arg(at));
+    guint out = argv->len - 2;
+    g_free(argv->pdata[out]);
+    argv->pdata[out] = g_strdup(tmp);
+    g_ptr_array_insert(argv, out, g_strdup("-t"));
+    g_ptr_array_insert(argv, out + 1, g_strdup_printf("%d", PREVIEW_SECONDS));
+
+    gchar *at_text = format_duration(at);
+    gchar *msg = g_strdup_printf("Preview: encoding %d s from %s into %s\n", PREVIEW_SECONDS, at_text, tmp);
+    gtk_text_buffer_set_text(log_buffer, msg, -1);
+    g_free(msg);
+    g_free(at_text);
+
+    FfmpegWorker *w = spawn_ffmpeg_worker(argv, input_file, tmp, &error);
+    g_ptr_array_free(argv, TRUE);
+    if (!w) {
+        show_alert(NULL, "ffmpeg error", error ? error->message : "Failed to spawn ffmpeg");
+        if (error) g_error_free(error);
+    } else {
+        w->preview = TRUE;
+        w->source_duration = duration;
+        w->audio = g_strdup(audio);
+        w->video = g_strdup(video);
+        gtk_widget_set_sensitive(start_button, FALSE);
+        gtk_widget_set_sensitive(preview_button, FALSE);
+        gtk_widget_set_sensitive(stop_button, TRUE);
+    }
+    g_free(tmp);
+    g_free(audio);
+    g_free(video);
+}
+
+/* A finished preview, its output being probed on probe_pool */
+typedef struct {
+    gdouble wall;            /* seconds the encode took */
+    gdouble source_duration;
+} PreviewCheck;
+
+static void preview_probed(ProbeResult *res)
+{
+    PreviewCheck *pc = res->data;
+    const MediaInfo *out = &res->info;
+    gdouble wall = pc->wall;
+    gdouble source_duration = pc->source_duration;
+    g_free(pc);
+    if (!res->ok || out->duration <= 0) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, "Preview failed, see the output above.\n", -1);
+        return;
+    }
+    gdouble speed = out->duration / wall;
+    gdouble full = source_duration > 0 ? source_duration : out->duration;
+    gchar *size = g_format_size((guint64)(out->size * (full / out->duration)));
+    gchar *length = format_duration(full);
+    gchar *eta = format_duration(full / speed);
+    gchar *msg = g_strdup_printf("Preview: %.1f s encoded in %.1f s (%.2fx realtime)\n"
+                                 "Projected output: %s for %s, about %s to convert\n",
+                                 out->duration, wall, speed, size, length, eta);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+    g_free(size);
+    g_free(length);
+    g_free(eta);
+}
+
+/* Measured speed of a finished preview and what it predicts for the whole file */
+static void preview_report(FfmpegWorker *w, gboolean ok)
+{
+    gdouble wall = (g_get_monotonic_time() - w->started) / (gdouble)G_USEC_PER_SEC;
+    if (!ok || wall <= 0) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, "Preview failed, see the output above.\n", -1);
         return;
     }
+    PreviewCheck *pc = g_new0(PreviewCheck, 1);
+    pc->wall = wall;
+    pc->source_duration = w->source_duration;
+    probe_in_background(w->output, preview_probed, pc);
+}
+
+/* Child and IO callbacks */
+static gboolean enable_ui_after_child(gpointer user_data) {
+    /* Another conversion may have started in the meantime */
+    if (workers && workers->len > 0)
+        return G_SOURCE_REMOVE;
+    update_start_button_state();
+    gtk_widget_set_sensitive(stop_button, FALSE);
+    /* Re-enable codec combos unless their 'Copy' checkboxes are active */
+    if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
+        gtk_widget_set_sensitive(audio_combo, TRUE);
+    else
+        gtk_widget_set_sensitive(audio_combo, FALSE);
+    if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+        gtk_widget_set_sensitive(video_combo, TRUE);
+    else
+        gtk_widget_set_sensitive(video_combo, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+/* Common tail for a worker whose conversion has ended, however it ran */
+static void worker_finished(FfmpegWorker *w)
+{
+    gboolean was_batch = w->batch;
+    mem_model_learn(w);
+    g_ptr_array_remove(workers, w);
+    worker_free(w);
+    g_idle_add(enable_ui_after_child, NULL);
+    /* If batch mode is running, schedule continuation to next file */
+    if (batch_running && was_batch) {
+        /* schedule on main loop to avoid reentrancy in child watch */
+        g_idle_add(continue_batch_idle, NULL);
+    }
+}
+
+/* Why a conversion failed, as far as its output tells */
+typedef enum {
+    FAILURE_UNKNOWN,
+    FAILURE_INPUT,        /* unreadable input, full disk... retrying cannot help */
+    FAILURE_ENCODER,      /* encoder missing or refused to open */
+    FAILURE_PIX_FMT,
+    FAILURE_AUDIO_FMT     /* sample rate, sample format or channel layout */
+} FailureClass;
+
+static gboolean tail_has(const char *tail, const char * const *needles)
+{
+    for (gint i = 0; needles[i]; i++)
+        if (strstr(tail, needles[i])) return TRUE;
+    return FALSE;
+}
+
+/* Classify from the last lines ffmpeg printed. `video_side` tells which
+ * stream is to blame: ffmpeg prefixes encoder messages with "[<name> @". */
+static FailureClass classify_failure(const FfmpegWorker *w, gboolean *video_side)
+{
+    static const char * const input_errors[] = {
+        "No such file or directory", "Invalid data found when processing input",
+        "No space left on device", "Permission denied", "moov atom not found", NULL
+    };
+    static const char * const encoder_errors[] = {
+        "Unknown encoder", "Encoder not found", "Error while opening encoder",
+        "Could not open encoder", "Error initializing output stream",
+        "Error selecting an encoder", "Error opening output file", NULL
+    };
+    static const char * const pix_errors[] = {
+        "Incompatible pixel format", "pixel format", "Pixel format", NULL
+    };
+    static const char * const audio_errors[] = {
+        "sample rate", "Sample rate", "sample format", "Sample format",
+        "channel layout", "Channel layout", NULL
+    };
+    const char *tail = w->tail ? w->tail->str : "";
+    *video_side = FALSE;
+    if (tail_has(tail, input_errors)) return FAILURE_INPUT;
+
+    gchar *vtag = w->video ? g_strdup_printf("[%s @", w->video) : NULL;
+    gchar *atag = w->audio ? g_strdup_printf("[%s @", w->audio) : NULL;
+    gboolean blames_video = vtag && strstr(tail, vtag);
+    gboolean blames_audio = atag && strstr(tail, atag);
+    g_free(vtag);
+    g_free(atag);
+
+    FailureClass cls = FAILURE_UNKNOWN;
+    if (tail_has(tail, pix_errors)) {
+        cls = FAILURE_PIX_FMT;
+        *video_side = TRUE;
+    } else if (tail_has(tail, audio_errors)) {
+        cls = FAILURE_AUDIO_FMT;
+    } else if (tail_has(tail, encoder_errors)) {
+        cls = FAILURE_ENCODER;
+        if (blames_video && !blames_audio)
+            *video_side = TRUE;
+        else if (!blames_audio)
+            /* no tag: name the side whose encoder the message mentions */
+            *video_side = w->video && strstr(tail, w->video) && !(w->audio && strstr(tail, w->audio));
+    }
+    return cls;
+}
+
+/* Next encoder to try for one side of a failed job: other encoders of the
+ * same codec first, then the rest of the map in order. Candidates must be
+ * offered by this ffmpeg, untried, usable in software and accepted by the
+ * output container. Returns a new string or NULL. */
+static gchar *fallback_encoder(const FfmpegWorker *w, BatchJob *job, gboolean video)
+{
+    const CodecMap *map = video ? video_encoder_map : audio_encoder_map;
+    GPtrArray *available = video ? video_codecs : audio_codecs;
+    const char *current = video ? w->video : w->audio;
+    const char *codec = NULL;
+    for (const CodecMap *m = map; m->codec && !codec; m++)
+        if (g_strcmp0(m->encoder, current) == 0 || g_strcmp0(m->codec, current) == 0) codec = m->codec;
+
+    GPtrArray *candidates = g_ptr_array_new();
+    for (guint i = 0; codec && available && i < available->len; i++) {
+        const char *e = g_ptr_array_index(available, i);
+        if (g_str_has_prefix(e, codec) && (e[strlen(codec)] == '_' || e[strlen(codec)] == '\0'))
+            g_ptr_array_add(candidates, (gpointer)e);
+        for (const CodecMap *m = map; m->codec; m++)
+            if (g_strcmp0(m->codec, codec) == 0 && g_strcmp0(m->encoder, e) == 0)
+                g_ptr_array_add(candidates, (gpointer)e);
+    }
+    for (const CodecMap *m = map; m->codec; m++)
+        g_ptr_array_add(candidates, (gpointer)m->encoder);
+
+    gchar *found = NULL;
+    for (guint i = 0; i < candidates->len && !found; i++) {
+        const char *e = g_ptr_array_index(candidates, i);
+        if (g_strcmp0(e, current) == 0) continue;
+        if (!available || !g_ptr_array_find_with_equal_func(available, e, g_str_equal, NULL)) continue;
+        if (job->tried && g_ptr_array_find_with_equal_func(job->tried, e, g_str_equal, NULL)) continue;
+        gchar *reason = NULL;
+        if (!encoder_usable(e, &reason)) {
+            g_free(reason);
+            continue;
+        }
+        gchar *problem = job_settings_problem(w->output, video ? NULL : e, video ? e : NULL, &job->info);
+        if (problem) {
+            g_free(problem);
+            continue;
+        }
+        found = g_strdup(e);
+    }
+    g_ptr_array_free(candidates, TRUE);
+    return found;
+}
+
+/* -vf value converting to a pixel format `encoder` takes */
+static gchar *pix_fmt_filter(const char *encoder)
+{
+    EncoderCaps *c = encoder_caps_lookup(encoder);
+    for (gint i = 0; c && c->pix_fmts && c->pix_fmts[i]; i++)
+        if (!g_strv_contains(hw_pix_fmts, c->pix_fmts[i]))
+            return g_strdup_printf("format=%s", c->pix_fmts[i]);
+    return g_strdup("format=yuv420p");
+}
+
+/* -af value converting to a sample format, rate and layout `encoder` takes */
+static gchar *audio_fmt_filter(const char *encoder)
+{
+    EncoderCaps *c = encoder_caps_lookup(encoder);
+    const char *rate = c && c->sample_rates && c->sample_rates[0] ? c->sample_rates[0] : "48000";
+    /* prefer 48 kHz when the encoder lists it */
+    if (c && c->sample_rates && g_strv_contains((const gchar * const *)c->sample_rates, "48000")) rate = "48000";
+    if (c && c->sample_fmts && c->sample_fmts[0])
+        return g_strdup_printf("aresample=%s,aformat=sample_fmts=%s:sample_rates=%s:channel_layouts=stereo",
+                               rate, c->sample_fmts[0], rate);
+    return g_strdup_printf("aresample=%s,aformat=sample_rates=%s:channel_layouts=stereo", rate, rate);
+}
+
+static gdouble batch_job_seconds(const char *path)
+{
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    return job && job->info.probed ? job->info.duration : 0;
+}
+
+/* Batch-wide progress in media seconds: everything queued for this run
+ * against what finished and what the running jobs have encoded so far.
+ * Throughput is media seconds per wall-clock second over the run, so the
+ * ETA follows the actual worker count and job mix. Shown in the batch
+ * dialog and, with BAC_PROGRESS=1, printed to standard output. */
+static void batch_progress_update(gboolean finished)
+{
+    if (!batch_files) return;
+    gdouble total = 0, pending = 0, flight = 0, flight_done = 0;
+    guint unknown = 0;
+    for (guint i = batch_first; i < batch_files->len; i++) {
+        gdouble d = batch_job_seconds(g_ptr_array_index(batch_files, i));
+        if (d <= 0) unknown++;
+        total += d;
+        if (i >= batch_index) pending += d;
+    }
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (!w->batch) continue;
+        if (w->group_inputs) {
+            /* one clock for the group: each input is interleaved by timestamp */
+            for (guint j = 0; j < w->group_inputs->len; j++) {
+                gdouble d = batch_job_seconds(g_ptr_array_index(w->group_inputs, j));
+                flight += d;
+                flight_done += CLAMP(w->encoded, 0, d);
+            }
+            continue;
+        }
+        gdouble d = batch_job_seconds(w->input);
+        gdouble done = w->encoded;
+#ifdef HAVE_LIBAV
+        if (w->inproc)
+            done = d * g_atomic_int_get(&((InprocJob *)w->inproc)->permille) / 1000.0;
+#endif
+        flight += d;
+        flight_done += CLAMP(done, 0, d);
+    }
+    gdouble remaining = finished ? 0 : MAX(pending + flight - flight_done, 0);
+    gdouble done = MAX(total - remaining, 0);
+    gdouble elapsed = (g_get_monotonic_time() - batch_started_us) / (gdouble)G_USEC_PER_SEC;
+    gdouble rate = elapsed > 0 ? (batch_encoded_seconds + flight_done) / elapsed : 0;
 
-    JsonParser *parser = json_parser_new();
-    if (!json_parser_load_from_data(parser, stdout_str, -1, &error)) {
-        g_warning("Failed to parse json: %s", error->message);
-        g_error_free(error);
-        g_object_unref(parser);
-        g_free(stdout_str);
-        g_free(stderr_str);
-        return;
+    gchar *done_str = format_duration(done);
+    gchar *total_str = format_duration(total);
+    GString *line = g_string_new(NULL);
+    g_string_append_printf(line, "%.1f%%, %s of %s", total > 0 ? 100.0 * done / total : 0.0, done_str, total_str);
+    if (rate > 0)
+        g_string_append_printf(line, ", %.2fx", rate);
+    if (!finished && rate > 0 && elapsed >= BATCH_ETA_MIN_SECONDS) {
+        gchar *eta = format_duration(remaining / rate);
+        g_string_append_printf(line, ", about %s left", eta);
+        g_free(eta);
     }
+    if (unknown > 0)
+        g_string_append_printf(line, " (%u not probed yet)", unknown);
+    g_free(done_str);
+    g_free(total_str);
 
-    JsonNode *root = json_parser_get_root(parser);
-    JsonObject *obj = json_node_get_object(root);
-    JsonArray *streams = json_object_get_array_member(obj, "streams");
-
-    JsonObject *format_obj = json_object_get_object_member(obj, "format");
-    if (format_obj) {
-        const char *fmt_name = json_object_get_string_member(format_obj, "format_name");
-        if (fmt_name) {
-            gchar **parts = g_strsplit(fmt_name, ",", 2);
-            gchar *first = g_strstrip(parts[0]);
-            gchar *low = g_utf8_strdown(first, -1);
-            const char *mapped = map_probe_format_to_container(low);
-            g_free(current_format);
-            if (mapped)
-                current_format = g_strdup(mapped);
-            else
-                current_format = g_strdup(low);
-            g_free(low);
-            g_strfreev(parts);
-        }
-    }
-    for (guint i = 0; i < json_array_get_length(streams); i++) {
-        JsonNode *stream_node = json_array_get_element(streams, i);
-        JsonObject *stream = json_node_get_object(stream_node);
-        const char *codec_type = json_object_get_string_member(stream, "codec_type");
-        const char *codec_name = json_object_get_string_member(stream, "codec_name");
-
-        if (g_strcmp0(codec_type, "audio") == 0) {
-            input_has_audio = TRUE;
-            if (!default_audio_codec)
-                default_audio_codec = g_strdup(codec_name);
-        } else if (g_strcmp0(codec_type, "video") == 0) {
-            input_has_video = TRUE;
-            if (!default_video_codec)
-                default_video_codec = g_strdup(codec_name);
-        }
+    if (batch_progress_bar) {
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(batch_progress_bar), total > 0 ? done / total : 0.0);
+        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(batch_progress_bar), line->str);
     }
+    gint64 now = g_get_monotonic_time();
+    if (progress_stdout && (finished || now - batch_progress_printed >= BATCH_PROGRESS_PRINT_SECONDS * G_USEC_PER_SEC)) {
+        batch_progress_printed = now;
+        g_print("batch: %s\n", line->str);
+        fflush(stdout);
+    }
+    g_string_free(line, TRUE);
+}
 
-    g_object_unref(parser);
-    g_free(stdout_str);
-    g_free(stderr_str);
+/* Batch report: one CSV row per converted job in the run's log directory,
+ * with its settings, encode time and, when measured, quality scores. Rows
+ * are appended as jobs finish, so presets can be compared across runs. */
+typedef struct {
+    gchar *input;
+    gchar *output;
+    gchar *audio;
+    gchar *video;
+    gchar *preset;
+    gdouble duration;       /* media seconds */
+    gdouble encode_seconds; /* wall time of the conversion */
+    gdouble psnr;           /* dB; scores are < 0 when not measured */
+    gdouble ssim;
+    gdouble vmaf;
+} JobReport;
+
+static JobReport *job_report_new(FfmpegWorker *w, const char *input, const char *output)
+{
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, input) : NULL;
+    JobReport *r = g_new0(JobReport, 1);
+    r->input = g_strdup(input);
+    r->output = g_strdup(output);
+    r->audio = g_strdup(w->audio);
+    r->video = g_strdup(w->video);
+    r->preset = g_strdup(job && job->settings ? job->settings->preset : NULL);
+    r->duration = batch_job_seconds(input);
+    r->encode_seconds = (g_get_monotonic_time() - w->started) / (gdouble)G_USEC_PER_SEC;
+    r->psnr = r->ssim = r->vmaf = -1;
+    return r;
 }
 
-/* Helper to update output filename */
-static void update_output_label() {
-    if (!input_file) return;
-    char *dir = g_path_get_dirname(input_file);
-    char *basename = g_path_get_basename(input_file);
-    char *dot = strrchr(basename, '.');
-    if (dot) {
-        size_t name_len = dot - basename;
-        char *name = g_strndup(basename, name_len);
-        const char *orig_ext = dot;
-        const char *new_ext = format_to_extension(current_format);
-        if (!new_ext) new_ext = orig_ext;
-        output_file = g_build_filename(dir, g_strdup_printf("%s_out%s", name, new_ext), NULL);
-        g_free(name);
-    } else {
-        const char *new_ext = format_to_extension(current_format);
-        if (new_ext)
-            output_file = g_build_filename(dir, g_strdup_printf("%s_out%s", basename, new_ext), NULL);
-        else
-            output_file = g_build_filename(dir, g_strdup_printf("%s_out", basename), NULL);
-    }
-    gtk_label_set_text(GTK_LABEL(output_label), output_file);
-    g_free(dir);
-    g_free(basename);
+static void job_report_free(JobReport *r)
+{
+    g_free(r->input);
+    g_free(r->output);
+    g_free(r->audio);
+    g_free(r->video);
+    g_free(r->preset);
+    g_free(r);
 }
 
-/* Use the modern GtkFileDialog API (GTK >= 4.8) and open it asynchronously.
- * The finish callback will handle the selected file and update UI state. */
-static void on_file_dialog_open_finish(GObject *source_object, GAsyncResult *res, gpointer user_data)
+static void report_csv_field(GString *row, const char *value, gboolean last)
 {
-    GtkFileDialog *dialog = GTK_FILE_DIALOG(source_object);
-    GError *error = NULL;
-    GFile *file = gtk_file_dialog_open_finish(dialog, res, &error);
-    if (!file) {
-        if (error) {
-            g_warning("File dialog error: %s", error->message);
-            g_error_free(error);
+    if (value && strpbrk(value, ",\"\r\n")) {
+        g_string_append_c(row, '"');
+        for (const char *p = value; *p; p++) {
+            if (*p == '"') g_string_append_c(row, '"');
+            g_string_append_c(row, *p);
         }
-        g_object_unref(dialog);
-        return;
+        g_string_append_c(row, '"');
+    } else if (value) {
+        g_string_append(row, value);
     }
+    g_string_append_c(row, last ? '\n' : ',');
+}
 
-    input_file = g_file_get_path(file);
-    gtk_label_set_text(GTK_LABEL(input_label), input_file);
-    g_free(default_audio_codec);
-    g_free(default_video_codec);
-    default_audio_codec = NULL;
-    default_video_codec = NULL;
-    detect_defaults(input_file);
-    if (!default_audio_codec) default_audio_codec = g_strdup("copy");
-    if (!default_video_codec) default_video_codec = g_strdup("copy");
+static void report_csv_number(GString *row, const char *format, gdouble value, gboolean last)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    report_csv_field(row, value >= 0 ? g_ascii_formatd(buf, sizeof(buf), format, value) : NULL, last);
+}
 
-    int active_idx = 0;
-    drop_down_set_items_from_ptrarray(audio_combo, &audio_model, audio_codecs, "No audio");
-    if (!input_has_audio) active_idx = 0;
-    else if (default_audio_codec) {
-        int best = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
-        active_idx = best + 1;
+static void job_report_write(const JobReport *r)
+{
+    if (!batch_log_dir) return;
+    gchar *path = g_build_filename(batch_log_dir, "report.csv", NULL);
+    gboolean fresh = !g_file_test(path, G_FILE_TEST_EXISTS);
+    FILE *f = g_fopen(path, "a");
+    if (!f) {
+        g_warning("cannot write %s: %s", path, g_strerror(errno));
+        g_free(path);
+        return;
     }
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), active_idx);
+    GString *row = g_string_new(fresh ? "input,output,audio,video,preset,media_seconds,encode_seconds,output_bytes,psnr,ssim,vmaf\n" : NULL);
+    GStatBuf st;
+    report_csv_field(row, r->input, FALSE);
+    report_csv_field(row, r->output, FALSE);
+    report_csv_field(row, r->audio, FALSE);
+    report_csv_field(row, r->video, FALSE);
+    report_csv_field(row, r->preset, FALSE);
+    report_csv_number(row, "%.3f", r->duration > 0 ? r->duration : -1, FALSE);
+    report_csv_number(row, "%.3f", r->encode_seconds, FALSE);
+    report_csv_number(row, "%.0f", g_stat(r->output, &st) == 0 ? (gdouble)st.st_size : -1, FALSE);
+    report_csv_number(row, "%.3f", r->psnr, FALSE);
+    report_csv_number(row, "%.5f", r->ssim, FALSE);
+    report_csv_number(row, "%.3f", r->vmaf, TRUE);
+    fputs(row->str, f);
+    fclose(f);
+    g_string_free(row, TRUE);
+    g_free(path);
+}
 
-    active_idx = 0;
-    drop_down_set_items_from_ptrarray(video_combo, &video_model, video_codecs, "No video");
-    if (!input_has_video) active_idx = 0;
-    else if (default_video_codec) {
-        int best = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
-        active_idx = best + 1;
-    }
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), active_idx);
+/* Optional quality check of converted batch jobs: ffmpeg's psnr and ssim
+ * filters (and libvmaf when this ffmpeg has it) compare each output with its
+ * source. One check runs at a time in a niced process beside the batch
+ * workers, so it overlaps with the next encodes instead of delaying them. */
+#define QUALITY_NICE 10
+#define QUALITY_TAIL_BYTES 16384
 
-    if (current_format) {
-        int fidx = find_format_index(current_format);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), fidx);
-        set_codecs_for_format(current_format);
-    } else {
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), 0);
-    }
-    update_output_label();
-    /* Enable UI controls now that an input was selected. */
-    update_start_button_state();
-    /* Enable copy checkboxes so user can toggle copy behavior */
-    gtk_widget_set_sensitive(copy_audio_check, TRUE);
-    gtk_widget_set_sensitive(copy_video_check, TRUE);
-    /* Format dropdown should be enabled */
-    gtk_widget_set_sensitive(format_combo_audio, TRUE);
-    /* Enable or disable audio controls based on detection and copy checkbox */
-    if (input_has_audio) {
-        /* If default is 'copy', set the checkbox active and disable combo */
-        if (default_audio_codec && g_strcmp0(default_audio_codec, "copy") == 0) {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
-            gtk_widget_set_sensitive(audio_combo, FALSE);
-            gtk_widget_set_sensitive(reset_audio, FALSE);
-        } else {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-            gtk_widget_set_sensitive(audio_combo, TRUE);
-            gtk_widget_set_sensitive(reset_audio, TRUE);
-        }
-    } else {
-        /* No audio: leave Copy unchecked and allow selection of 'No audio' */
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-        gtk_widget_set_sensitive(audio_combo, TRUE);
-        gtk_widget_set_sensitive(reset_audio, TRUE);
-    }
-    /* Enable or disable video controls based on detection and copy checkbox */
-    if (input_has_video) {
-        if (default_video_codec && g_strcmp0(default_video_codec, "copy") == 0) {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
-            gtk_widget_set_sensitive(video_combo, FALSE);
-            gtk_widget_set_sensitive(reset_video, FALSE);
-        } else {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-            gtk_widget_set_sensitive(video_combo, TRUE);
-            gtk_widget_set_sensitive(reset_video, TRUE);
-        }
-    } else {
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-        gtk_widget_set_sensitive(video_combo, TRUE);
-        gtk_widget_set_sensitive(reset_video, TRUE);
-    }
-    /* Ensure Start/Stop reflect running state */
-    gtk_widget_set_sensitive(stop_button, FALSE);
-    g_object_unref(file);
-    g_object_unref(dialog);
+typedef struct {
+    JobReport *report;
+    GPid pid;
+    GIOChannel *chan;
+    guint watch;
+    GString *tail;        /* the scores are printed last */
+} QualityRun;
+
+static gboolean quality_enabled = FALSE;
+static GQueue quality_queue = G_QUEUE_INIT; /* JobReport* waiting for a check */
+static QualityRun *quality_current = NULL;
+static GtkWidget *batch_quality_check = NULL;
+
+/* Checked during discovery, see detect_vmaf */
+static gboolean quality_has_vmaf(void)
+{
+    return quality_vmaf > 0;
 }
 
-static void on_choose_file_clicked(GtkButton *button, gpointer user_data) {
-    GtkWindow *window = GTK_WINDOW(user_data);
-    GtkFileDialog *dialog = gtk_file_dialog_new();
-    gtk_file_dialog_set_title(dialog, "Choose input file");
-    /* Open asynchronously; the finish callback will handle the chosen file */
-    gtk_file_dialog_open(dialog, window, NULL, on_file_dialog_open_finish, NULL);
+static void child_setup_low_priority(gpointer user_data)
+{
+    setpgid(0, 0);
+    setpriority(PRIO_PROCESS, 0, QUALITY_NICE);
 }
 
-static void on_copy_audio_toggled(GtkCheckButton *check, gpointer user_data) {
-    gboolean copy = gtk_check_button_get_active(check);
-    /* If conversion is running, keep combos disabled regardless */
-    if (ffmpeg_pid > 0) {
-        gtk_widget_set_sensitive(audio_combo, FALSE);
-    } else {
-        gtk_widget_set_sensitive(audio_combo, !copy);
-    }
-    /* Reset button should be disabled when copy is active */
-    gtk_widget_set_sensitive(reset_audio, !copy);
-    update_output_label();
+/* Both inputs start at 0 and the output is scaled to the source's size, so
+ * the metrics still apply when the job scaled or the streams start late */
+static gchar *quality_filtergraph(gboolean vmaf)
+{
+    guint n = vmaf ? 3 : 2;
+    GString *g = g_string_new("[0:v:0]settb=AVTB,setpts=PTS-STARTPTS[d];"
+                              "[1:v:0]settb=AVTB,setpts=PTS-STARTPTS[r];"
+                              "[d][r]scale2ref=flags=bicubic[ds][rs];");
+    g_string_append_printf(g, "[ds]split=%u", n);
+    for (guint i = 0; i < n; i++) g_string_append_printf(g, "[d%u]", i);
+    g_string_append_printf(g, ";[rs]split=%u", n);
+    for (guint i = 0; i < n; i++) g_string_append_printf(g, "[r%u]", i);
+    g_string_append(g, ";[d0][r0]psnr;[d1][r1]ssim");
+    if (vmaf) g_string_append(g, ";[d2][r2]libvmaf");
+    return g_string_free(g, FALSE);
 }
 
-static void on_copy_video_toggled(GtkCheckButton *check, gpointer user_data) {
-    gboolean copy = gtk_check_button_get_active(check);
-    if (ffmpeg_pid > 0) {
-        gtk_widget_set_sensitive(video_combo, FALSE);
-    } else {
-        gtk_widget_set_sensitive(video_combo, !copy);
+/* Summary lines: "PSNR y:.. average:41.2 ...", "SSIM Y:.. All:0.98 (17.1)",
+ * "VMAF score: 95.3" */
+static gdouble quality_score(const char *text, const char *line, const char *key)
+{
+    const char *p = strstr(text, line);
+    if (p) p = strstr(p, key);
+    if (!p) return -1;
+    gchar *end;
+    gdouble v = g_ascii_strtod(p + strlen(key), &end);
+    return end == p + strlen(key) ? -1 : v;
+}
+
+static void quality_start_next(void);
+
+static void quality_report_line(const JobReport *r)
+{
+    GString *line = g_string_new(NULL);
+    g_string_append_printf(line, "Quality of %s: PSNR %.2f dB, SSIM %.4f", r->output, r->psnr, r->ssim);
+    if (r->vmaf >= 0) g_string_append_printf(line, ", VMAF %.2f", r->vmaf);
+    g_string_append_c(line, '\n');
+    gtk_text_buffer_insert_at_cursor(log_buffer, line->str, -1);
+    g_string_free(line, TRUE);
+}
+
+static gboolean quality_output_cb(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+    QualityRun *q = user_data;
+    gchar tmp[1024];
+    gsize bytes_read = 0;
+    GIOStatus st = G_IO_STATUS_NORMAL;
+    if (condition & G_IO_IN)
+        st = g_io_channel_read_chars(source, tmp, sizeof(tmp), &bytes_read, NULL);
+    if (bytes_read > 0) {
+        g_string_append_len(q->tail, tmp, bytes_read);
+        if (q->tail->len > QUALITY_TAIL_BYTES)
+            g_string_erase(q->tail, 0, q->tail->len - QUALITY_TAIL_BYTES);
     }
-    /* Reset button should be disabled when copy is active */
-    gtk_widget_set_sensitive(reset_video, !copy);
-    update_output_label();
+    if (st == G_IO_STATUS_ERROR || st == G_IO_STATUS_EOF || (bytes_read == 0 && (condition & (G_IO_HUP | G_IO_ERR)))) {
+        q->watch = 0;
+        return FALSE;
+    }
+    return TRUE;
 }
 
-/* Combo changes */
-static void on_audio_combo_changed(GtkComboBox *combo, gpointer user_data) {
-    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), audio_model);
-    if (sel) {
-        if (g_strcmp0(sel, "copy") == 0 || g_strcmp0(sel, "Copy") == 0) {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
-        } else {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-        }
-        g_free(sel);
+static void quality_child_watch_cb(GPid pid, gint status, gpointer user_data)
+{
+    QualityRun *q = user_data;
+    if (q->watch) {
+        g_source_remove(q->watch);
+        q->watch = 0;
+        gchar tmp[1024];
+        gsize n = 0;
+        while (g_io_channel_read_chars(q->chan, tmp, sizeof(tmp), &n, NULL) == G_IO_STATUS_NORMAL && n > 0)
+            g_string_append_len(q->tail, tmp, n);
     }
-    update_output_label();
+    g_io_channel_shutdown(q->chan, FALSE, NULL);
+    g_io_channel_unref(q->chan);
+    g_spawn_close_pid(pid);
+    child_registry_remove(pid);
+
+    JobReport *r = q->report;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        r->psnr = quality_score(q->tail->str, "] PSNR ", "average:");
+        r->ssim = quality_score(q->tail->str, "] SSIM ", "All:");
+        r->vmaf = quality_score(q->tail->str, "VMAF score", ": ");
+        quality_report_line(r);
+    } else if (!WIFSIGNALED(status)) { /* a signal means it was stopped */
+        gchar *msg = g_strdup_printf("Quality check of %s failed, see report.csv for the job without scores\n", r->output);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+    }
+    job_report_write(r);
+    job_report_free(r);
+    g_string_free(q->tail, TRUE);
+    g_free(q);
+    quality_current = NULL;
+    quality_start_next();
 }
 
-static void on_video_combo_changed(GtkComboBox *combo, gpointer user_data) {
-    gchar *sel = drop_down_get_active_text(GTK_WIDGET(combo), video_model);
-    if (sel) {
-        if (g_strcmp0(sel, "copy") == 0 || g_strcmp0(sel, "Copy") == 0) {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
-        } else {
-            gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
+static void quality_start_next(void)
+{
+    while (!quality_current && !g_queue_is_empty(&quality_queue)) {
+        JobReport *r = g_queue_pop_head(&quality_queue);
+        gchar *graph = quality_filtergraph(quality_has_vmaf());
+        gchar *argv[] = {ffmpeg_path ? ffmpeg_path : "ffmpeg", "-hide_banner", "-nostats", "-nostdin",
+                         "-i", r->output, "-i", r->input, "-lavfi", graph, "-f", "null", "-", NULL};
+        GPid pid = 0;
+        gint stderr_fd = -1;
+        GError *error = NULL;
+        gboolean spawned = g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL,
+                                                    child_setup_low_priority, NULL, &pid, NULL, NULL, &stderr_fd, &error);
+        g_free(graph);
+        if (!spawned) {
+            gchar *msg = g_strdup_printf("Cannot check quality of %s: %s\n", r->output, error->message);
+            gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+            g_free(msg);
+            g_error_free(error);
+            job_report_write(r);
+            job_report_free(r);
+            continue;
         }
-        g_free(sel);
+        child_registry_add(pid, r->output);
+        QualityRun *q = g_new0(QualityRun, 1);
+        q->report = r;
+        q->pid = pid;
+        q->tail = g_string_new(NULL);
+        q->chan = g_io_channel_unix_new(stderr_fd);
+        g_io_channel_set_encoding(q->chan, NULL, NULL);
+        g_io_channel_set_buffered(q->chan, FALSE);
+        g_io_channel_set_flags(q->chan, G_IO_FLAG_NONBLOCK, NULL);
+        q->watch = g_io_add_watch(q->chan, G_IO_IN | G_IO_HUP | G_IO_ERR, quality_output_cb, q);
+        g_child_watch_add(pid, quality_child_watch_cb, q);
+        quality_current = q;
     }
-    update_output_label();
 }
 
-/* Reset buttons */
-static void on_reset_audio_clicked(GtkButton *button, gpointer user_data) {
-    if (!audio_codecs) return;
-    /* If the input has no audio, reset to 'No audio' (index 0). */
-    if (!input_has_audio) {
-        /* No audio stream: ensure Copy is off and combobox shows 'No audio' */
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 0);
-        gtk_widget_set_sensitive(audio_combo, TRUE);
-        gtk_widget_set_sensitive(reset_audio, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)));
+/* A batch job was converted: record it, after a quality check if enabled
+ * and there is encoded video to compare */
+static void job_report_finish(JobReport *r, gboolean has_video)
+{
+    gboolean measure = quality_enabled && has_video && r->video &&
+                       g_strcmp0(r->video, "copy") != 0 && g_strcmp0(r->video, "No video") != 0;
+    if (!measure) {
+        job_report_write(r);
+        job_report_free(r);
         return;
     }
-    /* default_audio_codec should normally be set after file selection; if missing, default to 'copy' */
-    if (!default_audio_codec || g_strcmp0(default_audio_codec, "copy") == 0) {
-        /* Default is 'copy' -> enable the Copy checkbox and disable codec combobox */
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), TRUE);
-        gtk_widget_set_sensitive(audio_combo, FALSE);
-        /* combobox layout: [No audio, copy, ...] -> 'copy' is index 1 */
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), 1);
-        /* When Copy is active, reset button should be disabled */
-        gtk_widget_set_sensitive(reset_audio, FALSE);
-        return;
+    g_queue_push_tail(&quality_queue, r);
+    quality_start_next();
+}
+
+/* Batch stopped: waiting checks are dropped (their jobs are still reported);
+ * a running check is stopped with the other children */
+static void quality_cancel(void)
+{
+    JobReport *r;
+    while ((r = g_queue_pop_head(&quality_queue))) {
+        job_report_write(r);
+        job_report_free(r);
     }
-    /* Non-copy default: ensure Copy is off and combo enabled */
-    gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_audio_check), FALSE);
-    gtk_widget_set_sensitive(audio_combo, TRUE);
-    int idx = find_best_encoder_in_array(audio_codecs, default_audio_codec, audio_encoder_map);
-    /* offset by 1 because combobox has a leading 'No audio' entry */
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(audio_combo), idx + 1);
-    gtk_widget_set_sensitive(reset_audio, TRUE);
 }
 
-static void on_reset_video_clicked(GtkButton *button, gpointer user_data) {
-    if (!video_codecs) return;
-    /* If the input has no video, reset to 'No video' (index 0). */
-    if (!input_has_video) {
-        /* No video stream: ensure Copy is off and combobox shows 'No video' */
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 0);
-        gtk_widget_set_sensitive(video_combo, TRUE);
-        gtk_widget_set_sensitive(reset_video, !gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)));
-        return;
+static void batch_quality_toggled(GtkCheckButton *check, gpointer user_data)
+{
+    quality_enabled = gtk_check_button_get_active(check);
+    if (quality_enabled) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, quality_has_vmaf()
+            ? "Quality checks: PSNR, SSIM and VMAF\n"
+            : "Quality checks: PSNR and SSIM (this ffmpeg has no libvmaf)\n", -1);
     }
-    if (!default_video_codec || g_strcmp0(default_video_codec, "copy") == 0) {
-        /* Default is 'copy' -> enable the Copy checkbox and disable codec combobox */
-        gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), TRUE);
-        gtk_widget_set_sensitive(video_combo, FALSE);
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), 1);
-        gtk_widget_set_sensitive(reset_video, FALSE);
+}
+
+/* Put a failed job back at the front of the pending part of the batch */
+static void batch_requeue(const char *path)
+{
+    for (guint i = 0; i < batch_index && i < batch_files->len; i++) {
+        if (g_strcmp0(g_ptr_array_index(batch_files, i), path) != 0) continue;
+        gpointer p = g_ptr_array_steal_index(batch_files, i);
+        batch_index--;
+        g_ptr_array_insert(batch_files, batch_index, p);
+        batch_list_rebuild();
         return;
     }
-    /* Non-copy default: ensure Copy is off and combo enabled */
-    gtk_check_button_set_active(GTK_CHECK_BUTTON(copy_video_check), FALSE);
-    gtk_widget_set_sensitive(video_combo, TRUE);
-    int idx = find_best_encoder_in_array(video_codecs, default_video_codec, video_encoder_map);
-    gtk_drop_down_set_selected(GTK_DROP_DOWN(video_combo), idx + 1);
-    gtk_widget_set_sensitive(reset_video, TRUE);
 }
 
-/* Start conversion */
-static void on_start_clicked(GtkButton *button, gpointer user_data) {
-    // Disable all except stop
-    gtk_widget_set_sensitive(start_button, FALSE);
-    gtk_widget_set_sensitive(stop_button, TRUE);
-    // Construct ffmpeg command
-    /* Determine selections; combo boxes now have a 'No audio'/'No video' at index 0 */
-
-    /* Build a human-readable preview command for log */
-    gchar *command = g_strdup_printf("ffmpeg -i \"%s\" ... \"%s\"", input_file, output_file);
-    gtk_text_buffer_set_text(log_buffer, "Starting conversion...\n", -1);
-    gtk_text_buffer_insert_at_cursor(log_buffer, command, -1);
-    gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+/* Retry policy for batch jobs: decide from the exit and the output tail
+ * whether a failed job is worth another attempt, and with what. */
+static void batch_job_exited(FfmpegWorker *w, gboolean ok, gboolean killed)
+{
+    if (!batch_failed) batch_failed = g_ptr_array_new_with_free_func(g_free);
+    if (ok) {
+        BatchJob *done = batch_jobs ? g_hash_table_lookup(batch_jobs, w->input) : NULL;
+        if (done)
+            size_model_learn(&done->info, w->audio, w->video, w->output);
+        history_record_job(w, done);
+        batch_encoded_seconds += batch_job_seconds(w->input);
+        batch_converted++;
+        job_report_finish(job_report_new(w, w->input, w->output), done && done->info.video_codec);
+        return;
+    }
+    /* stopped by the user */
+    if (killed && !batch_running) return;
 
-    /* Spawn ffmpeg using bare program name so PATH is used. If that fails with ENOENT,
-     * retry with the resolved ffmpeg_path (if available). */
-    gchar *audio_dup = NULL;
-    gchar *video_dup = NULL;
-    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
-        audio_dup = g_strdup("copy");
-    else
-        audio_dup = drop_down_get_active_text(audio_combo, audio_model);
-    if (gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
-        video_dup = g_strdup("copy");
-    else
-        video_dup = drop_down_get_active_text(video_combo, video_model);
-
-    gchar *argv_spawn[12];
-    int argc_spawn = 0;
-    argv_spawn[argc_spawn++] = "ffmpeg";
-    argv_spawn[argc_spawn++] = "-y"; /* overwrite output */
-    argv_spawn[argc_spawn++] = "-i";
-    argv_spawn[argc_spawn++] = (gchar *)input_file;
-    /* Handle "No audio" / "No video" selections: pass -an / -vn instead of codec flags */
-    if (audio_dup && g_strcmp0(audio_dup, "No audio") == 0) {
-        argv_spawn[argc_spawn++] = "-an";
-    } else {
-        argv_spawn[argc_spawn++] = "-c:a";
-        argv_spawn[argc_spawn++] = audio_dup;
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, w->input) : NULL;
+    gboolean video_side = FALSE;
+    FailureClass cls = killed ? FAILURE_INPUT : classify_failure(w, &video_side);
+    gchar *action = NULL;
+    if (job && batch_running && cls != FAILURE_INPUT && cls != FAILURE_UNKNOWN && job->attempts < BATCH_MAX_RETRIES) {
+        gboolean switch_encoder = cls == FAILURE_ENCODER;
+        if (cls == FAILURE_PIX_FMT && !w->vfilter && w->video) {
+            g_free(job->retry_vf);
+            job->retry_vf = pix_fmt_filter(w->video);
+            action = g_strdup_printf("adding -vf %s", job->retry_vf);
+        } else if (cls == FAILURE_AUDIO_FMT && !w->afilter && w->audio) {
+            g_free(job->retry_af);
+            job->retry_af = audio_fmt_filter(w->audio);
+            action = g_strdup_printf("adding -af %s", job->retry_af);
+        } else {
+            /* the conversion filter did not help either */
+            switch_encoder = TRUE;
+            if (cls == FAILURE_AUDIO_FMT) video_side = FALSE;
+        }
+        if (switch_encoder) {
+            gchar *next = fallback_encoder(w, job, video_side);
+            if (next) {
+                if (!job->tried) job->tried = g_ptr_array_new_with_free_func(g_free);
+                g_ptr_array_add(job->tried, g_strdup(video_side ? w->video : w->audio));
+                action = g_strdup_printf("switching %s encoder %s -> %s", video_side ? "video" : "audio",
+                                         video_side ? w->video : w->audio, next);
+                /* the filter was chosen for the old encoder */
+                if (video_side) {
+                    g_free(job->retry_video);
+                    job->retry_video = next;
+                    g_clear_pointer(&job->retry_vf, g_free);
+                } else {
+                    g_free(job->retry_audio);
+                    job->retry_audio = next;
+                    g_clear_pointer(&job->retry_af, g_free);
+                }
+            }
+        }
     }
-    if (video_dup && g_strcmp0(video_dup, "No video") == 0) {
-        argv_spawn[argc_spawn++] = "-vn";
+    gchar *msg;
+    if (action) {
+        job->attempts++;
+        msg = g_strdup_printf("Retrying %s (%u/%u): %s\n", w->input, job->attempts, BATCH_MAX_RETRIES, action);
+        batch_requeue(w->input);
+        g_free(action);
     } else {
-        argv_spawn[argc_spawn++] = "-c:v";
-        argv_spawn[argc_spawn++] = video_dup;
+        msg = g_strdup_printf("Giving up on %s\n", w->input);
+        g_ptr_array_add(batch_failed, g_strdup(w->input));
     }
-    argv_spawn[argc_spawn++] = (gchar *)output_file;
-    argv_spawn[argc_spawn] = NULL;
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+}
 
-    /* Log which executable will be used (argv[0]) */
-    gchar *which = g_strdup(argv_spawn[0]);
-    gchar *which_msg = g_strdup_printf("Spawning: %s\n", which);
-    gtk_text_buffer_insert_at_cursor(log_buffer, which_msg, -1);
-    g_free(which_msg);
-    g_free(which);
+/* Can `job` share an ffmpeg process with other small files? Only short
+ * audio-only inputs converted with their queued settings qualify. */
+static gboolean batch_job_groupable(const char *path, const BatchJob *job)
+{
+    if (batch_group_limit < 2 || !job || !job->settings || job->no_group || job->attempts > 0) return FALSE;
+    if (job->settings->stream_rules) return FALSE; /* groups always take the first audio track */
+    const char *audio = job->settings->audio;
+    if (!audio || g_strcmp0(audio, "No audio") == 0 || job->settings->afilter) return FALSE;
+    if (!job->info.probed || !job->info.audio_codec || job->info.video_codec) return FALSE;
+    if (job->info.size <= 0 || job->info.size > BATCH_GROUP_MAX_BYTES) return FALSE;
+#ifdef HAVE_LIBAV
+    gchar *out = job_output_path(path, job->settings);
+    gboolean inproc = inproc_accepts(job, out, audio, job->settings);
+    g_free(out);
+    if (inproc) return FALSE; /* cheaper still */
+#endif
+    return TRUE;
+}
 
-    GError *error = NULL;
-    gint stdin_fd = -1, stdout_fd = -1, stderr_fd = -1;
-    gboolean spawned = g_spawn_async_with_pipes(NULL, argv_spawn, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH, NULL, NULL, &ffmpeg_pid, &stdin_fd, &stdout_fd, &stderr_fd, &error);
-    if (!spawned) {
-        /* If the error indicates executable not found, try resolved ffmpeg_path */
-        if (error && error->domain == G_SPAWN_ERROR && error->code == G_SPAWN_ERROR_NOENT && ffmpeg_path) {
-            g_clear_error(&error);
-            argv_spawn[0] = ffmpeg_path; /* use full path */
-            spawned = g_spawn_async_with_pipes(NULL, argv_spawn, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &ffmpeg_pid, &stdin_fd, &stdout_fd, &stderr_fd, &error);
+/* Collect groupable jobs with the audio encoder `audio` from batch_index on,
+ * stopping at the first one that does not qualify. Every member gets the
+ * checks a job started alone gets; one that fails them leaves grouping and
+ * is skipped with its reason when its turn comes. Returns the paths (not
+ * owned), or NULL for fewer than 2. */
+static GPtrArray *batch_collect_group(const char *audio)
+{
+    GPtrArray *paths = g_ptr_array_new();
+    for (guint i = batch_index; i < batch_files->len && paths->len < batch_group_limit; i++) {
+        const char *p = g_ptr_array_index(batch_files, i);
+        BatchJob *job = g_hash_table_lookup(batch_jobs, p);
+        if (!batch_job_groupable(p, job) || g_strcmp0(job->settings->audio, audio) != 0) break;
+        gchar *out = job_output_path(p, job->settings);
+        gchar *problem = NULL;
+        if (selected_encoders_usable(audio, job->settings->video, &problem))
+            problem = job_settings_problem(out, audio, job->settings->video, &job->info);
+        g_free(out);
+        if (problem) {
+            /* the group ends here; the members must be consecutive */
+            job->no_group = TRUE;
+            g_free(problem);
+            break;
         }
+        g_ptr_array_add(paths, (gpointer)p);
     }
-
-    if (!spawned) {
-        const char *msg = error ? error->message : "Failed to spawn ffmpeg";
-        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
-        gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
-    /* show alert to user (no parent available here) */
-    show_alert(NULL, "ffmpeg error", msg);
-    /* Restore UI since spawn failed */
-    update_start_button_state();
-    gtk_widget_set_sensitive(stop_button, FALSE);
-        if (error) g_error_free(error);
-        g_free(audio_dup);
-        g_free(video_dup);
-        g_free(command);
-        return;
+    if (paths->len < 2) {
+        g_ptr_array_free(paths, TRUE);
+        return NULL;
     }
+    return paths;
+}
 
-    /* Set up GIO channels to read ffmpeg stdout/stderr and watch the child process */
-    if (stdin_fd != -1) close(stdin_fd); /* we don't write to ffmpeg stdin */
-    if (stdout_fd != -1) {
-        ffmpeg_stdout_chan = g_io_channel_unix_new(stdout_fd);
-        g_io_channel_set_encoding(ffmpeg_stdout_chan, NULL, NULL);
-        g_io_channel_set_buffered(ffmpeg_stdout_chan, FALSE);
-        ffmpeg_stdout_watch = g_io_add_watch(ffmpeg_stdout_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, ffmpeg_stdout_cb, NULL);
+/* One ffmpeg with an -i per file and one mapped output per input, so process
+ * startup and encoder initialization are paid once per group. Every output
+ * gets the options of its own job. */
+static FfmpegWorker *batch_start_group(GPtrArray *paths, const char *audio)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *inputs = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *outputs = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup("ffmpeg"));
+    g_ptr_array_add(argv, g_strdup("-y"));
+    for (guint i = 0; i < paths->len; i++) {
+        g_ptr_array_add(argv, g_strdup("-i"));
+        g_ptr_array_add(argv, g_strdup(g_ptr_array_index(paths, i)));
+        g_ptr_array_add(inputs, g_strdup(g_ptr_array_index(paths, i)));
     }
-    if (stderr_fd != -1) {
-        ffmpeg_stderr_chan = g_io_channel_unix_new(stderr_fd);
-        g_io_channel_set_encoding(ffmpeg_stderr_chan, NULL, NULL);
-        g_io_channel_set_buffered(ffmpeg_stderr_chan, FALSE);
-        ffmpeg_stderr_watch = g_io_add_watch(ffmpeg_stderr_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, ffmpeg_stderr_cb, NULL);
+    for (guint i = 0; i < paths->len; i++) {
+        const JobSettings *js = ((BatchJob *)g_hash_table_lookup(batch_jobs, g_ptr_array_index(paths, i)))->settings;
+        gchar *out = job_output_path(g_ptr_array_index(paths, i), js);
+        g_ptr_array_add(argv, g_strdup("-map"));
+        g_ptr_array_add(argv, g_strdup_printf("%u:a:0", i));
+        append_encode_options(argv, audio, NULL, NULL, NULL, js);
+        g_ptr_array_add(argv, g_strdup(out));
+        g_ptr_array_add(outputs, out);
     }
-    /* Watch the child so we can cleanup when it exits */
-    g_child_watch_add(ffmpeg_pid, ffmpeg_child_watch_cb, NULL);
-    g_free(audio_dup);
-    g_free(video_dup);
-    g_free(command);
-    /* Disable codec selection while conversion is running */
-    gtk_widget_set_sensitive(audio_combo, FALSE);
-    gtk_widget_set_sensitive(video_combo, FALSE);
-    // TODO: watch for output, but for now, just start
+    g_ptr_array_add(argv, NULL);
+
+    gchar *msg = g_strdup_printf("Converting %u small files in one ffmpeg run, starting with %s\n",
+                                 paths->len, (const char *)g_ptr_array_index(paths, 0));
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+    GError *error = NULL;
+    FfmpegWorker *w = spawn_ffmpeg_worker(argv, g_ptr_array_index(inputs, 0), g_ptr_array_index(outputs, 0), &error);
+    g_ptr_array_free(argv, TRUE);
+    if (!w) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, error->message, -1);
+        gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+        g_error_free(error);
+        g_ptr_array_free(inputs, TRUE);
+        g_ptr_array_free(outputs, TRUE);
+        return NULL;
+    }
+    w->group_inputs = inputs;
+    w->group_outputs = outputs;
+    w->audio = g_strdup(audio);
+    gtk_widget_set_sensitive(start_button, FALSE);
+    gtk_widget_set_sensitive(preview_button, FALSE);
+    gtk_widget_set_sensitive(stop_button, TRUE);
+    return w;
 }
 
-/* Child and IO callbacks */
-static gboolean enable_ui_after_child(gpointer user_data) {
-    update_start_button_state();
-    gtk_widget_set_sensitive(stop_button, FALSE);
-    /* Re-enable codec combos unless their 'Copy' checkboxes are active */
-    if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_audio_check)))
-        gtk_widget_set_sensitive(audio_combo, TRUE);
-    else
-        gtk_widget_set_sensitive(audio_combo, FALSE);
-    if (!gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
-        gtk_widget_set_sensitive(video_combo, TRUE);
-    else
-        gtk_widget_set_sensitive(video_combo, FALSE);
-    return G_SOURCE_REMOVE;
+/* Per-file outcome of a grouped run. ffmpeg's exit status covers the whole
+ * group, so after a failure every member runs again on its own, where it
+ * gets its own status and the retry policy. */
+static void batch_group_exited(FfmpegWorker *w, gboolean ok, gboolean killed)
+{
+    if (killed && !batch_running) return; /* stopped by the user */
+    guint converted = 0, requeued = 0;
+    for (guint i = 0; i < w->group_inputs->len; i++) {
+        const char *in = g_ptr_array_index(w->group_inputs, i);
+        const char *out = g_ptr_array_index(w->group_outputs, i);
+        GStatBuf st;
+        if (ok && g_stat(out, &st) == 0 && st.st_size > 0) {
+            batch_encoded_seconds += batch_job_seconds(in);
+            batch_converted++;
+            converted++;
+            /* the group's time is shared by its members */
+            JobReport *r = job_report_new(w, in, out);
+            r->encode_seconds /= w->group_inputs->len;
+            job_report_finish(r, FALSE);
+            continue;
+        }
+        BatchJob *job = g_hash_table_lookup(batch_jobs, in);
+        if (job) job->no_group = TRUE;
+        batch_requeue(in);
+        requeued++;
+    }
+    gchar *msg = g_strdup_printf("Grouped run: %u converted, %u re-queued to run individually\n", converted, requeued);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
 }
 
 static void ffmpeg_child_watch_cb(GPid pid, gint status, gpointer user_data) {
+    FfmpegWorker *w = user_data;
     GtkTextIter end;
     gtk_text_buffer_get_end_iter(log_buffer, &end);
     if (WIFEXITED(status)) {
@@ -1004,13 +6631,18 @@ static void ffmpeg_child_watch_cb(GPid pid, gint status, gpointer user_data) {
         g_free(msg);
     }
     g_spawn_close_pid(pid);
-    g_idle_add(enable_ui_after_child, NULL);
-    if (ffmpeg_pid == pid) ffmpeg_pid = 0;
-    /* If batch mode is running, schedule continuation to next file */
-    if (batch_running) {
-        /* schedule on main loop to avoid reentrancy in child watch */
-        g_idle_add(continue_batch_idle, NULL);
-    }
+    child_registry_remove(pid);
+    if (w->group_inputs)
+        batch_group_exited(w, WIFEXITED(status) && WEXITSTATUS(status) == 0, WIFSIGNALED(status));
+    else if (w->batch)
+        batch_job_exited(w, WIFEXITED(status) && WEXITSTATUS(status) == 0, WIFSIGNALED(status));
+    if (w->preview)
+        preview_report(w, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (w->fanout_outputs)
+        fanout_report(w, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (w->trim)
+        trim_step_finished(w, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    worker_finished(w);
 }
 
 /* Continue batch processing on idle (called after a conversion finishes) */
@@ -1020,80 +6652,431 @@ static gboolean continue_batch_idle(gpointer user_data)
     return G_SOURCE_REMOVE;
 }
 
-/* Collect files recursively from a folder GFile and append to batch_files and listbox */
-static void collect_files_from_folder(GFile *folder)
+/* Append a path to batch_files and, if the dialog is open, to the listbox.
+ * Returns FALSE when the path is already queued. */
+static gboolean batch_append_path(const char *path)
+{
+    if (!path || batch_has_path(path)) return FALSE;
+    if (!batch_files) batch_files = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(batch_files, g_strdup(path));
+    batch_job_register(path);
+    if (batch_model) {
+        batch_list_append(path);
+        /* Select the first row in the list so the first item is applied; skip
+         * this while running, selection would reapply settings mid-batch. */
+        if (!batch_running && gtk_single_selection_get_selected(batch_selection) == GTK_INVALID_LIST_POSITION)
+            gtk_single_selection_set_selected(batch_selection, 0);
+    }
+    return TRUE;
+}
+
+/* Collect files recursively from a folder GFile and append to batch_files and listbox */
+static void collect_files_from_folder(GFile *folder)
+{
+    if (!folder) return;
+    GError *err = NULL;
+    /* Request content-type so we can filter non-media files */
+    const char *attrs = G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE ",standard::content-type";
+    GFileEnumerator *enumerator = g_file_enumerate_children(folder, attrs, G_FILE_QUERY_INFO_NONE, NULL, &err);
+    if (!enumerator) {
+        if (err) g_error_free(err);
+        return;
+    }
+    GFileInfo *info;
+    while ((info = g_file_enumerator_next_file(enumerator, NULL, &err)) != NULL) {
+        const char *name = g_file_info_get_name(info);
+        GFile *child = g_file_get_child(folder, name);
+        GFileType type = g_file_info_get_file_type(info);
+        if (type == G_FILE_TYPE_DIRECTORY) {
+            collect_files_from_folder(child);
+        } else if (type == G_FILE_TYPE_REGULAR) {
+            /* check content-type first; if missing, fall back to extension matching */
+            char *path = g_file_get_path(child);
+            if (path && file_looks_like_media(path, g_file_info_get_content_type(info)))
+                batch_append_path(path);
+            g_free(path);
+        }
+        g_object_unref(child);
+        g_object_unref(info);
+    }
+    if (err) g_error_free(err);
+    g_object_unref(enumerator);
+}
+
+/* Identity of an opened file independent of its spelling: device and inode
+ * are the same for relative, symlinked and /proc/<pid>/fd paths alike. */
+static gchar *watch_file_id(const GStatBuf *st)
+{
+    return g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT, (guint64)st->st_dev, (guint64)st->st_ino);
+}
+
+/* One walk over /proc/<pid>/fd for all files in `due` (file id -> path):
+ * returns the ids some process has open for writing, judged by the access
+ * mode in the matching fdinfo. Processes of other users are not visible and
+ * are treated as non-writers. The returned set borrows the keys of `due`. */
+static GHashTable *watch_files_being_written(GHashTable *due)
+{
+    GHashTable *busy = g_hash_table_new(g_str_hash, g_str_equal);
+    GDir *proc = g_dir_open("/proc", 0, NULL);
+    if (!proc) return busy;
+    const char *pid;
+    while (g_hash_table_size(busy) < g_hash_table_size(due) && (pid = g_dir_read_name(proc)) != NULL) {
+        if (!g_ascii_isdigit(pid[0])) continue;
+        gchar *fd_dir = g_build_filename("/proc", pid, "fd", NULL);
+        GDir *fds = g_dir_open(fd_dir, 0, NULL);
+        if (fds) {
+            const char *fd;
+            while ((fd = g_dir_read_name(fds)) != NULL) {
+                gchar *link = g_build_filename(fd_dir, fd, NULL);
+                GStatBuf st;
+                /* stat follows the descriptor to the open file itself */
+                gboolean regular = g_stat(link, &st) == 0 && S_ISREG(st.st_mode);
+                g_free(link);
+                if (!regular) continue;
+                gchar *id = watch_file_id(&st);
+                gpointer key = NULL;
+                if (g_hash_table_lookup_extended(due, id, &key, NULL) && !g_hash_table_contains(busy, key)) {
+                    gchar *fdinfo = g_build_filename("/proc", pid, "fdinfo", fd, NULL);
+                    gchar *contents = NULL;
+                    if (g_file_get_contents(fdinfo, &contents, NULL, NULL)) {
+                        const char *flags = strstr(contents, "flags:");
+                        if (flags) {
+                            guint64 mode = g_ascii_strtoull(flags + 6, NULL, 8);
+                            if ((mode & O_ACCMODE) != O_RDONLY)
+                                g_hash_table_add(busy, key);
+                        }
+                    }
+                    g_free(contents);
+                    g_free(fdinfo);
+                }
+                g_free(id);
+            }
+            g_dir_close(fds);
+        }
+        g_free(fd_dir);
+    }
+    g_dir_close(proc);
+    return busy;
+}
+
+/* Outputs are written next to their inputs as "<name>_out.<ext>"; never feed
+ * them back into the queue when the watched folder is also the destination. */
+static gboolean watch_is_own_output(const char *path)
+{
+    gchar *base = g_path_get_basename(path);
+    char *dot = strrchr(base, '.');
+    if (dot) *dot = '\0';
+    gboolean own = g_str_has_suffix(base, "_out");
+    g_free(base);
+    return own;
+}
+
+static void watch_note_candidate(const char *path)
+{
+    if (!watch_candidates || !path) return;
+    if (watch_is_own_output(path)) return;
+    if (!file_looks_like_media(path, NULL)) return;
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) return;
+    WatchSeen *seen = g_hash_table_lookup(watch_seen, path);
+    if (!seen && batch_has_path(path)) {
+        /* queued by hand before the watch saw it: that is this version */
+        seen = g_new0(WatchSeen, 1);
+        seen->size = st.st_size;
+        seen->mtime = st.st_mtime;
+        g_hash_table_insert(watch_seen, g_strdup(path), seen);
+    }
+    if (seen && seen->size == st.st_size && seen->mtime == (gint64)st.st_mtime) return;
+    WatchCandidate *c = g_hash_table_lookup(watch_candidates, path);
+    if (!c) {
+        c = g_new0(WatchCandidate, 1);
+        c->size = -1;
+        g_hash_table_insert(watch_candidates, g_strdup(path), c);
+    }
+    c->stable_since = g_get_monotonic_time();
+}
+
+static void watch_monitor_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, gpointer user_data);
+
+static gboolean watch_path_below(gpointer key, gpointer value, gpointer user_data)
+{
+    const char *dir = user_data;
+    size_t len = strlen(dir);
+    return strncmp(key, dir, len) == 0 && ((const char *)key)[len] == G_DIR_SEPARATOR;
+}
+
+/* `path` is gone or renamed: drop it and, for a directory, the monitors and
+ * candidates of everything below it. */
+static void watch_forget_path(const char *path)
+{
+    g_hash_table_remove(watch_candidates, path);
+    g_hash_table_remove(watch_monitors, path);
+    g_hash_table_foreach_remove(watch_candidates, watch_path_below, (gpointer)path);
+    g_hash_table_foreach_remove(watch_monitors, watch_path_below, (gpointer)path);
+}
+
+static void watch_add_directory(GFile *dir)
+{
+    char *dpath = g_file_get_path(dir);
+    if (!dpath) return;
+    if (g_hash_table_contains(watch_monitors, dpath)) { g_free(dpath); return; }
+    GError *err = NULL;
+    GFileMonitor *mon = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &err);
+    if (!mon) {
+        g_warning("Cannot watch %s: %s", dpath, err ? err->message : "unknown error");
+        if (err) g_error_free(err);
+        g_free(dpath);
+        return;
+    }
+    g_signal_connect(mon, "changed", G_CALLBACK(watch_monitor_changed_cb), NULL);
+    g_hash_table_insert(watch_monitors, dpath, mon);
+
+    /* Files already present (possibly still being written) go through the
+     * same stability check as new arrivals. */
+    GFileEnumerator *en = g_file_enumerate_children(dir, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (!en) return;
+    GFileInfo *info;
+    while ((info = g_file_enumerator_next_file(en, NULL, NULL)) != NULL) {
+        GFile *child = g_file_get_child(dir, g_file_info_get_name(info));
+        GFileType type = g_file_info_get_file_type(info);
+        if (type == G_FILE_TYPE_DIRECTORY) {
+            watch_add_directory(child);
+        } else if (type == G_FILE_TYPE_REGULAR) {
+            char *path = g_file_get_path(child);
+            watch_note_candidate(path);
+            g_free(path);
+        }
+        g_object_unref(child);
+        g_object_unref(info);
+    }
+    g_object_unref(en);
+}
+
+static void watch_monitor_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, gpointer user_data)
+{
+    /* events already queued when the watch was stopped */
+    if (!watch_monitors) return;
+    char *path = g_file_get_path(file);
+    if (!path) return;
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT: {
+        GFileType type = g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL);
+        if (type == G_FILE_TYPE_DIRECTORY)
+            watch_add_directory(file);
+        else if (type == G_FILE_TYPE_REGULAR)
+            watch_note_candidate(path);
+        break;
+    }
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        watch_forget_path(path);
+        if (other) {
+            if (g_file_query_file_type(other, G_FILE_QUERY_INFO_NONE, NULL) == G_FILE_TYPE_DIRECTORY) {
+                watch_add_directory(other);
+            } else {
+                char *opath = g_file_get_path(other);
+                watch_note_candidate(opath);
+                g_free(opath);
+            }
+        }
+        break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        watch_forget_path(path);
+        break;
+    default:
+        break;
+    }
+    g_free(path);
+}
+
+/* Periodic stability check: enqueue candidates whose size and mtime have not
+ * changed for watch_stable_seconds and that nobody is writing any more. */
+static gboolean watch_tick_cb(gpointer user_data)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 needed = (gint64)watch_stable_seconds * G_USEC_PER_SEC;
+    GHashTable *due = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free); /* file id -> path */
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, watch_candidates);
+    while (g_hash_table_iter_next(&it, &key, &value)) {
+        const char *path = key;
+        WatchCandidate *c = value;
+        GStatBuf st;
+        if (g_stat(path, &st) != 0) {
+            g_hash_table_iter_remove(&it);
+            continue;
+        }
+        if (st.st_size != c->size || (gint64)st.st_mtime != c->mtime) {
+            c->size = st.st_size;
+            c->mtime = st.st_mtime;
+            c->stable_since = now;
+            continue;
+        }
+        if (now - c->stable_since < needed) continue;
+        g_hash_table_replace(due, watch_file_id(&st), g_strdup(path));
+    }
+    if (g_hash_table_size(due) == 0) {
+        g_hash_table_destroy(due);
+        return G_SOURCE_CONTINUE;
+    }
+    GHashTable *busy = watch_files_being_written(due);
+    gboolean added = FALSE;
+    guint first_new = batch_files ? batch_files->len : 0;
+    g_hash_table_iter_init(&it, due);
+    while (g_hash_table_iter_next(&it, &key, &value)) {
+        const char *path = value;
+        WatchCandidate *c = g_hash_table_lookup(watch_candidates, path);
+        if (!c) continue;
+        /* A writer may pause longer than the interval; re-check later. So
+         * does a rewritten file that is still being converted. */
+        if (g_hash_table_contains(busy, key)) {
+            c->stable_since = now;
+            continue;
+        }
+        gboolean queued;
+        if (batch_has_path(path)) {
+            queued = batch_job_rewritten(path);
+            if (queued) first_new--;
+        } else {
+            queued = batch_append_path(path);
+        }
+        if (!queued) {
+            c->stable_since = now;
+            continue;
+        }
+        gchar *msg = g_strdup_printf("Watch: queued %s\n", path);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+        WatchSeen *seen = g_new0(WatchSeen, 1);
+        seen->size = c->size;
+        seen->mtime = c->mtime;
+        g_hash_table_replace(watch_seen, g_strdup(path), seen);
+        g_hash_table_remove(watch_candidates, path);
+        added = TRUE;
+    }
+    g_hash_table_destroy(busy);
+    g_hash_table_destroy(due);
+    /* Feed the regular batch engine; the resume runs only the new arrivals,
+     * batch_index may have been reset by a reorder since the last run. A
+     * batch the user stopped stays stopped until Start is pressed. */
+    if (added && !batch_running) {
+        if (batch_user_stopped) {
+            gtk_text_buffer_insert_at_cursor(log_buffer, "Watch: batch stopped, press Start to run the new files\n", -1);
+        } else {
+            batch_index = first_new;
+            batch_begin(FALSE);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void watch_monitor_free(gpointer data)
+{
+    GFileMonitor *mon = data;
+    g_signal_handlers_disconnect_by_func(mon, watch_monitor_changed_cb, NULL);
+    g_file_monitor_cancel(mon);
+    g_object_unref(mon);
+}
+
+static void watch_update_button(void)
+{
+    if (batch_watch_button)
+        gtk_button_set_label(GTK_BUTTON(batch_watch_button), watch_root ? "Stop watching" : "Watch folder");
+}
+
+static void watch_start(GFile *dir)
+{
+    watch_stop();
+    watch_root = g_object_ref(dir);
+    watch_monitors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, watch_monitor_free);
+    watch_candidates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    watch_seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    watch_add_directory(dir);
+    watch_tick_source = g_timeout_add_seconds(1, watch_tick_cb, NULL);
+    char *path = g_file_get_path(dir);
+    gchar *msg = g_strdup_printf("Watching %s (stable after %u s)\n", path ? path : "?", watch_stable_seconds);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    g_free(msg);
+    g_free(path);
+    watch_update_button();
+}
+
+/* Cancel and free every monitor, the subdirectories' included */
+static void watch_release(void)
+{
+    if (watch_tick_source) {
+        g_source_remove(watch_tick_source);
+        watch_tick_source = 0;
+    }
+    g_clear_pointer(&watch_monitors, g_hash_table_destroy);
+    g_clear_pointer(&watch_candidates, g_hash_table_destroy);
+    g_clear_pointer(&watch_seen, g_hash_table_destroy);
+    g_clear_object(&watch_root);
+}
+
+static void watch_stop(void)
+{
+    if (!watch_root) return;
+    watch_release();
+    gtk_text_buffer_insert_at_cursor(log_buffer, "Stopped watching.\n", -1);
+    watch_update_button();
+}
+
+static void batch_watch_native_response(GtkNativeDialog *native, gint response, gpointer user_data)
+{
+    if (response == GTK_RESPONSE_ACCEPT) {
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+        GFile *f = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(native));
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+        if (f) {
+            watch_start(f);
+            g_object_unref(f);
+        }
+    }
+    gtk_native_dialog_destroy(native);
+}
+
+static void batch_watch_clicked(GtkButton *button, gpointer user_data)
+{
+    if (watch_root) {
+        watch_stop();
+        return;
+    }
+    GtkWindow *parent = GTK_WINDOW(user_data);
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    GtkFileChooserNative *native = gtk_file_chooser_native_new("Select folder to watch", parent, GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER, "Watch", "Cancel");
+    g_signal_connect(native, "response", G_CALLBACK(batch_watch_native_response), native);
+    gtk_native_dialog_show(GTK_NATIVE_DIALOG(native));
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+}
+
+static void batch_watch_interval_changed(GtkSpinButton *spin, gpointer user_data)
 {
-    if (!folder) return;
-    GError *err = NULL;
-    /* Request content-type so we can filter non-media files */
-    const char *attrs = G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE ",standard::content-type";
-    GFileEnumerator *enumerator = g_file_enumerate_children(folder, attrs, G_FILE_QUERY_INFO_NONE, NULL, &err);
-    if (!enumerator) {
-        if (err) g_error_free(err);
-        return;
-    }
-    GFileInfo *info;
-    while ((info = g_file_enumerator_next_file(enumerator, NULL, &err)) != NULL) {
-        const char *name = g_file_info_get_name(info);
-        GFile *child = g_file_get_child(folder, name);
-        GFileType type = g_file_info_get_file_type(info);
-        if (type == G_FILE_TYPE_DIRECTORY) {
-            collect_files_from_folder(child);
-        } else if (type == G_FILE_TYPE_REGULAR) {
-            /* check content-type first; if missing, fall back to extension matching */
-            const char *ctype = g_file_info_get_content_type(info);
-            gboolean is_media = FALSE;
-            if (ctype) {
-                if (g_str_has_prefix(ctype, "audio/") || g_str_has_prefix(ctype, "video/"))
-                    is_media = TRUE;
-            }
-            if (!is_media) {
-                /* fallback: check extension */
-                char *path = g_file_get_path(child);
-                if (path) {
-                    const char *ext = strrchr(path, '.');
-                    if (ext) {
-                        gchar *ext_l = g_utf8_strdown(ext + 1, -1);
-                        const char *good_exts[] = {"mp4","mkv","webm","avi","mov","mpeg","mpg","mp3","flac","wav","ogg","aac","m4a","opus","m4v","webm","m2ts", NULL};
-                        for (int i = 0; good_exts[i] != NULL; i++) {
-                            if (g_strcmp0(ext_l, good_exts[i]) == 0) { is_media = TRUE; break; }
-                        }
-                        g_free(ext_l);
-                    }
-                    g_free(path);
-                }
-            }
-            if (is_media) {
-                char *path = g_file_get_path(child);
-                if (path) {
-                    if (!batch_has_path(path)) {
-                        if (!batch_files) batch_files = g_ptr_array_new_with_free_func(g_free);
-                        g_ptr_array_add(batch_files, g_strdup(path));
-                        if (batch_listbox) {
-                            GtkWidget *row = gtk_label_new(path);
-                            /* left align and ellipsize start so filename at end stays visible */
-                            gtk_label_set_xalign(GTK_LABEL(row), 0.0);
-                            gtk_label_set_ellipsize(GTK_LABEL(row), PANGO_ELLIPSIZE_START);
-                            /* show tooltip with full path */
-                            gtk_widget_set_tooltip_text(row, path);
-                            gtk_list_box_insert(GTK_LIST_BOX(batch_listbox), row, -1);
-                                gtk_widget_set_visible(row, TRUE);
-                                /* Select the first row in the list so the first item is applied */
-                                {
-                                    GtkListBoxRow *to_select = gtk_list_box_get_row_at_index(GTK_LIST_BOX(batch_listbox), 0);
-                                    if (to_select) gtk_list_box_select_row(GTK_LIST_BOX(batch_listbox), to_select);
-                                }
-                        }
-                    }
-                    g_free(path);
-                }
-            }
-        }
-        g_object_unref(child);
-        g_object_unref(info);
-    }
-    if (err) g_error_free(err);
-    g_object_unref(enumerator);
+    watch_stable_seconds = (guint)gtk_spin_button_get_value_as_int(spin);
 }
 
 static void batch_add_folder_clicked(GtkButton *button, gpointer user_data)
@@ -1146,107 +7129,901 @@ static void batch_add_folder_native_response(GtkNativeDialog *native, gint respo
 
 static void batch_remove_selected_clicked(GtkButton *button, gpointer user_data)
 {
-    if (!batch_listbox || !batch_files) return;
-    GList *selected = gtk_list_box_get_selected_rows(GTK_LIST_BOX(batch_listbox));
-    if (!selected) return;
-    gint min_index = -1;
-    /* find minimal index among selected rows via gtk_list_box_row_get_index */
-    for (GList *l = selected; l; l = l->next) {
-        GtkListBoxRow *sel_row = GTK_LIST_BOX_ROW(l->data);
-        gint idx = gtk_list_box_row_get_index(sel_row);
-        if (idx >= 0 && (min_index == -1 || idx < min_index)) min_index = idx;
-    }
-    /* Remove selected rows and corresponding paths */
-    for (GList *l = selected; l; l = l->next) {
-        GtkListBoxRow *sel_row = GTK_LIST_BOX_ROW(l->data);
-        GtkWidget *child = gtk_list_box_row_get_child(sel_row);
-        const char *text = NULL;
-        if (child && GTK_IS_LABEL(child)) text = gtk_label_get_text(GTK_LABEL(child));
-        if (text) {
-            for (guint i = 0; i < batch_files->len; i++) {
-                char *p = g_ptr_array_index(batch_files, i);
-                if (g_strcmp0(p, text) == 0) {
-                    g_ptr_array_remove_index(batch_files, i);
-                    break;
-                }
-            }
-        }
-        gtk_list_box_remove(GTK_LIST_BOX(batch_listbox), GTK_WIDGET(sel_row));
-    }
-    /* After removals, select the next appropriate row: try to select the row at
-     * min_index; if it doesn't exist (past end), try previous indices down to 0. */
-    if (min_index >= 0) {
-        for (gint sel_index = min_index; sel_index >= 0; sel_index--) {
-            GtkListBoxRow *to_select = gtk_list_box_get_row_at_index(GTK_LIST_BOX(batch_listbox), sel_index);
-            if (to_select) {
-                gtk_list_box_select_row(GTK_LIST_BOX(batch_listbox), to_select);
-                break;
-            }
-        }
-    }
-    g_list_free(selected);
+    if (!batch_model || !batch_files) return;
+    guint pos = gtk_single_selection_get_selected(batch_selection);
+    if (pos == GTK_INVALID_LIST_POSITION || pos >= batch_files->len) return;
+    /* the model mirrors batch_files, row for row */
+    batch_job_forget(g_ptr_array_index(batch_files, pos));
+    g_ptr_array_remove_index(batch_files, pos);
+    gtk_string_list_remove(batch_model, pos);
+    /* select the row that took its place, or the new last one */
+    if (batch_files->len > 0)
+        gtk_single_selection_set_selected(batch_selection, MIN(pos, batch_files->len - 1));
 }
 
 static void batch_start_clicked_cb(GtkButton *button, gpointer user_data)
+{
+    batch_user_stopped = FALSE;
+    batch_begin(TRUE);
+}
+
+/* Start (or resume) the batch. A resume keeps batch_index so files appended by
+ * the folder watcher are processed without re-running finished entries. */
+static void batch_begin(gboolean from_start)
 {
     if (!batch_files || batch_files->len == 0) return;
+    if (batch_running) return;
+    /* Refuse up front rather than failing every job of the batch. Jobs from
+     * the window are queued with the window's settings as they are now;
+     * manifest jobs keep their own. */
+    JobSettings *ui = job_settings_from_ui();
+    gchar *reason = NULL;
+    /* Validate every pending job against the container matrix; verdicts are
+     * cached per muxer/encoder pair, so this costs a lookup per file. */
+    guint pending = 0, invalid = 0;
+    for (guint i = from_start ? 0 : batch_index; i < batch_files->len; i++) {
+        const char *path = g_ptr_array_index(batch_files, i);
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+        const JobSettings *js = job && job->from_manifest ? job->settings : ui;
+        gchar *out = job_output_path(path, js);
+        gchar *problem = NULL;
+        if (selected_encoders_usable(js->audio, js->video, &problem))
+            problem = job_settings_problem(out, js->audio, js->video, job ? &job->info : NULL);
+        g_free(out);
+        pending++;
+        if (problem) {
+            invalid++;
+            if (!reason) reason = problem;
+            else g_free(problem);
+        }
+    }
+    if (pending > 0 && invalid == pending) {
+        gtk_text_buffer_insert_at_cursor(log_buffer, reason, -1);
+        gtk_text_buffer_insert_at_cursor(log_buffer, "\n", -1);
+        show_alert(NULL, "Cannot convert with these settings", reason);
+        g_free(reason);
+        job_settings_unref(ui);
+        return;
+    }
+    for (guint i = from_start ? 0 : batch_index; i < batch_files->len; i++) {
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, g_ptr_array_index(batch_files, i)) : NULL;
+        if (!job || job->from_manifest) continue;
+        if (job->settings) job_settings_unref(job->settings);
+        job->settings = g_atomic_rc_box_acquire(ui);
+    }
+    /* files added while the batch runs are queued with the same settings */
+    if (batch_ui_settings) job_settings_unref(batch_ui_settings);
+    batch_ui_settings = ui;
+    batch_space_preflight(from_start ? 0 : batch_index);
+    batch_plan_forecast(from_start ? 0 : batch_index, ui);
+    if (invalid > 0) {
+        gchar *msg = g_strdup_printf("%u of %u queued files will be skipped, e.g. %s\n", invalid, pending, reason);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+        g_free(reason);
+    }
     batch_running = TRUE;
-    batch_index = 0;
+    if (from_start || !batch_log_dir)
+        batch_logs_begin();
+    if (from_start) {
+        batch_index = 0;
+        batch_converted = 0;
+        if (batch_failed) g_ptr_array_set_size(batch_failed, 0);
+        batch_prefetch_cancel();
+    }
+    /* progress and throughput cover this run, a resumed one starts over */
+    batch_first = batch_index;
+    batch_started_us = g_get_monotonic_time();
+    batch_encoded_seconds = 0;
+    batch_progress_printed = 0;
     /* disable add/remove while running */
     if (batch_add_folder_button) gtk_widget_set_sensitive(batch_add_folder_button, FALSE);
     if (batch_add_files_button) gtk_widget_set_sensitive(batch_add_files_button, FALSE);
     if (batch_remove_button) gtk_widget_set_sensitive(batch_remove_button, FALSE);
     if (batch_start_button) gtk_widget_set_sensitive(batch_start_button, FALSE);
     if (batch_stop_button) gtk_widget_set_sensitive(batch_stop_button, TRUE);
-    /* disable listbox so user can't change selection during batch */
-    if (batch_listbox) gtk_widget_set_sensitive(batch_listbox, FALSE);
+    /* the list stays selectable: while running, selecting a job shows its log */
+    adaptive_start();
     process_next_in_batch();
 }
 
-static void batch_stop_clicked_cb(GtkButton *button, gpointer user_data)
+static void batch_stop_clicked_cb(GtkButton *button, gpointer user_data)
+{
+    batch_running = FALSE;
+    batch_user_stopped = TRUE;
+    batch_prefetch_cancel();
+    quality_cancel();
+    /* Re-enable controls */
+    if (batch_add_folder_button) gtk_widget_set_sensitive(batch_add_folder_button, TRUE);
+    if (batch_add_files_button) gtk_widget_set_sensitive(batch_add_files_button, TRUE);
+    if (batch_remove_button) gtk_widget_set_sensitive(batch_remove_button, TRUE);
+    if (batch_start_button) gtk_widget_set_sensitive(batch_start_button, TRUE);
+    if (batch_stop_button) gtk_widget_set_sensitive(batch_stop_button, FALSE);
+    if (batch_list_view) gtk_widget_set_sensitive(batch_list_view, TRUE);
+    /* Also stop any running ffmpeg process */
+    on_stop_clicked(NULL, NULL);
+}
+
+/* Relative encode cost per second of 1080p video, roughly libx264 medium = 1.
+ * Used only to order jobs, so coarse values are fine. */
+typedef struct {
+    const char *encoder;
+    gdouble factor;
+} EncoderCost;
+
+static const EncoderCost encoder_costs[] = {
+    {"copy", 0.02},
+    {"mpeg2video", 0.3},
+    {"mpeg4", 0.4},
+    {"libtheora", 0.8},
+    {"libx264", 1.0},
+    {"libvpx", 1.5},
+    {"libsvtav1", 2.5},
+    {"libvpx-vp9", 3.0},
+    {"libx265", 4.0},
+    {"librav1e", 6.0},
+    {"libaom-av1", 10.0},
+    {NULL, 0.0}
+};
+
+static gdouble encoder_cost_factor(const char *enc)
+{
+    /* measured on this host (relative to libx264) beats the table */
+    EncoderCaps *c = encoder_caps_lookup(enc);
+    gdouble *rel = bench_relative && enc ? g_hash_table_lookup(bench_relative, enc) : NULL;
+    if (rel && *rel > 0 && c && c->video)
+        return 1.0 / *rel;
+    for (int i = 0; encoder_costs[i].encoder != NULL; i++) {
+        if (g_strcmp0(encoder_costs[i].encoder, enc) == 0)
+            return encoder_costs[i].factor;
+    }
+    return 1.0;
+}
+
+/* Estimated processing cost of a job (in "libx264 1080p seconds") given the
+ * current video selection. Unprobed files fall back to a size-based duration
+ * guess of 5 Mbit/s so they still sort sensibly. */
+static gdouble batch_job_cost(const BatchJob *job, const char *video_enc)
+{
+    const MediaInfo *mi = &job->info;
+    gdouble duration = mi->duration > 0 ? mi->duration : (gdouble)mi->size / 625000.0;
+    gdouble factor = 0.05; /* audio-only work */
+    if ((mi->video_codec || !mi->probed) && g_strcmp0(video_enc, "No video") != 0) {
+        gdouble scale = 1.0;
+        if (mi->width > 0 && mi->height > 0)
+            scale = (gdouble)mi->width * mi->height / (1920.0 * 1080.0);
+        /* decoding HEVC/AV1 sources adds noticeably to cheap encodes */
+        gdouble decode = 0.2;
+        if (g_strcmp0(mi->video_codec, "hevc") == 0) decode = 0.35;
+        else if (g_strcmp0(mi->video_codec, "av1") == 0) decode = 0.45;
+        factor += scale * (encoder_cost_factor(video_enc) + decode);
+    }
+    return duration * factor;
+}
+
+/* Dry-run planner: expected time of the pending jobs at every worker count,
+ * from the throughput history. Jobs of encoders without history have no
+ * time in seconds (batch_job_cost is only relative), so they are counted
+ * and reported apart, never added to the totals. Jobs are given to the
+ * first free worker in queue order; memory and disk space holds are not
+ * modelled. */
+#define BATCH_PLAN_MAX_WORKERS 16
+
+typedef struct {
+    gdouble cpu;
+    gdouble util;
+} PlanJob;
+
+/* Pending jobs from `first` on that have history, with their settings as
+ * batch_begin would queue them. *unknown counts the others and
+ * *unknown_seconds adds up their media length. */
+static GArray *batch_plan_jobs(guint first, const JobSettings *ui, guint *unknown, gdouble *unknown_seconds)
+{
+    GArray *jobs = g_array_new(FALSE, FALSE, sizeof(PlanJob));
+    *unknown = 0;
+    *unknown_seconds = 0;
+    for (guint i = first; batch_files && i < batch_files->len; i++) {
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, g_ptr_array_index(batch_files, i)) : NULL;
+        if (!job) continue;
+        const JobSettings *js = job->settings && (job->from_manifest || batch_running) ? job->settings : ui;
+        gint64 pixels = 0;
+        if (job->info.width > 0 && job->info.height > 0)
+            pixels = (gint64)job->info.width * job->info.height;
+        else if (!job->info.probed || job->info.video_codec)
+            pixels = 1920 * 1080;
+        gchar *key = mem_model_key(js->audio, js->video, pixels);
+        PlanJob p;
+        if (history_predict(key, js->preset, &job->info, &p.cpu, &p.util)) {
+            g_array_append_val(jobs, p);
+        } else {
+            (*unknown)++;
+            *unknown_seconds += MAX(job->info.duration, 0.0);
+        }
+        g_free(key);
+    }
+    return jobs;
+}
+
+static gdouble batch_plan_makespan(GArray *jobs, guint workers_n)
+{
+    gdouble *free_at = g_new0(gdouble, workers_n);
+    gdouble makespan = 0;
+    for (guint i = 0; i < jobs->len; i++) {
+        const PlanJob *p = &g_array_index(jobs, PlanJob, i);
+        guint slot = 0;
+        for (guint s = 1; s < workers_n; s++)
+            if (free_at[s] < free_at[slot]) slot = s;
+        free_at[slot] += history_wall(p->cpu, p->util, MIN(workers_n, jobs->len));
+        makespan = MAX(makespan, free_at[slot]);
+    }
+    g_free(free_at);
+    return makespan;
+}
+
+static void batch_plan_print(const char *text)
+{
+    gtk_text_buffer_insert_at_cursor(log_buffer, text, -1);
+    if (progress_stdout || plan_only) {
+        g_print("%s", text);
+        fflush(stdout);
+    }
+}
+
+static void batch_plan_report(void)
+{
+    JobSettings *ui = job_settings_from_ui();
+    guint unknown;
+    gdouble unknown_seconds;
+    GArray *jobs = batch_plan_jobs(batch_running ? batch_index : 0, ui, &unknown, &unknown_seconds);
+    job_settings_unref(ui);
+    gchar *unknown_line = NULL;
+    if (unknown > 0) {
+        gchar *media = format_duration(unknown_seconds);
+        unknown_line = g_strdup_printf("%u %s (%s of media) without history %s not included.\n", unknown,
+                                       unknown == 1 ? "job" : "jobs", media, unknown == 1 ? "is" : "are");
+        g_free(media);
+    }
+    if (jobs->len == 0) {
+        batch_plan_print(unknown ? "Plan: no queued job has history yet.\n" : "Plan: no jobs queued.\n");
+        if (unknown_line) batch_plan_print(unknown_line);
+        g_free(unknown_line);
+        g_array_free(jobs, TRUE);
+        return;
+    }
+    guint limit = MIN(MAX(batch_max_workers, (guint)g_get_num_processors()), BATCH_PLAN_MAX_WORKERS);
+    limit = MIN(limit, jobs->len);
+    GString *text = g_string_new(NULL);
+    g_string_append_printf(text, "Plan for %u %s from history:\n", jobs->len, jobs->len == 1 ? "job" : "jobs");
+    guint best = 1;
+    gdouble best_time = 0;
+    for (guint k = 1; k <= limit; k++) {
+        gdouble t = batch_plan_makespan(jobs, k);
+        /* another worker has to save at least 2% to be worth it */
+        if (k == 1 || t < best_time * 0.98) {
+            best = k;
+            best_time = t;
+        }
+        gchar *time_str = format_duration(t);
+        g_string_append_printf(text, "  %2u %s  %s%s\n", k, k == 1 ? "worker: " : "workers:", time_str,
+                               k == batch_max_workers ? "  (current)" : "");
+        g_free(time_str);
+    }
+    gchar *best_str = format_duration(best_time);
+    g_string_append_printf(text, "Fastest with %u %s, about %s.\n", best, best == 1 ? "worker" : "workers", best_str);
+    g_free(best_str);
+    if (unknown_line) g_string_append(text, unknown_line);
+    g_free(unknown_line);
+    batch_plan_print(text->str);
+    g_string_free(text, TRUE);
+    g_array_free(jobs, TRUE);
+}
+
+/* One line at the current worker count, once some encoder has history */
+static void batch_plan_forecast(guint first, const JobSettings *ui)
+{
+    guint unknown;
+    gdouble unknown_seconds;
+    GArray *jobs = batch_plan_jobs(first, ui, &unknown, &unknown_seconds);
+    if (jobs->len > 0) {
+        gchar *expected = format_duration(batch_plan_makespan(jobs, MAX(batch_worker_limit(), 1)));
+        gchar *msg = unknown
+            ? g_strdup_printf("Expected batch time about %s for the %u of %u jobs with history\n",
+                              expected, jobs->len, jobs->len + unknown)
+            : g_strdup_printf("Expected batch time about %s\n", expected);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+        g_free(expected);
+    }
+    g_array_free(jobs, TRUE);
+}
+
+static void batch_plan_clicked(GtkButton *button, gpointer user_data)
+{
+    batch_plan_report();
+}
+
+static void batch_job_free(gpointer data)
+{
+    BatchJob *job = data;
+    media_info_clear(&job->info);
+    g_free(job->retry_audio);
+    g_free(job->retry_video);
+    g_free(job->retry_vf);
+    g_free(job->retry_af);
+    if (job->tried) g_ptr_array_free(job->tried, TRUE);
+    g_free(job->log_path);
+    if (job->settings) job_settings_unref(job->settings);
+    g_free(job);
+}
+
+static void batch_probe_done(ProbeResult *res)
+{
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, res->path) : NULL;
+    if (!job) return;
+    job->probing = FALSE;
+    media_info_clear(&job->info);
+    job->info = res->info;
+    memset(&res->info, 0, sizeof(res->info));
+    if (batch_policy != BATCH_POLICY_FIFO)
+        batch_schedule_reorder();
+}
+
+static void batch_job_probe(const char *path, BatchJob *job)
+{
+    job->probing = TRUE;
+    probe_in_background(path, batch_probe_done, NULL);
+}
+
+static void batch_job_register(const char *path)
+{
+    if (!batch_jobs)
+        batch_jobs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, batch_job_free);
+    if (g_hash_table_contains(batch_jobs, path)) return;
+    BatchJob *job = g_new0(BatchJob, 1);
+    if (batch_running && batch_ui_settings)
+        job->settings = g_atomic_rc_box_acquire(batch_ui_settings);
+    GStatBuf st;
+    if (g_stat(path, &st) == 0)
+        job->info.size = st.st_size;
+    g_hash_table_insert(batch_jobs, g_strdup(path), job);
+    batch_job_probe(path, job);
+}
+
+/* A queued file was written again under the same name: forget what was
+ * learned about the old contents and move it to the end of the list so it
+ * runs again. Returns FALSE while a worker or a probe still reads the file. */
+static gboolean batch_job_rewritten(const char *path)
+{
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    if (!job) return FALSE;
+    if (job->probing) return FALSE;
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (g_strcmp0(w->input, path) == 0) return FALSE;
+        if (w->group_inputs && g_ptr_array_find_with_equal_func(w->group_inputs, path, g_str_equal, NULL))
+            return FALSE;
+    }
+    media_info_clear(&job->info);
+    g_clear_pointer(&job->retry_audio, g_free);
+    g_clear_pointer(&job->retry_video, g_free);
+    g_clear_pointer(&job->retry_vf, g_free);
+    g_clear_pointer(&job->retry_af, g_free);
+    g_clear_pointer(&job->tried, g_ptr_array_unref);
+    job->attempts = 0;
+    job->no_group = FALSE;
+    if (!job->from_manifest) {
+        g_clear_pointer(&job->settings, job_settings_unref);
+        if (batch_running && batch_ui_settings)
+            job->settings = g_atomic_rc_box_acquire(batch_ui_settings);
+    }
+    GStatBuf st;
+    if (g_stat(path, &st) == 0)
+        job->info.size = st.st_size;
+    batch_job_probe(path, job);
+    for (guint i = 0; i < batch_files->len; i++) {
+        if (g_strcmp0(g_ptr_array_index(batch_files, i), path) != 0) continue;
+        gpointer p = g_ptr_array_steal_index(batch_files, i);
+        if (i < batch_index) batch_index--;
+        g_ptr_array_add(batch_files, p);
+        break;
+    }
+    batch_list_rebuild();
+    return TRUE;
+}
+
+/* Read-ahead of upcoming batch inputs: while jobs run, the next
+ * PREFETCH_AHEAD pending files are pulled into the page cache by a single
+ * background thread (one sequential reader keeps the disk streaming), as
+ * long as the not-yet-started prefetched bytes stay within the budget. Files
+ * whose probe has not come back yet are probed right after, from cache. */
+#define PREFETCH_AHEAD 3
+#define PREFETCH_BUDGET_MAX ((gint64)1024 * 1024 * 1024)
+#define PREFETCH_CHUNK (1024 * 1024)
+
+typedef struct {
+    gchar *path;
+    gint generation;
+    gboolean probe;
+} PrefetchTask;
+
+static GThreadPool *prefetch_pool = NULL;
+static GHashTable *prefetched = NULL; /* path -> size queued for read-ahead */
+static gint prefetch_generation = 0;  /* bumped to abandon running read-aheads */
+
+/* posix_fadvise is only a hint, and network and FUSE file systems ignore
+ * it; there the data is read explicitly */
+static gboolean prefetch_needs_reads(int fd)
+{
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) != 0) return TRUE;
+    switch ((unsigned long)sfs.f_type) {
+    case 0x6969UL:      /* NFS */
+    case 0x517BUL:      /* SMB */
+    case 0xFF534D42UL:  /* CIFS */
+    case 0xFE534D42UL:  /* SMB2 */
+    case 0x65735546UL:  /* FUSE */
+    case 0x00C36400UL:  /* Ceph */
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void prefetch_worker(gpointer data, gpointer user_data)
+{
+    PrefetchTask *task = data;
+    int fd = g_open(task->path, O_RDONLY, 0);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        if (prefetch_needs_reads(fd)) {
+            gchar *buf = g_malloc(PREFETCH_CHUNK);
+            while (g_atomic_int_get(&prefetch_generation) == task->generation &&
+                   read(fd, buf, PREFETCH_CHUNK) > 0)
+                ;
+            g_free(buf);
+        }
+        close(fd);
+    }
+    if (task->probe && g_atomic_int_get(&prefetch_generation) == task->generation) {
+        ProbeResult *res = g_new0(ProbeResult, 1);
+        res->path = g_strdup(task->path);
+        res->done = batch_probe_done;
+        res->ok = probe_media_info(res->path, &res->info);
+        g_idle_add(probe_done_idle, res);
+    }
+    g_free(task->path);
+    g_free(task);
+}
+
+static void batch_prefetch_cancel(void)
+{
+    g_atomic_int_inc(&prefetch_generation);
+    if (prefetched) g_hash_table_remove_all(prefetched);
+}
+
+/* Queue read-ahead for the pending files after the running ones */
+static void batch_prefetch_schedule(void)
+{
+    if (!batch_running || !batch_files) return;
+    if (!prefetched)
+        prefetched = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    gint64 budget = PREFETCH_BUDGET_MAX;
+    gint64 avail = read_proc_kb("/proc/meminfo", "MemAvailable:");
+    if (avail > 0)
+        budget = MIN(budget, avail * 1024 / 4);
+    /* bytes already read ahead for files that have not started yet */
+    guint end = MIN(batch_files->len, batch_index + PREFETCH_AHEAD);
+    for (guint i = batch_index; i < end; i++) {
+        gpointer size;
+        if (g_hash_table_lookup_extended(prefetched, g_ptr_array_index(batch_files, i), NULL, &size))
+            budget -= GPOINTER_TO_SIZE(size);
+    }
+    for (guint i = batch_index; i < end; i++) {
+        const char *path = g_ptr_array_index(batch_files, i);
+        if (g_hash_table_contains(prefetched, path)) continue;
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+        gint64 size = job ? job->info.size : 0;
+        if (size <= 0 || size > budget) break;
+        budget -= size;
+        g_hash_table_insert(prefetched, g_strdup(path), GSIZE_TO_POINTER((gsize)size));
+        if (!prefetch_pool)
+            prefetch_pool = g_thread_pool_new(prefetch_worker, NULL, 1, FALSE, NULL);
+        PrefetchTask *task = g_new0(PrefetchTask, 1);
+        task->path = g_strdup(path);
+        task->generation = g_atomic_int_get(&prefetch_generation);
+        /* a probe still queued on probe_pool is not doubled */
+        task->probe = !job->info.probed && !job->probing;
+        g_thread_pool_push(prefetch_pool, task, NULL);
+    }
+}
+
+static void batch_job_forget(const char *path)
+{
+    if (batch_jobs)
+        g_hash_table_remove(batch_jobs, path);
+}
+
+typedef struct {
+    BatchPolicy policy;
+    const char *video_enc;
+} BatchOrderCtx;
+
+static gint batch_job_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const BatchOrderCtx *ctx = user_data;
+    const char *pa = *(const char * const *)a;
+    const char *pb = *(const char * const *)b;
+    BatchJob *ja = batch_jobs ? g_hash_table_lookup(batch_jobs, pa) : NULL;
+    BatchJob *jb = batch_jobs ? g_hash_table_lookup(batch_jobs, pb) : NULL;
+    gint prio_a = ja ? ja->priority : 0;
+    gint prio_b = jb ? jb->priority : 0;
+    if (prio_a != prio_b) return prio_b - prio_a;
+    if (ctx->policy == BATCH_POLICY_FIFO || !ja || !jb) return 0;
+    /* queued jobs are costed with their own encoder */
+    gdouble ca = batch_job_cost(ja, ja->settings ? ja->settings->video : ctx->video_enc);
+    gdouble cb = batch_job_cost(jb, jb->settings ? jb->settings->video : ctx->video_enc);
+    if (ca == cb) return 0;
+    if (ctx->policy == BATCH_POLICY_SJF)
+        return ca < cb ? -1 : 1;
+    return ca > cb ? -1 : 1;
+}
+
+/* The batch list is a GtkListView over batch_model, so only the visible
+ * rows have widgets however many jobs are queued. Rows are labels, left
+ * aligned and ellipsized at the start so the filename stays visible; the
+ * tooltip shows the full path and any bump. */
+static void batch_row_setup(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data)
+{
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_START);
+    gtk_list_item_set_child(item, label);
+}
+
+static void batch_row_bind(GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data)
+{
+    GtkWidget *label = gtk_list_item_get_child(item);
+    const char *path = gtk_string_object_get_string(GTK_STRING_OBJECT(gtk_list_item_get_item(item)));
+    gtk_label_set_text(GTK_LABEL(label), path);
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    if (job && job->priority > 0) {
+        gchar *tip = g_strdup_printf("%s (priority +%d)", path, job->priority);
+        gtk_widget_set_tooltip_text(label, tip);
+        gtk_widget_add_css_class(label, "accent");
+        g_free(tip);
+    } else {
+        gtk_widget_set_tooltip_text(label, path);
+        gtk_widget_remove_css_class(label, "accent");
+    }
+}
+
+static void batch_list_append(const char *path)
+{
+    if (batch_model) gtk_string_list_append(batch_model, path);
+}
+
+/* Replace the rows with batch_files in one change */
+static void batch_list_rebuild(void)
+{
+    if (!batch_model) return;
+    const char **paths = g_new0(const char *, (batch_files ? batch_files->len : 0) + 1);
+    for (guint i = 0; batch_files && i < batch_files->len; i++)
+        paths[i] = g_ptr_array_index(batch_files, i);
+    gtk_string_list_splice(batch_model, 0, g_list_model_get_n_items(G_LIST_MODEL(batch_model)), paths);
+    g_free(paths);
+}
+
+/* Path of the selected row, or NULL */
+static const char *batch_list_selected(void)
+{
+    GtkStringObject *item = batch_selection ? gtk_single_selection_get_selected_item(batch_selection) : NULL;
+    return item ? gtk_string_object_get_string(item) : NULL;
+}
+
+/* Sort the not-yet-started part of batch_files (from batch_index on) by the
+ * active policy; manual priority always wins. The sort is stable, so FIFO
+ * keeps insertion order among equal priorities. */
+static void batch_reorder_pending(void)
+{
+    /* between runs the pending part is all of it: Start runs the whole
+     * list, whatever the previous run reached */
+    if (!batch_running) batch_index = 0;
+    if (!batch_files || batch_index >= batch_files->len) return;
+    GPtrArray *pending = g_ptr_array_sized_new(batch_files->len - batch_index);
+    for (guint i = batch_index; i < batch_files->len; i++)
+        g_ptr_array_add(pending, g_ptr_array_index(batch_files, i));
+    gchar *video_enc = NULL;
+    if (copy_video_check && gtk_check_button_get_active(GTK_CHECK_BUTTON(copy_video_check)))
+        video_enc = g_strdup("copy");
+    else
+        video_enc = drop_down_get_active_text(video_combo, video_model);
+    BatchOrderCtx ctx = { batch_policy, video_enc };
+    g_ptr_array_sort_with_data(pending, batch_job_compare, &ctx);
+    gboolean changed = FALSE;
+    for (guint i = 0; i < pending->len; i++) {
+        if (batch_files->pdata[batch_index + i] != pending->pdata[i]) {
+            batch_files->pdata[batch_index + i] = pending->pdata[i];
+            changed = TRUE;
+        }
+    }
+    g_ptr_array_free(pending, TRUE);
+    g_free(video_enc);
+    if (changed)
+        batch_list_rebuild();
+}
+
+static gboolean batch_reorder_timeout_cb(gpointer user_data)
+{
+    batch_reorder_source = 0;
+    batch_reorder_pending();
+    return G_SOURCE_REMOVE;
+}
+
+/* Coalesce reorders triggered by bursts of probe results */
+static void batch_schedule_reorder(void)
+{
+    if (!batch_reorder_source)
+        batch_reorder_source = g_timeout_add(200, batch_reorder_timeout_cb, NULL);
+}
+
+static void batch_policy_changed_cb(GtkDropDown *combo, GParamSpec *pspec, gpointer user_data)
+{
+    batch_policy = (BatchPolicy)gtk_drop_down_get_selected(combo);
+    batch_reorder_pending();
+}
+
+/* Raise the priority of the selected pending jobs so they run next */
+static void batch_bump_clicked(GtkButton *button, gpointer user_data)
+{
+    const char *path = batch_list_selected();
+    BatchJob *job = path && batch_jobs ? g_hash_table_lookup(batch_jobs, path) : NULL;
+    if (!job) return;
+    job->priority++;
+    batch_reorder_pending();
+}
+
+/* Free-space admission for the next job. Returns FALSE to hold it while
+ * other jobs on the same file system are running; when none are, the job
+ * cannot fit at all and *problem explains why it is skipped. */
+static gboolean batch_space_check(const char *path, const char *output, gint64 needed, gchar **problem)
+{
+    dev_t dev;
+    gboolean others;
+    gint64 avail;
+    if (space_admit(output, needed, &dev, &others, &avail)) {
+        g_clear_pointer(&space_held_path, g_free);
+        return TRUE;
+    }
+    gchar *need = g_format_size(needed);
+    gchar *free_str = g_format_size(MAX(avail, 0));
+    if (!others) {
+        *problem = g_strdup_printf("needs about %s but only %s is free for the output", need, free_str);
+        if (!batch_failed) batch_failed = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(batch_failed, g_strdup(path));
+    } else if (g_strcmp0(space_held_path, path) != 0) {
+        gchar *msg = g_strdup_printf("Holding %s: needs about %s, %s free is reserved for running jobs\n", path, need, free_str);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        g_free(msg);
+        g_free(space_held_path);
+        space_held_path = g_strdup(path);
+    }
+    g_free(need);
+    g_free(free_str);
+    return !others;
+}
+
+/* Start as many pending batch files as the worker limit and memory admission
+ * allow. Files are converted with the current UI settings; autodetection is
+ * skipped (detect_defaults is not called). The batch finishes once nothing is
+ * pending and the last worker has exited. */
+static void process_next_in_batch(void)
+{
+    if (!batch_running) return;
+    guint running = 0;
+    for (guint i = 0; workers && i < workers->len; i++) {
+        FfmpegWorker *w = g_ptr_array_index(workers, i);
+        if (w->batch) running++;
+    }
+    if (!batch_files || batch_index >= batch_files->len) {
+        if (running > 0) return; /* wait for the last workers */
+        /* finished */
+        batch_running = FALSE;
+        if (batch_add_folder_button) gtk_widget_set_sensitive(batch_add_folder_button, TRUE);
+        if (batch_add_files_button) gtk_widget_set_sensitive(batch_add_files_button, TRUE);
+        if (batch_remove_button) gtk_widget_set_sensitive(batch_remove_button, TRUE);
+        if (batch_start_button) gtk_widget_set_sensitive(batch_start_button, TRUE);
+        if (batch_stop_button) gtk_widget_set_sensitive(batch_stop_button, FALSE);
+        if (batch_list_view) gtk_widget_set_sensitive(batch_list_view, TRUE);
+        batch_progress_update(TRUE);
+        gchar *summary = g_strdup_printf("Batch finished: %u converted, %u failed.\n", batch_converted, batch_failed ? batch_failed->len : 0);
+        gtk_text_buffer_insert_at_cursor(log_buffer, summary, -1);
+        if (progress_stdout) {
+            g_print("%s", summary);
+            fflush(stdout);
+        }
+        g_free(summary);
+        for (guint i = 0; batch_failed && i < batch_failed->len; i++) {
+            gchar *line = g_strdup_printf("  failed: %s\n", (const char *)g_ptr_array_index(batch_failed, i));
+            gtk_text_buffer_insert_at_cursor(log_buffer, line, -1);
+            g_free(line);
+        }
+        if (autorun_manifest) {
+            latency_report();
+            g_application_quit(g_application_get_default());
+        }
+        return;
+    }
+    /* Pick the next jobs according to the scheduling policy */
+    batch_reorder_pending();
+    while (batch_index < batch_files->len && running < batch_worker_limit() && !batch_admission_paused) {
+        const char *next = g_ptr_array_index(batch_files, batch_index);
+        BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, next) : NULL;
+        const JobSettings *js = job && job->settings ? job->settings : batch_ui_settings;
+        /* a retried job runs with the fallback chosen for it */
+        const char *job_audio = job && job->retry_audio ? job->retry_audio : js->audio;
+        const char *job_video = job && job->retry_video ? job->retry_video : js->video;
+        gchar *next_out = job_output_path(next, js);
+        gchar *problem = NULL;
+        if (selected_encoders_usable(job_audio, job_video, &problem))
+            problem = job_settings_problem(next_out, job_audio, job_video, job ? &job->info : NULL);
+        if (!problem && job && !batch_space_check(next, next_out, estimate_output_bytes(&job->info, job_audio, job_video), &problem)) {
+            g_free(next_out);
+            break; /* held until a running job on that file system finishes */
+        }
+        if (problem) {
+            gchar *msg = g_strdup_printf("Skipping %s: %s\n", next, problem);
+            gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+            g_free(msg);
+            g_free(problem);
+            g_free(next_out);
+            batch_index++;
+            continue;
+        }
+        GPtrArray *group = batch_job_groupable(next, job) ? batch_collect_group(job_audio) : NULL;
+        if (group) {
+            /* the group is checked against the first output's file system */
+            gint64 gbytes = 0;
+            for (guint i = 0; i < group->len; i++) {
+                BatchJob *member = g_hash_table_lookup(batch_jobs, g_ptr_array_index(group, i));
+                gbytes += estimate_output_bytes(&member->info, job_audio, NULL);
+            }
+            /* admission only: skips are recorded when a member is checked alone */
+            dev_t gdev;
+            gboolean gothers;
+            gint64 gfree;
+            gboolean fits = space_admit(next_out, gbytes, &gdev, &gothers, &gfree);
+            g_free(next_out);
+            if (!fits && gothers) {
+                /* held until a running job on that file system finishes */
+                g_ptr_array_free(group, TRUE);
+                break;
+            }
+            if (!fits) {
+                /* the group can never fit: let the members go on their own */
+                for (guint i = 0; i < group->len; i++) {
+                    BatchJob *member = g_hash_table_lookup(batch_jobs, g_ptr_array_index(group, i));
+                    member->no_group = TRUE;
+                }
+                g_ptr_array_free(group, TRUE);
+                continue;
+            }
+            /* one process, memory of about one audio job; not learned from */
+            gchar *gkey = mem_model_key(job_audio, NULL, 0);
+            gint64 gestimate = estimate_job_memory(gkey, 0);
+            g_free(gkey);
+            if (!mem_admit(gestimate)) {
+                g_ptr_array_free(group, TRUE);
+                break;
+            }
+            /* the paths stay owned by batch_files while the index moves past them */
+            batch_index += group->len;
+            FfmpegWorker *w = batch_start_group(group, job_audio);
+            if (!w) {
+                for (guint i = 0; i < group->len; i++) {
+                    BatchJob *member = g_hash_table_lookup(batch_jobs, g_ptr_array_index(group, i));
+                    if (member) member->no_group = TRUE;
+                }
+                batch_index -= group->len;
+                g_ptr_array_free(group, TRUE);
+                continue;
+            }
+            g_ptr_array_free(group, TRUE);
+            w->batch = TRUE;
+            w->mem_estimate = gestimate;
+            w->out_estimate = gbytes;
+            gint64 gavail;
+            output_fs(w->output, &w->out_dev, &gavail);
+            running++;
+            continue;
+        }
+        gint64 pixels = 0;
+        if (job && job->info.width > 0 && job->info.height > 0)
+            pixels = (gint64)job->info.width * job->info.height;
+        else if (!job || !job->info.probed || job->info.video_codec)
+            pixels = 1920 * 1080; /* unknown yet: assume 1080p */
+        gchar *key = mem_model_key(job_audio, job_video, pixels);
+        gint64 estimate = estimate_job_memory(key, pixels);
+        if (!mem_admit(estimate)) {
+            /* retried from worker_sample_cb and on every job exit */
+            g_free(key);
+            g_free(next_out);
+            break;
+        }
+        /* Show the job in the main window, but DO NOT call detect_defaults (skip autodetection) */
+        g_free(input_file);
+        input_file = g_strdup(next);
+        gtk_label_set_text(GTK_LABEL(input_label), input_file);
+        g_free(output_file);
+        output_file = next_out;
+        gtk_label_set_text(GTK_LABEL(output_label), output_file);
+        batch_index++;
+        FfmpegWorker *w = start_conversion(input_file, output_file, job_audio, job_video,
+                                           job && job->retry_vf ? job->retry_vf : js->vfilter,
+                                           job && job->retry_af ? job->retry_af : js->afilter, js, job);
+        if (!w) {
+            g_free(key);
+            continue;
+        }
+        w->batch = TRUE;
+        w->mem_key = key;
+        w->pixels = pixels;
+        w->mem_estimate = estimate;
+        if (job) {
+            gint64 avail;
+            w->out_estimate = estimate_output_bytes(&job->info, job_audio, job_video);
+            output_fs(w->output, &w->out_dev, &avail);
+        }
+        running++;
+        gdouble cpu, util;
+        if (job && history_predict(key, js->preset, &job->info, &cpu, &util)) {
+            /* the job shares the machine with as many others as the limit
+             * and the pending jobs allow */
+            guint pending = batch_files->len - batch_index;
+            guint parallel = MAX(running, MIN(batch_worker_limit(), running + pending));
+            gchar *expected = format_duration(history_wall(cpu, util, parallel));
+            gchar *msg = g_strdup_printf("Expected to take about %s\n", expected);
+            gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+            g_free(msg);
+            g_free(expected);
+        }
+    }
+    batch_prefetch_schedule();
+    if (running == 0 && batch_index >= batch_files->len)
+        g_idle_add(continue_batch_idle, NULL); /* everything failed to spawn */
+}
+
+static void batch_workers_changed(GtkSpinButton *spin, gpointer user_data)
+{
+    batch_max_workers = (guint)gtk_spin_button_get_value_as_int(spin);
+    if (batch_min_workers > batch_max_workers && batch_min_workers_spin)
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_min_workers_spin), batch_max_workers);
+    batch_target_workers = CLAMP(batch_target_workers, batch_min_workers, batch_max_workers);
+    if (batch_running)
+        process_next_in_batch();
+}
+
+static void batch_min_workers_changed(GtkSpinButton *spin, gpointer user_data)
 {
-    batch_running = FALSE;
-    /* Re-enable controls */
-    if (batch_add_folder_button) gtk_widget_set_sensitive(batch_add_folder_button, TRUE);
-    if (batch_add_files_button) gtk_widget_set_sensitive(batch_add_files_button, TRUE);
-    if (batch_remove_button) gtk_widget_set_sensitive(batch_remove_button, TRUE);
-    if (batch_start_button) gtk_widget_set_sensitive(batch_start_button, TRUE);
-    if (batch_stop_button) gtk_widget_set_sensitive(batch_stop_button, FALSE);
-    if (batch_listbox) gtk_widget_set_sensitive(batch_listbox, TRUE);
-    /* Also stop any running ffmpeg process */
-    on_stop_clicked(NULL, NULL);
+    batch_min_workers = (guint)gtk_spin_button_get_value_as_int(spin);
+    if (batch_min_workers > batch_max_workers && batch_workers_spin)
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_workers_spin), batch_min_workers);
+    batch_target_workers = CLAMP(batch_target_workers, batch_min_workers, batch_max_workers);
 }
 
-/* Start processing next file in batch (if any). This will set input_file/output_file and
- * trigger the normal on_start_clicked logic. It will skip autodetection (so do not call
- * detect_defaults) as requested and reuse current UI settings. */
-static void process_next_in_batch(void)
+static void batch_group_limit_changed(GtkSpinButton *spin, gpointer user_data)
 {
-    if (!batch_running) return;
-    if (!batch_files || batch_index >= batch_files->len) {
-        /* finished */
-        batch_running = FALSE;
-        if (batch_add_folder_button) gtk_widget_set_sensitive(batch_add_folder_button, TRUE);
-        if (batch_add_files_button) gtk_widget_set_sensitive(batch_add_files_button, TRUE);
-        if (batch_remove_button) gtk_widget_set_sensitive(batch_remove_button, TRUE);
-        if (batch_start_button) gtk_widget_set_sensitive(batch_start_button, TRUE);
-        if (batch_stop_button) gtk_widget_set_sensitive(batch_stop_button, FALSE);
-        if (batch_listbox) gtk_widget_set_sensitive(batch_listbox, TRUE);
-        gtk_text_buffer_insert_at_cursor(log_buffer, "Batch finished.\n", -1);
-        return;
-    }
-    /* Set input_file to next path, but DO NOT call detect_defaults (skip autodetection) */
-    char *next = g_strdup(g_ptr_array_index(batch_files, batch_index));
-    g_free(input_file);
-    input_file = next;
-    gtk_label_set_text(GTK_LABEL(input_label), input_file);
-    /* Update output_file using current format selection */
-    update_output_label();
-    /* Start conversion using existing UI settings */
-    /* Reuse on_start_clicked but it's tied to button; call directly */
-    on_start_clicked(GTK_BUTTON(start_button), NULL);
-    /* increment index for next time (we continue after child exits) */
-    batch_index++;
+    batch_group_limit = (guint)gtk_spin_button_get_value_as_int(spin);
+}
+
+static void batch_adaptive_toggled(GtkCheckButton *check, gpointer user_data)
+{
+    batch_adaptive = gtk_check_button_get_active(check);
+    if (batch_min_workers_spin)
+        gtk_widget_set_sensitive(batch_min_workers_spin, batch_adaptive);
+    if (!batch_adaptive)
+        batch_admission_paused = FALSE;
+    else if (batch_running)
+        adaptive_start();
 }
 
 /* Open batch dialog: simple window with list and controls */
@@ -1254,6 +8031,8 @@ static void open_batch_dialog(GtkWindow *parent)
 {
     if (start_button)
         gtk_widget_set_sensitive(start_button, FALSE);
+    if (preview_button)
+        gtk_widget_set_sensitive(preview_button, FALSE);
     if (batch_dialog) {
         gtk_window_present(GTK_WINDOW(batch_dialog));
         return;
@@ -1269,19 +8048,33 @@ static void open_batch_dialog(GtkWindow *parent)
     gtk_widget_set_margin_bottom(vbox, 8);
     gtk_widget_set_margin_start(vbox, 8);
     gtk_widget_set_margin_end(vbox, 8);
-    batch_listbox = gtk_list_box_new();
-    g_signal_connect(batch_listbox, "row-selected", G_CALLBACK(batch_row_selected_cb), NULL);
+    batch_model = gtk_string_list_new(NULL);
+    batch_selection = gtk_single_selection_new(G_LIST_MODEL(g_object_ref(batch_model)));
+    gtk_single_selection_set_autoselect(batch_selection, FALSE);
+    gtk_single_selection_set_can_unselect(batch_selection, TRUE);
+    gtk_single_selection_set_selected(batch_selection, GTK_INVALID_LIST_POSITION);
+    g_signal_connect(batch_selection, "notify::selected-item", G_CALLBACK(batch_row_selected_cb), NULL);
+    GtkListItemFactory *batch_factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(batch_factory, "setup", G_CALLBACK(batch_row_setup), NULL);
+    g_signal_connect(batch_factory, "bind", G_CALLBACK(batch_row_bind), NULL);
+    /* the view owns the selection and the factory */
+    batch_list_view = gtk_list_view_new(GTK_SELECTION_MODEL(batch_selection), batch_factory);
     /* Put the listbox inside a scrolled window so the batch list is scrollable */
     GtkWidget *batch_scrolled = gtk_scrolled_window_new();
     gtk_widget_set_vexpand(batch_scrolled, TRUE);
-    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(batch_scrolled), batch_listbox);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(batch_scrolled), batch_list_view);
     /* Accept drag & drop onto the batch list so users can drop files/folders directly */
     {
         GtkDropTarget *batch_drop = gtk_drop_target_new(G_TYPE_FILE, GDK_ACTION_COPY);
         g_signal_connect(batch_drop, "drop", G_CALLBACK(on_drop_received), batch_dialog);
-        gtk_widget_add_controller(batch_listbox, GTK_EVENT_CONTROLLER(batch_drop));
+        gtk_widget_add_controller(batch_list_view, GTK_EVENT_CONTROLLER(batch_drop));
     }
     gtk_box_append(GTK_BOX(vbox), batch_scrolled);
+    /* Progress of the whole run in media time, with throughput and ETA */
+    batch_progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(batch_progress_bar), TRUE);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(batch_progress_bar), "");
+    gtk_box_append(GTK_BOX(vbox), batch_progress_bar);
     GtkWidget *h = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
     batch_add_folder_button = gtk_button_new_with_label("Add folder");
     g_signal_connect(batch_add_folder_button, "clicked", G_CALLBACK(batch_add_folder_clicked), batch_dialog);
@@ -1289,9 +8082,17 @@ static void open_batch_dialog(GtkWindow *parent)
     batch_add_files_button = gtk_button_new_with_label("Add file(s)");
     g_signal_connect(batch_add_files_button, "clicked", G_CALLBACK(batch_add_files_clicked), batch_dialog);
     gtk_box_append(GTK_BOX(h), batch_add_files_button);
+    GtkWidget *batch_import_button = gtk_button_new_with_label("Import list");
+    gtk_widget_set_tooltip_text(batch_import_button, "Queue the jobs of a CSV or JSON list, each with its own output, format, codecs and options");
+    g_signal_connect(batch_import_button, "clicked", G_CALLBACK(batch_import_clicked), batch_dialog);
+    gtk_box_append(GTK_BOX(h), batch_import_button);
     batch_remove_button = gtk_button_new_with_label("Remove selected");
     g_signal_connect(batch_remove_button, "clicked", G_CALLBACK(batch_remove_selected_clicked), NULL);
     gtk_box_append(GTK_BOX(h), batch_remove_button);
+    GtkWidget *batch_plan_button = gtk_button_new_with_label("Plan");
+    gtk_widget_set_tooltip_text(batch_plan_button, "Estimate how long the queued jobs take with 1, 2, ... workers, from the times of earlier runs");
+    g_signal_connect(batch_plan_button, "clicked", G_CALLBACK(batch_plan_clicked), NULL);
+    gtk_box_append(GTK_BOX(h), batch_plan_button);
     batch_start_button = gtk_button_new_with_label("Start batch");
     g_signal_connect(batch_start_button, "clicked", G_CALLBACK(batch_start_clicked_cb), NULL);
     gtk_box_append(GTK_BOX(h), batch_start_button);
@@ -1309,37 +8110,384 @@ static void open_batch_dialog(GtkWindow *parent)
     g_signal_connect(batch_clear_button, "clicked", G_CALLBACK(batch_clear_clicked), NULL);
     gtk_box_append(GTK_BOX(h), batch_clear_button);
     gtk_box_append(GTK_BOX(vbox), h);
+    /* Hot-folder watch: toggle button plus the stability interval in seconds */
+    GtkWidget *hw = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    batch_watch_button = gtk_button_new_with_label(watch_root ? "Stop watching" : "Watch folder");
+    g_signal_connect(batch_watch_button, "clicked", G_CALLBACK(batch_watch_clicked), batch_dialog);
+    gtk_box_append(GTK_BOX(hw), batch_watch_button);
+    gtk_box_append(GTK_BOX(hw), gtk_label_new("Stable after (s):"));
+    batch_watch_spin = gtk_spin_button_new_with_range(1, 600, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_watch_spin), watch_stable_seconds);
+    g_signal_connect(batch_watch_spin, "value-changed", G_CALLBACK(batch_watch_interval_changed), NULL);
+    gtk_box_append(GTK_BOX(hw), batch_watch_spin);
+    /* Scheduling policy and manual priority bumps */
+    gtk_box_append(GTK_BOX(hw), gtk_label_new("Order:"));
+    const char *policies[] = {"Insertion order", "Shortest first", "Longest first", NULL};
+    batch_policy_combo = gtk_drop_down_new_from_strings(policies);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(batch_policy_combo), batch_policy);
+    g_signal_connect(batch_policy_combo, "notify::selected", G_CALLBACK(batch_policy_changed_cb), NULL);
+    gtk_box_append(GTK_BOX(hw), batch_policy_combo);
+    batch_bump_button = gtk_button_new_with_label("Prioritize");
+    gtk_widget_set_tooltip_text(batch_bump_button, "Run the selected files next");
+    g_signal_connect(batch_bump_button, "clicked", G_CALLBACK(batch_bump_clicked), NULL);
+    gtk_box_append(GTK_BOX(hw), batch_bump_button);
+    gtk_box_append(GTK_BOX(vbox), hw);
+    /* Parallel workers; memory admission may run fewer */
+    GtkWidget *hp = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append(GTK_BOX(hp), gtk_label_new("Parallel jobs:"));
+    batch_workers_spin = gtk_spin_button_new_with_range(1, 64, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_workers_spin), batch_max_workers);
+    gtk_widget_set_tooltip_text(batch_workers_spin, "Upper bound; a job only starts when its estimated memory fits in MemAvailable");
+    g_signal_connect(batch_workers_spin, "value-changed", G_CALLBACK(batch_workers_changed), NULL);
+    gtk_box_append(GTK_BOX(hp), batch_workers_spin);
+    /* Adaptive mode: grow/shrink between the minimum and the limit above */
+    batch_adaptive_check = gtk_check_button_new_with_label("Adapt to system load, min:");
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(batch_adaptive_check), batch_adaptive);
+    gtk_widget_set_tooltip_text(batch_adaptive_check, "Sample /proc/loadavg and pressure stall information and adjust the number of workers");
+    g_signal_connect(batch_adaptive_check, "toggled", G_CALLBACK(batch_adaptive_toggled), NULL);
+    gtk_box_append(GTK_BOX(hp), batch_adaptive_check);
+    batch_min_workers_spin = gtk_spin_button_new_with_range(1, 64, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_min_workers_spin), batch_min_workers);
+    gtk_widget_set_sensitive(batch_min_workers_spin, batch_adaptive);
+    g_signal_connect(batch_min_workers_spin, "value-changed", G_CALLBACK(batch_min_workers_changed), NULL);
+    gtk_box_append(GTK_BOX(hp), batch_min_workers_spin);
+    gtk_box_append(GTK_BOX(hp), gtk_label_new("Group small files:"));
+    batch_group_spin = gtk_spin_button_new_with_range(1, 64, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_group_spin), batch_group_limit);
+    gtk_widget_set_tooltip_text(batch_group_spin, "Convert up to this many short audio-only files in one ffmpeg process (1 = one process per file)");
+    g_signal_connect(batch_group_spin, "value-changed", G_CALLBACK(batch_group_limit_changed), NULL);
+    gtk_box_append(GTK_BOX(hp), batch_group_spin);
+    gtk_box_append(GTK_BOX(vbox), hp);
+#ifdef HAVE_LIBAV
+    batch_inproc_check = gtk_check_button_new_with_label("Convert small audio files in-process");
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(batch_inproc_check), inproc_enabled);
+    gtk_widget_set_tooltip_text(batch_inproc_check, "Decode and encode short audio-only files with the FFmpeg libraries inside bac instead of starting an ffmpeg process for each");
+    g_signal_connect(batch_inproc_check, "toggled", G_CALLBACK(batch_inproc_toggled), NULL);
+    gtk_box_append(GTK_BOX(vbox), batch_inproc_check);
+#endif
+    batch_quality_check = gtk_check_button_new_with_label("Measure quality (PSNR, SSIM, VMAF if available)");
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(batch_quality_check), quality_enabled);
+    gtk_widget_set_tooltip_text(batch_quality_check, "Compare each converted video with its source in a low-priority ffmpeg run and add the scores to report.csv in the batch's log directory");
+    g_signal_connect(batch_quality_check, "toggled", G_CALLBACK(batch_quality_toggled), NULL);
+    gtk_box_append(GTK_BOX(vbox), batch_quality_check);
     gtk_window_set_child(GTK_WINDOW(batch_dialog), vbox);
     gtk_window_present(GTK_WINDOW(batch_dialog));
     if (!batch_files) batch_files = g_ptr_array_new_with_free_func(g_free);
     /* Populate existing batch entries into listbox */
-    for (guint i = 0; i < batch_files->len; i++) {
-        char *p = g_ptr_array_index(batch_files, i);
-        GtkWidget *row = gtk_label_new(p);
-        gtk_label_set_xalign(GTK_LABEL(row), 0.0);
-        gtk_label_set_ellipsize(GTK_LABEL(row), PANGO_ELLIPSIZE_START);
-        gtk_widget_set_tooltip_text(row, p);
-        gtk_list_box_insert(GTK_LIST_BOX(batch_listbox), row, -1);
-        gtk_widget_set_visible(row, TRUE);
-    }
+    batch_list_rebuild();
 }
 
 static gboolean batch_dialog_close_request_cb(GtkWindow *window, gpointer user_data)
 {
     /* Clear widget globals so the dialog can be recreated later. Keep batch_files
      * intact (we want to preserve the queued paths). */
-    batch_listbox = NULL;
+    batch_list_view = NULL;
+    /* the view keeps them alive until the window is destroyed */
+    g_clear_object(&batch_model);
+    batch_selection = NULL;
     batch_add_folder_button = NULL;
     batch_add_files_button = NULL;
     batch_remove_button = NULL;
     batch_start_button = NULL;
     batch_stop_button = NULL;
+    batch_progress_bar = NULL;
+    batch_watch_button = NULL;
+    batch_watch_spin = NULL;
+    batch_policy_combo = NULL;
+    batch_bump_button = NULL;
+    batch_workers_spin = NULL;
+    batch_adaptive_check = NULL;
+    batch_min_workers_spin = NULL;
+    batch_group_spin = NULL;
+#ifdef HAVE_LIBAV
+    batch_inproc_check = NULL;
+#endif
+    batch_quality_check = NULL;
     batch_dialog = NULL;
     update_start_button_state();
     /* Allow default handler to continue (destroy the window) */
     return FALSE;
 }
 
+/* Manifest import: a CSV file whose first row names the columns, or a JSON
+ * array of objects (optionally {"jobs": [...]}), one job per row. Columns:
+ * input (required), output, format, audio, video, vf, af, preset, threads,
+ * tile_columns, row_mt, streams, all_audio, languages, subtitles, cover.
+ * Relative paths are relative to the manifest; values left out are taken
+ * from the main window as it is at import time. */
+#define MANIFEST_REPORT_ERRORS 5
+
+static const char *manifest_value(GHashTable *row, const char *key)
+{
+    const char *v = g_hash_table_lookup(row, key);
+    return v && *v ? v : NULL;
+}
+
+static gboolean manifest_bool(GHashTable *row, const char *key, gboolean fallback)
+{
+    const char *v = manifest_value(row, key);
+    if (!v) return fallback;
+    return g_ascii_strcasecmp(v, "true") == 0 || g_ascii_strcasecmp(v, "yes") == 0 || atoi(v) != 0;
+}
+
+static gchar *manifest_path(const char *base, const char *path)
+{
+    return g_path_is_absolute(path) ? g_strdup(path) : g_build_filename(base, path, NULL);
+}
+
+/* Queue one manifest row with its own settings; NULL or why it was skipped */
+static gchar *manifest_queue_row(GHashTable *row, const char *base, const JobSettings *defaults)
+{
+    const char *value = manifest_value(row, "input");
+    if (!value) return g_strdup("no input");
+    gchar *input = manifest_path(base, value);
+    if (!g_file_test(input, G_FILE_TEST_IS_REGULAR)) {
+        gchar *problem = g_strdup_printf("%s does not exist", input);
+        g_free(input);
+        return problem;
+    }
+    if (!batch_append_path(input)) {
+        gchar *problem = g_strdup_printf("%s is already queued", input);
+        g_free(input);
+        return problem;
+    }
+    JobSettings *js = g_atomic_rc_box_new0(JobSettings);
+    value = manifest_value(row, "output");
+    js->output = value ? manifest_path(base, value) : NULL;
+    js->format = g_strdup((value = manifest_value(row, "format")) ? value : defaults->format);
+    js->audio = g_strdup((value = manifest_value(row, "audio")) ? value : defaults->audio);
+    js->video = g_strdup((value = manifest_value(row, "video")) ? value : defaults->video);
+    js->vfilter = g_strdup(manifest_value(row, "vf"));
+    js->afilter = g_strdup(manifest_value(row, "af"));
+    js->preset = g_strdup((value = manifest_value(row, "preset")) ? value : defaults->preset);
+    js->threads = (value = manifest_value(row, "threads")) ? (gint)g_ascii_strtoll(value, NULL, 10) : defaults->threads;
+    js->tile_columns = (value = manifest_value(row, "tile_columns")) ? (gint)g_ascii_strtoll(value, NULL, 10) : defaults->tile_columns;
+    js->row_mt = manifest_bool(row, "row_mt", defaults->row_mt);
+    js->stream_rules = manifest_bool(row, "streams", defaults->stream_rules);
+    js->all_audio = manifest_bool(row, "all_audio", defaults->all_audio);
+    js->languages = (value = manifest_value(row, "languages")) ? stream_languages_parse(value) : g_strdupv(defaults->languages);
+    js->keep_subtitles = manifest_bool(row, "subtitles", defaults->keep_subtitles);
+    js->keep_cover = manifest_bool(row, "cover", defaults->keep_cover);
+    BatchJob *job = g_hash_table_lookup(batch_jobs, input);
+    if (job->settings) job_settings_unref(job->settings);
+    job->settings = js;
+    job->from_manifest = TRUE;
+    g_free(input);
+    return NULL;
+}
+
+/* One CSV record (RFC 4180: quoted fields may hold commas, line breaks and
+ * quotes written as ""). Advances *p; NULL at the end of the data. */
+static GPtrArray *csv_next_record(const char **p)
+{
+    const char *s = *p;
+    if (!*s) return NULL;
+    GPtrArray *fields = g_ptr_array_new_with_free_func(g_free);
+    GString *field = g_string_new(NULL);
+    gboolean quoted = FALSE;
+    for (;;) {
+        char c = *s;
+        if (quoted) {
+            if (!c) break;
+            if (c == '"' && s[1] == '"') {
+                g_string_append_c(field, '"');
+                s += 2;
+            } else {
+                if (c == '"') quoted = FALSE;
+                else g_string_append_c(field, c);
+                s++;
+            }
+            continue;
+        }
+        if (!c || c == '\n' || c == '\r') {
+            if (c == '\r' && s[1] == '\n') s++;
+            if (c) s++;
+            break;
+        }
+        if (c == '"') {
+            quoted = TRUE;
+        } else if (c == ',') {
+            g_ptr_array_add(fields, g_strstrip(g_string_free(field, FALSE)));
+            field = g_string_new(NULL);
+        } else {
+            g_string_append_c(field, c);
+        }
+        s++;
+    }
+    g_ptr_array_add(fields, g_strstrip(g_string_free(field, FALSE)));
+    *p = s;
+    return fields;
+}
+
+/* Rows of a CSV manifest as column -> value tables */
+static GPtrArray *manifest_parse_csv(const char *data, GError **error)
+{
+    const char *p = data;
+    GPtrArray *header = csv_next_record(&p);
+    if (!header || !g_ptr_array_find_with_equal_func(header, "input", g_str_equal, NULL)) {
+        if (header) g_ptr_array_free(header, TRUE);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "the first row must name the columns, including \"input\"");
+        return NULL;
+    }
+    GPtrArray *rows = g_ptr_array_new_with_free_func((GDestroyNotify)g_hash_table_unref);
+    GPtrArray *fields;
+    while ((fields = csv_next_record(&p)) != NULL) {
+        if (fields->len == 1 && !*(const char *)g_ptr_array_index(fields, 0)) {
+            g_ptr_array_free(fields, TRUE); /* blank line */
+            continue;
+        }
+        GHashTable *row = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        for (guint i = 0; i < fields->len && i < header->len; i++)
+            g_hash_table_insert(row, g_strdup(g_ptr_array_index(header, i)), g_strdup(g_ptr_array_index(fields, i)));
+        g_ptr_array_add(rows, row);
+        g_ptr_array_free(fields, TRUE);
+    }
+    g_ptr_array_free(header, TRUE);
+    return rows;
+}
+
+/* Rows of a JSON manifest; numbers and booleans are taken as text */
+static GPtrArray *manifest_parse_json(const char *data, GError **error)
+{
+    JsonParser *parser = json_parser_new();
+    if (!json_parser_load_from_data(parser, data, -1, error)) {
+        g_object_unref(parser);
+        return NULL;
+    }
+    JsonNode *root = json_parser_get_root(parser);
+    JsonArray *jobs = NULL;
+    if (root && JSON_NODE_HOLDS_ARRAY(root))
+        jobs = json_node_get_array(root);
+    else if (root && JSON_NODE_HOLDS_OBJECT(root) && json_object_has_member(json_node_get_object(root), "jobs"))
+        jobs = json_object_get_array_member(json_node_get_object(root), "jobs");
+    if (!jobs) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "expected an array of jobs");
+        g_object_unref(parser);
+        return NULL;
+    }
+    GPtrArray *rows = g_ptr_array_new_with_free_func((GDestroyNotify)g_hash_table_unref);
+    for (guint i = 0; i < json_array_get_length(jobs); i++) {
+        GHashTable *row = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        JsonNode *node = json_array_get_element(jobs, i);
+        JsonObject *obj = JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node) : NULL;
+        GList *members = obj ? json_object_get_members(obj) : NULL;
+        for (GList *l = members; l; l = l->next) {
+            JsonNode *v = json_object_get_member(obj, l->data);
+            gchar *text = NULL;
+            if (!JSON_NODE_HOLDS_VALUE(v)) continue;
+            GType type = json_node_get_value_type(v);
+            if (type == G_TYPE_STRING)
+                text = g_strdup(json_node_get_string(v));
+            else if (type == G_TYPE_INT64)
+                text = g_strdup_printf("%" G_GINT64_FORMAT, json_node_get_int(v));
+            else if (type == G_TYPE_BOOLEAN)
+                text = g_strdup(json_node_get_boolean(v) ? "1" : "0");
+            else if (type == G_TYPE_DOUBLE)
+                text = g_strdup_printf("%d", (gint)json_node_get_double(v));
+            if (text) g_hash_table_insert(row, g_strdup(l->data), text);
+        }
+        g_list_free(members);
+        g_ptr_array_add(rows, row);
+    }
+    g_object_unref(parser);
+    return rows;
+}
+
+/* Queue every row of the manifest at `path` and report what was skipped */
+static void batch_import_manifest(const char *path)
+{
+    gchar *data = NULL;
+    GError *error = NULL;
+    GPtrArray *rows = NULL;
+    if (g_file_get_contents(path, &data, NULL, &error)) {
+        const char *start = data;
+        while (g_ascii_isspace(*start)) start++;
+        gboolean json = *start == '[' || *start == '{';
+        rows = json ? manifest_parse_json(start, &error) : manifest_parse_csv(start, &error);
+    }
+    g_free(data);
+    if (!rows) {
+        gchar *msg = g_strdup_printf("Cannot import %s: %s\n", path, error->message);
+        gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+        show_alert(NULL, "Cannot import the list", error->message);
+        g_free(msg);
+        g_error_free(error);
+        return;
+    }
+    gchar *base = g_path_get_dirname(path);
+    JobSettings *defaults = job_settings_from_ui();
+    guint queued = 0, skipped = 0;
+    GString *report = g_string_new(NULL);
+    for (guint i = 0; i < rows->len; i++) {
+        gchar *problem = manifest_queue_row(g_ptr_array_index(rows, i), base, defaults);
+        if (!problem) {
+            queued++;
+            continue;
+        }
+        if (++skipped <= MANIFEST_REPORT_ERRORS)
+            g_string_append_printf(report, "  job %u: %s\n", i + 1, problem);
+        g_free(problem);
+    }
+    gchar *msg = g_strdup_printf("Imported %u jobs from %s, skipped %u\n", queued, path, skipped);
+    gtk_text_buffer_insert_at_cursor(log_buffer, msg, -1);
+    gtk_text_buffer_insert_at_cursor(log_buffer, report->str, -1);
+    g_free(msg);
+    g_string_free(report, TRUE);
+    job_settings_unref(defaults);
+    g_free(base);
+    g_ptr_array_free(rows, TRUE);
+}
+
+static void batch_import_native_response(GtkNativeDialog *native, gint response, gpointer user_data)
+{
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    if (response == GTK_RESPONSE_ACCEPT) {
+        GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(native));
+        gchar *path = file ? g_file_get_path(file) : NULL;
+        if (path) batch_import_manifest(path);
+        g_free(path);
+        if (file) g_object_unref(file);
+    }
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+    gtk_native_dialog_destroy(native);
+}
+
+static void batch_import_clicked(GtkButton *button, gpointer user_data)
+{
+    GtkWindow *parent = GTK_WINDOW(user_data);
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    GtkFileChooserNative *native = gtk_file_chooser_native_new("Import job list", parent, GTK_FILE_CHOOSER_ACTION_OPEN, "Import", "Cancel");
+    GtkFileFilter *filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "Job lists (CSV, JSON)");
+    gtk_file_filter_add_suffix(filter, "csv");
+    gtk_file_filter_add_suffix(filter, "json");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(native), filter);
+    g_object_unref(filter);
+    g_signal_connect(native, "response", G_CALLBACK(batch_import_native_response), NULL);
+    gtk_native_dialog_show(GTK_NATIVE_DIALOG(native));
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+}
+
 static void add_single_file_to_batch(GFile *file)
 {
     if (!file) return;
@@ -1349,37 +8497,10 @@ static void add_single_file_to_batch(GFile *file)
     if (batch_has_path(path)) { g_free(path); return; }
     /* check media type same as folder logic */
     GFileInfo *info = g_file_query_info(file, "standard::content-type", G_FILE_QUERY_INFO_NONE, NULL, NULL);
-    gboolean is_media = FALSE;
-    if (info) {
-        const char *ctype = g_file_info_get_content_type(info);
-        if (ctype && (g_str_has_prefix(ctype, "audio/") || g_str_has_prefix(ctype, "video/"))) is_media = TRUE;
-        g_object_unref(info);
-    }
-    if (!is_media) {
-        const char *ext = strrchr(path, '.');
-        if (ext) {
-            gchar *ext_l = g_utf8_strdown(ext + 1, -1);
-            if (is_media_extension(ext_l)) is_media = TRUE;
-            g_free(ext_l);
-        }
-    }
-    if (!is_media) { g_free(path); return; }
-
-    if (!batch_files) batch_files = g_ptr_array_new_with_free_func(g_free);
-    g_ptr_array_add(batch_files, g_strdup(path));
-    if (batch_listbox) {
-        GtkWidget *row = gtk_label_new(path);
-        gtk_label_set_xalign(GTK_LABEL(row), 0.0);
-        gtk_label_set_ellipsize(GTK_LABEL(row), PANGO_ELLIPSIZE_START);
-        gtk_widget_set_tooltip_text(row, path);
-        gtk_list_box_insert(GTK_LIST_BOX(batch_listbox), row, -1);
-        gtk_widget_set_visible(row, TRUE);
-        /* Select the first row in the list so the first item is applied */
-        {
-            GtkListBoxRow *to_select = gtk_list_box_get_row_at_index(GTK_LIST_BOX(batch_listbox), 0);
-            if (to_select) gtk_list_box_select_row(GTK_LIST_BOX(batch_listbox), to_select);
-        }
-    }
+    const char *ctype = info ? g_file_info_get_content_type(info) : NULL;
+    if (file_looks_like_media(path, ctype))
+        batch_append_path(path);
+    if (info) g_object_unref(info);
     g_free(path);
 }
 
@@ -1389,13 +8510,9 @@ static void batch_clear_clicked(GtkButton *button, gpointer user_data)
     if (batch_files) {
         g_ptr_array_set_size(batch_files, 0);
     }
-    if (batch_listbox) {
-        /* GTK4: remove rows by repeatedly removing row at index 0 until empty */
-        GtkListBoxRow *r;
-        while ((r = gtk_list_box_get_row_at_index(GTK_LIST_BOX(batch_listbox), 0)) != NULL) {
-            gtk_list_box_remove(GTK_LIST_BOX(batch_listbox), GTK_WIDGET(r));
-        }
-    }
+    if (batch_jobs)
+        g_hash_table_remove_all(batch_jobs);
+    batch_list_rebuild();
     /* Reset batch index/state */
     batch_index = 0;
     batch_running = FALSE;
@@ -1464,7 +8581,7 @@ static void batch_add_files_native_response(GtkNativeDialog *native, gint respon
 /* Drag & Drop: accept 'text/uri-list' drops on the main window and add files to batch */
 static gboolean on_drop_received(GtkDropTarget *target, const GValue *value, double x, double y, gpointer user_data)
 {
-    if (!value) return FALSE;
+    if (!value || !discovery_ready) return FALSE;
     GtkWindow *parent = GTK_WINDOW(user_data);
     /* Ensure batch dialog is open so listbox exists and UI shows queued files */
     if (!is_batch_dialog_open()) open_batch_dialog(parent);
@@ -1507,12 +8624,8 @@ static gboolean on_drop_received(GtkDropTarget *target, const GValue *value, dou
 /* Helper: check whether a given path is already present in batch_files */
 static gboolean batch_has_path(const char *path)
 {
-    if (!path || !batch_files) return FALSE;
-    for (guint i = 0; i < batch_files->len; i++) {
-        char *p = g_ptr_array_index(batch_files, i);
-        if (g_strcmp0(p, path) == 0) return TRUE;
-    }
-    return FALSE;
+    /* batch_jobs has an entry for every path in batch_files */
+    return path && batch_jobs && g_hash_table_contains(batch_jobs, path);
 }
 
 /* Helper: apply a file path as if chosen via file dialog (run autodetection and update UI) */
@@ -1595,22 +8708,18 @@ static void set_input_and_update_ui(const char *path)
     gtk_widget_set_sensitive(stop_button, FALSE);
 }
 
-/* Callback: when a row in the batch list is selected, apply that file to main UI */
-static void batch_row_selected_cb(GtkListBox *box, GtkListBoxRow *row, gpointer user_data)
+/* Callback: when a row in the batch list is selected, apply that file to the
+ * main UI (or, while a batch runs, only show its log) */
+static void batch_row_selected_cb(GObject *selection, GParamSpec *pspec, gpointer user_data)
 {
-    if (!row) return;
-    GtkWidget *child = gtk_list_box_row_get_child(row);
-    if (!child) return;
-    const char *text = NULL;
-    if (GTK_IS_LABEL(child)) {
-        text = gtk_label_get_text(GTK_LABEL(child));
-    } else {
-        /* If the child is a container, try to find a label by iterating its children using GTK's
-         * widget iterator helpers: use gtk_widget_get_first_child and gtk_widget_get_next_sibling
-         * are not part of stable public API; instead assume our rows are simple labels for now. */
-        return;
-    }
-    if (text) set_input_and_update_ui(text);
+    const char *text = batch_list_selected();
+    if (!text) return;
+    BatchJob *job = batch_jobs ? g_hash_table_lookup(batch_jobs, text) : NULL;
+    /* a running batch reads the main window settings; leave them alone */
+    if (!batch_running)
+        set_input_and_update_ui(text);
+    if (batch_running || (job && job->log_path))
+        batch_log_show(text);
 }
 
 /* Wrapper used for the Batch button 'clicked' signal: the signal provides the
@@ -1621,94 +8730,81 @@ static void on_batch_button_clicked(GtkButton *button, gpointer user_data)
     open_batch_dialog(parent);
 }
 
-static gboolean ffmpeg_stdout_cb(GIOChannel *source, GIOCondition condition, gpointer user_data) {
-    if (condition & (G_IO_HUP | G_IO_ERR)) {
-        return FALSE;
-    }
-    GError *err = NULL;
-    GString *buf = g_string_new(NULL);
+static gboolean ffmpeg_output_cb(GIOChannel *source, GIOCondition condition, gpointer user_data) {
+    FfmpegWorker *w = user_data;
     gchar tmp[1024];
     gsize bytes_read = 0;
-    GIOStatus st = g_io_channel_read_chars(source, tmp, sizeof(tmp)-1, &bytes_read, &err);
-    if (st == G_IO_STATUS_ERROR) {
-        if (err) g_error_free(err);
-        g_string_free(buf, TRUE);
-        return FALSE;
-    }
+    GError *err = NULL;
+    GIOStatus st = G_IO_STATUS_NORMAL;
+    if (condition & G_IO_IN)
+        st = g_io_channel_read_chars(source, tmp, sizeof(tmp)-1, &bytes_read, &err);
     if (bytes_read > 0) {
         tmp[bytes_read] = '\0';
-        g_string_append(buf, tmp);
-        /* Insert into text buffer and ensure view scrolls to the end */
-        gtk_text_buffer_insert_at_cursor(log_buffer, buf->str, -1);
-        GtkTextIter end;
-        gtk_text_buffer_get_end_iter(log_buffer, &end);
-        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(log_text_view), &end, 0.0, FALSE, 0.0, 1.0);
-    }
-    g_string_free(buf, TRUE);
+        worker_log_output(w, tmp);
+    }
     if (err) g_error_free(err);
+    if (st == G_IO_STATUS_ERROR || st == G_IO_STATUS_EOF || (bytes_read == 0 && (condition & (G_IO_HUP | G_IO_ERR)))) {
+        /* returning FALSE removes the source */
+        if (source == w->stdout_chan) w->stdout_watch = 0;
+        else w->stderr_watch = 0;
+        return FALSE;
+    }
     return TRUE;
 }
 
-static gboolean ffmpeg_stderr_cb(GIOChannel *source, GIOCondition condition, gpointer user_data) {
-    if (condition & (G_IO_HUP | G_IO_ERR)) {
-        return FALSE;
-    }
-    GError *err = NULL;
-    GString *buf = g_string_new(NULL);
-    gchar tmp[1024];
-    gsize bytes_read = 0;
-    GIOStatus st = g_io_channel_read_chars(source, tmp, sizeof(tmp)-1, &bytes_read, &err);
-    if (st == G_IO_STATUS_ERROR) {
-        if (err) g_error_free(err);
-        g_string_free(buf, TRUE);
-        return FALSE;
+/* Forward what is left in a pipe after the child exited, then close it.
+ * The pipes are non-blocking: a grandchild that inherited the write end can
+ * keep EOF away, so only what is readable now is taken. */
+static void worker_close_channel(FfmpegWorker *w, GIOChannel **chan, guint *watch)
+{
+    if (*watch) {
+        g_source_remove(*watch);
+        *watch = 0;
+        gchar tmp[1024];
+        gsize n = 0;
+        while (g_io_channel_read_chars(*chan, tmp, sizeof(tmp)-1, &n, NULL) == G_IO_STATUS_NORMAL && n > 0) {
+            tmp[n] = '\0';
+            worker_log_output(w, tmp);
+        }
     }
-    if (bytes_read > 0) {
-        tmp[bytes_read] = '\0';
-        g_string_append(buf, tmp);
-        gtk_text_buffer_insert_at_cursor(log_buffer, buf->str, -1);
-        GtkTextIter end;
-        gtk_text_buffer_get_end_iter(log_buffer, &end);
-        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(log_text_view), &end, 0.0, FALSE, 0.0, 1.0);
+    if (*chan) {
+        g_io_channel_shutdown(*chan, FALSE, NULL);
+        g_io_channel_unref(*chan);
+        *chan = NULL;
     }
-    g_string_free(buf, TRUE);
-    if (err) g_error_free(err);
-    return TRUE;
+}
+
+static void worker_free(FfmpegWorker *w)
+{
+    worker_close_channel(w, &w->stdout_chan, &w->stdout_watch);
+    worker_close_channel(w, &w->stderr_chan, &w->stderr_watch);
+    g_free(w->input);
+    g_free(w->output);
+    g_free(w->mem_key);
+    g_free(w->audio);
+    g_free(w->video);
+    g_free(w->vfilter);
+    g_free(w->afilter);
+    if (w->tail) g_string_free(w->tail, TRUE);
+    if (w->group_inputs) g_ptr_array_free(w->group_inputs, TRUE);
+    if (w->group_outputs) g_ptr_array_free(w->group_outputs, TRUE);
+    if (w->fanout_outputs) g_ptr_array_free(w->fanout_outputs, TRUE);
+    if (w->log) fclose(w->log);
+    g_free(w->log_path);
+    g_free(w->command);
+    g_free(w);
 }
 
 static void on_stop_clicked(GtkButton *button, gpointer user_data) {
-    // Kill ffmpeg
-    if (ffmpeg_pid > 0) {
-        kill(ffmpeg_pid, SIGKILL);
-        g_spawn_close_pid(ffmpeg_pid);
-        ffmpeg_pid = 0;
-    } else {
-        gchar *out = NULL;
-        gchar *err = NULL;
-        gint st = 0;
-        g_spawn_command_line_sync("killall -9 ffmpeg", &out, &err, &st, NULL);
-        g_free(out);
-        g_free(err);
-    }
-    /* Clean up GIO channels and watches */
-    if (ffmpeg_stdout_watch) {
-        g_source_remove(ffmpeg_stdout_watch);
-        ffmpeg_stdout_watch = 0;
-    }
-    if (ffmpeg_stderr_watch) {
-        g_source_remove(ffmpeg_stderr_watch);
-        ffmpeg_stderr_watch = 0;
-    }
-    if (ffmpeg_stdout_chan) {
-        g_io_channel_shutdown(ffmpeg_stdout_chan, TRUE, NULL);
-        g_io_channel_unref(ffmpeg_stdout_chan);
-        ffmpeg_stdout_chan = NULL;
-    }
-    if (ffmpeg_stderr_chan) {
-        g_io_channel_shutdown(ffmpeg_stderr_chan, TRUE, NULL);
-        g_io_channel_unref(ffmpeg_stderr_chan);
-        ffmpeg_stderr_chan = NULL;
-    }
+    /* Stop our own process groups only. Workers stay registered until their
+     * child watch reaps them, so no pid is reused while we still hold it. */
+    child_registry_foreach_signal(SIGTERM);
+#ifdef HAVE_LIBAV
+    inproc_cancel_all();
+#endif
+    /* a trim still being planned is dropped when its plan arrives */
+    if (trim_planning) trim_planning->cancelled = TRUE;
+    if (bench_thread) bench_stop(SIGTERM);
     // Re-enable UI
     update_start_button_state();
     gtk_widget_set_sensitive(stop_button, FALSE);
@@ -1735,18 +8831,8 @@ static void on_adw_exit_dialog_response(AdwDialog *dialog, const char *response,
         return;
     }
     if (g_strcmp0(response, "accept") == 0) {
-        if (ffmpeg_pid > 0) {
-            kill(ffmpeg_pid, SIGKILL);
-            g_spawn_close_pid(ffmpeg_pid);
-            ffmpeg_pid = 0;
-        } else {
-            gchar *out = NULL;
-            gchar *err = NULL;
-            gint st = 0;
-            g_spawn_command_line_sync("killall -9 ffmpeg", &out, &err, &st, NULL);
-            g_free(out);
-            g_free(err);
-        }
+        /* We are about to exit, so there is no time for a graceful SIGTERM */
+        child_registry_foreach_signal(SIGKILL);
         if (window) gtk_window_destroy(window);
     }
     adw_dialog_close(dialog);
@@ -1758,7 +8844,7 @@ static gboolean on_window_close_request(GtkWindow *window, gpointer user_data) {
     /* If ffmpeg is running, show a confirmation dialog because quitting
      * will stop the conversion. If ffmpeg is not running, allow the
      * window to close immediately without prompting. */
-    if (ffmpeg_pid > 0) {
+    if ((workers && workers->len > 0) || quality_current) {
         const char *title_text = "Quit baConverter";
     const char *desc_text = "A conversion is running. Do you want to quit and stop it?";
     (void)log_buffer;
@@ -1775,6 +8861,190 @@ static gboolean on_window_close_request(GtkWindow *window, gpointer user_data) {
     return FALSE;
 }
 
+/* Print one startup phase: its duration since `since` and the time since main() */
+static void startup_mark(const char *phase, gint64 since)
+{
+    if (!startup_timing) return;
+    gint64 now = g_get_monotonic_time();
+    g_printerr("bac startup: %-26s %8.1f ms   (t = %8.1f ms)\n", phase,
+               (now - since) / 1000.0, (now - startup_t0) / 1000.0);
+}
+
+/* Time from exec to main(): process start time from /proc/self/stat against
+ * the system uptime, both in clock ticks/seconds since boot */
+static void startup_mark_process_start(void)
+{
+    if (!startup_timing) return;
+    gchar *stat = NULL, *uptime = NULL;
+    if (g_file_get_contents("/proc/self/stat", &stat, NULL, NULL) &&
+        g_file_get_contents("/proc/uptime", &uptime, NULL, NULL)) {
+        /* the command name may contain spaces; fields restart after ')' */
+        const char *p = strrchr(stat, ')');
+        gchar **fields = g_strsplit(p ? p + 2 : "", " ", -1);
+        /* starttime is field 22, i.e. index 19 after pid and comm */
+        if (g_strv_length(fields) > 19) {
+            gdouble started = g_ascii_strtod(fields[19], NULL) / sysconf(_SC_CLK_TCK);
+            gdouble now = g_ascii_strtod(uptime, NULL);
+            g_printerr("bac startup: %-26s %8.1f ms\n", "process start to main()", (now - started) * 1000.0);
+        }
+        g_strfreev(fields);
+    }
+    g_free(stat);
+    g_free(uptime);
+}
+
+static void startup_first_paint(GdkFrameClock *clock, gpointer user_data)
+{
+    g_signal_handlers_disconnect_by_func(clock, startup_first_paint, user_data);
+    startup_mark("first frame", startup_t0);
+}
+
+static void startup_window_realized(GtkWidget *window, gpointer user_data)
+{
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(window);
+    if (clock)
+        g_signal_connect(clock, "after-paint", G_CALLBACK(startup_first_paint), NULL);
+}
+
+/* Main loop latency: a timer due every LATENCY_PROBE_MS notes how late it
+ * actually runs. Anything blocking the loop (log insertion, child reaping,
+ * dispatch) shows up as delay. */
+#define LATENCY_PROBE_MS 50
+#define LATENCY_STALL_MS 100
+#define LATENCY_REPORT_SECONDS 10
+
+static gint64 latency_due = 0;
+static gint64 latency_worst = 0;   /* microseconds */
+static guint latency_stalls = 0;   /* runs more than LATENCY_STALL_MS late */
+static gint64 latency_reported = 0;
+
+static void latency_report(void)
+{
+    if (!latency_probe) return;
+    g_printerr("bac latency: worst %.1f ms, %u stalls over %d ms\n", latency_worst / 1000.0, latency_stalls, LATENCY_STALL_MS);
+    latency_reported = g_get_monotonic_time();
+}
+
+static gboolean latency_probe_cb(gpointer user_data)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 late = latency_due ? now - latency_due : 0;
+    if (late > latency_worst) latency_worst = late;
+    if (late > LATENCY_STALL_MS * 1000) latency_stalls++;
+    if (now - latency_reported >= LATENCY_REPORT_SECONDS * G_USEC_PER_SEC)
+        latency_report();
+    latency_due = now + LATENCY_PROBE_MS * 1000;
+    return G_SOURCE_CONTINUE;
+}
+
+/* Fill the format dropdown from container_formats, keeping the selection */
+static void format_model_refresh(void)
+{
+    if (!container_formats || !format_combo_audio) return;
+    guint selected = gtk_drop_down_get_selected(GTK_DROP_DOWN(format_combo_audio));
+    if (format_model) { g_object_unref(format_model); format_model = NULL; }
+    format_model = gtk_string_list_new(NULL);
+    for (guint i = 0; i < container_formats->len; i++) {
+        const char *f = g_ptr_array_index(container_formats, i);
+        gtk_string_list_append(format_model, f);
+    }
+    gtk_drop_down_set_model(GTK_DROP_DOWN(format_combo_audio), (GListModel*)format_model);
+    gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), selected == GTK_INVALID_LIST_POSITION ? 0 : selected);
+}
+
+static gboolean discovery_done_idle(gpointer user_data);
+
+/* Background part of startup: everything that runs ffmpeg. Only touches the
+ * discovery globals; the UI is updated from discovery_done_idle. */
+static gpointer discovery_thread_func(gpointer data)
+{
+    gint64 t = g_get_monotonic_time();
+    ffmpeg_path = g_find_program_in_path ("ffmpeg");
+    ffprobe_path = g_find_program_in_path ("ffprobe");
+    if (!ffmpeg_path)
+        g_printerr ("ffmpeg not found in PATH\n");
+    if (!ffprobe_path)
+        g_printerr ("ffprobe not found in PATH\n");
+    startup_mark("path lookup", t);
+
+    /* Gather available encoders and their capabilities from ffmpeg (if
+     * present) so we can populate codec lists. Both are cached per ffmpeg
+     * binary, so only the first start after an ffmpeg update pays for the
+     * one `ffmpeg -h encoder=...` per encoder. */
+    t = g_get_monotonic_time();
+    if (!encoder_cache_load(ffmpeg_path)) {
+        gather_ffmpeg_encoders(ffmpeg_path);
+        if (ffmpeg_path) {
+            encoder_caps_introspect(ffmpeg_path);
+            /* do not cache the result of a failed `ffmpeg -encoders` */
+            if (g_hash_table_size(encoder_caps) > 0)
+                encoder_cache_save(ffmpeg_path);
+        }
+    }
+    startup_mark("encoder discovery", t);
+    /* Muxers, the container/codec compatibility verdicts and whether the
+     * quality checks can use libvmaf, same cache scheme */
+    t = g_get_monotonic_time();
+    gboolean muxers_cached = ffmpeg_path && muxer_cache_load(ffmpeg_path);
+    if (ffmpeg_path && !muxers_cached)
+        gather_ffmpeg_muxers(ffmpeg_path);
+    gboolean vmaf_checked = quality_vmaf < 0 && ffmpeg_path;
+    if (vmaf_checked)
+        detect_vmaf(ffmpeg_path);
+    if (muxers && muxers->len > 0 && (mux_compat_discover() || !muxers_cached || vmaf_checked))
+        muxer_cache_save(ffmpeg_path);
+    startup_mark("muxer discovery", t);
+    bench_cache_load(ffmpeg_path);
+    history_load();
+    g_idle_add(discovery_done_idle, NULL);
+    return NULL;
+}
+
+/* Discovery finished: hand the results to the UI and unlock it */
+static gboolean discovery_done_idle(gpointer user_data)
+{
+    g_thread_join(discovery_thread);
+    discovery_thread = NULL;
+    discovery_ready = TRUE;
+    /* Every other muxer that writes files with a known extension follows the
+     * curated formats */
+    guint curated = container_formats->len;
+    for (guint i = 0; muxers && i < muxers->len; i++) {
+        MuxerInfo *m = g_ptr_array_index(muxers, i);
+        gboolean taken = !m->ext_dot;
+        for (guint j = 0; j < curated && !taken; j++) {
+            const char *fmt = g_ptr_array_index(container_formats, j);
+            taken = g_strcmp0(fmt, m->name) == 0 || g_strcmp0(format_to_extension(fmt), m->ext_dot) == 0;
+        }
+        if (!taken)
+            g_ptr_array_add(container_formats, g_strdup(m->name));
+    }
+    format_model_refresh();
+    speed_controls_update();
+    bench_update_relative();
+    if (bench_button) gtk_widget_set_sensitive(bench_button, ffmpeg_path != NULL);
+    if (choose_file_button) gtk_widget_set_sensitive(choose_file_button, TRUE);
+    if (batch_open_button) gtk_widget_set_sensitive(batch_open_button, TRUE);
+    if (input_label && !input_file) gtk_label_set_text(GTK_LABEL(input_label), "No input file selected");
+    update_start_button_state();
+    startup_mark("ready", startup_t0);
+    if (autorun_manifest) {
+        open_batch_dialog(NULL);
+        batch_import_manifest(autorun_manifest);
+        if (plan_only) {
+            batch_plan_report();
+            g_application_quit(g_application_get_default());
+            return G_SOURCE_REMOVE;
+        }
+        batch_begin(TRUE);
+        if (!batch_running) {
+            g_printerr("bac: nothing to run in %s\n", autorun_manifest);
+            g_application_quit(g_application_get_default());
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
 void
 activate (GtkApplication *app)
 {
@@ -1807,10 +9077,15 @@ activate (GtkApplication *app)
     GtkWidget *batch_button = gtk_button_new_with_label ("Batch");
     g_signal_connect(batch_button, "clicked", G_CALLBACK(on_batch_button_clicked), window);
     gtk_box_append (GTK_BOX (hchoose), batch_button);
+    /* both read the codec lists, which are still being discovered */
+    choose_file_button = choose_button;
+    batch_open_button = batch_button;
+    gtk_widget_set_sensitive(choose_button, discovery_ready);
+    gtk_widget_set_sensitive(batch_button, discovery_ready);
     gtk_box_append (GTK_BOX (box), hchoose);
 
     /* Input label */
-    input_label = gtk_label_new ("No input file selected");
+    input_label = gtk_label_new (discovery_ready ? "No input file selected" : "Looking for ffmpeg encoders...");
     gtk_widget_set_halign (input_label, GTK_ALIGN_START);
     gtk_box_append (GTK_BOX (box), input_label);
 
@@ -1819,6 +9094,12 @@ activate (GtkApplication *app)
     gtk_widget_set_halign (output_label, GTK_ALIGN_START);
     gtk_box_append (GTK_BOX (box), output_label);
 
+    /* Probed streams of the input */
+    streams_label = gtk_label_new (NULL);
+    gtk_widget_set_halign (streams_label, GTK_ALIGN_START);
+    gtk_label_set_wrap (GTK_LABEL (streams_label), TRUE);
+    gtk_box_append (GTK_BOX (box), streams_label);
+
     /* Audio row */
     audio_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
     copy_audio_check = gtk_check_button_new_with_label ("Copy audio");
@@ -1832,6 +9113,8 @@ activate (GtkApplication *app)
     /* Fixed width so both combos have equal length */
     gtk_widget_set_size_request(audio_combo, 250, -1);
     g_signal_connect(audio_combo, "notify::selected", G_CALLBACK(on_audio_combo_changed), NULL);
+    GtkListItemFactory *encoder_factory = encoder_list_factory_new();
+    gtk_drop_down_set_list_factory(GTK_DROP_DOWN(audio_combo), encoder_factory);
     gtk_box_append (GTK_BOX (audio_box), audio_combo);
     reset_audio = gtk_button_new_with_label ("Reset");
     g_signal_connect(reset_audio, "clicked", G_CALLBACK(on_reset_audio_clicked), NULL);
@@ -1845,6 +9128,9 @@ activate (GtkApplication *app)
     format_combo_audio = gtk_drop_down_new(NULL, 0);
     /* Initially disabled until an input file is selected */
     gtk_widget_set_size_request(format_combo_audio, 150, -1);
+    /* the list includes every file muxer, so allow typing to search it */
+    gtk_drop_down_set_expression(GTK_DROP_DOWN(format_combo_audio), gtk_property_expression_new(GTK_TYPE_STRING_OBJECT, NULL, "string"));
+    gtk_drop_down_set_enable_search(GTK_DROP_DOWN(format_combo_audio), TRUE);
     gtk_widget_set_sensitive(format_combo_audio, FALSE);
     g_signal_connect(format_combo_audio, "notify::selected", G_CALLBACK(on_format_combo_changed_generic), NULL);
     gtk_box_append(GTK_BOX(audio_box), format_combo_audio);
@@ -1863,6 +9149,8 @@ activate (GtkApplication *app)
     /* Fixed width so both combos have equal length */
     gtk_widget_set_size_request(video_combo, 250, -1);
     g_signal_connect(video_combo, "notify::selected", G_CALLBACK(on_video_combo_changed), NULL);
+    gtk_drop_down_set_list_factory(GTK_DROP_DOWN(video_combo), encoder_factory);
+    g_object_unref(encoder_factory);
     gtk_box_append (GTK_BOX (video_box), video_combo);
     reset_video = gtk_button_new_with_label ("Reset");
     g_signal_connect(reset_video, "clicked", G_CALLBACK(on_reset_video_clicked), NULL);
@@ -1872,6 +9160,105 @@ activate (GtkApplication *app)
     /* (format combobox moved to the audio row; no separate format on video row) */
     gtk_box_append (GTK_BOX (box), video_box);
 
+    /* Speed row: knobs of the selected video encoder, from its -h output */
+    GtkWidget *speed_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append (GTK_BOX (speed_box), gtk_label_new ("Preset"));
+    speed_preset_combo = gtk_drop_down_new(NULL, 0);
+    gtk_widget_set_size_request(speed_preset_combo, 150, -1);
+    g_signal_connect(speed_preset_combo, "notify::selected", G_CALLBACK(speed_preset_changed), NULL);
+    gtk_box_append (GTK_BOX (speed_box), speed_preset_combo);
+    gtk_box_append (GTK_BOX (speed_box), gtk_label_new ("Threads"));
+    speed_threads_spin = gtk_spin_button_new_with_range(0, 64, 1);
+    gtk_widget_set_tooltip_text(speed_threads_spin, "0 = automatic");
+    g_signal_connect(speed_threads_spin, "value-changed", G_CALLBACK(speed_threads_changed), NULL);
+    gtk_box_append (GTK_BOX (speed_box), speed_threads_spin);
+    gtk_box_append (GTK_BOX (speed_box), gtk_label_new ("Tile columns"));
+    const char *tile_items[] = {"Default", "1", "2", "4", "8", "16", "32", "64", NULL};
+    speed_tiles_combo = gtk_drop_down_new_from_strings(tile_items);
+    g_signal_connect(speed_tiles_combo, "notify::selected", G_CALLBACK(speed_tiles_changed), NULL);
+    gtk_box_append (GTK_BOX (speed_box), speed_tiles_combo);
+    speed_row_mt_check = gtk_check_button_new_with_label ("Row multithreading");
+    g_signal_connect(speed_row_mt_check, "toggled", G_CALLBACK(speed_row_mt_toggled), NULL);
+    gtk_box_append (GTK_BOX (speed_box), speed_row_mt_check);
+    bench_button = gtk_button_new_with_label ("Benchmark");
+    gtk_widget_set_tooltip_text(bench_button, "Measure how fast each encoder is on this computer; the encoder lists then show the speed relative to libx264 and aac");
+    /* enabled once discovery has found ffmpeg */
+    gtk_widget_set_sensitive(bench_button, discovery_ready && ffmpeg_path);
+    g_signal_connect(bench_button, "clicked", G_CALLBACK(bench_clicked), NULL);
+    gtk_box_append (GTK_BOX (speed_box), bench_button);
+    gtk_box_append (GTK_BOX (box), speed_box);
+    /* follow the video encoder selection and its sensitivity */
+    g_signal_connect(video_combo, "notify::selected", G_CALLBACK(speed_controls_notify), NULL);
+    g_signal_connect(video_combo, "notify::sensitive", G_CALLBACK(speed_controls_notify), NULL);
+    g_signal_connect(copy_video_check, "notify::active", G_CALLBACK(speed_controls_notify), NULL);
+    speed_controls_update();
+
+    /* Stream selection rules, turned into -map options */
+    GtkWidget *streams_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+    stream_rules_check = gtk_check_button_new_with_label ("Select streams:");
+    gtk_widget_set_tooltip_text(stream_rules_check, "Keep only the streams chosen here instead of ffmpeg's default of one stream per kind; applies to batches too");
+    g_signal_connect_swapped(stream_rules_check, "notify::active", G_CALLBACK(stream_rules_changed), NULL);
+    gtk_box_append (GTK_BOX (streams_box), stream_rules_check);
+    const char *audio_rules[] = {"First audio", "All audio", NULL};
+    stream_audio_combo = gtk_drop_down_new_from_strings(audio_rules);
+    g_signal_connect_swapped(stream_audio_combo, "notify::selected", G_CALLBACK(stream_rules_changed), NULL);
+    gtk_box_append (GTK_BOX (streams_box), stream_audio_combo);
+    gtk_box_append (GTK_BOX (streams_box), gtk_label_new ("Languages"));
+    stream_lang_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(stream_lang_entry), "e.g. eng,slv");
+    gtk_editable_set_width_chars(GTK_EDITABLE(stream_lang_entry), 10);
+    g_signal_connect_swapped(stream_lang_entry, "changed", G_CALLBACK(stream_rules_changed), NULL);
+    gtk_box_append (GTK_BOX (streams_box), stream_lang_entry);
+    stream_subs_check = gtk_check_button_new_with_label ("Subtitles");
+    g_signal_connect_swapped(stream_subs_check, "notify::active", G_CALLBACK(stream_rules_changed), NULL);
+    gtk_box_append (GTK_BOX (streams_box), stream_subs_check);
+    stream_cover_check = gtk_check_button_new_with_label ("Cover art");
+    gtk_check_button_set_active(GTK_CHECK_BUTTON(stream_cover_check), stream_keep_cover);
+    g_signal_connect_swapped(stream_cover_check, "notify::active", G_CALLBACK(stream_rules_changed), NULL);
+    gtk_box_append (GTK_BOX (streams_box), stream_cover_check);
+    gtk_box_append (GTK_BOX (box), streams_box);
+    stream_rules_changed(NULL);
+    /* the kept streams depend on the codec selection too */
+    g_signal_connect(audio_combo, "notify::selected", G_CALLBACK(streams_label_notify), NULL);
+    g_signal_connect(video_combo, "notify::selected", G_CALLBACK(streams_label_notify), NULL);
+    g_signal_connect(copy_audio_check, "notify::active", G_CALLBACK(streams_label_notify), NULL);
+    g_signal_connect(copy_video_check, "notify::active", G_CALLBACK(streams_label_notify), NULL);
+
+    /* Additional outputs from the same decode */
+    GtkWidget *outputs_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+    GtkWidget *add_output = gtk_button_new_with_label ("Add output");
+    gtk_widget_set_tooltip_text(add_output, "Also write the selected format and codecs; all outputs are encoded from one decode of the input");
+    g_signal_connect(add_output, "clicked", G_CALLBACK(on_add_output_clicked), NULL);
+    gtk_box_append (GTK_BOX (outputs_box), add_output);
+    extra_outputs_clear = gtk_button_new_with_label ("Clear");
+    g_signal_connect(extra_outputs_clear, "clicked", G_CALLBACK(on_clear_outputs_clicked), NULL);
+    gtk_box_append (GTK_BOX (outputs_box), extra_outputs_clear);
+    extra_outputs_label = gtk_label_new (NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(extra_outputs_label), PANGO_ELLIPSIZE_END);
+    gtk_box_append (GTK_BOX (outputs_box), extra_outputs_label);
+    gtk_box_append (GTK_BOX (box), outputs_box);
+    extra_outputs_update_label();
+
+    /* Trim: lossless cut at keyframes, optionally re-encoding the ends */
+    GtkWidget *trim_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+    trim_check = gtk_check_button_new_with_label ("Trim from (s)");
+    gtk_widget_set_tooltip_text(trim_check, "Start copies only this range without re-encoding; the start moves back to the nearest keyframe");
+    g_signal_connect_swapped(trim_check, "notify::active", G_CALLBACK(trim_controls_update), NULL);
+    gtk_box_append (GTK_BOX (trim_box), trim_check);
+    trim_from_spin = gtk_spin_button_new_with_range(0, 86400, 1);
+    gtk_spin_button_set_digits(GTK_SPIN_BUTTON(trim_from_spin), 2);
+    gtk_box_append (GTK_BOX (trim_box), trim_from_spin);
+    gtk_box_append (GTK_BOX (trim_box), gtk_label_new ("to (s)"));
+    trim_to_spin = gtk_spin_button_new_with_range(0, 86400, 1);
+    gtk_spin_button_set_digits(GTK_SPIN_BUTTON(trim_to_spin), 2);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(trim_to_spin), 60);
+    gtk_box_append (GTK_BOX (trim_box), trim_to_spin);
+    trim_smart_check = gtk_check_button_new_with_label ("Exact (re-encode the ends)");
+    gtk_widget_set_tooltip_text(trim_smart_check, "Cut at the exact times: only the partial GOPs at both ends are re-encoded, the rest is copied");
+    gtk_box_append (GTK_BOX (trim_box), trim_smart_check);
+    gtk_box_append (GTK_BOX (box), trim_box);
+    trim_controls_update(NULL);
+
     /* Start/Stop buttons */
     GtkWidget *button_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
     start_button = gtk_button_new_with_label ("Start");
@@ -1884,6 +9271,16 @@ activate (GtkApplication *app)
     gtk_widget_set_sensitive(stop_button, FALSE);
     g_signal_connect(stop_button, "clicked", G_CALLBACK(on_stop_clicked), NULL);
     gtk_box_append (GTK_BOX (button_box), stop_button);
+    /* Preview: a short test encode at the given position */
+    preview_button = gtk_button_new_with_label ("Preview");
+    gtk_widget_set_tooltip_text(preview_button, "Encode 10 seconds with the current settings and estimate speed and size");
+    gtk_widget_set_sensitive(preview_button, FALSE);
+    g_signal_connect(preview_button, "clicked", G_CALLBACK(on_preview_clicked), NULL);
+    gtk_box_append (GTK_BOX (button_box), preview_button);
+    gtk_box_append (GTK_BOX (button_box), gtk_label_new("at (s)"));
+    preview_at_spin = gtk_spin_button_new_with_range(0, 86400, 10);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(preview_at_spin), 60);
+    gtk_box_append (GTK_BOX (button_box), preview_at_spin);
     gtk_box_append (GTK_BOX (box), button_box);
 
     /* Log */
@@ -1897,17 +9294,7 @@ activate (GtkApplication *app)
 
     gtk_window_set_child (GTK_WINDOW (window), box);
 
-    /* Populate format dropdown from container_formats */
-    if (container_formats) {
-        if (format_model) { g_object_unref(format_model); format_model = NULL; }
-        format_model = gtk_string_list_new(NULL);
-        for (guint i = 0; i < container_formats->len; i++) {
-            const char *f = g_ptr_array_index(container_formats, i);
-            gtk_string_list_append(format_model, f);
-        }
-    gtk_drop_down_set_model(GTK_DROP_DOWN(format_combo_audio), (GListModel*)format_model);
-        gtk_drop_down_set_selected(GTK_DROP_DOWN(format_combo_audio), 0);
-    }
+    format_model_refresh();
 
     /* Ensure every interactive widget is disabled on startup except the Choose button.
      * The Choose button (choose_button) remains enabled so the user can select an input file.
@@ -1926,7 +9313,13 @@ activate (GtkApplication *app)
     if (scrolled) gtk_widget_set_sensitive(scrolled, FALSE);
 
     /* Present the window */
+    if (startup_timing)
+        g_signal_connect(window, "realize", G_CALLBACK(startup_window_realized), NULL);
     gtk_window_present (GTK_WINDOW (window));
+    startup_mark("window presented", startup_t0);
+    /* Discover ffmpeg in the background; see discovery_done_idle */
+    if (!discovery_thread && !discovery_ready)
+        discovery_thread = g_thread_new("discovery", discovery_thread_func, NULL);
 
     /* Accept drag & drop of files onto the main window to open Batch */
     GtkDropTarget *drop = gtk_drop_target_new(G_TYPE_FILE, GDK_ACTION_COPY);
@@ -1940,22 +9333,24 @@ main (int argc, char **argv)
     GtkApplication *app;
     int status;
 
+    startup_t0 = g_get_monotonic_time();
+    startup_timing = g_strcmp0(g_getenv("BAC_STARTUP_TIMING"), "1") == 0;
+    progress_stdout = g_strcmp0(g_getenv("BAC_PROGRESS"), "1") == 0;
+    latency_probe = g_strcmp0(g_getenv("BAC_LATENCY"), "1") == 0;
+    autorun_manifest = g_getenv("BAC_AUTORUN");
+    plan_only = g_strcmp0(g_getenv("BAC_PLAN"), "1") == 0;
+    if (latency_probe)
+        g_timeout_add(LATENCY_PROBE_MS, latency_probe_cb, NULL);
+    startup_mark_process_start();
     g_set_prgname ("bac");
-
-    /* Resolve ffmpeg and ffprobe paths */
-    ffmpeg_path = g_find_program_in_path ("ffmpeg");
-    ffprobe_path = g_find_program_in_path ("ffprobe");
-    if (!ffmpeg_path)
-        g_printerr ("ffmpeg not found in PATH\n");
-    if (!ffprobe_path)
-        g_printerr ("ffprobe not found in PATH\n");
-
-    /* Gather available encoders from ffmpeg (if present) so we can populate
-     * codec lists. */
-    gather_ffmpeg_encoders(ffmpeg_path);
+#ifdef HAVE_LIBAV
+    /* in-process probing must not write to our terminal */
+    av_log_set_level(AV_LOG_QUIET);
+#endif
 
     /* Known container/format list (simple set). Kept separate so UI can
-     * offer common choices regardless of ffmpeg availability. */
+     * offer common choices regardless of ffmpeg availability. The muxers
+     * found by discovery are appended later. */
     container_formats = g_ptr_array_new_with_free_func(g_free);
     const char *formats[] = {"auto", "avi", "mp4", "mkv", "webm", "mov", "mpeg", "mp3", "flac", "wav", "ogg", NULL};
     for (int i = 0; formats[i] != NULL; i++)
@@ -1967,9 +9362,37 @@ main (int argc, char **argv)
 
     status = g_application_run (G_APPLICATION (app), argc, argv);
     g_object_unref (app);
+    /* closed before discovery finished: let it end before freeing its results */
+    if (discovery_thread)
+        g_thread_join(discovery_thread);
+    /* the benchmark's ffmpeg is not in child_registry */
+    if (bench_thread) {
+        bench_stop(SIGKILL);
+        g_ptr_array_free(g_thread_join(bench_thread), TRUE);
+    }
+    /* a trim being planned reads video_codecs and the encoder caps */
+    if (trim_thread) {
+        g_thread_join(trim_thread);
+        trim_job_free(trim_planning);
+    }
+    /* a watch left running when the window closed */
+    watch_release();
+    /* container checks still running finish before mux_compat goes */
+    if (mux_test_pool)
+        g_thread_pool_free(mux_test_pool, TRUE, TRUE);
+    /* Do not leave encoders running behind a closed window */
+    child_registry_foreach_signal(SIGKILL);
+    if (preview_file) {
+        g_unlink(preview_file);
+        g_free(preview_file);
+    }
+    if (extra_outputs) g_ptr_array_free(extra_outputs, TRUE);
 
     if (audio_codecs) g_ptr_array_free(audio_codecs, TRUE);
     if (video_codecs) g_ptr_array_free(video_codecs, TRUE);
+    if (encoder_caps) g_hash_table_destroy(encoder_caps);
+    if (muxers) g_ptr_array_free(muxers, TRUE);
+    if (mux_compat) g_hash_table_destroy(mux_compat);
 
     return status;
 }